@@ -0,0 +1,99 @@
+#include "AssetLoader.h"
+#include "Utility.h"
+#include "MappedFile.h"
+/*Background asset decoding, with device work handed back to the device thread*/
+
+AssetLoader::AssetLoader(int numThreads)
+	: _pending(0)
+	, _quit(false)
+{
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	for (int i = 0; i < numThreads; i++)
+		_workers.push_back(std::thread(&AssetLoader::workerMain, this));
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+		_decodes.clear();
+	}
+	_wake.notify_all();
+
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i].join();
+}
+
+void AssetLoader::decodeLater(const std::function<void()>& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_decodes.push_back(job);
+	}
+	_wake.notify_one();
+}
+
+void AssetLoader::createLater(const std::function<void()>& job)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_creates.push_back(job);
+}
+
+int AssetLoader::pump(double budget)
+{
+	double start = Utility::GetTime();
+	int count = 0;
+
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_creates.empty())
+				break;
+			job = _creates.front();
+			_creates.pop_front();
+		}
+
+		// outside the lock, creating may take a while
+		job();
+		count++;
+
+		if (Utility::GetTime() - start >= budget)
+			break;
+	}
+
+	return count;
+}
+
+void AssetLoader::workerMain()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this] { return _quit || !_decodes.empty(); });
+			if (_quit)
+				return;
+
+			job = _decodes.front();
+			_decodes.pop_front();
+		}
+
+		job();
+	}
+}
+
+bool AssetLoader::ReadFile(const string& path, vector<char>* data)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	data->assign(file.data(), file.data() + file.size());
+	return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "basics.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <functional>
+
+/*Loads assets in the background. The decode half of a load (reading files,
+parsing, baking) runs on the loader's threads; the create half, which makes
+device resources, is queued for the thread that owns the device and runs
+from pump(), so the device is only ever used from one thread.
+
+The loader has threads of its own rather than using ThreadPool::Shared,
+which is fork-join and blocks its caller, and has no workers on one core.*/
+class AssetLoader
+{
+public:
+	AssetLoader(int numThreads = 2);
+	// Finishes the decode that is running on each thread and drops the rest,
+	// along with any create that was never pumped.
+	~AssetLoader();
+
+	// Runs decode on a loader thread and then create(result) on the device
+	// thread, from the next pump(). The future is ready as soon as decode is.
+	template<class T>
+	std::shared_future<T> load(const std::function<T()>& decode, const std::function<void(const T&)>& create);
+
+	// Runs the creates that are waiting, one at least and then more until
+	// budget seconds have gone. Returns how many ran.
+	int pump(double budget);
+
+	// Loads started and not yet created.
+	int pending() const { return _pending; }
+
+	// The whole of path, for decoders that hand the bytes to D3DX.
+	static bool ReadFile(const string& path, vector<char>* data);
+
+private:
+	AssetLoader(const AssetLoader&);
+	AssetLoader& operator=(const AssetLoader&);
+
+	void decodeLater(const std::function<void()>& job);
+	void createLater(const std::function<void()>& job);
+	void workerMain();
+
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::deque<std::function<void()> > _decodes;
+	std::deque<std::function<void()> > _creates;
+	std::atomic<int> _pending;
+	bool _quit;
+};
+
+template<class T>
+std::shared_future<T> AssetLoader::load(const std::function<T()>& decode, const std::function<void(const T&)>& create)
+{
+	std::shared_ptr<std::promise<T> > promise(new std::promise<T>());
+	std::shared_future<T> future = promise->get_future().share();
+	_pending++;
+
+	decodeLater([this, promise, future, decode, create]() {
+		promise->set_value(decode());
+		createLater([this, future, create]() {
+			create(future.get());
+			_pending--;
+		});
+	});
+
+	return future;
+}
@@ -0,0 +1,2331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include "Benchmark.h"
+#include "Utility.h"
+#include "Snow.h"
+#include "ParticleSimd.h"
+#include "ThreadPool.h"
+#include "RandomStream.h"
+#include "VertexStream.h"
+#include "ParticleSort.h"
+#include "ParticleBudget.h"
+#include "ParticleCollision.h"
+#include "Emitter.h"
+#include "XFile.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "AssetLoader.h"
+#include "TextureCache.h"
+#include "Model.h"
+#include "MeshOptimizer.h"
+#include "MeshLod.h"
+#include "MeshQuantizer.h"
+#include "Transform.h"
+#include "FrustumCull.h"
+#include "Bounds.h"
+#include "SceneBvh.h"
+/*Timing runs that report the per item cost of engine systems*/
+
+namespace
+{
+	/*The fountain written the way effects were before the emitter policies:
+	the force and colour are virtual calls made per particle, and respawning
+	goes through the virtual resetParticle one particle at a time.*/
+	class VirtualFountain : public PSystem
+	{
+	public:
+		VirtualFountain(const EmitterDesc& desc, unsigned int seed)
+			: _desc(desc)
+		{
+			_boundingBox = desc._boundingBox;
+			_maxParticles = desc._numParticles;
+			this->seed(seed);
+
+			_particles.reserve(desc._numParticles);
+			for (int i = 0; i < desc._numParticles; i++)
+			{
+				addParticle();
+			}
+		}
+
+		void resetParticle(Attribute* attribute, RandomStream& rng)
+		{
+			PointSpawn::Spawn(_desc, rng, &attribute->_position, &attribute->_velocity);
+			attribute->_lifeTime = rng.GetFloat(_desc._lifeTimeMin, _desc._lifeTimeMax);
+			attribute->_age = 0.0f;
+			attribute->_color = D3DXCOLOR(colorAt(0.0f, attribute->_lifeTime));
+		}
+
+		void update(float timeDelta)
+		{
+			updateChunks(timeDelta);
+		}
+
+		virtual void applyForce(float& vx, float& vy, float& vz, float timeDelta)
+		{
+			GravityForce::Apply(_desc, vx, vy, vz, timeDelta);
+		}
+
+		virtual D3DCOLOR colorAt(float age, float lifeTime)
+		{
+			return FadeColor::Color(_desc, age, lifeTime);
+		}
+
+	protected:
+		void updateChunk(int first, int count, float timeDelta, RandomStream& rng)
+		{
+			int* dead = &_respawn[first];
+			int numDead = 0;
+
+			for (int i = first; i < first + count; i++)
+			{
+				applyForce(_particles._velX[i], _particles._velY[i], _particles._velZ[i], timeDelta);
+				_particles._posX[i] += _particles._velX[i] * timeDelta;
+				_particles._posY[i] += _particles._velY[i] * timeDelta;
+				_particles._posZ[i] += _particles._velZ[i] * timeDelta;
+				_particles._age[i] += timeDelta;
+				_particles._color[i] = colorAt(_particles._age[i], _particles._lifeTime[i]);
+
+				D3DXVECTOR3 p(_particles._posX[i], _particles._posY[i], _particles._posZ[i]);
+				if (!_boundingBox.isPointInside(p) || _particles._age[i] > _particles._lifeTime[i])
+					dead[numDead++] = i;
+			}
+
+			respawnParticles(dead, numDead, rng);
+		}
+
+		EmitterDesc _desc;
+	};
+
+	// Every triangle as its material and corner positions, sorted, so meshes
+	// can be compared however their vertices and triangles are ordered
+	vector<vector<float> > TriangleSet(const XMesh& mesh)
+	{
+		vector<vector<float> > triangles(mesh.numTriangles());
+		for (int t = 0; t < mesh.numTriangles(); t++)
+		{
+			triangles[t].push_back((float)mesh.attributes[t]);
+			for (int k = 0; k < 3; k++)
+			{
+				const float* p = &mesh.positions[mesh.indices[t * 3 + k] * 3];
+				triangles[t].insert(triangles[t].end(), p, p + 3);
+			}
+		}
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	}
+
+	// A camera at eye looking at target, as D3DXMatrixLookAtLH times
+	// D3DXMatrixPerspectiveFovLH with a square aspect would make it
+	void ViewProjection(const float* eye, const float* target, float fovY, float zNear, float zFar, float* m)
+	{
+		float z[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+		float length = sqrtf(z[0] * z[0] + z[1] * z[1] + z[2] * z[2]);
+		for (int k = 0; k < 3; k++)
+			z[k] /= length;
+
+		// up is y, unless looking along it
+		float up[3] = { 0.0f, 1.0f, 0.0f };
+		if (fabsf(z[1]) > 0.99f)
+		{
+			up[1] = 0.0f;
+			up[2] = 1.0f;
+		}
+		float x[3] = { up[1] * z[2] - up[2] * z[1], up[2] * z[0] - up[0] * z[2], up[0] * z[1] - up[1] * z[0] };
+		length = sqrtf(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+		for (int k = 0; k < 3; k++)
+			x[k] /= length;
+		float y[3] = { z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0] };
+
+		float view[16] = {
+			x[0], y[0], z[0], 0.0f,
+			x[1], y[1], z[1], 0.0f,
+			x[2], y[2], z[2], 0.0f,
+			-(x[0] * eye[0] + x[1] * eye[1] + x[2] * eye[2]),
+			-(y[0] * eye[0] + y[1] * eye[1] + y[2] * eye[2]),
+			-(z[0] * eye[0] + z[1] * eye[1] + z[2] * eye[2]), 1.0f
+		};
+
+		float scale = 1.0f / tanf(fovY * 0.5f);
+		float depth = zFar / (zFar - zNear);
+		float projection[16] = {
+			scale, 0.0f, 0.0f, 0.0f,
+			0.0f, scale, 0.0f, 0.0f,
+			0.0f, 0.0f, depth, 1.0f,
+			0.0f, 0.0f, -zNear * depth, 0.0f
+		};
+
+		for (int r = 0; r < 4; r++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				m[r * 4 + c] = 0.0f;
+				for (int k = 0; k < 4; k++)
+					m[r * 4 + c] += view[r * 4 + k] * projection[k * 4 + c];
+			}
+		}
+	}
+
+	// Whether a culled meshlet really could not have drawn anything: all its
+	// vertices behind one frustum plane, or all its triangles facing away
+	bool CulledRightly(const Meshlet& meshlet, const unsigned int* indices, const float* positions,
+		const float* planes, const float* eye, bool outside)
+	{
+		const unsigned int* first = &indices[meshlet.firstTriangle * 3];
+		if (outside)
+		{
+			for (int p = 0; p < 6; p++)
+			{
+				const float* plane = &planes[p * 4];
+				bool behind = true;
+				for (unsigned int i = 0; i < meshlet.numTriangles * 3 && behind; i++)
+				{
+					const float* v = &positions[first[i] * 3];
+					behind = plane[0] * v[0] + plane[1] * v[1] + plane[2] * v[2] + plane[3] < 0.0f;
+				}
+				if (behind)
+					return true;
+			}
+			return false;
+		}
+
+		for (unsigned int t = 0; t < meshlet.numTriangles; t++)
+		{
+			const float* a = &positions[first[t * 3] * 3];
+			const float* b = &positions[first[t * 3 + 1] * 3];
+			const float* c = &positions[first[t * 3 + 2] * 3];
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			if (n[0] * (a[0] - eye[0]) + n[1] * (a[1] - eye[1]) + n[2] * (a[2] - eye[2]) < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	// D3DXMatrixRotationX, Y or Z: a turn of angle about one axis, row major
+	template <typename T>
+	void AxisRotation(int axis, T angle, T* m)
+	{
+		T c = (T)cos(angle), s = (T)sin(angle);
+		for (int k = 0; k < 16; k++)
+			m[k] = (k % 5 == 0) ? (T)1 : (T)0;
+
+		int a = (axis + 1) % 3, b = (axis + 2) % 3;
+		m[a * 4 + a] = c;
+		m[a * 4 + b] = s;
+		m[b * 4 + a] = -s;
+		m[b * 4 + b] = c;
+	}
+
+	// a * b into out, as D3DXMatrixMultiply does: 64 multiply-adds
+	template <typename T>
+	void MatrixProduct(const T* a, const T* b, T* out)
+	{
+		T product[16];
+		for (int r = 0; r < 4; r++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				product[r * 4 + c] = 0;
+				for (int k = 0; k < 4; k++)
+					product[r * 4 + c] += a[r * 4 + k] * b[k * 4 + c];
+			}
+		}
+		memcpy(out, product, sizeof(product));
+	}
+
+	// How far a world matrix's rotation is from orthonormal, the most any
+	// pair of its first three rows' dot product is off 0 (or 1 with itself)
+	float Shear(const float* m)
+	{
+		float worst = 0.0f;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = i; j < 3; j++)
+			{
+				float dot = m[i * 4] * m[j * 4] + m[i * 4 + 1] * m[j * 4 + 1] + m[i * 4 + 2] * m[j * 4 + 2];
+				float e = fabsf(dot - (i == j ? 1.0f : 0.0f));
+				worst = e > worst ? e : worst;
+			}
+		}
+		return worst;
+	}
+
+	// Whether order holds each of the count particles once, farthest from the
+	// camera first to within the 16 bit depth ParticleSort sorts by
+	bool BackToFront(const int* order, int count, const float* x, const float* y, const float* z, const D3DXMATRIX& view)
+	{
+		vector<float> depth(count);
+		float zmin = FLT_MAX, zmax = -FLT_MAX;
+		for (int i = 0; i < count; i++)
+		{
+			depth[i] = x[i] * view._13 + y[i] * view._23 + z[i] * view._33 + view._43;
+			zmin = depth[i] < zmin ? depth[i] : zmin;
+			zmax = depth[i] > zmax ? depth[i] : zmax;
+		}
+		float step = (zmax - zmin) / 65535.0f * 1.01f;
+
+		vector<bool> seen(count, false);
+		for (int k = 0; k < count; k++)
+		{
+			int i = order[k];
+			if (i < 0 || i >= count || seen[i])
+				return false;
+			seen[i] = true;
+			if (k > 0 && depth[i] > depth[order[k - 1]] + step)
+				return false;
+		}
+		return true;
+	}
+
+	// The angle between a unit normal and its round trip in degrees, from the
+	// cross and dot products in double: acos of a float dot product this close
+	// to 1 is itself off by a few hundredths of a degree
+	double NormalAngle(const float* a, const float* b)
+	{
+		double x = (double)a[1] * b[2] - (double)a[2] * b[1];
+		double y = (double)a[2] * b[0] - (double)a[0] * b[2];
+		double z = (double)a[0] * b[1] - (double)a[1] * b[0];
+		double dot = (double)a[0] * b[0] + (double)a[1] * b[1] + (double)a[2] * b[2];
+		return atan2(sqrt(x * x + y * y + z * z), dot) * 180.0 / D3DX_PI;
+	}
+
+	// A ray from a random point on the sphere of the given size about middle
+	// towards a random point in the box lo to hi, its direction of unit length
+	void RandomRay(RandomStream& rng, const float* middle, const float* lo, const float* hi, float size,
+		float* origin, float* direction)
+	{
+		float around[3], lengthSq;
+		do
+		{
+			for (int k = 0; k < 3; k++)
+				around[k] = rng.GetFloat(-1.0f, 1.0f);
+			lengthSq = around[0] * around[0] + around[1] * around[1] + around[2] * around[2];
+		} while (lengthSq > 1.0f || lengthSq < 1e-4f);
+
+		float length = sqrtf(lengthSq), toLengthSq = 0.0f;
+		for (int k = 0; k < 3; k++)
+		{
+			origin[k] = middle[k] + around[k] / length * size;
+			direction[k] = rng.GetFloat(lo[k], hi[k]) - origin[k];
+			toLengthSq += direction[k] * direction[k];
+		}
+		float toLength = sqrtf(toLengthSq);
+		for (int k = 0; k < 3; k++)
+			direction[k] /= toLength;
+	}
+
+	// The plain ray and triangle test, for checking BVHs against: where the
+	// ray meets the triangle's plane, and whether that is inside all three edges
+	bool RayTriangle(const float* positions, const unsigned int* triangle, const float* origin, const float* direction,
+		float* distance)
+	{
+		const float* a = &positions[triangle[0] * 3];
+		const float* b = &positions[triangle[1] * 3];
+		const float* c = &positions[triangle[2] * 3];
+		double ab[3], ac[3], n[3];
+		for (int k = 0; k < 3; k++)
+		{
+			ab[k] = b[k] - a[k];
+			ac[k] = c[k] - a[k];
+		}
+		n[0] = ab[1] * ac[2] - ab[2] * ac[1];
+		n[1] = ab[2] * ac[0] - ab[0] * ac[2];
+		n[2] = ab[0] * ac[1] - ab[1] * ac[0];
+		double facing = n[0] * direction[0] + n[1] * direction[1] + n[2] * direction[2];
+		if (facing == 0.0)
+			return false;
+		double t = (n[0] * (a[0] - origin[0]) + n[1] * (a[1] - origin[1]) + n[2] * (a[2] - origin[2])) / facing;
+		if (t < 0.0)
+			return false;
+
+		double hit[3];
+		for (int k = 0; k < 3; k++)
+			hit[k] = origin[k] + t * direction[k];
+		const float* corners[4] = { a, b, c, a };
+		for (int e = 0; e < 3; e++)
+		{
+			const float* from = corners[e];
+			const float* to = corners[e + 1];
+			double edge[3] = { to[0] - from[0], to[1] - from[1], to[2] - from[2] };
+			double toHit[3] = { hit[0] - from[0], hit[1] - from[1], hit[2] - from[2] };
+			double side = n[0] * (edge[1] * toHit[2] - edge[2] * toHit[1]) + n[1] * (edge[2] * toHit[0] - edge[0] * toHit[2])
+				+ n[2] * (edge[0] * toHit[1] - edge[1] * toHit[0]);
+			if (side < 0.0)
+				return false;
+		}
+		*distance = (float)t;
+		return true;
+	}
+
+	// Whether two nearest hits agree, to within rounding relative to the
+	// scene's size
+	bool SameDistance(float a, float b, float size)
+	{
+		if (a == FLT_MAX || b == FLT_MAX)
+			return a == b;
+		return fabsf(a - b) <= 1e-4f * size;
+	}
+}
+
+int Benchmark::_failures = 0;
+
+/*Runs every benchmark in turn, then reports how many of their checks failed
+and returns that*/
+int Benchmark::RunAll()
+{
+	_failures = 0;
+
+	ParticleScaling();
+	SnowKernels();
+	ParticleThreads();
+	RandomThroughput();
+	VertexStreaming();
+	ParticleSorting();
+	ParticleBudgets();
+	ParticleCollisions();
+	EmitterDispatch();
+	XFileParsing();
+	XFileFormats();
+	MeshStartup();
+	AssetLoading();
+	TextureCaching();
+	MeshOptimization();
+	MeshLods();
+	MeshQuantization();
+	MeshletCulling();
+	TransformPrecision();
+	FrustumCulling();
+	BoundsPlacement();
+	MeshPicking();
+	MeshRaycasting();
+	RayBatches();
+
+	if (_failures)
+		cout << "Checks: " << _failures << " FAILED" << endl;
+	else
+		cout << "Checks: all passed" << endl;
+	return _failures;
+}
+
+/*Returns the current time in seconds*/
+double Benchmark::Now()
+{
+	return Utility::GetTime();
+}
+
+/*Counts a failed check, and returns what to print for it: failed if it
+failed, else passed*/
+const char* Benchmark::Check(bool ok, const char* failed, const char* passed)
+{
+	if (ok)
+		return passed;
+	_failures++;
+	return failed;
+}
+
+/*Loads file into mesh and finds the box lo to hi around its positions. A mesh
+that won't load, or has no triangles, is printed and counted as a failed
+check, and false returned*/
+bool Benchmark::LoadMeshBox(const char* file, XMesh* mesh, float* lo, float* hi)
+{
+	string error;
+	if (!XFile::Load(file, mesh, &error) || mesh->numTriangles() == 0)
+	{
+		cout << "  " << file << ": " << Check(false, error.empty() ? "no triangles" : error.c_str()) << endl;
+		return false;
+	}
+
+	const float* p = &mesh->positions[0];
+	for (int k = 0; k < 3; k++)
+	{
+		lo[k] = FLT_MAX;
+		hi[k] = -FLT_MAX;
+	}
+	for (int v = 0; v < mesh->numVertices(); v++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = p[v * 3 + k] < lo[k] ? p[v * 3 + k] : lo[k];
+			hi[k] = p[v * 3 + k] > hi[k] ? p[v * 3 + k] : hi[k];
+		}
+	}
+	return true;
+}
+
+/*Scales Snow from the 2000 flakes the game uses up to a million and reports
+the cost per particle of update and of filling the vertex stream*/
+void Benchmark::ParticleScaling()
+{
+	const int counts[] = { 2000, 10000, 100000, 1000000 };
+	const int frames = 20;
+
+	cout << "Particles: ns/particle (update, vertex fill)" << endl;
+
+	for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		int n = counts[c];
+		Snow snow(n);
+		Particle* vertices = new Particle[n];
+
+		// one warm up frame so every page has been touched
+		snow.update(0.1f);
+
+		double start = Now();
+		for (int f = 0; f < frames; f++)
+			snow.update(0.1f);
+		double update = Now() - start;
+
+		start = Now();
+		for (int f = 0; f < frames; f++)
+			snow.fillVertices(vertices, 0, n);
+		double fill = Now() - start;
+
+		delete[] vertices;
+
+		double scale = 1e9 / ((double)n * frames);
+		cout << "  " << n << ": " << update * scale << ", " << fill * scale << endl;
+	}
+}
+
+/*Runs Snow on every SIMD level the CPU has from the same seed, checks the
+results are bit-identical to the scalar path and reports the update cost*/
+void Benchmark::SnowKernels()
+{
+	const int n = 100000;
+	const int frames = 50;
+	const unsigned int seed = 1234;
+
+	SimdLevel best = ParticleSimd::Detect();
+	Particle* expected = new Particle[n];
+	Particle* actual = new Particle[n];
+
+	cout << "Snow kernels: ns/particle, " << frames << " frames of " << n << endl;
+
+	for (int l = SIMD_SCALAR; l <= best; l++)
+	{
+		SimdLevel level = (SimdLevel)l;
+		ParticleSimd::SetLevel(level);
+
+		Snow snow(n, seed);
+
+		double start = Now();
+		for (int f = 0; f < frames; f++)
+			snow.update(0.1f);
+		double elapsed = Now() - start;
+
+		snow.fillVertices(level == SIMD_SCALAR ? expected : actual, 0, n);
+
+		cout << "  " << ParticleSimd::LevelName(level) << ": " << elapsed * 1e9 / ((double)n * frames);
+		if (level != SIMD_SCALAR)
+			cout << Check(memcmp(expected, actual, n * sizeof(Particle)) == 0, " (MISMATCH)", " (matches scalar)");
+		cout << endl;
+	}
+
+	ParticleSimd::SetLevel(best);
+
+	delete[] expected;
+	delete[] actual;
+}
+
+/*Runs Snow on 1 to N threads at 100k to 2M particles, reporting the update
+time and checking every thread count gives the same particles as one thread*/
+void Benchmark::ParticleThreads()
+{
+	const int counts[] = { 100000, 500000, 2000000 };
+	const int frames = 20;
+	const unsigned int seed = 1234;
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	cout << "Particle threads: ms/update (speedup over 1 thread)" << endl;
+
+	for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		int n = counts[c];
+		Particle* expected = new Particle[n];
+		Particle* actual = new Particle[n];
+		double single = 0.0;
+
+		cout << "  " << n << ":";
+
+		// 1, 2, 4 ... threads, finishing on every core
+		for (int threads = 1; ; threads *= 2)
+		{
+			if (threads > maxThreads)
+				threads = maxThreads;
+
+			ThreadPool pool(threads);
+			Snow snow(n, seed);
+			snow.setThreadPool(&pool);
+
+			double start = Now();
+			for (int f = 0; f < frames; f++)
+				snow.update(0.1f);
+			double elapsed = (Now() - start) * 1000.0 / frames;
+
+			snow.fillVertices(threads == 1 ? expected : actual, 0, n);
+
+			if (threads == 1)
+				single = elapsed;
+
+			cout << " " << threads << "t " << elapsed << " (" << single / elapsed << "x)";
+			if (threads > 1)
+				cout << Check(memcmp(expected, actual, n * sizeof(Particle)) == 0, " MISMATCH");
+
+			if (threads == maxThreads)
+				break;
+		}
+		cout << endl;
+
+		delete[] expected;
+		delete[] actual;
+	}
+}
+
+/*Compares the old rand() % 10000 path with RandomStream one value at a
+time and in batches, in millions of floats per second*/
+void Benchmark::RandomThroughput()
+{
+	const int n = 1 << 24;
+	const int batch = 1024;
+	float* out = new float[batch];
+	float sink = 0.0f;
+
+	cout << "Random floats: M/s" << endl;
+
+	double start = Now();
+	for (int i = 0; i < n; i++)
+		sink += (rand() % 10000) * 0.0001f;
+	double crt = Now() - start;
+
+	RandomStream rng(1234);
+	start = Now();
+	for (int i = 0; i < n; i++)
+		sink += rng.GetFloat(0.0f, 1.0f);
+	double single = Now() - start;
+
+	start = Now();
+	for (int i = 0; i < n; i += batch)
+	{
+		rng.FillFloats(out, batch, 0.0f, 1.0f);
+		sink += out[0];
+	}
+	double filled = Now() - start;
+
+	delete[] out;
+
+	cout << "  rand(): " << n / crt * 1e-6 << endl;
+	cout << "  GetFloat: " << n / single * 1e-6 << endl;
+	cout << "  FillFloats: " << n / filled * 1e-6 << endl;
+	cout << "  (checksum " << sink << ")" << endl;
+}
+
+/*Streams Snow through a VertexStream on the mock backend the way
+PSystem::render does, reporting locks, discards and bytes per frame next to
+the one lock per 512 particles of the old fixed batches*/
+void Benchmark::VertexStreaming()
+{
+	const int counts[] = { 2000, 100000, 1000000 };
+	const int frames = 20;
+	const UINT streamBytes = 1 << 20;
+
+	cout << "Vertex streaming: per frame locks (old), discards, KB, ns/particle" << endl;
+
+	for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		int n = counts[c];
+		Snow snow(n);
+		VertexStream stream(new MockVertexStreamBackend(), streamBytes);
+		int maxBatch = (int)stream.maxVertices(sizeof(Particle));
+
+		DWORD locks = 0, discards = 0, bytes = 0;
+		double start = Now();
+		for (int f = 0; f < frames; f++)
+		{
+			stream.beginFrame();
+
+			for (int first = 0; first < n; first += maxBatch)
+			{
+				int count = n - first;
+				if (count > maxBatch)
+					count = maxBatch;
+
+				UINT firstVertex = 0;
+				Particle* v = (Particle*)stream.alloc(count, sizeof(Particle), &firstVertex);
+				snow.fillVertices(v, first, count);
+				stream.commit();
+			}
+
+			locks += stream.stats().locks;
+			discards += stream.stats().discards;
+			bytes += stream.stats().bytes;
+		}
+		double elapsed = Now() - start;
+
+		cout << "  " << n << ": " << locks / frames << " (" << (n + 511) / 512 << "), "
+			<< (double)discards / frames << ", " << bytes / frames / 1024 << ", "
+			<< elapsed * 1e9 / ((double)n * frames) << endl;
+	}
+}
+
+/*Sorts falling snow back to front every frame from the game's camera. The
+first sort starts from arbitrary order, after that each frame starts from the
+last one, which is what PSystem::render sees. Every frame's order is checked
+to hold each particle once, back to front, as are the orders from sorting
+the last frame again and with a few flakes moved; the path reported is the
+last of those*/
+void Benchmark::ParticleSorting()
+{
+	const int counts[] = { 2000, 100000, 1000000 };
+	const int frames = 20;
+	const char* pathNames[] = { "none", "insertion", "radix" };
+
+	D3DXVECTOR3 eye(0.0f, 6.0f, 10.0f);
+	D3DXVECTOR3 at(0.0f, 0.0f, 0.0f);
+	D3DXVECTOR3 up(0.0f, 1.0f, 0.0f);
+	D3DXMATRIX view;
+	D3DXMatrixLookAtLH(&view, &eye, &at, &up);
+
+	cout << "Particle sort: ms first frame, ms/frame after (path with a few flakes nudged)" << endl;
+
+	for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		int n = counts[c];
+		Snow snow(n);
+		ParticleSort sort;
+		Particle* vertices = new Particle[n];
+		float* x = new float[n];
+		float* y = new float[n];
+		float* z = new float[n];
+
+		double first = 0.0, steady = 0.0;
+		bool sorted = true;
+		for (int f = 0; f <= frames; f++)
+		{
+			snow.update(0.1f);
+			snow.fillVertices(vertices, 0, n);
+			for (int i = 0; i < n; i++)
+			{
+				x[i] = vertices[i]._position.x;
+				y[i] = vertices[i]._position.y;
+				z[i] = vertices[i]._position.z;
+			}
+
+			double start = Now();
+			const int* order = sort.sort(x, y, z, n, view);
+			double elapsed = Now() - start;
+			sorted = sorted && BackToFront(order, n, x, y, z, view);
+
+			if (f == 0)
+				first = elapsed;
+			else
+				steady += elapsed;
+		}
+
+		// falling snow always takes the radix sort, so the other paths are
+		// checked on the last frame: sorted again as it is, then with a few
+		// flakes nudged
+		const int* order = sort.sort(x, y, z, n, view);
+		sorted = sorted && sort.lastPath() == ParticleSort::SORT_NONE && BackToFront(order, n, x, y, z, view);
+		for (int i = 0; i < n; i += 256)
+			z[i] += 0.01f;
+		order = sort.sort(x, y, z, n, view);
+		sorted = sorted && BackToFront(order, n, x, y, z, view);
+
+		cout << "  " << n << ": " << first * 1000.0 << ", " << steady * 1000.0 / frames
+			<< " (" << pathNames[sort.lastPath()] << ")" << Check(sorted, " (NOT BACK TO FRONT)") << endl;
+
+		delete[] vertices;
+		delete[] x;
+		delete[] y;
+		delete[] z;
+	}
+}
+
+/*Sixteen 100k snow emitters at increasing distance from the camera, run
+through a ParticleBudget with a 4ms target. Reports how the measured cost
+and the live particle count settle, and where the particles ended up.*/
+void Benchmark::ParticleBudgets()
+{
+	const int numSystems = 16;
+	const int perSystem = 100000;
+	const int frames = 60;
+	const float targetMs = 4.0f;
+
+	ParticleBudget budget(targetMs);
+	Snow* systems[numSystems];
+	for (int i = 0; i < numSystems; i++)
+	{
+		// a row of 20 unit boxes going away from the camera
+		BoundingBox box;
+		box._min = D3DXVECTOR3(-10.0f, -10.0f, i * 20.0f);
+		box._max = D3DXVECTOR3(10.0f, 10.0f, i * 20.0f + 20.0f);
+		systems[i] = new Snow(box, perSystem, i + 1);
+
+		// the nearer half is weather the player is in, so it matters more
+		budget.add(systems[i], i < numSystems / 2 ? 2.0f : 1.0f);
+	}
+
+	cout << "Particle budget: " << numSystems << " x " << perSystem << ", target " << targetMs << "ms" << endl;
+
+	budget.setCamera(D3DXVECTOR3(0.0f, 0.0f, -10.0f));
+
+	for (int f = 0; f < frames; f++)
+	{
+		budget.update(0.1f);
+
+		if (f % 10 == 9)
+			cout << "  frame " << f + 1 << ": " << budget.lastCostMs() << "ms, " << budget.liveCount() << " live" << endl;
+	}
+
+	cout << "  per system:";
+	for (int i = 0; i < numSystems; i++)
+		cout << " " << systems[i]->liveCount();
+	cout << endl;
+
+	for (int i = 0; i < numSystems; i++)
+		delete systems[i];
+}
+
+/*Collides 500k flakes with a growing number of spheres plus the floor, one
+thread, and checks the cost per particle stays under the budget for the stage.
+Every collider bounces so the particles carry on and are tested again.*/
+void Benchmark::ParticleCollisions()
+{
+	const int n = 500000;
+	const int sphereCounts[] = { 1, 8, 32, 64 };
+	const int steps = 10;
+	const double budgetNs = 25.0; // per particle per step, one thread
+
+	BoundingBox box;
+	box._min = D3DXVECTOR3(-10.0f, -10.0f, -10.0f);
+	box._max = D3DXVECTOR3(10.0f, 10.0f, 10.0f);
+
+	float* px = new float[n];
+	float* py = new float[n];
+	float* pz = new float[n];
+	float* vx = new float[n];
+	float* vy = new float[n];
+	float* vz = new float[n];
+	int* killed = new int[n];
+
+	cout << "Particle collision: " << n << " particles, ns/particle (budget " << budgetNs << ")" << endl;
+
+	for (int c = 0; c < sizeof(sphereCounts) / sizeof(sphereCounts[0]); c++)
+	{
+		RandomStream rng(7);
+		rng.FillFloats(px, n, box._min.x, box._max.x);
+		rng.FillFloats(py, n, box._min.y, box._max.y);
+		rng.FillFloats(pz, n, box._min.z, box._max.z);
+		rng.FillFloats(vx, n, -3.0f, 0.0f);
+		rng.FillFloats(vy, n, -10.0f, 0.0f);
+		rng.FillFloats(vz, n, 0.0f, 0.0f);
+
+		// models about a unit across scattered through the box
+		ParticleCollision collision;
+		for (int i = 0; i < sphereCounts[c]; i++)
+		{
+			D3DXVECTOR3 center;
+			rng.GetVector(&center, &box._min, &box._max);
+			collision.addSphere(center, rng.GetFloat(0.5f, 2.0f), COLLIDE_BOUNCE);
+		}
+		collision.addPlane(D3DXPLANE(0.0f, 1.0f, 0.0f, 10.0f), COLLIDE_BOUNCE);
+
+		double elapsed = 0.0;
+		int hits = 0;
+		for (int s = 0; s < steps; s++)
+		{
+			double start = Now();
+			collision.build();
+			hits += collision.collide(px, py, pz, vx, vy, vz, n, 0, killed);
+			elapsed += Now() - start;
+
+			// fall a step so the next one sees new positions
+			for (int i = 0; i < n; i++)
+			{
+				px[i] += vx[i] * 0.02f;
+				py[i] += vy[i] * 0.02f;
+				pz[i] += vz[i] * 0.02f;
+			}
+		}
+
+		double ns = elapsed * 1e9 / ((double)n * steps);
+		cout << "  " << sphereCounts[c] << " spheres: " << ns << (ns <= budgetNs ? "" : " OVER BUDGET") << endl;
+	}
+
+	delete[] px;
+	delete[] py;
+	delete[] pz;
+	delete[] vx;
+	delete[] vy;
+	delete[] vz;
+	delete[] killed;
+}
+
+/*Runs the same fountain as per particle virtual calls and as the Emitter
+specialised on its policies, on one thread, and checks both made the same
+particles. Also reports each emitter in the registry.*/
+void Benchmark::EmitterDispatch()
+{
+	const int n = 200000;
+	const int steps = 50;
+	const float timeDelta = 1.0f / 30.0f;
+	const unsigned int seed = 99;
+
+	EmitterDesc desc;
+	EmitterRegistry::Defaults("fountain", &desc);
+	desc._numParticles = n;
+
+	ThreadPool pool(1);
+	VirtualFountain virtualFountain(desc, seed);
+	Emitter<PointSpawn, GravityForce, FadeColor> emitter(desc, seed);
+	virtualFountain.setThreadPool(&pool);
+	emitter.setThreadPool(&pool);
+
+	double virtualTime = 0.0, emitterTime = 0.0;
+	for (int s = 0; s < steps; s++)
+	{
+		double start = Now();
+		virtualFountain.update(timeDelta);
+		virtualTime += Now() - start;
+
+		start = Now();
+		emitter.update(timeDelta);
+		emitterTime += Now() - start;
+	}
+
+	Particle* expected = new Particle[n];
+	Particle* actual = new Particle[n];
+	virtualFountain.fillVertices(expected, 0, n);
+	emitter.fillVertices(actual, 0, n);
+	bool same = memcmp(expected, actual, n * sizeof(Particle)) == 0;
+
+	cout << "Emitter dispatch: " << n << " fountain particles, ns/particle" << endl;
+	cout << "  virtual: " << virtualTime * 1e9 / ((double)n * steps) << endl;
+	cout << "  emitter: " << emitterTime * 1e9 / ((double)n * steps)
+		<< " (" << virtualTime / emitterTime << "x)" << Check(same, " MISMATCH") << endl;
+
+	delete[] expected;
+	delete[] actual;
+
+	const char* names[] = { "snow", "rain", "dust", "fountain" };
+	for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		EmitterDesc named;
+		EmitterRegistry::Defaults(names[i], &named);
+		named._numParticles = n;
+
+		PSystem* system = EmitterRegistry::Create(names[i], named, seed);
+		system->setThreadPool(&pool);
+
+		double start = Now();
+		for (int s = 0; s < steps; s++)
+			system->update(timeDelta);
+		double elapsed = Now() - start;
+
+		cout << "  " << names[i] << ": " << elapsed * 1e9 / ((double)n * steps) << endl;
+		delete system;
+	}
+}
+
+/*Parses every .x file that ships with the game and reports the throughput,
+after checking the float parser against strtof. Run from the folder the
+.x files are in.*/
+void Benchmark::XFileParsing()
+{
+	const char* files[] = {
+		"tiger.x", "tiger2.x", "chair.x", "sphere.x", "sky.x", "room.x",
+		"airplane2.x", "dlair.x", "pawn-textured.x", "EvilDrone.x"
+	};
+	const double minSeconds = 0.2; // per file, so small files are timed over many loads
+
+	// the formats exporters write, over a wide range of magnitudes
+	RandomStream rng(5);
+	int checked = 0, mismatches = 0;
+	for (int i = 0; i < 100000; i++)
+	{
+		float f = rng.GetFloat(-1.0f, 1.0f) * powf(10.0f, rng.GetFloat(-8.0f, 8.0f));
+		const char* formats[] = { "%f", "%.6e", "%.9g" };
+		for (int k = 0; k < 3; k++)
+		{
+			char text[64];
+			snprintf(text, sizeof(text), formats[k], f);
+
+			float ours = 0.0f;
+			XFile::ParseFloat(text, text + strlen(text), &ours);
+			float theirs = strtof(text, 0);
+			if (memcmp(&ours, &theirs, sizeof(float)) != 0)
+				mismatches++;
+			checked++;
+		}
+	}
+
+	cout << "X file parsing: float parser " << Check(mismatches == 0, "MISMATCH ", "matches strtof ")
+		<< checked - mismatches << "/" << checked << endl;
+	cout << "  file: MB/s (vertices, triangles, materials)" << endl;
+
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		XMesh mesh;
+		string error;
+		MappedFile file;
+		file.open(files[i]);
+		double megabytes = file.size() / (1024.0 * 1024.0);
+		file.close();
+
+		int loads = 0;
+		bool ok = true;
+		double start = Now(), elapsed = 0.0;
+		do
+		{
+			ok = XFile::Load(files[i], &mesh, &error);
+			loads++;
+			elapsed = Now() - start;
+		} while (ok && elapsed < minSeconds);
+
+		cout << "  " << files[i] << ": ";
+		if (ok)
+			cout << megabytes * loads / elapsed << " (" << mesh.numVertices() << ", "
+				<< mesh.numTriangles() << ", " << mesh.materials.size() << ")" << endl;
+		else
+			cout << Check(false, error.c_str()) << endl;
+	}
+}
+
+/*Loads every mesh from a text and a binary copy written from the same XMesh,
+so the two formats are timed on identical data, and checks they agree*/
+void Benchmark::XFileFormats()
+{
+	const char* files[] = {
+		"tiger.x", "chair.x", "sphere.x", "dlair.x", "pawn-textured.x", "EvilDrone.x"
+	};
+	const char* textPath = "benchmark_text.x";
+	const char* binaryPath = "benchmark_binary.x";
+	const double minSeconds = 0.2;
+
+	cout << "X file formats: ms/load (text, binary, speed up)" << endl;
+
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		XMesh source;
+		string error;
+		if (!XFile::Load(files[i], &source, &error))
+		{
+			cout << "  " << files[i] << ": " << Check(false, error.c_str()) << endl;
+			continue;
+		}
+
+		XFile::Save(textPath, source, false);
+		XFile::Save(binaryPath, source, true);
+
+		const char* paths[] = { textPath, binaryPath };
+		XMesh meshes[2];
+		double perLoad[2];
+		bool ok = true;
+		for (int k = 0; k < 2 && ok; k++)
+		{
+			int loads = 0;
+			double start = Now(), elapsed = 0.0;
+			do
+			{
+				ok = XFile::Load(paths[k], &meshes[k], &error);
+				loads++;
+				elapsed = Now() - start;
+			} while (ok && elapsed < minSeconds);
+			perLoad[k] = elapsed * 1000.0 / loads;
+		}
+
+		cout << "  " << files[i] << ": ";
+		if (!ok)
+		{
+			cout << Check(false, error.c_str()) << endl;
+			continue;
+		}
+
+		bool same = meshes[0].positions == meshes[1].positions && meshes[0].normals == meshes[1].normals
+			&& meshes[0].texCoords == meshes[1].texCoords && meshes[0].indices == meshes[1].indices
+			&& meshes[0].attributes == meshes[1].attributes;
+		cout << perLoad[0] << ", " << perLoad[1] << ", " << perLoad[0] / perLoad[1] << "x"
+			<< Check(same, " (MISMATCH)") << endl;
+	}
+
+	remove(textPath);
+	remove(binaryPath);
+}
+
+/*Opens every asset through the mesh cache with no cache on disk (cold: parse
+and bake) and with the cache it left (warm: hash the source and map), checks
+the warm open did not rebuild and that a stale cache does*/
+void Benchmark::MeshStartup()
+{
+	const char* files[] = {
+		"tiger.x", "tiger2.x", "chair.x", "sphere.x", "sky.x", "room.x",
+		"airplane2.x", "dlair.x", "pawn-textured.x", "EvilDrone.x"
+	};
+	const double minSeconds = 0.1;
+
+	cout << "Mesh startup: ms/open (cold, warm, speed up)" << endl;
+
+	double totalCold = 0.0, totalWarm = 0.0;
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		string cachePath = MeshCache::CachePath(files[i]);
+		MeshCache cache;
+		string error;
+
+		int opens = 0;
+		bool ok = true;
+		double start = Now(), cold = 0.0;
+		do
+		{
+			remove(cachePath.c_str());
+			ok = cache.open(files[i], &error) && cache.rebuilt();
+			opens++;
+			cold = Now() - start;
+		} while (ok && cold < minSeconds);
+		cold /= opens;
+
+		opens = 0;
+		start = Now();
+		double warm = 0.0;
+		while (ok && warm < minSeconds)
+		{
+			ok = cache.open(files[i], &error) && !cache.rebuilt();
+			opens++;
+			warm = Now() - start;
+		}
+
+		cout << "  " << files[i] << ": ";
+		if (!ok)
+		{
+			cout << Check(false, error.empty() ? "cache rebuilt when it was fresh" : error.c_str()) << endl;
+			continue;
+		}
+
+		warm /= opens;
+		totalCold += cold;
+		totalWarm += warm;
+		cout << cold * 1000.0 << ", " << warm * 1000.0 << ", " << cold / warm << "x" << endl;
+	}
+	cout << "  all: " << totalCold * 1000.0 << ", " << totalWarm * 1000.0 << ", " << totalCold / totalWarm << "x" << endl;
+
+	// a cache baked from other contents must be thrown away
+	XMesh mesh;
+	XFile::Load(files[0], &mesh);
+	MeshCache::Bake(mesh, 0, MeshCache::CachePath(files[0]));
+	MeshCache stale;
+	bool rebuilt = stale.open(files[0]) && stale.rebuilt();
+	cout << "  stale cache " << Check(rebuilt, "NOT REBUILT", "rebuilt") << endl;
+}
+
+/*Decodes the game's startup assets one after another, the way Init used to,
+and through the AssetLoader, with and without mesh caches on disk. For the
+loader, first is how long the caller was held up before it could draw a
+frame and total is until every create had been pumped*/
+void Benchmark::AssetLoading()
+{
+	const char* files[] = { "tiger2.x", "chair.x", "sphere.x", "EvilDrone.x" };
+	const int numFiles = sizeof(files) / sizeof(files[0]);
+
+	cout << "Asset loading: ms (serial, loader first frame, loader total)" << endl;
+
+	for (int warm = 0; warm < 2; warm++)
+	{
+		int loaded = 0;
+
+		if (!warm)
+		{
+			for (int i = 0; i < numFiles; i++)
+				remove(MeshCache::CachePath(files[i]).c_str());
+		}
+
+		double start = Now();
+		for (int i = 0; i < numFiles; i++)
+			loaded += Model::Decode(files[i])->cached;
+		vector<char> texture;
+		AssetLoader::ReadFile("snowflake.dds", &texture);
+		double serial = Now() - start;
+
+		if (!warm)
+		{
+			for (int i = 0; i < numFiles; i++)
+				remove(MeshCache::CachePath(files[i]).c_str());
+		}
+
+		start = Now();
+		AssetLoader loader(2);
+		for (int i = 0; i < numFiles; i++)
+		{
+			string file = files[i];
+			loader.load<std::shared_ptr<ModelAsset> >(
+				[file]() { return Model::Decode(file); },
+				[&loaded](const std::shared_ptr<ModelAsset>& asset) { loaded += asset->cached; });
+		}
+		loader.load<std::shared_ptr<vector<char> > >(
+			[]()
+			{
+				std::shared_ptr<vector<char> > data(new vector<char>());
+				AssetLoader::ReadFile("snowflake.dds", data.get());
+				return data;
+			},
+			[](const std::shared_ptr<vector<char> >& data) {});
+		double first = Now() - start;
+
+		// what the game loop does each frame, without the frame
+		while (loader.pending() > 0)
+		{
+			if (loader.pump(0.004) == 0)
+				std::this_thread::yield();
+		}
+		double total = Now() - start;
+
+		cout << "  " << (warm ? "warm" : "cold") << ": " << serial * 1000.0 << ", " << first * 1000.0
+			<< ", " << total * 1000.0 << Check(loaded == numFiles * 2, " (FAILED)") << endl;
+	}
+}
+
+/*Checks TextureCache::NormalizePath turns the ways models name textures into
+the one key the cache finds them by, and times it, as every Acquire and
+Contains normalises its path first. Then checks that Release and Clear
+ignore textures the cache doesn't hold, which needs no device.*/
+void Benchmark::TextureCaching()
+{
+	const char* cases[][2] = {
+		{ "wood.dds", "wood.dds" },
+		{ "Textures/Wood.DDS", "textures\\wood.dds" },
+		{ "textures\\wood.dds", "textures\\wood.dds" },
+		{ "textures//wood.dds", "textures\\wood.dds" },
+		{ ".\\textures\\.\\wood.dds", "textures\\wood.dds" },
+		{ "models\\..\\textures\\wood.dds", "textures\\wood.dds" },
+		{ "..\\wood.dds", "..\\wood.dds" },
+		{ "../../a/../Wood.dds", "..\\..\\wood.dds" },
+		{ "a\\b\\..\\..\\..\\wood.dds", "..\\wood.dds" },
+		{ "textures\\", "textures" },
+		{ "", "" }
+	};
+	const int numCases = sizeof(cases) / sizeof(cases[0]);
+	const double minSeconds = 0.05;
+
+	int wrong = 0;
+	for (int i = 0; i < numCases; i++)
+	{
+		string normalized = TextureCache::NormalizePath(cases[i][0]);
+		if (normalized != cases[i][1])
+		{
+			cout << "  \"" << cases[i][0] << "\" became \"" << normalized << "\", not \"" << cases[i][1] << "\"" << endl;
+			wrong++;
+		}
+	}
+
+	int runs = 0;
+	double start = Now(), elapsed = 0.0;
+	do
+	{
+		for (int i = 0; i < numCases; i++)
+			TextureCache::NormalizePath(cases[i][0]);
+		runs++;
+		elapsed = Now() - start;
+	} while (elapsed < minSeconds);
+
+	cout << "Texture cache: paths normalised " << numCases - wrong << "/" << numCases
+		<< Check(wrong == 0, " (WRONG)") << ", " << elapsed * 1e9 / ((double)runs * numCases) << " ns/path" << endl;
+
+	// giving back textures the cache never handed out must not touch the count
+	TextureCache::Stats before = TextureCache::GetStats();
+	TextureCache::Release(0);
+	TextureCache::Release((LPDIRECT3DTEXTURE9)&before);
+	TextureCache::Clear();
+	TextureCache::Clear();
+	TextureCache::Release((LPDIRECT3DTEXTURE9)&before);
+	TextureCache::Stats after = TextureCache::GetStats();
+	bool kept = after.textures == 0 && after.hits == before.hits && after.misses == before.misses
+		&& !TextureCache::Contains(cases[1][0]);
+	cout << "  unknown releases and clears" << Check(kept, " CHANGED THE CACHE", " left it empty") << endl;
+}
+
+/*Runs MeshOptimizer on meshes as the exporter wrote them and reports what
+the GPU would do drawing them before and after, and checks the same
+triangles are drawn with no more vertices transformed than before*/
+void Benchmark::MeshOptimization()
+{
+	const char* files[] = {
+		"tiger.x", "chair.x", "sphere.x", "room.x", "airplane2.x", "dlair.x", "pawn-textured.x", "EvilDrone.x"
+	};
+
+	cout << "Mesh optimization: before -> after (ACMR, ATVR, overdraw, vertices), ms to optimize" << endl;
+
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		XMesh before;
+		string error;
+		if (!XFile::Load(files[i], &before, &error))
+		{
+			cout << "  " << files[i] << ": " << Check(false, error.c_str()) << endl;
+			continue;
+		}
+
+		XMesh after = before;
+		double start = Now();
+		MeshOptimizer::Optimize(&after);
+		double elapsed = Now() - start;
+
+		const XMesh* meshes[] = { &before, &after };
+		float acmr[2], atvr[2], overdraw[2];
+		for (int k = 0; k < 2; k++)
+		{
+			const XMesh& m = *meshes[k];
+			acmr[k] = MeshOptimizer::ACMR(&m.indices[0], m.indices.size(), m.numVertices());
+			atvr[k] = MeshOptimizer::ATVR(&m.indices[0], m.indices.size(), m.numVertices());
+			overdraw[k] = MeshOptimizer::Overdraw(&m.positions[0], m.numVertices(), &m.indices[0], m.indices.size());
+		}
+
+		// welding alone changes ATVR, so the order is judged over the welded
+		// vertices as they come
+		XMesh welded = before;
+		MeshOptimizer::WeldVertices(&welded);
+		float weldedAtvr = MeshOptimizer::ATVR(&welded.indices[0], welded.indices.size(), welded.numVertices());
+		bool worse = acmr[1] > acmr[0] || atvr[1] > weldedAtvr;
+
+		bool same = TriangleSet(before) == TriangleSet(after);
+		cout << "  " << files[i] << ": "
+			<< acmr[0] << " -> " << acmr[1] << ", "
+			<< atvr[0] << " -> " << atvr[1] << ", "
+			<< overdraw[0] << " -> " << overdraw[1] << ", "
+			<< before.numVertices() << " -> " << after.numVertices() << ", "
+			<< elapsed * 1000.0 << Check(same, " (TRIANGLES CHANGED)") << Check(!worse, " (WORSE)") << endl;
+	}
+}
+
+/*Builds the level of detail chains, then flies the game's camera (a 45
+degree field of view over 500 pixels) away from a 10x10 grid of each mesh
+and back, counting the triangles drawn each frame with every model at full
+detail and with each picking its level the way RenderModel does*/
+void Benchmark::MeshLods()
+{
+	const char* files[] = { "pawn-textured.x", "chair.x", "EvilDrone.x" };
+	const int gridSize = 10;
+	const int numFrames = 600;
+	const float projectionScale = 1.0f / tanf(D3DX_PI / 8.0f);
+	const float viewportHeight = 500.0f;
+
+	cout << "Mesh LODs: triangles (error) per level, ms to build" << endl;
+	cout << "  then triangles/frame for a " << gridSize << "x" << gridSize << " grid (full, LOD, ratio), level changes/frame" << endl;
+
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		XMesh mesh;
+		float lo[3], hi[3];
+		if (!LoadMeshBox(files[i], &mesh, lo, hi))
+			continue;
+		MeshOptimizer::Optimize(&mesh);
+
+		double start = Now();
+		vector<MeshLodLevel> levels;
+		MeshLod::BuildChain(mesh, &levels);
+		double elapsed = Now() - start;
+
+		vector<float> errors;
+		cout << "  " << files[i] << ":";
+		for (size_t l = 0; l < levels.size(); l++)
+		{
+			errors.push_back(levels[l].error);
+			cout << " " << levels[l].attributes.size() << " (" << levels[l].error << ")";
+		}
+		cout << ", " << elapsed * 1000.0 << endl;
+
+		// bounding sphere around the middle of the box
+		float radius = 0.0f;
+		for (int v = 0; v < mesh.numVertices(); v++)
+		{
+			float d[3];
+			for (int k = 0; k < 3; k++)
+				d[k] = mesh.positions[v * 3 + k] - (lo[k] + hi[k]) * 0.5f;
+			float r = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+			radius = r > radius ? r : radius;
+		}
+
+		// the camera backs off from 2 to 60 radii in front of the grid and returns
+		vector<int> current(gridSize * gridSize, 0);
+		double full = 0.0, withLods = 0.0;
+		int changes = 0;
+		for (int frame = 0; frame < numFrames; frame++)
+		{
+			float t = (float)frame / (numFrames / 2);
+			t = t > 1.0f ? 2.0f - t : t;
+			float distance = radius * (2.0f + 58.0f * t);
+
+			for (int row = 0; row < gridSize; row++)
+			{
+				for (int column = 0; column < gridSize; column++)
+				{
+					int m = row * gridSize + column;
+					float depth = distance + row * radius * 3.0f;
+					float screenRadius = MeshLod::ScreenRadius(radius, depth, projectionScale, viewportHeight);
+					int level = MeshLod::Select(&errors[0], (int)errors.size(), current[m], radius, screenRadius);
+
+					changes += level != current[m];
+					current[m] = level;
+					full += levels[0].attributes.size();
+					withLods += levels[level].attributes.size();
+				}
+			}
+		}
+
+		cout << "  " << full / numFrames << ", " << withLods / numFrames << ", " << full / withLods << "x, "
+			<< (float)changes / numFrames << endl;
+	}
+}
+
+/*Bakes each mesh's cache with float and with quantized vertices and reports
+the bytes its vertices and indices take in each, and how long unpacking the
+quantized ones into the float vertex buffer takes. Every quantized vertex is
+checked against its float one: positions and uvs must be within
+MeshQuantizer::Tolerance, about half a step of the bounds, and normals within
+MeshQuantizer::NORMAL_ERROR, as are a million random unit normals*/
+void Benchmark::MeshQuantization()
+{
+	const char* files[] = {
+		"tiger.x", "chair.x", "sphere.x", "room.x", "airplane2.x", "dlair.x", "pawn-textured.x", "EvilDrone.x"
+	};
+	const double minSeconds = 0.05;
+	const int numRandomNormals = 1000000;
+
+	cout << "Mesh quantization: KB of vertices + indices (float, quantized, saved), ms to unpack" << endl;
+	cout << "  then largest error (position and uv in steps, normal in degrees)" << endl;
+
+	double totalFloat = 0.0, totalQuantized = 0.0;
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		MeshCache floats, quantized;
+		string error;
+		if (!floats.open(files[i], &error, VERTEX_FLOAT) || !quantized.open(files[i], &error, VERTEX_QUANTIZED))
+		{
+			cout << "  " << files[i] << ": " << Check(false, error.c_str()) << endl;
+			continue;
+		}
+
+		double indexBytes = (double)floats.numTriangles() * 3 * floats.indexSize();
+		double floatBytes = (double)floats.numVertices() * floats.vertexSize() + indexBytes;
+		double quantizedBytes = (double)quantized.numVertices() * quantized.vertexSize() + indexBytes;
+		totalFloat += floatBytes;
+		totalQuantized += quantizedBytes;
+
+		int numVertices = quantized.numVertices();
+		vector<BakedVertex> unpacked(numVertices);
+		int unpacks = 0;
+		double start = Now(), elapsed = 0.0;
+		do
+		{
+			for (int v = 0; v < numVertices; v++)
+				quantized.vertex(v, &unpacked[v]);
+			unpacks++;
+			elapsed = Now() - start;
+		} while (elapsed < minSeconds);
+
+		const QuantizationBounds& bounds = *quantized.quantizationBounds();
+		float positionError = 0.0f, uvError = 0.0f, normalError = 0.0f;
+		bool within = numVertices == floats.numVertices();
+		for (int v = 0; v < numVertices && numVertices == floats.numVertices(); v++)
+		{
+			const BakedVertex& a = floats.vertices()[v];
+			const BakedVertex& b = unpacked[v];
+			for (int k = 0; k < 3; k++)
+			{
+				float e = fabsf(a.position[k] - b.position[k]);
+				float steps = bounds.positionScale[k] > 0.0f ? e / bounds.positionScale[k] : 0.0f;
+				positionError = steps > positionError ? steps : positionError;
+				within = within && e <= MeshQuantizer::Tolerance(bounds.positionOffset[k], bounds.positionScale[k]);
+			}
+			float uvs[2] = { a.u - b.u, a.v - b.v };
+			for (int k = 0; k < 2; k++)
+			{
+				float e = fabsf(uvs[k]);
+				float steps = bounds.uvScale[k] > 0.0f ? e / bounds.uvScale[k] : 0.0f;
+				uvError = steps > uvError ? steps : uvError;
+				within = within && e <= MeshQuantizer::Tolerance(bounds.uvOffset[k], bounds.uvScale[k]);
+			}
+
+			// normals from the file need not be unit length, the unpacked ones are
+			float length = sqrtf(a.normal[0] * a.normal[0] + a.normal[1] * a.normal[1] + a.normal[2] * a.normal[2]);
+			if (length > 0.0f)
+			{
+				float unit[3] = { a.normal[0] / length, a.normal[1] / length, a.normal[2] / length };
+				float degrees = (float)NormalAngle(unit, b.normal);
+				normalError = degrees > normalError ? degrees : normalError;
+			}
+		}
+
+		within = within && normalError <= MeshQuantizer::NORMAL_ERROR;
+		cout << "  " << files[i] << ": " << floatBytes / 1024.0 << ", " << quantizedBytes / 1024.0 << ", "
+			<< (1.0 - quantizedBytes / floatBytes) * 100.0 << "%, " << elapsed * 1000.0 / unpacks << endl;
+		cout << "    " << positionError << ", " << uvError << ", " << normalError << Check(within, " (OVER BOUND)") << endl;
+	}
+	cout << "  all: " << totalFloat / 1024.0 << ", " << totalQuantized / 1024.0 << ", "
+		<< (1.0 - totalQuantized / totalFloat) * 100.0 << "%" << endl;
+
+	// a mesh's normals cover only a few directions, so the bound is checked
+	// on unit normals spread over the whole sphere as well
+	RandomStream rng(22);
+	double worst = 0.0;
+	for (int i = 0; i < numRandomNormals; i++)
+	{
+		float n[3], lengthSq;
+		do
+		{
+			for (int k = 0; k < 3; k++)
+				n[k] = rng.GetFloat(-1.0f, 1.0f);
+			lengthSq = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+		} while (lengthSq > 1.0f || lengthSq < 1e-4f);
+
+		float length = sqrtf(lengthSq);
+		for (int k = 0; k < 3; k++)
+			n[k] /= length;
+
+		short packed[2];
+		float unpacked[3];
+		MeshQuantizer::EncodeNormal(n, packed);
+		MeshQuantizer::DecodeNormal(packed, unpacked);
+		double degrees = NormalAngle(n, unpacked);
+		worst = degrees > worst ? degrees : worst;
+	}
+	cout << "  " << numRandomNormals << " random normals: " << worst
+		<< Check(worst <= MeshQuantizer::NORMAL_ERROR, " (OVER BOUND)") << endl;
+}
+
+/*Splits each mesh's full level into meshlets and culls them from cameras all
+around it, on 64 directions spread over a sphere, from inside its bounding
+sphere (half its radius out, looking at the middle), just outside (1.5) and
+further off (4), with a 45 degree field of view. Every meshlet culled is
+checked to really draw nothing from there*/
+void Benchmark::MeshletCulling()
+{
+	const char* files[] = { "pawn-textured.x", "room.x", "chair.x", "EvilDrone.x" };
+	const int numDirections = 64;
+	const float distances[] = { 0.5f, 1.5f, 4.0f };
+	const int numDistances = sizeof(distances) / sizeof(distances[0]);
+
+	cout << "Meshlet culling: meshlets, triangles/meshlet, ms to build" << endl;
+	cout << "  then per distance (radii): % of triangles culled (outside, facing away), runs drawn/view, us to cull" << endl;
+
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		XMesh mesh;
+		float lo[3], hi[3];
+		if (!LoadMeshBox(files[i], &mesh, lo, hi))
+			continue;
+		MeshOptimizer::Optimize(&mesh);
+
+		vector<unsigned int> indices = mesh.indices;
+		vector<Meshlet> meshlets;
+		double start = Now();
+		Meshlets::Build(&indices, mesh.attributes, &mesh.positions[0], mesh.numVertices(), &meshlets);
+		double elapsed = Now() - start;
+
+		cout << "  " << files[i] << ": " << meshlets.size() << ", " << (float)mesh.numTriangles() / meshlets.size()
+			<< ", " << elapsed * 1000.0 << endl;
+
+		// the sphere around the middle of the box
+		float center[3] = { (lo[0] + hi[0]) * 0.5f, (lo[1] + hi[1]) * 0.5f, (lo[2] + hi[2]) * 0.5f };
+		float radius = 0.0f;
+		for (int v = 0; v < mesh.numVertices(); v++)
+		{
+			float d[3];
+			for (int k = 0; k < 3; k++)
+				d[k] = mesh.positions[v * 3 + k] - center[k];
+			float r = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+			radius = r > radius ? r : radius;
+		}
+
+		int wrong = 0;
+		for (int d = 0; d < numDistances; d++)
+		{
+			MeshletStats stats;
+			vector<MeshletRange> ranges;
+			double cullTime = 0.0;
+			for (int view = 0; view < numDirections; view++)
+			{
+				// a Fibonacci spiral spreads the directions evenly
+				float y = 1.0f - 2.0f * (view + 0.5f) / numDirections;
+				float ring = sqrtf(1.0f - y * y);
+				float angle = view * 2.39996323f;
+				float eye[3] = {
+					center[0] + cosf(angle) * ring * radius * distances[d],
+					center[1] + y * radius * distances[d],
+					center[2] + sinf(angle) * ring * radius * distances[d]
+				};
+
+				float matrix[16], planes[24];
+				ViewProjection(eye, center, D3DX_PI / 4.0f, radius * 0.01f, radius * 10.0f, matrix);
+				Meshlets::FrustumPlanes(matrix, planes);
+
+				ranges.clear();
+				start = Now();
+				Meshlets::Cull(&meshlets[0], meshlets.size(), planes, eye, true, &ranges, &stats);
+				cullTime += Now() - start;
+
+				for (size_t m = 0; m < meshlets.size(); m++)
+				{
+					bool outside = Meshlets::Outside(meshlets[m], planes);
+					if ((outside || Meshlets::BackFacing(meshlets[m], eye))
+						&& !CulledRightly(meshlets[m], &indices[0], &mesh.positions[0], planes, eye, outside))
+					{
+						wrong++;
+					}
+				}
+			}
+
+			cout << "    " << distances[d] << ": " << 100.0 * stats.trianglesCulled / stats.triangles << "% ("
+				<< 100.0 * stats.outside / stats.meshlets << "%, " << 100.0 * stats.backFacing / stats.meshlets << "% of meshlets), "
+				<< (float)stats.ranges / numDirections << ", " << cullTime * 1e6 / numDirections << endl;
+		}
+		const char* flag = Check(wrong == 0, " MESHLETS CULLED THAT WERE IN VIEW");
+		if (wrong)
+			cout << "    " << wrong << flag << endl;
+	}
+}
+
+/*Turns a model a million times by the 0.1 radians a rotate key does, about x,
+y or z either way at random, starting away from the origin, once by
+multiplying rotation matrices onto its world matrix the way models used to
+move and once through Transforms. Both are compared with the same turns
+multiplied out in doubles: shear is how far the rotation rows are from
+orthonormal, drift the most any entry is off. Then times building world
+matrices for many models, by one product each, by Transforms::Matrix and by
+the batched UpdateWorlds, whose matrices must match Matrix's to the bit*/
+void Benchmark::TransformPrecision()
+{
+	const int turns = 1000000;
+	const int numTransforms = 4096;
+	const double minSeconds = 0.05;
+	const float maxShear = 1e-5f;
+
+	cout << "Transforms: shear and drift after " << turns << " turns" << endl;
+
+	Transform transform;
+	Transforms::Translate(&transform, 2.0f, 1.0f, 3.0f);
+	float product[16], turn[16];
+	double reference[16], turnReference[16];
+	Transforms::Matrix(transform, product);
+	for (int k = 0; k < 16; k++)
+		reference[k] = product[k];
+
+	RandomStream rng(20);
+	const float axes[3][3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+	for (int i = 0; i < turns; i++)
+	{
+		int key = (int)rng.GetFloat(0.0f, 6.0f) % 6;
+		float angle = key < 3 ? 0.1f : -0.1f;
+
+		AxisRotation(key % 3, angle, turn);
+		MatrixProduct(product, turn, product);
+		AxisRotation(key % 3, (double)angle, turnReference);
+		MatrixProduct(reference, turnReference, reference);
+		Transforms::Rotate(&transform, axes[key % 3], angle);
+	}
+
+	float world[16];
+	Transforms::Matrix(transform, world);
+	float productDrift = 0.0f, transformDrift = 0.0f;
+	for (int k = 0; k < 16; k++)
+	{
+		float a = (float)fabs(product[k] - reference[k]), b = (float)fabs(world[k] - reference[k]);
+		productDrift = a > productDrift ? a : productDrift;
+		transformDrift = b > transformDrift ? b : transformDrift;
+	}
+	float transformShear = Shear(world);
+	cout << "  matrix products: " << Shear(product) << ", " << productDrift << endl;
+	cout << "  Transforms: " << transformShear << ", " << transformDrift << Check(transformShear <= maxShear, " (SHEARED)") << endl;
+
+	// many models at random places, turned and scaled
+	vector<Transform> transforms(numTransforms);
+	vector<float> matrices(numTransforms * 16), batched(numTransforms * 16);
+	vector<Transform*> pointers(numTransforms);
+	vector<float*> worlds(numTransforms);
+	for (int i = 0; i < numTransforms; i++)
+	{
+		Transform& t = transforms[i];
+		Transforms::Translate(&t, rng.GetFloat(-10.0f, 10.0f), rng.GetFloat(-10.0f, 10.0f), rng.GetFloat(-10.0f, 10.0f));
+		for (int k = 0; k < 3; k++)
+		{
+			Transforms::Rotate(&t, axes[k], rng.GetFloat(-3.0f, 3.0f));
+			t.scale[k] = rng.GetFloat(0.5f, 2.0f);
+		}
+		pointers[i] = &t;
+		worlds[i] = &batched[i * 16];
+	}
+
+	cout << "  then ns per world matrix (product, Matrix, UpdateWorlds, UpdateWorlds with none dirty)" << endl;
+
+	AxisRotation(1, 0.1f, turn);
+	int runs = 0;
+	double start = Now(), productTime = 0.0;
+	do
+	{
+		for (int i = 0; i < numTransforms; i++)
+			MatrixProduct(&matrices[i * 16], turn, &matrices[i * 16]);
+		runs++;
+		productTime = Now() - start;
+	} while (productTime < minSeconds);
+	productTime /= runs;
+
+	runs = 0;
+	start = Now();
+	double matrixTime = 0.0;
+	do
+	{
+		for (int i = 0; i < numTransforms; i++)
+			Transforms::Matrix(transforms[i], &matrices[i * 16]);
+		runs++;
+		matrixTime = Now() - start;
+	} while (matrixTime < minSeconds);
+	matrixTime /= runs;
+
+	runs = 0;
+	start = Now();
+	double batchTime = 0.0;
+	size_t built = 0;
+	do
+	{
+		for (int i = 0; i < numTransforms; i++)
+			transforms[i].dirty = true;
+		built += Transforms::UpdateWorlds(&pointers[0], &worlds[0], numTransforms);
+		runs++;
+		batchTime = Now() - start;
+	} while (batchTime < minSeconds);
+	batchTime /= runs;
+	bool allBuilt = built == (size_t)runs * numTransforms;
+
+	// nothing moved, nothing to build
+	runs = 0;
+	built = 0;
+	start = Now();
+	double cleanTime = 0.0;
+	do
+	{
+		built += Transforms::UpdateWorlds(&pointers[0], &worlds[0], numTransforms);
+		runs++;
+		cleanTime = Now() - start;
+	} while (cleanTime < minSeconds);
+	cleanTime /= runs;
+	allBuilt = allBuilt && built == 0;
+
+	bool same = memcmp(&matrices[0], &batched[0], matrices.size() * sizeof(float)) == 0;
+	cout << "    " << productTime * 1e9 / numTransforms << ", " << matrixTime * 1e9 / numTransforms << ", "
+		<< batchTime * 1e9 / numTransforms << ", " << cleanTime * 1e9 / numTransforms
+		<< Check(same && allBuilt, " (MISMATCH)") << endl;
+}
+
+/*Culls scenes of a thousand up to a hundred thousand spheres, scattered
+through a box around a camera with a 45 degree field of view, on every SIMD
+level the CPU has, and reports thousands of spheres culled per millisecond.
+Every level must keep the same spheres as the scalar one*/
+void Benchmark::FrustumCulling()
+{
+	const int counts[] = { 1000, 10000, 100000 };
+	const double minSeconds = 0.05;
+	const float eye[3] = { 0.0f, 0.0f, 0.0f }, target[3] = { 0.0f, 0.0f, 1.0f };
+
+	float viewProjection[16], planes[24];
+	ViewProjection(eye, target, D3DX_PI / 4.0f, 0.1f, 100.0f, viewProjection);
+	Meshlets::FrustumPlanes(viewProjection, planes);
+
+	SimdLevel best = ParticleSimd::Detect();
+	cout << "Frustum culling: % visible, then thousand spheres/ms per level" << endl;
+
+	RandomStream rng(21);
+	for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		int n = counts[c];
+		vector<float> x(n), y(n), z(n), radius(n);
+		rng.FillFloats(&x[0], n, -100.0f, 100.0f);
+		rng.FillFloats(&y[0], n, -100.0f, 100.0f);
+		rng.FillFloats(&z[0], n, -100.0f, 100.0f);
+		rng.FillFloats(&radius[0], n, 0.5f, 3.0f);
+
+		vector<int> expected(n), visible(n);
+		int numExpected = 0;
+		cout << "  " << n << ":";
+		for (int l = SIMD_SCALAR; l <= best; l++)
+		{
+			SimdLevel level = (SimdLevel)l;
+			ParticleSimd::SetLevel(level);
+
+			int numVisible = 0, runs = 0;
+			double start = Now(), elapsed = 0.0;
+			do
+			{
+				numVisible = FrustumCull::CullSpheres(&x[0], &y[0], &z[0], &radius[0], n, planes,
+					level == SIMD_SCALAR ? &expected[0] : &visible[0]);
+				runs++;
+				elapsed = Now() - start;
+			} while (elapsed < minSeconds);
+
+			if (level == SIMD_SCALAR)
+			{
+				numExpected = numVisible;
+				cout << " " << numVisible * 100.0 / n << "%";
+			}
+			bool same = level == SIMD_SCALAR ||
+				(numVisible == numExpected && memcmp(&visible[0], &expected[0], numVisible * sizeof(int)) == 0);
+
+			cout << ", " << ParticleSimd::LevelName(level) << " " << (double)n * runs / (elapsed * 1000.0) / 1000.0
+				<< Check(same, " (MISMATCH)");
+		}
+		cout << endl;
+	}
+	ParticleSimd::SetLevel(best);
+}
+
+/*Measures each mesh's local bounds, places them with random turns, scales
+and moves, and checks that the world sphere, axis aligned box and oriented
+box each hold every vertex the same matrix places; that PlaceAll gives the
+same bits as Place; and how many ns a model takes either way*/
+void Benchmark::BoundsPlacement()
+{
+	const char* files[] = { "tiger.x", "chair.x", "sphere.x", "room.x", "pawn-textured.x", "EvilDrone.x" };
+	const int numPlaced = 64;
+	const int numTimed = 4096;
+	const double minSeconds = 0.05;
+	const float axes[3][3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+
+	cout << "World bounds: every vertex inside (sphere, box, oriented box)" << endl;
+
+	RandomStream rng(22);
+	vector<LocalBounds> locals;
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+	{
+		XMesh mesh;
+		float lo[3], hi[3];
+		if (!LoadMeshBox(files[i], &mesh, lo, hi))
+			continue;
+
+		// the box, and the sphere about its middle
+		int numVertices = mesh.numVertices();
+		const float* p = &mesh.positions[0];
+		LocalBounds local;
+		for (int k = 0; k < 3; k++)
+		{
+			local.center[k] = local.boxCenter[k] = (lo[k] + hi[k]) * 0.5f;
+			local.boxExtent[k] = (hi[k] - lo[k]) * 0.5f;
+		}
+		float radiusSq = 0.0f;
+		for (int v = 0; v < numVertices; v++)
+		{
+			float dx = p[v * 3] - local.center[0], dy = p[v * 3 + 1] - local.center[1], dz = p[v * 3 + 2] - local.center[2];
+			float d = dx * dx + dy * dy + dz * dz;
+			radiusSq = d > radiusSq ? d : radiusSq;
+		}
+		local.radius = sqrtf(radiusSq);
+		locals.push_back(local);
+
+		bool inSphere = true, inBox = true, inOriented = true;
+		for (int t = 0; t < numPlaced; t++)
+		{
+			Transform transform;
+			for (int k = 0; k < 3; k++)
+			{
+				Transforms::Rotate(&transform, axes[k], rng.GetFloat(-3.0f, 3.0f));
+				transform.scale[k] = rng.GetFloat(0.25f, 4.0f);
+			}
+			Transforms::Translate(&transform, rng.GetFloat(-50.0f, 50.0f), rng.GetFloat(-50.0f, 50.0f), rng.GetFloat(-50.0f, 50.0f));
+			float m[16];
+			Transforms::Matrix(transform, m);
+			WorldBounds world;
+			Bounds::Place(local, m, &world);
+
+			// slack for the rounding of the placed vertex and bounds, relative to their size
+			float slack = 1e-5f * (world.radius + fabsf(m[12]) + fabsf(m[13]) + fabsf(m[14]));
+			for (int v = 0; v < numVertices; v++)
+			{
+				float w[3];
+				for (int j = 0; j < 3; j++)
+					w[j] = p[v * 3] * m[j] + p[v * 3 + 1] * m[4 + j] + p[v * 3 + 2] * m[8 + j] + m[12 + j];
+
+				float d[3] = { w[0] - world.center[0], w[1] - world.center[1], w[2] - world.center[2] };
+				inSphere = inSphere && sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) <= world.radius + slack;
+				for (int j = 0; j < 3; j++)
+					inBox = inBox && w[j] >= world.boxMin[j] - slack && w[j] <= world.boxMax[j] + slack;
+
+				// along each oriented axis, no further than the axis is long
+				float middle[3];
+				for (int j = 0; j < 3; j++)
+					middle[j] = (world.boxMin[j] + world.boxMax[j]) * 0.5f;
+				for (int a = 0; a < 3; a++)
+				{
+					const float* axis = world.obbAxes[a];
+					float lengthSq = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+					float along = (w[0] - middle[0]) * axis[0] + (w[1] - middle[1]) * axis[1] + (w[2] - middle[2]) * axis[2];
+					inOriented = inOriented && fabsf(along) <= lengthSq + slack * sqrtf(lengthSq);
+				}
+			}
+		}
+
+		cout << "  " << files[i] << ": " << (inSphere ? "yes" : "NO") << ", " << (inBox ? "yes" : "NO") << ", "
+			<< (inOriented ? "yes" : "NO") << Check(inSphere && inBox && inOriented, " (OUTSIDE)") << endl;
+	}
+	if (locals.empty())
+		return;
+
+	// many models, each some mesh's bounds at some place
+	vector<float> matrices(numTimed * 16);
+	vector<WorldBounds> single(numTimed), batched(numTimed);
+	vector<const LocalBounds*> localPointers(numTimed);
+	vector<const float*> worldPointers(numTimed);
+	vector<WorldBounds*> out(numTimed);
+	for (int i = 0; i < numTimed; i++)
+	{
+		Transform transform;
+		for (int k = 0; k < 3; k++)
+		{
+			Transforms::Rotate(&transform, axes[k], rng.GetFloat(-3.0f, 3.0f));
+			transform.scale[k] = rng.GetFloat(0.25f, 4.0f);
+		}
+		Transforms::Translate(&transform, rng.GetFloat(-50.0f, 50.0f), rng.GetFloat(-50.0f, 50.0f), rng.GetFloat(-50.0f, 50.0f));
+		Transforms::Matrix(transform, &matrices[i * 16]);
+		localPointers[i] = &locals[i % locals.size()];
+		worldPointers[i] = &matrices[i * 16];
+		out[i] = &batched[i];
+	}
+
+	int runs = 0;
+	double start = Now(), placeTime = 0.0;
+	do
+	{
+		for (int i = 0; i < numTimed; i++)
+			Bounds::Place(*localPointers[i], worldPointers[i], &single[i]);
+		runs++;
+		placeTime = Now() - start;
+	} while (placeTime < minSeconds);
+	placeTime /= runs;
+
+	runs = 0;
+	start = Now();
+	double batchTime = 0.0;
+	do
+	{
+		Bounds::PlaceAll(&localPointers[0], &worldPointers[0], &out[0], numTimed);
+		runs++;
+		batchTime = Now() - start;
+	} while (batchTime < minSeconds);
+	batchTime /= runs;
+
+	bool same = memcmp(&single[0], &batched[0], numTimed * sizeof(WorldBounds)) == 0;
+	cout << "  ns per model (Place, PlaceAll): " << placeTime * 1e9 / numTimed << ", " << batchTime * 1e9 / numTimed
+		<< Check(same, " (MISMATCH)") << endl;
+}
+
+/*Builds each mesh's triangle BVH and casts rays at it from all around, from
+a sphere twice the mesh's size towards random points in its box; checks the
+nearest hit against testing every triangle, and reports the build time and
+rays per second both ways. Then places the mesh many times over in a scene
+BVH and does the same through both levels, checked against every model's
+BVH in turn*/
+void Benchmark::MeshPicking()
+{
+	const char* files[] = { "pawn-textured.x", "room.x" };
+	const int numRays = 100000;
+	const int numChecked = 1000;
+	const int numPlaced = 64;
+	const double minSeconds = 0.1;
+	const float axes[3][3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+
+	cout << "Picking: build ms, rays per second (BVH, every triangle), scene rays per second" << endl;
+
+	RandomStream rng(23);
+	for (int f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+	{
+		XMesh mesh;
+		float lo[3], hi[3];
+		if (!LoadMeshBox(files[f], &mesh, lo, hi))
+			continue;
+
+		int numTriangles = mesh.numTriangles();
+		const float* p = &mesh.positions[0];
+		float middle[3], size = 0.0f;
+		for (int k = 0; k < 3; k++)
+		{
+			middle[k] = (lo[k] + hi[k]) * 0.5f;
+			size += (hi[k] - lo[k]) * (hi[k] - lo[k]);
+		}
+		size = sqrtf(size);
+
+		MeshBvh bvh;
+		int builds = 0;
+		double start = Now(), buildTime = 0.0;
+		do
+		{
+			bvh.build(p, &mesh.indices[0], numTriangles);
+			builds++;
+			buildTime = Now() - start;
+		} while (buildTime < minSeconds);
+		buildTime /= builds;
+
+		// unit directions, so hit distances are in mesh units
+		vector<float> origins(numRays * 3), directions(numRays * 3);
+		for (int r = 0; r < numRays; r++)
+			RandomRay(rng, middle, lo, hi, size, &origins[r * 3], &directions[r * 3]);
+
+		vector<RayHit> hits(numRays);
+		int runs = 0;
+		start = Now();
+		double bvhTime = 0.0;
+		do
+		{
+			for (int r = 0; r < numRays; r++)
+			{
+				hits[r] = RayHit();
+				bvh.intersect(&origins[r * 3], &directions[r * 3], &hits[r]);
+			}
+			runs++;
+			bvhTime = Now() - start;
+		} while (bvhTime < minSeconds);
+		bvhTime /= runs;
+
+		// every triangle, for the few rays it has time for
+		int numHits = 0;
+		bool same = true;
+		start = Now();
+		for (int r = 0; r < numChecked; r++)
+		{
+			float nearest = FLT_MAX;
+			for (int t = 0; t < numTriangles; t++)
+			{
+				float distance;
+				if (RayTriangle(p, &mesh.indices[t * 3], &origins[r * 3], &directions[r * 3], &distance)
+					&& distance < nearest)
+				{
+					nearest = distance;
+				}
+			}
+			numHits += nearest != FLT_MAX;
+			same = same && SameDistance(hits[r].distance, nearest, size);
+		}
+		double bruteTime = (Now() - start) / numChecked;
+
+		// the mesh placed all over, through both levels
+		vector<float> matrices(numPlaced * 16), inverses(numPlaced * 16);
+		LocalBounds local;
+		for (int k = 0; k < 3; k++)
+		{
+			local.center[k] = local.boxCenter[k] = middle[k];
+			local.boxExtent[k] = (hi[k] - lo[k]) * 0.5f;
+		}
+		local.radius = size * 0.5f;
+		SceneBvh scene;
+		float sceneLo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, sceneHi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int i = 0; i < numPlaced; i++)
+		{
+			Transform transform;
+			for (int k = 0; k < 3; k++)
+				Transforms::Rotate(&transform, axes[k], rng.GetFloat(-3.0f, 3.0f));
+			float scale = rng.GetFloat(0.5f, 2.0f);
+			for (int k = 0; k < 3; k++)
+				transform.scale[k] = scale;
+			Transforms::Translate(&transform, rng.GetFloat(-4.0f, 4.0f) * size, rng.GetFloat(-4.0f, 4.0f) * size,
+				rng.GetFloat(-4.0f, 4.0f) * size);
+			Transforms::Matrix(transform, &matrices[i * 16]);
+			Transforms::InverseMatrix(transform, &inverses[i * 16]);
+
+			WorldBounds world;
+			Bounds::Place(local, &matrices[i * 16], &world);
+			scene.add(i, &bvh, world, &inverses[i * 16]);
+			for (int k = 0; k < 3; k++)
+			{
+				sceneLo[k] = world.boxMin[k] < sceneLo[k] ? world.boxMin[k] : sceneLo[k];
+				sceneHi[k] = world.boxMax[k] > sceneHi[k] ? world.boxMax[k] : sceneHi[k];
+			}
+		}
+		scene.build();
+
+		float sceneMiddle[3], sceneSize = 0.0f;
+		for (int k = 0; k < 3; k++)
+		{
+			sceneMiddle[k] = (sceneLo[k] + sceneHi[k]) * 0.5f;
+			sceneSize += (sceneHi[k] - sceneLo[k]) * (sceneHi[k] - sceneLo[k]);
+		}
+		sceneSize = sqrtf(sceneSize);
+		for (int r = 0; r < numRays; r++)
+			RandomRay(rng, sceneMiddle, sceneLo, sceneHi, sceneSize, &origins[r * 3], &directions[r * 3]);
+
+		runs = 0;
+		start = Now();
+		double sceneTime = 0.0;
+		do
+		{
+			for (int r = 0; r < numRays; r++)
+			{
+				hits[r] = RayHit();
+				scene.intersect(&origins[r * 3], &directions[r * 3], &hits[r]);
+			}
+			runs++;
+			sceneTime = Now() - start;
+		} while (sceneTime < minSeconds);
+		sceneTime /= runs;
+
+		// every model's BVH in turn, the same way the scene reaches them
+		int numSceneHits = 0;
+		for (int r = 0; r < numChecked; r++)
+		{
+			RayHit nearest;
+			for (int i = 0; i < numPlaced; i++)
+			{
+				const float* m = &inverses[i * 16];
+				const float* o = &origins[r * 3];
+				const float* d = &directions[r * 3];
+				float localOrigin[3], localDirection[3];
+				for (int j = 0; j < 3; j++)
+				{
+					localOrigin[j] = o[0] * m[j] + o[1] * m[4 + j] + o[2] * m[8 + j] + m[12 + j];
+					localDirection[j] = d[0] * m[j] + d[1] * m[4 + j] + d[2] * m[8 + j];
+				}
+				bvh.intersect(localOrigin, localDirection, &nearest);
+			}
+			numSceneHits += nearest.distance != FLT_MAX;
+			same = same && SameDistance(hits[r].distance, nearest.distance, sceneSize);
+		}
+
+		cout << "  " << files[f] << " (" << numTriangles << " triangles, " << bvh.numNodes() << " nodes): "
+			<< buildTime * 1e3 << ", " << numRays / bvhTime << ", " << 1.0 / bruteTime << ", "
+			<< numRays / sceneTime << " (" << numPlaced << " models); hits " << numHits * 100 / numChecked << "%, "
+			<< numSceneHits * 100 / numChecked << "%" << Check(same, " (MISMATCH)") << endl;
+	}
+}
+
+/*Builds every mesh's BVH and casts rays at it from all around on every SIMD
+level the CPU has, reporting the build time and millions of rays per second.
+Each level must find the same hits, to the bit, as the scalar one*/
+void Benchmark::MeshRaycasting()
+{
+	const char* files[] = { "tiger.x", "chair.x", "sphere.x", "room.x", "airplane2.x", "dlair.x", "pawn-textured.x",
+		"EvilDrone.x" };
+	const int numRays = 100000;
+	const double minSeconds = 0.1;
+
+	SimdLevel best = ParticleSimd::Detect();
+	cout << "Ray casting: build ms, then Mrays/s per level" << endl;
+
+	RandomStream rng(24);
+	for (int f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+	{
+		XMesh mesh;
+		float lo[3], hi[3];
+		if (!LoadMeshBox(files[f], &mesh, lo, hi))
+			continue;
+
+		const float* p = &mesh.positions[0];
+		float middle[3], size = 0.0f;
+		for (int k = 0; k < 3; k++)
+		{
+			middle[k] = (lo[k] + hi[k]) * 0.5f;
+			size += (hi[k] - lo[k]) * (hi[k] - lo[k]);
+		}
+		size = sqrtf(size);
+
+		MeshBvh bvh;
+		int builds = 0;
+		double start = Now(), buildTime = 0.0;
+		do
+		{
+			bvh.build(p, &mesh.indices[0], mesh.numTriangles());
+			builds++;
+			buildTime = Now() - start;
+		} while (buildTime < minSeconds);
+		buildTime /= builds;
+
+		vector<float> origins(numRays * 3), directions(numRays * 3);
+		for (int r = 0; r < numRays; r++)
+			RandomRay(rng, middle, lo, hi, size, &origins[r * 3], &directions[r * 3]);
+
+		cout << "  " << files[f] << " (" << mesh.numTriangles() << " triangles): " << buildTime * 1e3;
+		vector<RayHit> expected(numRays), hits(numRays);
+		for (int l = SIMD_SCALAR; l <= best; l++)
+		{
+			SimdLevel level = (SimdLevel)l;
+			ParticleSimd::SetLevel(level);
+			vector<RayHit>& out = level == SIMD_SCALAR ? expected : hits;
+
+			int runs = 0;
+			start = Now();
+			double elapsed = 0.0;
+			do
+			{
+				for (int r = 0; r < numRays; r++)
+				{
+					out[r] = RayHit();
+					bvh.intersect(&origins[r * 3], &directions[r * 3], &out[r]);
+				}
+				runs++;
+				elapsed = Now() - start;
+			} while (elapsed < minSeconds);
+
+			bool same = level == SIMD_SCALAR || memcmp(&hits[0], &expected[0], numRays * sizeof(RayHit)) == 0;
+			cout << ", " << ParticleSimd::LevelName(level) << " " << (double)numRays * runs / elapsed / 1e6
+				<< Check(same, " (MISMATCH)");
+		}
+		cout << endl;
+	}
+	ParticleSimd::SetLevel(best);
+}
+
+/*Places pawn-textured.x 64 times over, every eighth without its BVH as a D3DX
+loaded model would be, and casts two batches of rays into the scene: coherent
+ones from a camera through a grid of pixels, taken in 2x2 blocks, and
+incoherent ones from all around towards random points. Each goes one ray at a
+time, then as a batch of packets and as a stream on one thread, and the better
+of those on every thread; reports millions of rays per second and checks every
+batch finds the distances the single rays do*/
+void Benchmark::RayBatches()
+{
+	const char* file = "pawn-textured.x";
+	const int numPlaced = 64;
+	const int side = 256;
+	const int numRays = side * side;
+	const double minSeconds = 0.2;
+	const float axes[3][3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+
+	cout << "Ray batches (" << numPlaced << " x " << file << ", " << numRays << " rays): % hit, then Mrays/s "
+		"(one at a time, packets, stream, best of them on " << ThreadPool::Shared()->size() << " threads)" << endl;
+
+	XMesh mesh;
+	float lo[3], hi[3];
+	if (!LoadMeshBox(file, &mesh, lo, hi))
+		return;
+
+	const float* p = &mesh.positions[0];
+	LocalBounds local;
+	float size = 0.0f;
+	for (int k = 0; k < 3; k++)
+	{
+		local.center[k] = local.boxCenter[k] = (lo[k] + hi[k]) * 0.5f;
+		local.boxExtent[k] = (hi[k] - lo[k]) * 0.5f;
+		size += (hi[k] - lo[k]) * (hi[k] - lo[k]);
+	}
+	size = sqrtf(size);
+	local.radius = size * 0.5f;
+
+	MeshBvh bvh;
+	bvh.build(p, &mesh.indices[0], mesh.numTriangles());
+
+	RandomStream rng(25);
+	SceneBvh scene;
+	vector<float> inverses(numPlaced * 16);
+	float sceneLo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, sceneHi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int i = 0; i < numPlaced; i++)
+	{
+		Transform transform;
+		for (int k = 0; k < 3; k++)
+			Transforms::Rotate(&transform, axes[k], rng.GetFloat(-3.0f, 3.0f));
+		Transforms::Translate(&transform, rng.GetFloat(-4.0f, 4.0f) * size, rng.GetFloat(-4.0f, 4.0f) * size,
+			rng.GetFloat(-4.0f, 4.0f) * size);
+		float m[16];
+		Transforms::Matrix(transform, m);
+		Transforms::InverseMatrix(transform, &inverses[i * 16]);
+
+		WorldBounds world;
+		Bounds::Place(local, m, &world);
+		scene.add(i, i % 8 ? &bvh : 0, world, &inverses[i * 16]);
+		for (int k = 0; k < 3; k++)
+		{
+			sceneLo[k] = world.boxMin[k] < sceneLo[k] ? world.boxMin[k] : sceneLo[k];
+			sceneHi[k] = world.boxMax[k] > sceneHi[k] ? world.boxMax[k] : sceneHi[k];
+		}
+	}
+	scene.build();
+
+	float sceneMiddle[3], sceneSize = 0.0f;
+	for (int k = 0; k < 3; k++)
+	{
+		sceneMiddle[k] = (sceneLo[k] + sceneHi[k]) * 0.5f;
+		sceneSize += (sceneHi[k] - sceneLo[k]) * (sceneHi[k] - sceneLo[k]);
+	}
+	sceneSize = sqrtf(sceneSize);
+
+	// a camera back along z looking at the middle, its pixels in 2x2 blocks
+	vector<float> coherentOrigins(numRays * 3), coherentDirections(numRays * 3);
+	float eye[3] = { sceneMiddle[0], sceneMiddle[1], sceneMiddle[2] - sceneSize * 0.5f };
+	float spread = 0.5f / side; // tan of half a 53 degree view, a pixel's worth
+	for (int by = 0; by < side; by += 2)
+	{
+		for (int bx = 0; bx < side; bx += 2)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				int x = bx + (j & 1), y = by + (j >> 1);
+				int r = (by * side + bx * 2) + j;
+				float direction[3] = { (x - side * 0.5f) * spread * 2.0f, (y - side * 0.5f) * spread * 2.0f, 1.0f };
+				float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + 1.0f);
+				for (int k = 0; k < 3; k++)
+				{
+					coherentOrigins[r * 3 + k] = eye[k];
+					coherentDirections[r * 3 + k] = direction[k] / length;
+				}
+			}
+		}
+	}
+	vector<float> incoherentOrigins(numRays * 3), incoherentDirections(numRays * 3);
+	for (int r = 0; r < numRays; r++)
+		RandomRay(rng, sceneMiddle, sceneLo, sceneHi, sceneSize, &incoherentOrigins[r * 3], &incoherentDirections[r * 3]);
+
+	const char* names[] = { "coherent", "incoherent" };
+	const float* origins[] = { &coherentOrigins[0], &incoherentOrigins[0] };
+	const float* directions[] = { &coherentDirections[0], &incoherentDirections[0] };
+	ThreadPool one(1);
+	for (int set = 0; set < 2; set++)
+	{
+		vector<RayHit> expected(numRays), hits(numRays);
+		int runs = 0;
+		double start = Now(), singleTime = 0.0;
+		do
+		{
+			for (int r = 0; r < numRays; r++)
+			{
+				expected[r] = RayHit();
+				scene.intersect(origins[set] + r * 3, directions[set] + r * 3, &expected[r]);
+			}
+			runs++;
+			singleTime = Now() - start;
+		} while (singleTime < minSeconds);
+		singleTime /= runs;
+
+		int numHits = 0;
+		for (int r = 0; r < numRays; r++)
+			numHits += expected[r].distance != FLT_MAX;
+		cout << "  " << names[set] << ": " << numHits * 100 / numRays << "%, " << numRays / singleTime / 1e6;
+
+		double times[3];
+		RayCoherence modes[3] = { RAYS_COHERENT, RAYS_INCOHERENT, RAYS_COHERENT };
+		for (int run = 0; run < 3; run++)
+		{
+			// the last run is the faster mode on every thread
+			RayCoherence coherence = run < 2 ? modes[run] : (times[0] < times[1] ? RAYS_COHERENT : RAYS_INCOHERENT);
+			scene.setThreadPool(run < 2 ? &one : ThreadPool::Shared());
+
+			runs = 0;
+			start = Now();
+			double elapsed = 0.0;
+			do
+			{
+				for (int r = 0; r < numRays; r++)
+					hits[r] = RayHit();
+				scene.intersect(origins[set], directions[set], numRays, &hits[0], coherence);
+				runs++;
+				elapsed = Now() - start;
+			} while (elapsed < minSeconds);
+			times[run] = elapsed / runs;
+
+			bool same = true;
+			for (int r = 0; r < numRays; r++)
+				same = same && SameDistance(hits[r].distance, expected[r].distance, sceneSize);
+			cout << ", " << numRays / times[run] / 1e6 << Check(same, " (MISMATCH)");
+		}
+		cout << endl;
+	}
+	scene.setThreadPool(ThreadPool::Shared());
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "basics.h"
+
+struct XMesh;
+
+/*Headless timing runs for the engine systems. None of these need a device,
+so they can be run from a console build (see main.cpp) as well as from the game.
+Results are written to standard output. A correctness check that fails is
+flagged where it is printed and counted in what RunAll returns.*/
+class Benchmark
+{
+public:
+	static int RunAll(); // checks that failed, 0 if all passed
+
+	static void ParticleScaling();
+	static void SnowKernels();
+	static void ParticleThreads();
+	static void RandomThroughput();
+	static void VertexStreaming();
+	static void ParticleSorting();
+	static void ParticleBudgets();
+	static void ParticleCollisions();
+	static void EmitterDispatch();
+	static void XFileParsing();
+	static void XFileFormats();
+	static void MeshStartup();
+	static void AssetLoading();
+	static void TextureCaching();
+	static void MeshOptimization();
+	static void MeshLods();
+	static void MeshQuantization();
+	static void MeshletCulling();
+	static void TransformPrecision();
+	static void FrustumCulling();
+	static void BoundsPlacement();
+	static void MeshPicking();
+	static void MeshRaycasting();
+	static void RayBatches();
+
+private:
+	static double Now();
+	static const char* Check(bool ok, const char* failed, const char* passed = "");
+	static bool LoadMeshBox(const char* file, XMesh* mesh, float* lo, float* hi);
+
+	static int _failures;
+};
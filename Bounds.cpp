@@ -0,0 +1,138 @@
+#include <float.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "Bounds.h"
+/*Bounding volumes, from model space into the world*/
+
+namespace
+{
+	/*Four meshes at once, one lane each, through the same operations in the
+	same order as Bounds::Place so the two agree to the bit*/
+	void Place4(const LocalBounds* const* locals, const float* const* worlds, WorldBounds* const* out)
+	{
+		// a row of every matrix, turned into one entry per register
+		__m128 m[16];
+		for (int r = 0; r < 4; r++)
+		{
+			m[r * 4] = _mm_loadu_ps(worlds[0] + r * 4);
+			m[r * 4 + 1] = _mm_loadu_ps(worlds[1] + r * 4);
+			m[r * 4 + 2] = _mm_loadu_ps(worlds[2] + r * 4);
+			m[r * 4 + 3] = _mm_loadu_ps(worlds[3] + r * 4);
+			_MM_TRANSPOSE4_PS(m[r * 4], m[r * 4 + 1], m[r * 4 + 2], m[r * 4 + 3]);
+		}
+
+		__m128 cx = _mm_loadu_ps(locals[0]->center), cy = _mm_loadu_ps(locals[1]->center);
+		__m128 cz = _mm_loadu_ps(locals[2]->center), r = _mm_loadu_ps(locals[3]->center);
+		_MM_TRANSPOSE4_PS(cx, cy, cz, r);
+		__m128 bx = _mm_loadu_ps(locals[0]->boxCenter), by = _mm_loadu_ps(locals[1]->boxCenter);
+		__m128 bz = _mm_loadu_ps(locals[2]->boxCenter), unused0 = _mm_loadu_ps(locals[3]->boxCenter);
+		_MM_TRANSPOSE4_PS(bx, by, bz, unused0);
+		__m128 ex = _mm_loadu_ps(locals[0]->boxExtent), ey = _mm_loadu_ps(locals[1]->boxExtent);
+		__m128 ez = _mm_loadu_ps(locals[2]->boxExtent), unused1 = _mm_loadu_ps(locals[3]->boxExtent);
+		_MM_TRANSPOSE4_PS(ex, ey, ez, unused1);
+
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		const __m128 zero = _mm_setzero_ps();
+
+		__m128 scale = zero;
+		for (int i = 0; i < 3; i++)
+		{
+			__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[i * 4], m[i * 4]), _mm_mul_ps(m[i * 4 + 1], m[i * 4 + 1])),
+				_mm_mul_ps(m[i * 4 + 2], m[i * 4 + 2]));
+			scale = _mm_max_ps(lengthSq, scale);
+		}
+
+		__m128 sphere[4], boxMin[4], boxMax[4], axes[3][4];
+		for (int j = 0; j < 3; j++)
+		{
+			sphere[j] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, m[j]), _mm_mul_ps(cy, m[4 + j])),
+				_mm_mul_ps(cz, m[8 + j])), m[12 + j]);
+
+			__m128 middle = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, m[j]), _mm_mul_ps(by, m[4 + j])),
+				_mm_mul_ps(bz, m[8 + j])), m[12 + j]);
+			__m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_and_ps(m[j], absMask)),
+				_mm_mul_ps(ey, _mm_and_ps(m[4 + j], absMask))), _mm_mul_ps(ez, _mm_and_ps(m[8 + j], absMask)));
+			boxMin[j] = _mm_sub_ps(middle, extent);
+			boxMax[j] = _mm_add_ps(middle, extent);
+
+			axes[0][j] = _mm_mul_ps(ex, m[j]);
+			axes[1][j] = _mm_mul_ps(ey, m[4 + j]);
+			axes[2][j] = _mm_mul_ps(ez, m[8 + j]);
+		}
+		sphere[3] = _mm_mul_ps(r, _mm_sqrt_ps(scale));
+		boxMin[3] = boxMax[3] = zero;
+		for (int i = 0; i < 3; i++)
+			axes[i][3] = zero;
+
+		// back to a mesh per register
+		_MM_TRANSPOSE4_PS(sphere[0], sphere[1], sphere[2], sphere[3]);
+		_MM_TRANSPOSE4_PS(boxMin[0], boxMin[1], boxMin[2], boxMin[3]);
+		_MM_TRANSPOSE4_PS(boxMax[0], boxMax[1], boxMax[2], boxMax[3]);
+		for (int i = 0; i < 3; i++)
+			_MM_TRANSPOSE4_PS(axes[i][0], axes[i][1], axes[i][2], axes[i][3]);
+
+		for (int k = 0; k < 4; k++)
+		{
+			_mm_storeu_ps(out[k]->center, sphere[k]);
+			_mm_storeu_ps(out[k]->boxMin, boxMin[k]);
+			_mm_storeu_ps(out[k]->boxMax, boxMax[k]);
+			for (int i = 0; i < 3; i++)
+				_mm_storeu_ps(out[k]->obbAxes[i], axes[i][k]);
+		}
+	}
+}
+
+LocalBounds::LocalBounds()
+	: radius(FLT_MAX)
+	, pad0(0.0f)
+	, pad1(0.0f)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		center[k] = 0.0f;
+		boxCenter[k] = 0.0f;
+		boxExtent[k] = FLT_MAX;
+	}
+}
+
+void Bounds::Place(const LocalBounds& local, const float* m, WorldBounds* out)
+{
+	float scale = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		float lengthSq = m[i * 4] * m[i * 4] + m[i * 4 + 1] * m[i * 4 + 1] + m[i * 4 + 2] * m[i * 4 + 2];
+		scale = lengthSq > scale ? lengthSq : scale;
+	}
+
+	const float* c = local.center;
+	const float* b = local.boxCenter;
+	const float* e = local.boxExtent;
+	for (int j = 0; j < 3; j++)
+	{
+		out->center[j] = c[0] * m[j] + c[1] * m[4 + j] + c[2] * m[8 + j] + m[12 + j];
+
+		float middle = b[0] * m[j] + b[1] * m[4 + j] + b[2] * m[8 + j] + m[12 + j];
+		float extent = e[0] * fabsf(m[j]) + e[1] * fabsf(m[4 + j]) + e[2] * fabsf(m[8 + j]);
+		out->boxMin[j] = middle - extent;
+		out->boxMax[j] = middle + extent;
+
+		out->obbAxes[0][j] = e[0] * m[j];
+		out->obbAxes[1][j] = e[1] * m[4 + j];
+		out->obbAxes[2][j] = e[2] * m[8 + j];
+	}
+	out->radius = local.radius * sqrtf(scale);
+	out->pad0 = 0.0f;
+	out->pad1 = 0.0f;
+	for (int i = 0; i < 3; i++)
+		out->obbAxes[i][3] = 0.0f;
+}
+
+void Bounds::PlaceAll(const LocalBounds* const* locals, const float* const* worlds, WorldBounds* const* out,
+	size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		Place4(locals + i, worlds + i, out + i);
+	for (; i < count; i++)
+		Place(*locals[i], worlds[i], out[i]);
+}
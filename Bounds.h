@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+
+//A mesh's bounds in its own space. Until it is measured it bounds everything.
+struct LocalBounds
+{
+	LocalBounds();
+
+	float center[3];    // of the sphere
+	float radius;
+	float boxCenter[3]; // of the axis aligned box
+	float pad0;
+	float boxExtent[3]; // half the box's size along each axis
+	float pad1;
+};
+
+//A mesh's bounds placed in the world by its world matrix
+struct WorldBounds
+{
+	float center[3];     // of the sphere
+	float radius;
+	float boxMin[3];     // the axis aligned box around the oriented one
+	float pad0;
+	float boxMax[3];
+	float pad1;
+	float obbAxes[3][4]; // the local box's half extents along its own axes, turned into the world (w unused)
+};
+
+/*Carries local bounds into the world: the sphere's centre goes through the
+whole matrix and its radius grows by the largest scale; the box's centre is
+the oriented box's centre, its three half extents turned by the matrix are the
+oriented box's axes, and the axis aligned box is what holds those (Arvo,
+"Transforming Axis-Aligned Bounding Boxes", Graphics Gems, 1990).
+
+Matrices are row major, D3D's layout. PlaceAll does four meshes at a time
+with SSE2 and gives the same bits as Place.*/
+class Bounds
+{
+public:
+	static void Place(const LocalBounds& local, const float* world, WorldBounds* out);
+	static void PlaceAll(const LocalBounds* const* locals, const float* const* worlds, WorldBounds* const* out,
+		size_t count);
+};
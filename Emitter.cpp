@@ -0,0 +1,116 @@
+#include "Emitter.h"
+/*Emitter descriptions and the registry of emitters by name*/
+
+EmitterDesc::EmitterDesc()
+	: _origin(0.0f, 0.0f, 0.0f)
+	, _numParticles(1000)
+	, _emitRate(500.0f)
+	, _size(0.25f)
+	, _velocityMin(0.0f, 0.0f, 0.0f)
+	, _velocityMax(0.0f, 0.0f, 0.0f)
+	, _speedMin(0.0f)
+	, _speedMax(0.0f)
+	, _spread(0.0f)
+	, _gravity(0.0f, -9.8f, 0.0f)
+	, _drag(0.0f)
+	, _lifeTimeMin(0.0f)
+	, _lifeTimeMax(0.0f)
+	, _startColor(1.0f, 1.0f, 1.0f, 1.0f)
+	, _endColor(1.0f, 1.0f, 1.0f, 1.0f)
+{
+	_boundingBox._min = D3DXVECTOR3(-10.0f, -10.0f, -10.0f);
+	_boundingBox._max = D3DXVECTOR3(10.0f, 10.0f, 10.0f);
+}
+
+/*The emitters that come with the engine, registered the first time the
+registry is used*/
+map<string, EmitterRegistry::Entry>& EmitterRegistry::Entries()
+{
+	static map<string, Entry> entries;
+	static bool registered = false;
+
+	if (!registered)
+	{
+		registered = true;
+
+		// falls and drifts left, like Snow
+		EmitterDesc snow;
+		snow._velocityMin = D3DXVECTOR3(-3.0f, -10.0f, 0.0f);
+		snow._velocityMax = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		Register("snow", Make<BoxTopSpawn, NoForce, ConstantColor>, snow);
+
+		EmitterDesc rain;
+		rain._size = 0.1f;
+		rain._velocityMin = D3DXVECTOR3(-0.5f, -20.0f, -0.5f);
+		rain._velocityMax = D3DXVECTOR3(0.5f, -15.0f, 0.5f);
+		rain._gravity = D3DXVECTOR3(0.0f, -9.8f, 0.0f);
+		rain._drag = 0.5f;
+		rain._startColor = D3DXCOLOR(0.6f, 0.6f, 0.8f, 1.0f);
+		Register("rain", Make<BoxTopSpawn, DragForce, ConstantColor>, rain);
+
+		// hangs in the air and fades away
+		EmitterDesc dust;
+		dust._velocityMin = D3DXVECTOR3(-0.2f, -0.2f, -0.2f);
+		dust._velocityMax = D3DXVECTOR3(0.2f, 0.2f, 0.2f);
+		dust._gravity = D3DXVECTOR3(0.0f, -0.1f, 0.0f);
+		dust._drag = 0.5f;
+		dust._lifeTimeMin = 2.0f;
+		dust._lifeTimeMax = 5.0f;
+		dust._startColor = D3DXCOLOR(0.8f, 0.7f, 0.5f, 1.0f);
+		dust._endColor = D3DXCOLOR(0.8f, 0.7f, 0.5f, 0.0f);
+		Register("dust", Make<BoxSpawn, DragForce, FadeColor>, dust);
+
+		EmitterDesc fountain;
+		fountain._origin = D3DXVECTOR3(0.0f, -10.0f, 0.0f);
+		fountain._speedMin = 10.0f;
+		fountain._speedMax = 14.0f;
+		fountain._spread = 0.2f;
+		fountain._lifeTimeMin = 1.5f;
+		fountain._lifeTimeMax = 2.5f;
+		fountain._startColor = D3DXCOLOR(0.7f, 0.8f, 1.0f, 1.0f);
+		fountain._endColor = D3DXCOLOR(0.2f, 0.3f, 1.0f, 0.0f);
+		Register("fountain", Make<PointSpawn, GravityForce, FadeColor>, fountain);
+	}
+
+	return entries;
+}
+
+/*Adds or replaces the emitter called name*/
+void EmitterRegistry::Register(const string& name, Factory factory, const EmitterDesc& defaults)
+{
+	Entry entry;
+	entry.factory = factory;
+	entry.defaults = defaults;
+	Entries()[name] = entry;
+}
+
+PSystem* EmitterRegistry::Create(const string& name, unsigned int seed)
+{
+	map<string, Entry>& entries = Entries();
+	map<string, Entry>::iterator it = entries.find(name);
+	if (it == entries.end())
+		return 0;
+
+	return it->second.factory(it->second.defaults, seed);
+}
+
+PSystem* EmitterRegistry::Create(const string& name, const EmitterDesc& desc, unsigned int seed)
+{
+	map<string, Entry>& entries = Entries();
+	map<string, Entry>::iterator it = entries.find(name);
+	if (it == entries.end())
+		return 0;
+
+	return it->second.factory(desc, seed);
+}
+
+bool EmitterRegistry::Defaults(const string& name, EmitterDesc* desc)
+{
+	map<string, Entry>& entries = Entries();
+	map<string, Entry>::iterator it = entries.find(name);
+	if (it == entries.end())
+		return false;
+
+	*desc = it->second.defaults;
+	return true;
+}
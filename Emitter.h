@@ -0,0 +1,305 @@
+#pragma once
+
+#include "PSystem.h"
+#include <math.h>
+#include <string>
+#include <map>
+
+//Everything the emitter policies read, one per emitter
+struct EmitterDesc
+{
+	EmitterDesc();
+
+	BoundingBox _boundingBox;    // particles that leave it are respawned
+	D3DXVECTOR3 _origin;         // where PointSpawn emits from
+	int         _numParticles;
+	float       _emitRate;       // particles per second once a budget is set
+	float       _size;
+
+	D3DXVECTOR3 _velocityMin;    // BoxSpawn and BoxTopSpawn velocity range
+	D3DXVECTOR3 _velocityMax;
+	float       _speedMin;       // PointSpawn speed range
+	float       _speedMax;
+	float       _spread;         // PointSpawn cone half angle around +y, in radians
+
+	D3DXVECTOR3 _gravity;
+	float       _drag;           // fraction of the velocity lost per second
+
+	float       _lifeTimeMin;    // 0 and 0 means particles live until they leave the box
+	float       _lifeTimeMax;
+
+	D3DXCOLOR   _startColor;
+	D3DXCOLOR   _endColor;
+};
+
+/*Emitter policies. Each is a struct of static inline functions, so the
+Emitter that is built from them has no calls left in its update loop.
+
+Spawn:  static void Spawn(const EmitterDesc&, RandomStream&, D3DXVECTOR3* position, D3DXVECTOR3* velocity)
+Force:  static void Apply(const EmitterDesc&, float& vx, float& vy, float& vz, float timeDelta)
+Colour: static D3DCOLOR Color(const EmitterDesc&, float age, float lifeTime)*/
+
+//Anywhere along the top of the box, falling (snow, rain)
+struct BoxTopSpawn
+{
+	static void Spawn(const EmitterDesc& d, RandomStream& rng, D3DXVECTOR3* position, D3DXVECTOR3* velocity)
+	{
+		position->x = rng.GetFloat(d._boundingBox._min.x, d._boundingBox._max.x);
+		position->y = d._boundingBox._max.y;
+		position->z = rng.GetFloat(d._boundingBox._min.z, d._boundingBox._max.z);
+		rng.GetVector(velocity, &d._velocityMin, &d._velocityMax);
+	}
+};
+
+//Anywhere in the box (dust, fireflies)
+struct BoxSpawn
+{
+	static void Spawn(const EmitterDesc& d, RandomStream& rng, D3DXVECTOR3* position, D3DXVECTOR3* velocity)
+	{
+		rng.GetVector(position, &d._boundingBox._min, &d._boundingBox._max);
+		rng.GetVector(velocity, &d._velocityMin, &d._velocityMax);
+	}
+};
+
+//From the origin, in a cone around +y (fountains, sparks)
+struct PointSpawn
+{
+	static void Spawn(const EmitterDesc& d, RandomStream& rng, D3DXVECTOR3* position, D3DXVECTOR3* velocity)
+	{
+		*position = d._origin;
+
+		// uniform over the cap of the cone
+		float theta = rng.GetFloat(0.0f, 2.0f * D3DX_PI);
+		float cosPhi = rng.GetFloat(cosf(d._spread), 1.0f);
+		float sinPhi = sqrtf(1.0f - cosPhi * cosPhi);
+		float speed = rng.GetFloat(d._speedMin, d._speedMax);
+
+		velocity->x = sinPhi * cosf(theta) * speed;
+		velocity->y = cosPhi * speed;
+		velocity->z = sinPhi * sinf(theta) * speed;
+	}
+};
+
+struct NoForce
+{
+	static void Apply(const EmitterDesc& d, float& vx, float& vy, float& vz, float timeDelta)
+	{
+	}
+};
+
+struct GravityForce
+{
+	static void Apply(const EmitterDesc& d, float& vx, float& vy, float& vz, float timeDelta)
+	{
+		vx += d._gravity.x * timeDelta;
+		vy += d._gravity.y * timeDelta;
+		vz += d._gravity.z * timeDelta;
+	}
+};
+
+//Gravity with air resistance, particles drift towards a terminal velocity
+struct DragForce
+{
+	static void Apply(const EmitterDesc& d, float& vx, float& vy, float& vz, float timeDelta)
+	{
+		float keep = 1.0f - d._drag * timeDelta;
+		vx = (vx + d._gravity.x * timeDelta) * keep;
+		vy = (vy + d._gravity.y * timeDelta) * keep;
+		vz = (vz + d._gravity.z * timeDelta) * keep;
+	}
+};
+
+struct ConstantColor
+{
+	static D3DCOLOR Color(const EmitterDesc& d, float age, float lifeTime)
+	{
+		return (D3DCOLOR)d._startColor;
+	}
+};
+
+//From the start colour at birth to the end colour at death
+struct FadeColor
+{
+	static D3DCOLOR Color(const EmitterDesc& d, float age, float lifeTime)
+	{
+		float t = lifeTime > 0.0f ? age / lifeTime : 0.0f;
+		if (t > 1.0f)
+			t = 1.0f;
+
+		D3DXCOLOR c = d._startColor + (d._endColor - d._startColor) * t;
+		return (D3DCOLOR)c;
+	}
+};
+
+/*A particle system put together from a spawn, a force and a colour policy.
+
+Each update runs one loop per chunk with every policy inlined into it, and
+respawning goes through respawnParticles, so no virtual call is made per
+particle. resetParticle is only used by addParticle when emitting.*/
+template<class SpawnPolicy, class ForcePolicy, class ColorPolicy>
+class Emitter : public PSystem
+{
+public:
+	Emitter(const EmitterDesc& desc, unsigned int seed = 1)
+		: _desc(desc)
+	{
+		_boundingBox = desc._boundingBox;
+		_origin = desc._origin;
+		_size = desc._size;
+		_vbSize = 2048;
+		_maxParticles = desc._numParticles;
+		_emitRate = desc._emitRate;
+
+		this->seed(seed);
+
+		_particles.reserve(desc._numParticles);
+		for (int i = 0; i < desc._numParticles; i++)
+		{
+			addParticle();
+		}
+	}
+
+	const EmitterDesc& desc() const { return _desc; }
+
+	void resetParticle(Attribute* attribute, RandomStream& rng)
+	{
+		SpawnPolicy::Spawn(_desc, rng, &attribute->_position, &attribute->_velocity);
+		attribute->_acceleration = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		attribute->_lifeTime = lifeTime(rng);
+		attribute->_age = 0.0f;
+		attribute->_color = D3DXCOLOR(ColorPolicy::Color(_desc, 0.0f, attribute->_lifeTime));
+		attribute->_colorFade = D3DXCOLOR(0.0f, 0.0f, 0.0f, 0.0f);
+		attribute->_isAlive = true;
+	}
+
+	void update(float timeDelta)
+	{
+		updateChunks(timeDelta);
+	}
+
+protected:
+	void updateChunk(int first, int count, float timeDelta, RandomStream& rng)
+	{
+		float* px = _particles._posX + first;
+		float* py = _particles._posY + first;
+		float* pz = _particles._posZ + first;
+		float* vx = _particles._velX + first;
+		float* vy = _particles._velY + first;
+		float* vz = _particles._velZ + first;
+		float* age = _particles._age + first;
+		const float* lifeTime = _particles._lifeTime + first;
+		D3DCOLOR* color = _particles._color + first;
+
+		// a copy the stores to the particle arrays can't touch, so it stays in registers
+		const EmitterDesc desc = _desc;
+		float minX = desc._boundingBox._min.x, minY = desc._boundingBox._min.y, minZ = desc._boundingBox._min.z;
+		float maxX = desc._boundingBox._max.x, maxY = desc._boundingBox._max.y, maxZ = desc._boundingBox._max.z;
+
+		// this chunk's share of the respawn list starts at the same index as its particles
+		int* dead = &_respawn[first];
+		int numDead = 0;
+
+		for (int i = 0; i < count; i++)
+		{
+			// work on locals, the arrays may alias as far as the compiler knows
+			float x = px[i], y = py[i], z = pz[i];
+			float velX = vx[i], velY = vy[i], velZ = vz[i];
+			float a = age[i] + timeDelta;
+			float life = lifeTime[i];
+
+			ForcePolicy::Apply(desc, velX, velY, velZ, timeDelta);
+
+			x += velX * timeDelta;
+			y += velY * timeDelta;
+			z += velZ * timeDelta;
+
+			px[i] = x;
+			py[i] = y;
+			pz[i] = z;
+			vx[i] = velX;
+			vy[i] = velY;
+			vz[i] = velZ;
+			age[i] = a;
+			color[i] = ColorPolicy::Color(desc, a, life);
+
+			int outside = (x < minX) | (y < minY) | (z < minZ) | (x > maxX) | (y > maxY) | (z > maxZ);
+			int old = (life > 0.0f) & (a > life);
+
+			dead[numDead] = first + i;
+			numDead += outside | old;
+		}
+
+		Emitter::respawnParticles(dead, numDead, rng);
+
+		if (_collision)
+		{
+			int numKilled = _collision->collide(px, py, pz, vx, vy, vz, count, first, dead);
+			Emitter::respawnParticles(dead, numKilled, rng);
+		}
+	}
+
+	void respawnParticles(const int* indices, int count, RandomStream& rng)
+	{
+		for (int k = 0; k < count; k++)
+		{
+			int i = indices[k];
+
+			D3DXVECTOR3 position, velocity;
+			SpawnPolicy::Spawn(_desc, rng, &position, &velocity);
+			float life = lifeTime(rng);
+
+			_particles._posX[i] = position.x;
+			_particles._posY[i] = position.y;
+			_particles._posZ[i] = position.z;
+			_particles._velX[i] = velocity.x;
+			_particles._velY[i] = velocity.y;
+			_particles._velZ[i] = velocity.z;
+			_particles._lifeTime[i] = life;
+			_particles._age[i] = 0.0f;
+			_particles._color[i] = ColorPolicy::Color(_desc, 0.0f, life);
+		}
+	}
+
+	float lifeTime(RandomStream& rng)
+	{
+		if (_desc._lifeTimeMax <= 0.0f)
+			return 0.0f;
+		return rng.GetFloat(_desc._lifeTimeMin, _desc._lifeTimeMax);
+	}
+
+	EmitterDesc _desc;
+};
+
+/*Emitters by name, so effects can be picked from data at runtime. Each entry
+makes one specialisation of Emitter; the built in ones are "snow", "rain",
+"dust" and "fountain".*/
+class EmitterRegistry
+{
+public:
+	typedef PSystem* (*Factory)(const EmitterDesc& desc, unsigned int seed);
+
+	// Makes the Factory for one set of policies
+	template<class SpawnPolicy, class ForcePolicy, class ColorPolicy>
+	static PSystem* Make(const EmitterDesc& desc, unsigned int seed)
+	{
+		return new Emitter<SpawnPolicy, ForcePolicy, ColorPolicy>(desc, seed);
+	}
+
+	static void Register(const string& name, Factory factory, const EmitterDesc& defaults);
+
+	// Returns 0 for a name that was never registered.
+	static PSystem* Create(const string& name, unsigned int seed = 1);
+	static PSystem* Create(const string& name, const EmitterDesc& desc, unsigned int seed = 1);
+
+	// The desc an emitter is made with when none is given.
+	static bool Defaults(const string& name, EmitterDesc* desc);
+
+private:
+	struct Entry
+	{
+		Factory factory;
+		EmitterDesc defaults;
+	};
+
+	static map<string, Entry>& Entries();
+};
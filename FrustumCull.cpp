@@ -0,0 +1,176 @@
+#include <intrin.h>
+#include <immintrin.h>
+#include "FrustumCull.h"
+#include "ParticleSimd.h"
+#include "Meshlets.h"
+/*Sphere vs frustum culling, scalar, SSE2 and AVX*/
+
+namespace
+{
+	typedef int(*CullFn)(const float*, const float*, const float*, const float*, int, const float*, int*);
+
+	// Every level takes a sphere's distance from a plane as ((a x + b y) + c z) + d
+	// and keeps it while that is at least -radius, so they agree to the bit
+	int CullScalar(const float* x, const float* y, const float* z, const float* radius, int count,
+		const float* planes, int* visible)
+	{
+		int numVisible = 0;
+		for (int i = 0; i < count; i++)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				const float* plane = &planes[p * 4];
+				float distance = plane[0] * x[i] + plane[1] * y[i] + plane[2] * z[i] + plane[3];
+				inside = distance >= -radius[i];
+			}
+			if (inside)
+				visible[numVisible++] = i;
+		}
+		return numVisible;
+	}
+
+	int CullSSE2(const float* x, const float* y, const float* z, const float* radius, int count,
+		const float* planes, int* visible)
+	{
+		__m128 a[6], b[6], c[6], d[6];
+		for (int p = 0; p < 6; p++)
+		{
+			a[p] = _mm_set1_ps(planes[p * 4]);
+			b[p] = _mm_set1_ps(planes[p * 4 + 1]);
+			c[p] = _mm_set1_ps(planes[p * 4 + 2]);
+			d[p] = _mm_set1_ps(planes[p * 4 + 3]);
+		}
+		const __m128 zero = _mm_setzero_ps();
+
+		int numVisible = 0;
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 sx = _mm_loadu_ps(x + i), sy = _mm_loadu_ps(y + i), sz = _mm_loadu_ps(z + i);
+			__m128 below = _mm_sub_ps(zero, _mm_loadu_ps(radius + i));
+
+			// ordered compares, so a NaN sphere is culled like the scalar test culls it
+			__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], sx), _mm_mul_ps(b[0], sy)),
+				_mm_mul_ps(c[0], sz)), d[0]), below);
+			for (int p = 1; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a[p], sx), _mm_mul_ps(b[p], sy)),
+					_mm_mul_ps(c[p], sz)), d[p]);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, below));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			while (mask)
+			{
+				unsigned long lane;
+				_BitScanForward(&lane, mask);
+				visible[numVisible++] = i + lane;
+				mask &= mask - 1;
+			}
+		}
+
+		int rest = CullScalar(x + i, y + i, z + i, radius + i, count - i, planes, visible + numVisible);
+		for (int k = 0; k < rest; k++)
+			visible[numVisible + k] += i;
+		return numVisible + rest;
+	}
+
+	int CullAVX(const float* x, const float* y, const float* z, const float* radius, int count,
+		const float* planes, int* visible)
+	{
+		__m256 a[6], b[6], c[6], d[6];
+		for (int p = 0; p < 6; p++)
+		{
+			a[p] = _mm256_set1_ps(planes[p * 4]);
+			b[p] = _mm256_set1_ps(planes[p * 4 + 1]);
+			c[p] = _mm256_set1_ps(planes[p * 4 + 2]);
+			d[p] = _mm256_set1_ps(planes[p * 4 + 3]);
+		}
+		const __m256 zero = _mm256_setzero_ps();
+
+		int numVisible = 0;
+		int i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 sx = _mm256_loadu_ps(x + i), sy = _mm256_loadu_ps(y + i), sz = _mm256_loadu_ps(z + i);
+			__m256 below = _mm256_sub_ps(zero, _mm256_loadu_ps(radius + i));
+
+			__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[0], sx),
+				_mm256_mul_ps(b[0], sy)), _mm256_mul_ps(c[0], sz)), d[0]), below, _CMP_GE_OQ);
+			for (int p = 1; p < 6; p++)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[p], sx),
+					_mm256_mul_ps(b[p], sy)), _mm256_mul_ps(c[p], sz)), d[p]);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, below, _CMP_GE_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(inside);
+			while (mask)
+			{
+				unsigned long lane;
+				_BitScanForward(&lane, mask);
+				visible[numVisible++] = i + lane;
+				mask &= mask - 1;
+			}
+		}
+
+		int rest = CullSSE2(x + i, y + i, z + i, radius + i, count - i, planes, visible + numVisible);
+		for (int k = 0; k < rest; k++)
+			visible[numVisible + k] += i;
+		return numVisible + rest;
+	}
+}
+
+FrustumCull::FrustumCull()
+{
+	// until a camera is set nothing is culled
+	for (int k = 0; k < 24; k++)
+		_planes[k] = 0.0f;
+}
+
+void FrustumCull::clear()
+{
+	_x.clear();
+	_y.clear();
+	_z.clear();
+	_radius.clear();
+	_visible.clear();
+}
+
+void FrustumCull::addSphere(const D3DXVECTOR3& center, float radius)
+{
+	_x.push_back(center.x);
+	_y.push_back(center.y);
+	_z.push_back(center.z);
+	_radius.push_back(radius);
+}
+
+void FrustumCull::setViewProjection(const D3DXMATRIX& viewProjection)
+{
+	Meshlets::FrustumPlanes((const float*)&viewProjection, _planes);
+}
+
+int FrustumCull::cull()
+{
+	int count = numSpheres();
+	_visible.resize(count);
+	if (count == 0)
+		return 0;
+
+	_visible.resize(CullSpheres(&_x[0], &_y[0], &_z[0], &_radius[0], count, _planes, &_visible[0]));
+	return (int)_visible.size();
+}
+
+int FrustumCull::CullSpheres(const float* x, const float* y, const float* z, const float* radius, int count,
+	const float* planes, int* visible)
+{
+	CullFn cull = CullScalar;
+	switch (ParticleSimd::GetLevel())
+	{
+	case SIMD_AVX:  cull = CullAVX;  break;
+	case SIMD_SSE2: cull = CullSSE2; break;
+	default:        break;
+	}
+	return cull(x, y, z, radius, count, planes, visible);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "basics.h"
+#include <vector>
+
+/*Culls bounding spheres against the view frustum, so only what can be seen
+is submitted.
+
+The spheres are kept a component per array, so the kernels test four (SSE2)
+or eight (AVX) of them against a plane at once; the level is whatever
+ParticleSimd runs at, and every level gives the same result. The planes are
+pulled out of the view * projection once per frame (Meshlets::FrustumPlanes).
+
+The spheres move with what they bound, so the owner clears, re-adds and culls
+them every frame.*/
+class FrustumCull
+{
+public:
+	FrustumCull();
+
+	void clear();
+	// Spheres are numbered in the order they are added, from 0
+	void addSphere(const D3DXVECTOR3& center, float radius);
+	void setViewProjection(const D3DXMATRIX& viewProjection);
+
+	// Lists the spheres at least partly inside all six planes, in
+	// increasing order, and returns how many there are.
+	int cull();
+	const std::vector<int>& visible() const { return _visible; }
+	int numSpheres() const { return (int)_radius.size(); }
+
+	// The kernel cull() runs: writes the index of each of count spheres that
+	// no plane (a, b, c, d, unit normal pointing in) has wholly behind it to
+	// visible, in increasing order. Returns the number written.
+	static int CullSpheres(const float* x, const float* y, const float* z, const float* radius, int count,
+		const float* planes, int* visible);
+
+private:
+	std::vector<float> _x;
+	std::vector<float> _y;
+	std::vector<float> _z;
+	std::vector<float> _radius;
+	float _planes[24];
+
+	std::vector<int> _visible;
+};
@@ -18,6 +18,19 @@ Game::Game()
 	models = new Model*[numModels];
 
 	letItSnow = false;
+
+	useLods = true;
+	trianglesDrawn = 0;
+	useMeshlets = true;
+
+	loader = 0;
+	placeholder = 0;
+	initTime = 0.0;
+	firstFrameShown = false;
+	loadReported = false;
+
+	lastTime = 0.0;
+	accumulator = 0.0;
 }
 
 /*This is the destructor for Game
@@ -25,6 +38,11 @@ Called during the shutdown function
 Deallocates memory used in the game*/
 Game::~Game()
 {
+	//Stop the loader first, its jobs point at the models
+	delete loader;
+	if (placeholder)
+		placeholder->Release();
+
 	delete fc;
 
 	delete tiger;
@@ -33,14 +51,20 @@ Game::~Game()
 	delete drone;
 
 	delete[] models;
+	delete modelCull;
+	delete scene;
 
 	delete light;
 	delete pointlight;
 	delete spotlight;
 
+	delete particleBudget;
 	delete snow;
+	delete sceneCollision;
 
 	delete mirror;
+
+	delete stream;
 }
 
 //FAILED is a macro that returns false if return value is a failure - safer than using value itself
@@ -55,6 +79,7 @@ g_HwndMain - is the handle to the game window
 int Game::Init(HWND g_hWndMain)
 {
 	HRESULT r = 0;//return values
+	initTime = Utility::GetTime();
 
 	//fps
 	//GetWindowRect(g_hWndMain, &rect);
@@ -86,6 +111,7 @@ int Game::Init(HWND g_hWndMain)
 	fc = new FrameCounter(g_pDevice);
 	//fc->displayFPS(&rect);
 	fc->startTimer();
+	lastTime = Utility::GetTime();
 
 	//Models
 	tiger = new Model("tiger2.x");
@@ -96,11 +122,18 @@ int Game::Init(HWND g_hWndMain)
 	models[2] = globe;
 	drone = new Model("EvilDrone.x");
 	models[3] = drone;
-
+	modelBounds.resize(numModels);
+	Model::UpdateWorlds(models, numModels, &modelBounds[0]);
+	modelCull = new FrustumCull();
+	scene = new SceneBvh();
+
+	//The models load in the background and are drawn as placeholders until
+	//they arrive, so the first frame doesn't wait for any of them
+	loader = new AssetLoader(ASSET_THREADS);
+	D3DXCreateSphere(g_pDevice, 1.0f, 16, 8, &placeholder, 0);
 	for (int i = 0; i < numModels; i++)
 	{
-		models[i]->InitGeometry(g_pDevice);
-		models[i]->CreateBSphere();
+		models[i]->LoadAsync(loader, g_pDevice);
 	}
 
 	//Lights
@@ -111,9 +144,46 @@ int Game::Init(HWND g_hWndMain)
 	spotlight = new SpotLight();
 	spotlight->InitLight(g_pDevice);
 
+	//Transient vertices, 1MB is 64k particles per lock
+	stream = new VertexStream(new D3DVertexStreamBackend(g_pDevice), 1 << 20);
+
 	//Particles
 	snow = new Snow(2000);
-	snow->init(g_pDevice, "snowflake.dds");
+	snow->init(g_pDevice, 0, stream);
+	Snow* flakes = snow;
+	loader->load<std::shared_ptr<vector<char> > >(
+		[]()
+		{
+			std::shared_ptr<vector<char> > data(new vector<char>());
+			AssetLoader::ReadFile("snowflake.dds", data.get());
+			return data;
+		},
+		[this, flakes](const std::shared_ptr<vector<char> >& data)
+		{
+			LPDIRECT3DTEXTURE9 tex = 0;
+			if (!data->empty() &&
+				SUCCEEDED(D3DXCreateTextureFromFileInMemory(g_pDevice, &(*data)[0], (UINT)data->size(), &tex)))
+			{
+				flakes->setTexture(tex);
+			}
+			else
+			{
+				Utility::SetError("Could not load snowflake.dds");
+			}
+		});
+	snow->setSortMode(true);
+
+	//Snow that lands on a model melts and falls again
+	sceneCollision = new ParticleCollision();
+	snow->setCollision(sceneCollision);
+
+	//Every particle system shares 4ms of the frame
+	particleBudget = new ParticleBudget(4.0f);
+	particleBudget->add(snow, 1.0f);
+
+	//The camera, which Simulate reads for the particles before the first
+	//frame sets it up again
+	models[0]->SetupMatrices(g_pDevice);
 
 	//Mirrors
 	//mirror = new Mirror();
@@ -132,63 +202,41 @@ Also listens for:
 int Game::Loop()
 {
 	fc->incFPS();
-	Render();
-	//Quit
-	if (GetAsyncKeyState(VK_ESCAPE))
-	{
-		PostQuitMessage(0);
-	}
 
-	//Translations
-	if (GetAsyncKeyState(0x57)) // w key - forward
-	{
-		models[modI]->moveForward(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x41)) // a key - right
-	{
-		models[modI]->moveLeft(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x53)) // s key - back
-	{
-		models[modI]->moveBack(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x44)) // d key - left
-	{
-		models[modI]->moveRight(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x45)) // e key - up
-	{
-		models[modI]->moveUp(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x51)) // q key - down
-	{
-		models[modI]->moveDown(g_pDevice);
-	}
+	//Put whatever the loader has finished on the device
+	loader->pump(ASSET_CREATE_TIME);
 
-	//Rotations
-	if (GetAsyncKeyState(0x55)) // u key - rotate X pos
-	{
-		models[modI]->rotateXpos(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x49)) // i key - rotate Y pos
-	{
-		models[modI]->rotateYpos(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x4F)) // o key - rotate Z pos
-	{
-		models[modI]->rotateZpos(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x4A)) // j key - rotate X neg
-	{
-		models[modI]->rotateXneg(g_pDevice);
-	}
-	if (GetAsyncKeyState(0x4B)) // k key - rotate Y neg
+	//Fixed timestep: bank the real time that passed and simulate it in SIM_STEP pieces
+	double now = Utility::GetTime();
+	double frameTime = now - lastTime;
+	lastTime = now;
+
+	//After a stall (breakpoint, window drag) don't try to catch up on all of it
+	if (frameTime > MAX_FRAME_TIME)
+		frameTime = MAX_FRAME_TIME;
+	accumulator += frameTime;
+
+	int steps = 0;
+	while (accumulator >= SIM_STEP && steps < MAX_SIM_STEPS)
 	{
-		models[modI]->rotateYneg(g_pDevice);
+		Simulate((float)SIM_STEP);
+		accumulator -= SIM_STEP;
+		steps++;
 	}
-	if (GetAsyncKeyState(0x4C)) // l key - rotate Z neg
+
+	//Still behind after the most steps we allow a frame, drop the rest
+	//rather than spiral into ever longer frames
+	if (steps == MAX_SIM_STEPS && accumulator >= SIM_STEP)
+		accumulator = 0.0;
+
+	//How far between the last two simulation states this frame falls
+	Render((float)(accumulator / SIM_STEP));
+	ReportLoading();
+
+	//Quit
+	if (GetAsyncKeyState(VK_ESCAPE))
 	{
-		models[modI]->rotateZneg(g_pDevice);
+		PostQuitMessage(0);
 	}
 
 	//Switch between models
@@ -253,13 +301,162 @@ int Game::Loop()
 		letItSnow = false;
 	}
 
+	//Levels of detail, with the triangles the models took before the switch
+	if (GetAsyncKeyState(VK_F11) && !useLods) // f11 - Turn on levels of detail
+	{
+		useLods = true;
+		cout << "Levels of detail on, " << trianglesDrawn << " triangles last frame" << endl;
+	}
+	if (GetAsyncKeyState(VK_F12) && useLods) // f12 - Turn off levels of detail
+	{
+		useLods = false;
+		cout << "Levels of detail off, " << trianglesDrawn << " triangles last frame" << endl;
+	}
+
+	//Meshlet culling, with how much it took out last frame
+	if (GetAsyncKeyState(0x4D) && !useMeshlets) // m key - Turn on meshlet culling
+	{
+		useMeshlets = true;
+		cout << "Meshlet culling on, " << trianglesDrawn << " triangles last frame" << endl;
+	}
+	if (GetAsyncKeyState(0x4E) && useMeshlets) // n key - Turn off meshlet culling
+	{
+		useMeshlets = false;
+		cout << "Meshlet culling off, " << meshletStats.trianglesCulled << " of " << meshletStats.triangles
+			<< " triangles culled last frame (" << meshletStats.outside << " meshlets outside, "
+			<< meshletStats.backFacing << " facing away, of " << meshletStats.meshlets << ")" << endl;
+	}
+
 	return S_OK;
 }
 
+/*Advances the game by one fixed step: held movement keys and particles.
+
+timeDelta - the length of the step in seconds, always SIM_STEP
+*/
+void Game::Simulate(float timeDelta)
+{
+	//Keep where everything was so Render can blend towards where it is now
+	for (int i = 0; i < numModels; i++)
+	{
+		models[i]->SaveState();
+	}
+
+	//Translations
+	if (GetAsyncKeyState(0x57)) // w key - forward
+	{
+		models[modI]->moveForward(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x41)) // a key - right
+	{
+		models[modI]->moveLeft(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x53)) // s key - back
+	{
+		models[modI]->moveBack(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x44)) // d key - left
+	{
+		models[modI]->moveRight(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x45)) // e key - up
+	{
+		models[modI]->moveUp(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x51)) // q key - down
+	{
+		models[modI]->moveDown(g_pDevice);
+	}
+
+	//Rotations
+	if (GetAsyncKeyState(0x55)) // u key - rotate X pos
+	{
+		models[modI]->rotateXpos(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x49)) // i key - rotate Y pos
+	{
+		models[modI]->rotateYpos(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x4F)) // o key - rotate Z pos
+	{
+		models[modI]->rotateZpos(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x4A)) // j key - rotate X neg
+	{
+		models[modI]->rotateXneg(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x4B)) // k key - rotate Y neg
+	{
+		models[modI]->rotateYneg(g_pDevice);
+	}
+	if (GetAsyncKeyState(0x4C)) // l key - rotate Z neg
+	{
+		models[modI]->rotateZneg(g_pDevice);
+	}
+
+	//Rebuild the world matrices and bounds of the models that moved, in one
+	//pass, and the picking BVH over them if any did
+	if (Model::UpdateWorlds(models, numModels, &modelBounds[0]) > 0)
+		BuildScene();
+
+	//Update Snow
+	if (letItSnow)
+	{
+		// the camera sits where the inverse view puts the origin
+		D3DXMATRIX view, viewInverse;
+		g_pDevice->GetTransform(D3DTS_VIEW, &view);
+		D3DXMatrixInverse(&viewInverse, 0, &view);
+		particleBudget->setCamera(D3DXVECTOR3(viewInverse._41, viewInverse._42, viewInverse._43));
+
+		// the models may have moved this step
+		sceneCollision->clear();
+		for (int i = 0; i < numModels; i++)
+		{
+			if (!models[i]->IsLoaded())
+				continue;
+
+			const WorldBounds& bounds = modelBounds[i];
+			D3DXVECTOR3 center(bounds.center[0], bounds.center[1], bounds.center[2]);
+			sceneCollision->addSphere(center, bounds.radius);
+		}
+		sceneCollision->build();
+
+		particleBudget->update(timeDelta);
+	}
+}
+
+/*Reports how long after Init the first frame was shown, and how long after
+it every asset was on the device along with how much the texture cache
+shared, once each
+*/
+void Game::ReportLoading()
+{
+	double elapsed = (Utility::GetTime() - initTime) * 1000.0;
+
+	if (!firstFrameShown)
+	{
+		firstFrameShown = true;
+		cout << "First frame after " << elapsed << "ms, " << loader->pending() << " assets still loading" << endl;
+	}
+
+	if (!loadReported && loader->pending() == 0)
+	{
+		loadReported = true;
+		cout << "All assets loaded after " << elapsed << "ms" << endl;
+
+		TextureCache::Stats stats = TextureCache::GetStats();
+		cout << "Textures: " << stats.textures << " shared by the models, " << stats.hits << " hits, "
+			<< stats.misses << " misses, " << stats.bytesSaved << " bytes not loaded again" << endl;
+	}
+}
+
 /*Releases the devices and memory that are being use to create/run the game
 */
 int Game::Shutdown()
 {
+	//Models may outlive the device, their textures can't
+	TextureCache::Clear();
+
 	//release resources. First display adapter because COM object created it, then COM object
 	if (g_pDevice)
 		g_pDevice->Release();
@@ -272,8 +469,10 @@ int Game::Shutdown()
 
 /*Renders each frame by loading the neccessary surfaces for the background. 
 Also renders any models and lights that exist and displays the current FPS
+
+alpha - how far this frame is from the previous simulation step (0) to the latest one (1)
 */
-int Game::Render()
+int Game::Render(float alpha)
 {
 	HRESULT r;
 	D3DLOCKED_RECT LockedRect;			//locked area of display memory(buffer really) we are drawing to
@@ -286,10 +485,6 @@ int Game::Render()
 		return E_FAIL;
 	}
 
-	//Update Snow
-	if (letItSnow)
-		snow->update(0.1f);
-
 	//clear the display arera with colour black, ignore stencil buffer
 	//Need D3D ClearStencil
 	g_pDevice->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0, 0, 25), 1.0f, 0);
@@ -316,14 +511,42 @@ int Game::Render()
 
 	#pragma endregion
 
+	stream->beginFrame();
+
 	//FPS counter
 	g_pDevice->BeginScene();
 
-	//Render all models
+	//Cull the models against the camera, which every model sets up the same,
+	//allowing for how far each moves between the states it is drawn between
+	if (numModels > 0)
+		models[0]->SetupMatrices(g_pDevice);
+	D3DXMATRIX view, projection, viewProjection;
+	g_pDevice->GetTransform(D3DTS_VIEW, &view);
+	g_pDevice->GetTransform(D3DTS_PROJECTION, &projection);
+	D3DXMatrixMultiply(&viewProjection, &view, &projection);
+
+	modelCull->clear();
 	for (int i = 0; i < numModels; i++)
 	{
-		models[i]->SetupMatrices(g_pDevice);
-		models[i]->RenderModel(g_pDevice);
+		const WorldBounds& bounds = modelBounds[i];
+		D3DXVECTOR3 center(bounds.center[0], bounds.center[1], bounds.center[2]);
+		modelCull->addSphere(center, bounds.radius + models[i]->GetMotion());
+	}
+	modelCull->setViewProjection(viewProjection);
+	modelCull->cull();
+
+	//Render the models that are in view
+	trianglesDrawn = 0;
+	meshletStats = MeshletStats();
+	const vector<int>& visible = modelCull->visible();
+	for (size_t v = 0; v < visible.size(); v++)
+	{
+		Model* model = models[visible[v]];
+		model->SetupMatrices(g_pDevice);
+		if (model->IsLoaded())
+			trianglesDrawn += model->RenderModel(g_pDevice, alpha, useLods, useMeshlets, &meshletStats);
+		else
+			model->RenderPlaceholder(g_pDevice, placeholder, alpha);
 	}
 
 	//Render Mirrors
@@ -334,7 +557,7 @@ int Game::Render()
 	//mirror->TestMirror();
 
 	if (letItSnow)
-		snow->render();
+		particleBudget->render((1.0f - alpha) * (float)SIM_STEP);
 	
 	g_pDevice->EndScene();
 
@@ -478,6 +701,9 @@ int Game::LoadBitmapToSurface(string pathName, LPDIRECT3DSURFACE9* ppSurface, LP
 
 #pragma region Rays
 
+/*Picks the model under the clicked point: the one whose triangles the ray
+meets nearest, through the scene BVH. The hit is kept in picked
+*/
 void Game::GetRay(int x, int y)
 {
 	// compute the ray in view space given the clicked screen point
@@ -492,16 +718,63 @@ void Game::GetRay(int x, int y)
 
 	TransformRay(&ray, &viewInverse);
 
-	// test for a hit
+	//Set current model to be whatever was clicked on
+	RayHit hit;
+	if (scene->intersect((const float*)&ray._origin, (const float*)&ray._direction, &hit))
+	{
+		picked = hit;
+		modI = (int)hit.id;
+	}
+}
+
+/*Casts a ray through each of count screen points at once, for tools that
+ask about many (hover highlights, sight lines, placement sweeps), and puts
+the nearest hit of each in hits. Points next to each other on the screen
+make coherent rays; hits start from nothing
+
+coherence - whether each four points in a row are close together on the screen
+*/
+void Game::GetRays(const POINT* points, int count, RayHit* hits, RayCoherence coherence)
+{
+	D3DXMATRIX view;
+	g_pDevice->GetTransform(D3DTS_VIEW, &view);
+
+	D3DXMATRIX viewInverse;
+	D3DXMatrixInverse(&viewInverse, 0, &view);
+
+	vector<float> origins(count * 3), directions(count * 3);
+	for (int i = 0; i < count; i++)
+	{
+		Ray ray = CalcPickingRay(points[i].x, points[i].y);
+		TransformRay(&ray, &viewInverse);
+		origins[i * 3] = ray._origin.x;
+		origins[i * 3 + 1] = ray._origin.y;
+		origins[i * 3 + 2] = ray._origin.z;
+		directions[i * 3] = ray._direction.x;
+		directions[i * 3 + 1] = ray._direction.y;
+		directions[i * 3 + 2] = ray._direction.z;
+		hits[i] = RayHit();
+	}
+	if (count > 0)
+		scene->intersect(&origins[0], &directions[0], count, hits, coherence);
+}
+
+/*Rebuilds the scene BVH over the loaded models where they are now; each
+model's own BVH is reached through the inverse of its transform
+*/
+void Game::BuildScene()
+{
+	scene->clear();
 	for (int i = 0; i < numModels; i++)
 	{
-		//Set current model to be whatever was clicked on
-		if (RaySphereIntTest(&ray, models[i]->GetBSphere()))
-		{
-			modI = i;
-		}
-			//::MessageBox(0, "Hit!", "HIT", 0);
+		if (!models[i]->IsLoaded())
+			continue;
+
+		float inverse[16];
+		Transforms::InverseMatrix(models[i]->transform, inverse);
+		scene->add(i, models[i]->GetBvh(), modelBounds[i], inverse);
 	}
+	scene->build();
 }
 
 Ray Game::CalcPickingRay(int x, int y)
@@ -543,30 +816,4 @@ void Game::TransformRay(Ray* ray, D3DXMATRIX* T)
 	D3DXVec3Normalize(&ray->_direction, &ray->_direction);
 }
 
-bool Game::RaySphereIntTest(Ray* ray, BoundingSphere* sphere)
-{
-	D3DXVECTOR3 v = ray->_origin - sphere->_center;
-
-	float b = 2.0f * D3DXVec3Dot(&ray->_direction, &v);
-	float c = D3DXVec3Dot(&v, &v) - (sphere->_radius * sphere->_radius);
-
-	// find the discriminant
-	float discriminant = (b * b) - (4.0f * c);
-
-	// test for imaginary number
-	if (discriminant < 0.0f)
-		return false;
-
-	discriminant = sqrtf(discriminant);
-
-	float s0 = (-b + discriminant) / 2.0f;
-	float s1 = (-b - discriminant) / 2.0f;
-
-	// if a solution is >= 0, then we intersected the sphere
-	if (s0 >= 0.0f || s1 >= 0.0f)
-		return true;
-
-	return false;
-}
-
 #pragma endregion
@@ -8,12 +8,26 @@
 #include "PointLight.h"
 #include "SpotLight.h"
 #include "Snow.h"
+#include "ParticleBudget.h"
 #include "Mirror.h"
+#include "AssetLoader.h"
+#include "FrustumCull.h"
+#include "SceneBvh.h"
 
 #define GWND_WIDTH 500
 #define GWND_HEIGHT 500
 #define WINDOWED false
 
+//Simulation runs at a fixed 30Hz whatever the frame rate
+#define SIM_STEP (1.0 / 30.0)
+#define MAX_SIM_STEPS 5
+#define MAX_FRAME_TIME 0.25
+
+//Assets load on their own threads, and each frame gives up to 4ms to
+//putting the finished ones on the device
+#define ASSET_THREADS 2
+#define ASSET_CREATE_TIME 0.004
+
 struct Ray
 {
 	D3DXVECTOR3 _origin;
@@ -30,12 +44,15 @@ public:
 	int Loop();
 	int Shutdown();
 
-	int Render();
+	void Simulate(float timeDelta);
+	void ReportLoading();
+	int Render(float alpha);
 	void Draw(int Pitch, DWORD* pData);
 
 	int LoadBitmapToSurface(string pathName, LPDIRECT3DSURFACE9* ppSurface, LPDIRECT3DDEVICE9 pDevice);
 
 	void GetRay(int x, int y);
+	void GetRays(const POINT* points, int count, RayHit* hits, RayCoherence coherence = RAYS_COHERENT);
 
 
 private:
@@ -47,10 +64,14 @@ private:
 
 	Ray CalcPickingRay(int x, int y);
 	void TransformRay(Ray* ray, D3DXMATRIX* T);
-	bool RaySphereIntTest(Ray* ray, BoundingSphere* sphere);
+	void BuildScene();
 
 	//fps
 	FrameCounter* fc;
+
+	//Fixed timestep
+	double lastTime;
+	double accumulator; // real time not yet simulated, in seconds
 	//HWND hWnd;
 	RECT rect;
 
@@ -63,16 +84,40 @@ private:
 	Model** models;
 	int modI;
 	int numModels;
+	vector<WorldBounds> modelBounds; // per model, rebuilt when it moves
+	FrustumCull* modelCull;          // the models' spheres, re-added every frame
+	SceneBvh* scene;                 // the loaded models and their triangles, rebuilt when one moves
+	RayHit picked;                   // the nearest hit of the last click
+
+	//Loading
+	AssetLoader* loader;
+	LPD3DXMESH placeholder; // drawn for a model until it has loaded
+	double initTime;        // when Init started
+	bool firstFrameShown;
+	bool loadReported;
 
 	//Lights
 	Light* light;
 	PointLight* pointlight;
 	SpotLight* spotlight;
 
+	//Transient vertices, shared by everything that rebuilds geometry each frame
+	VertexStream* stream;
+
 	//Particles
 	Snow* snow;
+	ParticleBudget* particleBudget;
+	ParticleCollision* sceneCollision; // the models and floor, rebuilt every step
 	bool letItSnow;
 
+	//Levels of detail
+	bool useLods;
+	DWORD trianglesDrawn; // by the models, last frame
+
+	//Meshlet culling
+	bool useMeshlets;
+	MeshletStats meshletStats; // of the models, last frame
+
 	//Mirrors
 	Mirror* mirror;
 };
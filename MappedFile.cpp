@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+/*Memory mapped, read only files*/
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile()
+	: _data(0)
+	, _size(0)
+#ifdef _WIN32
+	, _file(INVALID_HANDLE_VALUE)
+	, _mapping(0)
+#else
+	, _fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+/*Maps the whole of path. An empty file opens with a null data() and size() 0.*/
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size))
+	{
+		close();
+		return false;
+	}
+
+	_size = (size_t)size.QuadPart;
+	if (_size == 0)
+		return true;
+
+	_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!_mapping)
+	{
+		close();
+		return false;
+	}
+
+	_data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!_data)
+	{
+		close();
+		return false;
+	}
+#else
+	_fd = ::open(path.c_str(), O_RDONLY);
+	if (_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(_fd, &st) != 0)
+	{
+		close();
+		return false;
+	}
+
+	_size = (size_t)st.st_size;
+	if (_size == 0)
+		return true;
+
+	void* p = mmap(0, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (p == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	// parsers read it front to back
+	madvise(p, _size, MADV_SEQUENTIAL);
+	_data = (const char*)p;
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+
+	_mapping = 0;
+	_file = INVALID_HANDLE_VALUE;
+#else
+	if (_data)
+		munmap((void*)_data, _size);
+	if (_fd >= 0)
+		::close(_fd);
+
+	_fd = -1;
+#endif
+
+	_data = 0;
+	_size = 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+/*A read only view of a whole file through the OS's memory mapping, so
+loaders can parse straight out of the page cache without copying the file
+into a buffer first. Works on Windows and on POSIX systems, and needs
+nothing from Direct3D.*/
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const std::string& path);
+	void close();
+
+	const char* data() const { return _data; }
+	size_t size() const { return _size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* _data;
+	size_t _size;
+
+#ifdef _WIN32
+	void* _file;
+	void* _mapping;
+#else
+	int _fd;
+#endif
+};
@@ -0,0 +1,922 @@
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <intrin.h>
+#include <immintrin.h>
+#include "MeshBvh.h"
+#include "ParticleSimd.h"
+/*Triangle BVH: building it with SAH and casting rays through it, scalar,
+SSE2 and AVX*/
+
+namespace
+{
+	// Each four-wide level pushes at most three more than it pops, and the
+	// build keeps the binary tree, so this one, within 64 levels
+	const int STACK_SIZE = 256;
+
+	// Below this depth nodes are split by SAH, from it on at the median, which
+	// halves them and so bounds the depth whatever the triangles
+	const unsigned int MAX_SAH_DEPTH = 32;
+
+	// What a box costs to test against what an item does
+	const float TRAVERSAL_COST = 1.0f;
+
+	// Orders items by the centre of their boxes along one axis
+	struct CentreOrder
+	{
+		const float* boxes;
+		int axis;
+
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			return boxes[a * 6 + axis] + boxes[a * 6 + 3 + axis] < boxes[b * 6 + axis] + boxes[b * 6 + 3 + axis];
+		}
+	};
+
+	// Whether an item's centre falls below a bin boundary along one axis
+	struct BelowBin
+	{
+		const float* boxes;
+		int axis;
+		float low, scale;
+		int bin;
+
+		bool operator()(unsigned int item) const;
+	};
+
+	// The bin a centre (doubled, like the boxes' min + max) goes in; a centre
+	// at the very top goes in the last
+	int Bin(float centre, float low, float scale)
+	{
+		float f = (centre - low) * scale;
+		return f > 0.0f ? (f < (float)MeshBvh::BINS ? (int)f : MeshBvh::BINS - 1) : 0;
+	}
+
+	bool BelowBin::operator()(unsigned int item) const
+	{
+		return Bin(boxes[item * 6 + axis] + boxes[item * 6 + 3 + axis], low, scale) < bin;
+	}
+
+	// Half a box's surface, which is all SAH needs to compare boxes
+	float HalfArea(const float* lo, const float* hi)
+	{
+		float x = hi[0] - lo[0], y = hi[1] - lo[1], z = hi[2] - lo[2];
+		return x * y + y * z + z * x;
+	}
+
+	void Grow(float* lo, float* hi, const float* box)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = box[k] < lo[k] ? box[k] : lo[k];
+			hi[k] = box[3 + k] > hi[k] ? box[3 + k] : hi[k];
+		}
+	}
+
+	struct StackEntry
+	{
+		unsigned int child; // node, or first packet
+		unsigned int count; // packets, 0 for a node
+		float enter;        // where the ray enters its box
+	};
+
+	/*Every level's kernels do the same operations in the same order, the
+	min and max taken as a < b ? a : b and a > b ? a : b the way SSE's are, so
+	they find the same hit to the bit. Moller and Trumbore, "Fast, Minimum
+	Storage Ray/Triangle Intersection", 1997: the distance and barycentrics
+	come out together, without the triangle's plane*/
+	struct ScalarKernel
+	{
+		struct Ray
+		{
+			Ray(const float* origin, const float* direction)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					o[k] = origin[k];
+					d[k] = direction[k];
+					inverse[k] = 1.0f / direction[k];
+				}
+			}
+
+			float o[3], d[3], inverse[3];
+		};
+
+		static int HitBoxes(const Bvh4Node& node, const Ray& ray, float far, float* enter)
+		{
+			const float* mins[3] = { node.minX, node.minY, node.minZ };
+			const float* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+			int mask = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				float in = 0.0f, out = far;
+				for (int k = 0; k < 3; k++)
+				{
+					float a = (mins[k][i] - ray.o[k]) * ray.inverse[k];
+					float b = (maxs[k][i] - ray.o[k]) * ray.inverse[k];
+					float nearer = a < b ? a : b, further = a > b ? a : b;
+					in = nearer > in ? nearer : in;
+					out = further < out ? further : out;
+				}
+				enter[i] = in;
+				mask |= (in <= out) << i;
+			}
+			return mask;
+		}
+
+		static bool HitPackets(const TrianglePacket* packets, unsigned int count, const Ray& ray, RayHit* hit)
+		{
+			const float* o = ray.o;
+			const float* d = ray.d;
+			bool found = false;
+			for (unsigned int n = 0; n < count; n++)
+			{
+				const TrianglePacket& p = packets[n];
+				for (int i = 0; i < 4; i++)
+				{
+					float px = d[1] * p.e2z[i] - d[2] * p.e2y[i];
+					float py = d[2] * p.e2x[i] - d[0] * p.e2z[i];
+					float pz = d[0] * p.e2y[i] - d[1] * p.e2x[i];
+					float det = p.e1x[i] * px + p.e1y[i] * py + p.e1z[i] * pz;
+					float inverse = 1.0f / det;
+
+					float sx = o[0] - p.ax[i], sy = o[1] - p.ay[i], sz = o[2] - p.az[i];
+					float u = (sx * px + sy * py + sz * pz) * inverse;
+					float qx = sy * p.e1z[i] - sz * p.e1y[i];
+					float qy = sz * p.e1x[i] - sx * p.e1z[i];
+					float qz = sx * p.e1y[i] - sy * p.e1x[i];
+					float v = (d[0] * qx + d[1] * qy + d[2] * qz) * inverse;
+					float t = (p.e2x[i] * qx + p.e2y[i] * qy + p.e2z[i] * qz) * inverse;
+
+					if (det != 0.0f && u >= 0.0f && u <= 1.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f
+						&& t < hit->distance)
+					{
+						hit->distance = t;
+						hit->triangle = p.id[i];
+						hit->u = u;
+						hit->v = v;
+						found = true;
+					}
+				}
+			}
+			return found;
+		}
+	};
+
+	struct SSE2Kernel
+	{
+		struct Ray
+		{
+			Ray(const float* origin, const float* direction)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					o[k] = _mm_set1_ps(origin[k]);
+					d[k] = _mm_set1_ps(direction[k]);
+					inverse[k] = _mm_set1_ps(1.0f / direction[k]);
+				}
+			}
+
+			__m128 o[3], d[3], inverse[3];
+		};
+
+		static int HitBoxes(const Bvh4Node& node, const Ray& ray, float far, float* enter)
+		{
+			const float* mins[3] = { node.minX, node.minY, node.minZ };
+			const float* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+			__m128 in = _mm_setzero_ps(), out = _mm_set1_ps(far);
+			for (int k = 0; k < 3; k++)
+			{
+				__m128 a = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(mins[k]), ray.o[k]), ray.inverse[k]);
+				__m128 b = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxs[k]), ray.o[k]), ray.inverse[k]);
+				in = _mm_max_ps(_mm_min_ps(a, b), in);
+				out = _mm_min_ps(_mm_max_ps(a, b), out);
+			}
+			_mm_storeu_ps(enter, in);
+			return _mm_movemask_ps(_mm_cmple_ps(in, out));
+		}
+
+		// The four lanes' hits, t where they hit and +infinity where they don't
+		static __m128 HitPacket(const TrianglePacket& p, const Ray& ray, __m128 best, __m128* u, __m128* v)
+		{
+			const __m128* o = ray.o;
+			const __m128* d = ray.d;
+			__m128 e1x = _mm_loadu_ps(p.e1x), e1y = _mm_loadu_ps(p.e1y), e1z = _mm_loadu_ps(p.e1z);
+			__m128 e2x = _mm_loadu_ps(p.e2x), e2y = _mm_loadu_ps(p.e2y), e2z = _mm_loadu_ps(p.e2z);
+
+			__m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2z), _mm_mul_ps(d[2], e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2x), _mm_mul_ps(d[0], e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2y), _mm_mul_ps(d[1], e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+			__m128 sx = _mm_sub_ps(o[0], _mm_loadu_ps(p.ax));
+			__m128 sy = _mm_sub_ps(o[1], _mm_loadu_ps(p.ay));
+			__m128 sz = _mm_sub_ps(o[2], _mm_loadu_ps(p.az));
+			*u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverse);
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			*v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), inverse);
+			__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+
+			const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+			__m128 hits = _mm_cmpneq_ps(det, zero);
+			hits = _mm_and_ps(hits, _mm_cmpge_ps(*u, zero));
+			hits = _mm_and_ps(hits, _mm_cmple_ps(*u, one));
+			hits = _mm_and_ps(hits, _mm_cmpge_ps(*v, zero));
+			hits = _mm_and_ps(hits, _mm_cmple_ps(_mm_add_ps(*u, *v), one));
+			hits = _mm_and_ps(hits, _mm_cmpge_ps(t, zero));
+			hits = _mm_and_ps(hits, _mm_cmplt_ps(t, best));
+			const __m128 never = _mm_set1_ps(INFINITY);
+			return _mm_or_ps(_mm_and_ps(hits, t), _mm_andnot_ps(hits, never));
+		}
+
+		static bool HitPackets(const TrianglePacket* packets, unsigned int count, const Ray& ray, RayHit* hit)
+		{
+			bool found = false;
+			for (unsigned int n = 0; n < count; n++)
+			{
+				__m128 u, v;
+				__m128 t = HitPacket(packets[n], ray, _mm_set1_ps(hit->distance), &u, &v);
+
+				// the nearest lane, the first of any that tie, as the scalar loop keeps
+				__m128 nearest = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+				nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+				int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpeq_ps(t, nearest), _mm_cmplt_ps(t, _mm_set1_ps(INFINITY))));
+				if (!mask)
+					continue;
+
+				unsigned long lane;
+				_BitScanForward(&lane, mask);
+				float ts[4], us[4], vs[4];
+				_mm_storeu_ps(ts, t);
+				_mm_storeu_ps(us, u);
+				_mm_storeu_ps(vs, v);
+				hit->distance = ts[lane];
+				hit->triangle = packets[n].id[lane];
+				hit->u = us[lane];
+				hit->v = vs[lane];
+				found = true;
+			}
+			return found;
+		}
+	};
+
+	// Boxes four at a time as SSE2 does them; triangles eight at a time, a
+	// leaf's two packets side by side
+	struct AVXKernel
+	{
+		struct Ray : SSE2Kernel::Ray
+		{
+			Ray(const float* origin, const float* direction)
+				: SSE2Kernel::Ray(origin, direction)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					o8[k] = _mm256_set1_ps(origin[k]);
+					d8[k] = _mm256_set1_ps(direction[k]);
+				}
+			}
+
+			__m256 o8[3], d8[3];
+		};
+
+		static int HitBoxes(const Bvh4Node& node, const Ray& ray, float far, float* enter)
+		{
+			return SSE2Kernel::HitBoxes(node, ray, far, enter);
+		}
+
+		static __m256 Load(const float* low, const float* high)
+		{
+			return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+		}
+
+		static bool HitPackets(const TrianglePacket* packets, unsigned int count, const Ray& ray, RayHit* hit)
+		{
+			bool found = false;
+			unsigned int n = 0;
+			for (; n + 2 <= count; n += 2)
+			{
+				const TrianglePacket& p = packets[n];
+				const TrianglePacket& r = packets[n + 1];
+				const __m256* o = ray.o8;
+				const __m256* d = ray.d8;
+				__m256 e1x = Load(p.e1x, r.e1x), e1y = Load(p.e1y, r.e1y), e1z = Load(p.e1z, r.e1z);
+				__m256 e2x = Load(p.e2x, r.e2x), e2y = Load(p.e2y, r.e2y), e2z = Load(p.e2z, r.e2z);
+
+				__m256 px = _mm256_sub_ps(_mm256_mul_ps(d[1], e2z), _mm256_mul_ps(d[2], e2y));
+				__m256 py = _mm256_sub_ps(_mm256_mul_ps(d[2], e2x), _mm256_mul_ps(d[0], e2z));
+				__m256 pz = _mm256_sub_ps(_mm256_mul_ps(d[0], e2y), _mm256_mul_ps(d[1], e2x));
+				__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)),
+					_mm256_mul_ps(e1z, pz));
+				__m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+				__m256 sx = _mm256_sub_ps(o[0], Load(p.ax, r.ax));
+				__m256 sy = _mm256_sub_ps(o[1], Load(p.ay, r.ay));
+				__m256 sz = _mm256_sub_ps(o[2], Load(p.az, r.az));
+				__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)),
+					_mm256_mul_ps(sz, pz)), inverse);
+				__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+				__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+				__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+				__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], qx), _mm256_mul_ps(d[1], qy)),
+					_mm256_mul_ps(d[2], qz)), inverse);
+				__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+					_mm256_mul_ps(e2z, qz)), inverse);
+
+				const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), never = _mm256_set1_ps(INFINITY);
+				__m256 hits = _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ);
+				hits = _mm256_and_ps(hits, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+				hits = _mm256_and_ps(hits, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+				hits = _mm256_and_ps(hits, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+				hits = _mm256_and_ps(hits, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+				hits = _mm256_and_ps(hits, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+				hits = _mm256_and_ps(hits, _mm256_cmp_ps(t, _mm256_set1_ps(hit->distance), _CMP_LT_OQ));
+				t = _mm256_or_ps(_mm256_and_ps(hits, t), _mm256_andnot_ps(hits, never));
+
+				__m256 nearest = _mm256_min_ps(t, _mm256_permute_ps(t, _MM_SHUFFLE(2, 3, 0, 1)));
+				nearest = _mm256_min_ps(nearest, _mm256_permute_ps(nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+				nearest = _mm256_min_ps(nearest, _mm256_permute2f128_ps(nearest, nearest, 1));
+				int mask = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(t, nearest, _CMP_EQ_OQ),
+					_mm256_cmp_ps(t, never, _CMP_LT_OQ)));
+				if (!mask)
+					continue;
+
+				unsigned long lane;
+				_BitScanForward(&lane, mask);
+				float ts[8], us[8], vs[8];
+				_mm256_storeu_ps(ts, t);
+				_mm256_storeu_ps(us, u);
+				_mm256_storeu_ps(vs, v);
+				hit->distance = ts[lane];
+				hit->triangle = packets[n + lane / 4].id[lane % 4];
+				hit->u = us[lane];
+				hit->v = vs[lane];
+				found = true;
+			}
+			if (n < count)
+				found = SSE2Kernel::HitPackets(packets + n, count - n, ray, hit) || found;
+			return found;
+		}
+	};
+
+	/*Pops the nearest box not yet searched, skips it if the nearest hit is
+	already in front of it, and otherwise tests its triangles or pushes the
+	children the ray goes through, furthest first so the nearest is next*/
+	template <class Kernel>
+	bool Traverse(const Bvh4Node* nodes, const TrianglePacket* packets, const float* origin, const float* direction,
+		RayHit* hit)
+	{
+		typename Kernel::Ray ray(origin, direction);
+		StackEntry stack[STACK_SIZE];
+		int top = 0;
+		StackEntry root = { 0, 0, 0.0f };
+		stack[top++] = root;
+		bool found = false;
+		while (top > 0)
+		{
+			StackEntry entry = stack[--top];
+			if (entry.enter > hit->distance)
+				continue;
+			if (entry.count)
+			{
+				found = Kernel::HitPackets(packets + entry.child, entry.count, ray, hit) || found;
+				continue;
+			}
+
+			const Bvh4Node& node = nodes[entry.child];
+			float enter[4];
+			int mask = Kernel::HitBoxes(node, ray, hit->distance, enter);
+
+			StackEntry children[4];
+			int numChildren = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				if (!(mask & (1 << i)) || node.child[i] == MeshBvh::NONE)
+					continue;
+
+				int at = numChildren++;
+				while (at > 0 && children[at - 1].enter < enter[i])
+				{
+					children[at] = children[at - 1];
+					at--;
+				}
+				StackEntry child = { node.child[i], node.count[i], enter[i] };
+				children[at] = child;
+			}
+			for (int i = 0; i < numChildren; i++)
+				stack[top++] = children[i];
+		}
+		return found;
+	}
+
+	struct PacketEntry
+	{
+		unsigned int child; // node, or first packet
+		unsigned int count; // packets, 0 for a node
+		__m128 enter;       // where each ray enters its box, +infinity for those that don't
+	};
+
+	/*Four rays down the tree together, a lane each: a box is searched if any
+	of them enters it before its nearest hit, and its children nearest first
+	by whichever ray enters them soonest. Each lane does what SSE2Kernel does
+	for one ray, so its distances are the same; a leaf's triangles are taken
+	one at a time against all four*/
+	int TracePacket(const Bvh4Node* nodes, const TrianglePacket* packets, const float* origins, const float* directions,
+		RayHit* hits)
+	{
+		__m128 o[3], d[3], inverse[3];
+		for (int k = 0; k < 3; k++)
+		{
+			o[k] = _mm_loadu_ps(origins + k * 4);
+			d[k] = _mm_loadu_ps(directions + k * 4);
+			inverse[k] = _mm_div_ps(_mm_set1_ps(1.0f), d[k]);
+		}
+		float distances[4] = { hits[0].distance, hits[1].distance, hits[2].distance, hits[3].distance };
+		__m128 best = _mm_loadu_ps(distances);
+		__m128 bestU = _mm_setzero_ps(), bestV = _mm_setzero_ps();
+		__m128i bestId = _mm_set1_epi32((int)MeshBvh::NONE);
+		__m128 found = _mm_setzero_ps();
+
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), never = _mm_set1_ps(INFINITY);
+		PacketEntry stack[STACK_SIZE];
+		int top = 0;
+		stack[top].child = 0;
+		stack[top].count = 0;
+		stack[top++].enter = zero;
+		while (top > 0)
+		{
+			PacketEntry entry = stack[--top];
+			if (!_mm_movemask_ps(_mm_cmple_ps(entry.enter, best)))
+				continue;
+
+			if (entry.count)
+			{
+				for (unsigned int n = entry.child; n < entry.child + entry.count; n++)
+				{
+					const TrianglePacket& p = packets[n];
+					for (int j = 0; j < 4 && p.id[j] != MeshBvh::NONE; j++)
+					{
+						__m128 e1x = _mm_set1_ps(p.e1x[j]), e1y = _mm_set1_ps(p.e1y[j]), e1z = _mm_set1_ps(p.e1z[j]);
+						__m128 e2x = _mm_set1_ps(p.e2x[j]), e2y = _mm_set1_ps(p.e2y[j]), e2z = _mm_set1_ps(p.e2z[j]);
+
+						__m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2z), _mm_mul_ps(d[2], e2y));
+						__m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2x), _mm_mul_ps(d[0], e2z));
+						__m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2y), _mm_mul_ps(d[1], e2x));
+						__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+						__m128 inv = _mm_div_ps(one, det);
+
+						__m128 sx = _mm_sub_ps(o[0], _mm_set1_ps(p.ax[j]));
+						__m128 sy = _mm_sub_ps(o[1], _mm_set1_ps(p.ay[j]));
+						__m128 sz = _mm_sub_ps(o[2], _mm_set1_ps(p.az[j]));
+						__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+						__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+						__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+						__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+						__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), inv);
+						__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+						__m128 hit = _mm_cmpneq_ps(det, zero);
+						hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+						hit = _mm_and_ps(hit, _mm_cmple_ps(u, one));
+						hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+						hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+						hit = _mm_and_ps(hit, _mm_cmpge_ps(t, zero));
+						hit = _mm_and_ps(hit, _mm_cmplt_ps(t, best));
+						if (!_mm_movemask_ps(hit))
+							continue;
+
+						best = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, best));
+						bestU = _mm_or_ps(_mm_and_ps(hit, u), _mm_andnot_ps(hit, bestU));
+						bestV = _mm_or_ps(_mm_and_ps(hit, v), _mm_andnot_ps(hit, bestV));
+						__m128i mask = _mm_castps_si128(hit);
+						bestId = _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi32((int)p.id[j])), _mm_andnot_si128(mask, bestId));
+						found = _mm_or_ps(found, hit);
+					}
+				}
+				continue;
+			}
+
+			const Bvh4Node& node = nodes[entry.child];
+			PacketEntry children[4];
+			float keys[4];
+			int numChildren = 0;
+			for (int i = 0; i < 4 && node.child[i] != MeshBvh::NONE; i++)
+			{
+				const float mins[3] = { node.minX[i], node.minY[i], node.minZ[i] };
+				const float maxs[3] = { node.maxX[i], node.maxY[i], node.maxZ[i] };
+				__m128 in = zero, out = best;
+				for (int k = 0; k < 3; k++)
+				{
+					__m128 a = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(mins[k]), o[k]), inverse[k]);
+					__m128 b = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxs[k]), o[k]), inverse[k]);
+					in = _mm_max_ps(_mm_min_ps(a, b), in);
+					out = _mm_min_ps(_mm_max_ps(a, b), out);
+				}
+				__m128 inside = _mm_cmple_ps(in, out);
+				if (!_mm_movemask_ps(inside))
+					continue;
+
+				__m128 enter = _mm_or_ps(_mm_and_ps(inside, in), _mm_andnot_ps(inside, never));
+				__m128 key = _mm_min_ps(enter, _mm_shuffle_ps(enter, enter, _MM_SHUFFLE(2, 3, 0, 1)));
+				key = _mm_min_ps(key, _mm_shuffle_ps(key, key, _MM_SHUFFLE(1, 0, 3, 2)));
+
+				int at = numChildren++;
+				float soonest = _mm_cvtss_f32(key);
+				while (at > 0 && keys[at - 1] < soonest)
+				{
+					children[at] = children[at - 1];
+					keys[at] = keys[at - 1];
+					at--;
+				}
+				children[at].child = node.child[i];
+				children[at].count = node.count[i];
+				children[at].enter = enter;
+				keys[at] = soonest;
+			}
+			for (int i = 0; i < numChildren; i++)
+				stack[top++] = children[i];
+		}
+
+		int mask = _mm_movemask_ps(found);
+		float ts[4], us[4], vs[4];
+		unsigned int ids[4];
+		_mm_storeu_ps(ts, best);
+		_mm_storeu_ps(us, bestU);
+		_mm_storeu_ps(vs, bestV);
+		_mm_storeu_si128((__m128i*)ids, bestId);
+		for (int i = 0; i < 4; i++)
+		{
+			if (!(mask & (1 << i)))
+				continue;
+			hits[i].distance = ts[i];
+			hits[i].triangle = ids[i];
+			hits[i].u = us[i];
+			hits[i].v = vs[i];
+		}
+		return mask;
+	}
+}
+
+RayHit::RayHit()
+	: distance(FLT_MAX)
+	, triangle(MeshBvh::NONE)
+	, u(0.0f)
+	, v(0.0f)
+	, id(MeshBvh::NONE)
+{
+}
+
+MeshBvh::MeshBvh()
+	: _numTriangles(0)
+{
+}
+
+/*Binned SAH, one node at a time off a stack. Boxes must be finite.
+
+Each axis's centres are dropped into BINS bins; sweeping the bins from each
+end gives both sides' boxes and counts at every boundary, and the cheapest
+boundary of the three axes wins. A node over leafSize is split there even
+when a leaf would be cheaper; one that can't be split that way (its centres
+all in one bin) or that is too deep is split at the median*/
+void MeshBvh::BuildNodes(const float* boxes, unsigned int count, unsigned int leafSize,
+	std::vector<BvhNode>* nodes, std::vector<unsigned int>* order)
+{
+	nodes->clear();
+	order->resize(count);
+	if (count == 0)
+		return;
+
+	for (unsigned int i = 0; i < count; i++)
+		(*order)[i] = i;
+
+	BvhNode root;
+	root.first = 0;
+	root.count = count;
+	nodes->reserve(count * 2);
+	nodes->push_back(root);
+
+	// node, depth
+	std::vector<std::pair<unsigned int, unsigned int> > open(1, std::make_pair(0u, 0u));
+	while (!open.empty())
+	{
+		unsigned int n = open.back().first, depth = open.back().second;
+		open.pop_back();
+		unsigned int first = (*nodes)[n].first, numItems = (*nodes)[n].count;
+
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		float centreLo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, centreHi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (unsigned int i = first; i < first + numItems; i++)
+		{
+			const float* box = &boxes[(*order)[i] * 6];
+			Grow(lo, hi, box);
+			for (int k = 0; k < 3; k++)
+			{
+				float centre = box[k] + box[3 + k];
+				centreLo[k] = centre < centreLo[k] ? centre : centreLo[k];
+				centreHi[k] = centre > centreHi[k] ? centre : centreHi[k];
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			(*nodes)[n].min[k] = lo[k];
+			(*nodes)[n].max[k] = hi[k];
+		}
+		if (numItems <= 1)
+			continue;
+
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestBin = 0;
+		for (int axis = 0; axis < 3 && depth < MAX_SAH_DEPTH; axis++)
+		{
+			float extent = centreHi[axis] - centreLo[axis];
+			if (!(extent > 0.0f))
+				continue;
+			float scale = BINS / extent;
+
+			float binLo[BINS][3], binHi[BINS][3];
+			unsigned int binCount[BINS];
+			for (int b = 0; b < BINS; b++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					binLo[b][k] = FLT_MAX;
+					binHi[b][k] = -FLT_MAX;
+				}
+				binCount[b] = 0;
+			}
+			for (unsigned int i = first; i < first + numItems; i++)
+			{
+				const float* box = &boxes[(*order)[i] * 6];
+				int b = Bin(box[axis] + box[3 + axis], centreLo[axis], scale);
+				Grow(binLo[b], binHi[b], box);
+				binCount[b]++;
+			}
+
+			// everything at or above each boundary
+			float aboveArea[BINS];
+			unsigned int aboveCount[BINS];
+			float runLo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, runHi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			unsigned int runCount = 0;
+			for (int b = BINS - 1; b > 0; b--)
+			{
+				float box[6] = { binLo[b][0], binLo[b][1], binLo[b][2], binHi[b][0], binHi[b][1], binHi[b][2] };
+				Grow(runLo, runHi, box);
+				runCount += binCount[b];
+				aboveArea[b] = runCount ? HalfArea(runLo, runHi) : 0.0f;
+				aboveCount[b] = runCount;
+			}
+
+			for (int k = 0; k < 3; k++)
+			{
+				runLo[k] = FLT_MAX;
+				runHi[k] = -FLT_MAX;
+			}
+			runCount = 0;
+			for (int b = 1; b < BINS; b++)
+			{
+				float box[6] = { binLo[b - 1][0], binLo[b - 1][1], binLo[b - 1][2],
+					binHi[b - 1][0], binHi[b - 1][1], binHi[b - 1][2] };
+				Grow(runLo, runHi, box);
+				runCount += binCount[b - 1];
+				if (runCount == 0 || aboveCount[b] == 0)
+					continue;
+
+				float cost = HalfArea(runLo, runHi) * runCount + aboveArea[b] * aboveCount[b];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		float area = HalfArea(lo, hi);
+		if (numItems <= leafSize && (bestAxis < 0 || numItems * area <= TRAVERSAL_COST * area + bestCost))
+			continue;
+
+		unsigned int half;
+		if (bestAxis >= 0)
+		{
+			BelowBin below;
+			below.boxes = boxes;
+			below.axis = bestAxis;
+			below.low = centreLo[bestAxis];
+			below.scale = BINS / (centreHi[bestAxis] - centreLo[bestAxis]);
+			below.bin = bestBin;
+			half = (unsigned int)(std::partition(order->begin() + first, order->begin() + first + numItems, below)
+				- (order->begin() + first));
+		}
+		else
+		{
+			int axis = 0;
+			for (int k = 1; k < 3; k++)
+				axis = centreHi[k] - centreLo[k] > centreHi[axis] - centreLo[axis] ? k : axis;
+			CentreOrder byCentre;
+			byCentre.boxes = boxes;
+			byCentre.axis = axis;
+			half = numItems / 2;
+			std::nth_element(order->begin() + first, order->begin() + first + half, order->begin() + first + numItems,
+				byCentre);
+		}
+
+		BvhNode left, right;
+		left.first = first;
+		left.count = half;
+		right.first = first + half;
+		right.count = numItems - half;
+
+		unsigned int children = (unsigned int)nodes->size();
+		(*nodes)[n].first = children;
+		(*nodes)[n].count = 0;
+		nodes->push_back(left);
+		nodes->push_back(right);
+		open.push_back(std::make_pair(children + 1, depth + 1));
+		open.push_back(std::make_pair(children, depth + 1));
+	}
+}
+
+/*Slab test: the ray is inside the box between the furthest of the three
+entries and the nearest of the three exits*/
+float MeshBvh::Enter(const BvhNode& node, const float* origin, const float* inverse, float far)
+{
+	float enter = 0.0f, exit = far;
+	for (int k = 0; k < 3; k++)
+	{
+		float a = (node.min[k] - origin[k]) * inverse[k];
+		float b = (node.max[k] - origin[k]) * inverse[k];
+		float nearer = a < b ? a : b, further = a < b ? b : a;
+		enter = nearer > enter ? nearer : enter;
+		exit = further < exit ? further : exit;
+	}
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+/*Builds over numTriangles triangles, 3 indices each into positions. The
+binary tree is folded into four-wide nodes: a node takes its children, then
+keeps opening whichever inner one has the largest surface, the one rays are
+likeliest to reach, into its two until it has four*/
+void MeshBvh::build(const float* positions, const unsigned int* indices, unsigned int numTriangles)
+{
+	clear();
+	if (numTriangles == 0)
+		return;
+
+	std::vector<float> boxes(numTriangles * 6);
+	for (unsigned int t = 0; t < numTriangles; t++)
+	{
+		float* box = &boxes[t * 6];
+		for (int k = 0; k < 3; k++)
+		{
+			box[k] = FLT_MAX;
+			box[3 + k] = -FLT_MAX;
+		}
+		for (int j = 0; j < 3; j++)
+		{
+			const float* p = &positions[indices[t * 3 + j] * 3];
+			float corner[6] = { p[0], p[1], p[2], p[0], p[1], p[2] };
+			Grow(box, box + 3, corner);
+		}
+	}
+
+	std::vector<BvhNode> binary;
+	std::vector<unsigned int> order;
+	BuildNodes(&boxes[0], numTriangles, LEAF_TRIANGLES, &binary, &order);
+
+	// binary node, the four-wide node made for it
+	std::vector<std::pair<unsigned int, unsigned int> > open(1, std::make_pair(0u, 0u));
+	_nodes.push_back(Bvh4Node());
+	while (!open.empty())
+	{
+		unsigned int from = open.back().first, to = open.back().second;
+		open.pop_back();
+
+		unsigned int slots[4];
+		int numSlots = 0;
+		if (binary[from].count)
+			slots[numSlots++] = from; // a root that is a leaf
+		else
+		{
+			slots[numSlots++] = binary[from].first;
+			slots[numSlots++] = binary[from].first + 1;
+		}
+		while (numSlots < 4)
+		{
+			int widest = -1;
+			float widestArea = -1.0f;
+			for (int i = 0; i < numSlots; i++)
+			{
+				const BvhNode& node = binary[slots[i]];
+				float area = HalfArea(node.min, node.max);
+				if (node.count == 0 && area > widestArea)
+				{
+					widest = i;
+					widestArea = area;
+				}
+			}
+			if (widest < 0)
+				break;
+			unsigned int opened = slots[widest];
+			slots[widest] = binary[opened].first;
+			slots[numSlots++] = binary[opened].first + 1;
+		}
+
+		for (int i = 0; i < 4; i++)
+		{
+			Bvh4Node& node = _nodes[to];
+			if (i >= numSlots)
+			{
+				node.minX[i] = node.minY[i] = node.minZ[i] = 0.0f;
+				node.maxX[i] = node.maxY[i] = node.maxZ[i] = 0.0f;
+				node.child[i] = NONE;
+				node.count[i] = 0;
+				continue;
+			}
+
+			const BvhNode& child = binary[slots[i]];
+			node.minX[i] = child.min[0];
+			node.minY[i] = child.min[1];
+			node.minZ[i] = child.min[2];
+			node.maxX[i] = child.max[0];
+			node.maxY[i] = child.max[1];
+			node.maxZ[i] = child.max[2];
+			if (child.count == 0)
+			{
+				node.child[i] = (unsigned int)_nodes.size();
+				node.count[i] = 0;
+				open.push_back(std::make_pair(slots[i], node.child[i]));
+				_nodes.push_back(Bvh4Node()); // may move the nodes, so node is looked up again each slot
+				continue;
+			}
+
+			// the leaf's triangles, packed in fours
+			node.child[i] = (unsigned int)_packets.size();
+			node.count[i] = (child.count + 3) / 4;
+			for (unsigned int first = child.first; first < child.first + child.count; first += 4)
+			{
+				TrianglePacket packet;
+				for (unsigned int lane = 0; lane < 4; lane++)
+				{
+					unsigned int t = first + lane < child.first + child.count ? order[first + lane] : NONE;
+					const float* a = t != NONE ? &positions[indices[t * 3] * 3] : 0;
+					const float* b = t != NONE ? &positions[indices[t * 3 + 1] * 3] : 0;
+					const float* c = t != NONE ? &positions[indices[t * 3 + 2] * 3] : 0;
+					packet.ax[lane] = a ? a[0] : 0.0f;
+					packet.ay[lane] = a ? a[1] : 0.0f;
+					packet.az[lane] = a ? a[2] : 0.0f;
+					packet.e1x[lane] = a ? b[0] - a[0] : 0.0f;
+					packet.e1y[lane] = a ? b[1] - a[1] : 0.0f;
+					packet.e1z[lane] = a ? b[2] - a[2] : 0.0f;
+					packet.e2x[lane] = a ? c[0] - a[0] : 0.0f;
+					packet.e2y[lane] = a ? c[1] - a[1] : 0.0f;
+					packet.e2z[lane] = a ? c[2] - a[2] : 0.0f;
+					packet.id[lane] = t;
+				}
+				_packets.push_back(packet);
+			}
+		}
+	}
+	_numTriangles = (int)numTriangles;
+}
+
+void MeshBvh::clear()
+{
+	_nodes.clear();
+	_packets.clear();
+	_numTriangles = 0;
+}
+
+bool MeshBvh::intersect(const float* origin, const float* direction, RayHit* hit) const
+{
+	if (_nodes.empty())
+		return false;
+
+	switch (ParticleSimd::GetLevel())
+	{
+	case SIMD_AVX:  return Traverse<AVXKernel>(&_nodes[0], &_packets[0], origin, direction, hit);
+	case SIMD_SSE2: return Traverse<SSE2Kernel>(&_nodes[0], &_packets[0], origin, direction, hit);
+	default:        return Traverse<ScalarKernel>(&_nodes[0], &_packets[0], origin, direction, hit);
+	}
+}
+
+int MeshBvh::intersectPacket(const float* origins, const float* directions, RayHit* hits) const
+{
+	if (_nodes.empty())
+		return 0;
+
+	if (ParticleSimd::GetLevel() == SIMD_SCALAR)
+	{
+		int mask = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			float origin[3] = { origins[i], origins[4 + i], origins[8 + i] };
+			float direction[3] = { directions[i], directions[4 + i], directions[8 + i] };
+			if (intersect(origin, direction, &hits[i]))
+				mask |= 1 << i;
+		}
+		return mask;
+	}
+	return TracePacket(&_nodes[0], &_packets[0], origins, directions, hits);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+
+//Where a ray first meets a mesh, or a scene of them
+struct RayHit
+{
+	RayHit();
+
+	float distance;        // along the ray, in lengths of its direction; FLT_MAX until something is hit
+	unsigned int triangle; // in the mesh's full level, MeshBvh::NONE if none (or only a bounding sphere) was hit
+	float u, v;            // where on it: (1 - u - v) * a + u * b + v * c
+	unsigned int id;       // what SceneBvh was told the mesh is, MeshBvh::NONE for a mesh on its own
+};
+
+//A box of a binary BVH in 32 bytes. The two children of an inner node sit
+//next to each other, so one index finds both.
+struct BvhNode
+{
+	float min[3];
+	unsigned int first; // first item of a leaf, or the left child of an inner node
+	float max[3];
+	unsigned int count; // items in a leaf, 0 for an inner node
+};
+
+//Four children's boxes side by side, each axis a row of four, so one SIMD
+//slab test takes all of them. 128 bytes, two cache lines.
+struct Bvh4Node
+{
+	float minX[4], minY[4], minZ[4];
+	float maxX[4], maxY[4], maxZ[4];
+	unsigned int child[4]; // an inner child's node, a leaf's first packet, MeshBvh::NONE for an empty slot
+	unsigned int count[4]; // a leaf's packets, 0 for an inner child
+};
+
+//Four triangles, each value a row of four, with the edges from the first
+//corner worked out. Lanes past a leaf's last triangle have zero edges, which
+//no ray hits.
+struct TrianglePacket
+{
+	float ax[4], ay[4], az[4];
+	float e1x[4], e1y[4], e1z[4]; // b - a
+	float e2x[4], e2y[4], e2z[4]; // c - a
+	unsigned int id[4];           // the mesh's triangle, MeshBvh::NONE for an empty lane
+};
+
+/*A bounding volume hierarchy over a mesh's triangles, for finding the nearest
+one a ray hits without testing them all.
+
+BuildNodes makes a binary tree with the binned surface area heuristic (Wald,
+"On fast Construction of SAH-based Bounding Volume Hierarchies", 2007): each
+node's centres are dropped into BINS slots along each axis, and it is split
+at whichever slot boundary makes the children's areas times their items least,
+or made a leaf if that costs more than testing its items. The mesh's tree is
+then folded into four-wide nodes, each taking its child's children while
+that keeps four or fewer, and its leaves' triangles are packed in fours.
+
+Rays test a node's four boxes together and go down the hit ones nearest
+first, skipping any that start further off than the nearest hit so far; the
+triangles of a leaf go through Moller and Trumbore's test, from either side,
+four at a time with SSE2, or eight with AVX. Every ParticleSimd level finds
+the same hit to the bit. Packets of four rays go through SSE2 a ray per lane,
+one triangle at a time, and one ray at a time on the scalar level.*/
+class MeshBvh
+{
+public:
+	static const unsigned int NONE = 0xFFFFFFFF;
+	static const unsigned int LEAF_TRIANGLES = 8; // at most, so two packets
+	static const int BINS = 16;
+
+	MeshBvh();
+
+	void build(const float* positions, const unsigned int* indices, unsigned int numTriangles);
+	void clear();
+
+	// Whether the ray origin + t * direction (t >= 0) hits a triangle nearer
+	// than hit->distance; if so hit is moved to it.
+	bool intersect(const float* origin, const float* direction, RayHit* hit) const;
+
+	// The same for four rays at once, origins and directions given a
+	// coordinate at a time (x of all four, then y, then z), traced as a packet
+	// down the boxes any of them enter. A ray whose hit distance is negative is
+	// left out. Returns a bit per ray that hit. The distances are the ones
+	// intersect finds; where a ray meets two triangles at the very same
+	// distance (along a shared edge) it may keep the other one.
+	int intersectPacket(const float* origins, const float* directions, RayHit* hits) const;
+
+	bool empty() const { return _nodes.empty(); }
+	int numNodes() const { return (int)_nodes.size(); }
+	int numTriangles() const { return _numTriangles; }
+
+	// Builds a binary tree over count items, boxes holding each one's min and
+	// max corners (6 floats), with leaves of no more than leafSize. order gets
+	// the items in leaf order.
+	static void BuildNodes(const float* boxes, unsigned int count, unsigned int leafSize,
+		std::vector<BvhNode>* nodes, std::vector<unsigned int>* order);
+
+	// Where the ray enters the node's box, if it does before far, else FLT_MAX.
+	// inverse is 1 / direction.
+	static float Enter(const BvhNode& node, const float* origin, const float* inverse, float far);
+
+private:
+	std::vector<Bvh4Node> _nodes;          // root first
+	std::vector<TrianglePacket> _packets;  // in leaf order
+	int _numTriangles;
+};
@@ -0,0 +1,586 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshLod.h"
+/*Baked, memory mapped meshes for fast model startup*/
+
+//The start of a cache file. Offsets are from the start of the file.
+struct BakedHeader
+{
+	char magic[4];                  // "XMSH"
+	unsigned int version;
+	unsigned long long sourceHash;  // of the whole .x file
+	unsigned long long fileSize;    // of this file, a short write is stale
+
+	unsigned int numVertices;
+	unsigned int numTriangles;
+	unsigned int numSubsets;
+	unsigned int numMaterials;
+	unsigned int indexSize;
+	unsigned int stringsSize;
+
+	unsigned int verticesOffset;
+	unsigned int indicesOffset;
+	unsigned int subsetsOffset;
+	unsigned int materialsOffset;
+	unsigned int stringsOffset;
+	unsigned int numLods;
+	unsigned int lodsOffset;
+	unsigned int vertexFormat;      // VertexFormat
+	QuantizationBounds bounds;      // of the vertices when they are quantized
+	unsigned int numMeshlets;
+	unsigned int meshletsOffset;
+};
+
+namespace
+{
+	// bumped whenever the layout or the baking changes, so old caches rebuild
+	const unsigned int VERSION = 6;
+	const size_t ALIGNMENT = 64;
+
+	inline size_t Align(size_t offset)
+	{
+		return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
+
+	size_t VertexSize(unsigned int format)
+	{
+		return format == VERTEX_QUANTIZED ? sizeof(QuantizedVertex) : sizeof(BakedVertex);
+	}
+
+	// Area weighted vertex normals, for meshes that come without any
+	void ComputeNormals(const XMesh& mesh, std::vector<float>* normals)
+	{
+		normals->assign(mesh.positions.size(), 0.0f);
+		for (size_t i = 0; i < mesh.indices.size(); i += 3)
+		{
+			const float* a = &mesh.positions[mesh.indices[i] * 3];
+			const float* b = &mesh.positions[mesh.indices[i + 1] * 3];
+			const float* c = &mesh.positions[mesh.indices[i + 2] * 3];
+
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0]
+			};
+
+			for (int k = 0; k < 3; k++)
+			{
+				float* out = &(*normals)[mesh.indices[i + k] * 3];
+				out[0] += n[0];
+				out[1] += n[1];
+				out[2] += n[2];
+			}
+		}
+
+		for (size_t i = 0; i < normals->size(); i += 3)
+		{
+			float* n = &(*normals)[i];
+			float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length > 0.0f)
+			{
+				n[0] /= length;
+				n[1] /= length;
+				n[2] /= length;
+			}
+		}
+	}
+
+	bool WriteFile(const std::string& path, const std::vector<char>& data)
+	{
+		FILE* f = 0;
+#ifdef _MSC_VER
+		if (fopen_s(&f, path.c_str(), "wb") != 0)
+			f = 0;
+#else
+		f = fopen(path.c_str(), "wb");
+#endif
+		if (!f)
+			return false;
+
+		bool ok = fwrite(&data[0], 1, data.size(), f) == data.size();
+		return fclose(f) == 0 && ok;
+	}
+}
+
+MeshCache::MeshCache()
+	: _header(0)
+	, _rebuilt(false)
+{
+}
+
+/*Hashes the source so a stale cache is found without parsing it. Eight bytes
+at a time with MurmurHash64A's mixing, which runs at memory speed.*/
+unsigned long long MeshCache::Hash(const char* data, size_t size)
+{
+	const unsigned long long m = 0xC6A4A7935BD1E995ull;
+	const int r = 47;
+	unsigned long long h = 0x5EED5EEDull ^ (size * m);
+
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; i++)
+	{
+		unsigned long long k;
+		memcpy(&k, data + i * 8, 8);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	size_t tail = size & 7;
+	if (tail)
+	{
+		unsigned long long k = 0;
+		memcpy(&k, data + words * 8, tail);
+		h ^= k;
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+std::string MeshCache::CachePath(const std::string& source)
+{
+	return source + ".mesh";
+}
+
+bool MeshCache::open(const std::string& source, std::string* error, VertexFormat format)
+{
+	close();
+	_rebuilt = false;
+
+	MappedFile sourceFile;
+	if (!sourceFile.open(source))
+	{
+		if (error)
+			*error = "could not open " + source;
+		return false;
+	}
+
+	unsigned long long hash = Hash(sourceFile.data(), sourceFile.size());
+	std::string path = CachePath(source);
+
+	if (_file.open(path) && valid(hash, format))
+		return true;
+	close();
+
+	XMesh mesh;
+	std::string reason;
+	if (!XFile::Parse(sourceFile.data(), sourceFile.size(), &mesh, &reason))
+	{
+		if (error)
+			*error = source + ": " + reason;
+		return false;
+	}
+
+	if (!Bake(mesh, hash, path, format) || !_file.open(path) || !valid(hash, format))
+	{
+		close();
+		if (error)
+			*error = "could not write " + path;
+		return false;
+	}
+
+	_rebuilt = true;
+	return true;
+}
+
+void MeshCache::close()
+{
+	_file.close();
+	_header = 0;
+}
+
+/*Checks the mapped file is a whole cache of this version for this source,
+with its vertices in format, and that every blob it points at is inside it*/
+bool MeshCache::valid(unsigned long long sourceHash, VertexFormat format)
+{
+	if (_file.size() < sizeof(BakedHeader))
+		return false;
+
+	const BakedHeader* h = (const BakedHeader*)_file.data();
+	if (memcmp(h->magic, "XMSH", 4) != 0 || h->version != VERSION
+		|| h->sourceHash != sourceHash || h->fileSize != _file.size() || h->vertexFormat != (unsigned int)format)
+	{
+		return false;
+	}
+
+	unsigned long long size = _file.size();
+	if ((unsigned long long)h->verticesOffset + (unsigned long long)h->numVertices * VertexSize(h->vertexFormat) > size
+		|| (unsigned long long)h->indicesOffset + (unsigned long long)h->numTriangles * 3 * h->indexSize > size
+		|| (unsigned long long)h->subsetsOffset + (unsigned long long)h->numSubsets * sizeof(BakedSubset) > size
+		|| (unsigned long long)h->materialsOffset + (unsigned long long)h->numMaterials * sizeof(BakedMaterial) > size
+		|| (unsigned long long)h->lodsOffset + (unsigned long long)h->numLods * sizeof(BakedLod) > size || h->numLods == 0
+		|| (unsigned long long)h->meshletsOffset + (unsigned long long)h->numMeshlets * sizeof(Meshlet) > size
+		|| (unsigned long long)h->stringsOffset + h->stringsSize > size)
+	{
+		return false;
+	}
+
+	_header = h;
+	return true;
+}
+
+/*Lays the mesh out as it will be used: run through MeshOptimizer, its level
+of detail chain built, each level's triangles sorted by material (they come
+sorted, and the sort keeps their order, so the meshlets stay whole), vertices
+renumbered in the order the sorted triangles first use them so each
+subset's vertices are close together, normals filled in if the mesh has
+none, and the vertices quantized if format asks for it*/
+bool MeshCache::Bake(const XMesh& source, unsigned long long sourceHash, const std::string& path, VertexFormat format)
+{
+	XMesh mesh = source;
+	MeshOptimizer::Optimize(&mesh);
+
+	unsigned int numVertices = mesh.numVertices();
+	unsigned int numMaterials = (unsigned int)mesh.materials.size();
+	if (numVertices == 0 || mesh.numTriangles() == 0)
+		return false;
+
+	for (int t = 0; t < mesh.numTriangles(); t++)
+	{
+		if (mesh.attributes[t] >= numMaterials)
+			return false;
+	}
+
+	std::vector<MeshLodLevel> levels;
+	MeshLod::BuildChain(mesh, &levels);
+
+	// quantized vertices are drawn where they decode to, up to half a step
+	// from where they were, so the meshlets' bounds are worked out again from
+	// there; spheres around the float positions could leave them outside
+	bool hasTexCoords = !mesh.texCoords.empty();
+	QuantizationBounds bounds;
+	memset(&bounds, 0, sizeof(bounds));
+	std::vector<float> decoded;
+	if (format == VERTEX_QUANTIZED)
+	{
+		MeshQuantizer::ComputeBounds(&mesh.positions[0], hasTexCoords ? &mesh.texCoords[0] : 0, numVertices, &bounds);
+		decoded = mesh.positions;
+		for (unsigned int v = 0; v < numVertices; v++)
+			MeshQuantizer::RoundPosition(bounds, &decoded[v * 3]);
+	}
+
+	// every level one after another, and vertices in order of first use
+	const unsigned int UNUSED = 0xFFFFFFFF;
+	std::vector<unsigned int> remap(numVertices, UNUSED);
+	std::vector<unsigned int> sortedIndices;
+	std::vector<unsigned int> vertexOrder;
+	vertexOrder.reserve(numVertices);
+	std::vector<BakedSubset> subsets;
+	std::vector<BakedLod> lods;
+	std::vector<Meshlet> meshlets;
+
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		const MeshLodLevel& level = levels[l];
+		unsigned int levelTriangles = (unsigned int)level.attributes.size();
+		unsigned int base = (unsigned int)(sortedIndices.size() / 3);
+
+		// counting sort of the triangles by material
+		std::vector<unsigned int> start(numMaterials + 1, 0);
+		for (unsigned int t = 0; t < levelTriangles; t++)
+			start[level.attributes[t] + 1]++;
+		for (unsigned int m = 0; m < numMaterials; m++)
+			start[m + 1] += start[m];
+
+		std::vector<unsigned int> order(levelTriangles);
+		std::vector<unsigned int> next(start.begin(), start.end() - 1);
+		for (unsigned int t = 0; t < levelTriangles; t++)
+			order[next[level.attributes[t]]++] = t;
+
+		for (unsigned int t = 0; t < levelTriangles; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = level.indices[order[t] * 3 + k];
+				if (remap[v] == UNUSED)
+				{
+					remap[v] = (unsigned int)vertexOrder.size();
+					vertexOrder.push_back(v);
+				}
+				sortedIndices.push_back(remap[v]);
+			}
+		}
+
+		BakedLod lod;
+		lod.firstSubset = (unsigned int)subsets.size();
+		lod.firstTriangle = base;
+		lod.numTriangles = levelTriangles;
+		lod.error = level.error;
+		lod.firstMeshlet = (unsigned int)meshlets.size();
+		lod.numMeshlets = (unsigned int)level.meshlets.size();
+		for (size_t m = 0; m < level.meshlets.size(); m++)
+		{
+			meshlets.push_back(level.meshlets[m]);
+			if (!decoded.empty())
+				Meshlets::ComputeBounds(&level.indices[level.meshlets[m].firstTriangle * 3], &decoded[0], &meshlets.back());
+			meshlets.back().firstTriangle += base;
+		}
+
+		for (unsigned int m = 0; m < numMaterials; m++)
+		{
+			if (start[m] == start[m + 1])
+				continue;
+
+			BakedSubset s;
+			s.material = m;
+			s.firstTriangle = base + start[m];
+			s.numTriangles = start[m + 1] - start[m];
+
+			unsigned int lo = UNUSED, hi = 0;
+			for (unsigned int i = s.firstTriangle * 3; i < (s.firstTriangle + s.numTriangles) * 3; i++)
+			{
+				lo = sortedIndices[i] < lo ? sortedIndices[i] : lo;
+				hi = sortedIndices[i] > hi ? sortedIndices[i] : hi;
+			}
+			s.firstVertex = lo;
+			s.numVertices = hi - lo + 1;
+			subsets.push_back(s);
+		}
+
+		lod.numSubsets = (unsigned int)subsets.size() - lod.firstSubset;
+		lods.push_back(lod);
+	}
+	unsigned int numUsed = (unsigned int)vertexOrder.size();
+	unsigned int numTriangles = (unsigned int)(sortedIndices.size() / 3);
+
+	std::vector<float> computedNormals;
+	const std::vector<float>* normals = &mesh.normals;
+	if (mesh.normals.empty())
+	{
+		ComputeNormals(mesh, &computedNormals);
+		normals = &computedNormals;
+	}
+
+	std::string strings;
+	std::vector<BakedMaterial> materials(numMaterials);
+	for (unsigned int m = 0; m < numMaterials; m++)
+	{
+		const XMaterial& x = mesh.materials[m];
+		BakedMaterial& b = materials[m];
+		memcpy(b.diffuse, x.diffuse, sizeof(b.diffuse));
+		b.power = x.power;
+		memcpy(b.specular, x.specular, sizeof(b.specular));
+		memcpy(b.emissive, x.emissive, sizeof(b.emissive));
+		b.texture = NO_TEXTURE;
+		if (!x.texture.empty())
+		{
+			b.texture = (unsigned int)strings.size();
+			strings.append(x.texture.c_str(), x.texture.size() + 1);
+		}
+	}
+
+	BakedHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "XMSH", 4);
+	h.version = VERSION;
+	h.sourceHash = sourceHash;
+	h.numVertices = numUsed;
+	h.numTriangles = numTriangles;
+	h.numSubsets = (unsigned int)subsets.size();
+	h.numMaterials = numMaterials;
+	h.numLods = (unsigned int)lods.size();
+	h.numMeshlets = (unsigned int)meshlets.size();
+	h.indexSize = numUsed > 0xFFFF ? 4 : 2;
+	h.vertexFormat = format;
+	h.stringsSize = (unsigned int)strings.size();
+	h.bounds = bounds;
+
+	size_t offset = Align(sizeof(BakedHeader));
+	h.verticesOffset = (unsigned int)offset;
+	offset = Align(offset + numUsed * VertexSize(format));
+	h.indicesOffset = (unsigned int)offset;
+	offset = Align(offset + numTriangles * 3 * h.indexSize);
+	h.subsetsOffset = (unsigned int)offset;
+	offset = Align(offset + subsets.size() * sizeof(BakedSubset));
+	h.materialsOffset = (unsigned int)offset;
+	offset = Align(offset + materials.size() * sizeof(BakedMaterial));
+	h.lodsOffset = (unsigned int)offset;
+	offset = Align(offset + lods.size() * sizeof(BakedLod));
+	h.meshletsOffset = (unsigned int)offset;
+	offset = Align(offset + meshlets.size() * sizeof(Meshlet));
+	h.stringsOffset = (unsigned int)offset;
+	offset += strings.size();
+	h.fileSize = offset;
+
+	std::vector<char> data(offset, 0);
+	memcpy(&data[0], &h, sizeof(h));
+
+	for (unsigned int i = 0; i < numUsed; i++)
+	{
+		unsigned int v = vertexOrder[i];
+		const float* uv = hasTexCoords ? &mesh.texCoords[v * 2] : 0;
+		if (format == VERTEX_QUANTIZED)
+		{
+			QuantizedVertex* vertices = (QuantizedVertex*)&data[h.verticesOffset];
+			MeshQuantizer::Encode(h.bounds, &mesh.positions[v * 3], &(*normals)[v * 3], uv, &vertices[i]);
+			continue;
+		}
+
+		BakedVertex* vertices = (BakedVertex*)&data[h.verticesOffset];
+		memcpy(vertices[i].position, &mesh.positions[v * 3], sizeof(vertices[i].position));
+		memcpy(vertices[i].normal, &(*normals)[v * 3], sizeof(vertices[i].normal));
+		vertices[i].u = uv ? uv[0] : 0.0f;
+		vertices[i].v = uv ? uv[1] : 0.0f;
+	}
+
+	if (h.indexSize == 2)
+	{
+		unsigned short* indices = (unsigned short*)&data[h.indicesOffset];
+		for (size_t i = 0; i < sortedIndices.size(); i++)
+			indices[i] = (unsigned short)sortedIndices[i];
+	}
+	else
+	{
+		memcpy(&data[h.indicesOffset], &sortedIndices[0], sortedIndices.size() * 4);
+	}
+
+	if (!subsets.empty())
+		memcpy(&data[h.subsetsOffset], &subsets[0], subsets.size() * sizeof(BakedSubset));
+	if (!materials.empty())
+		memcpy(&data[h.materialsOffset], &materials[0], materials.size() * sizeof(BakedMaterial));
+	memcpy(&data[h.lodsOffset], &lods[0], lods.size() * sizeof(BakedLod));
+	if (!meshlets.empty())
+		memcpy(&data[h.meshletsOffset], &meshlets[0], meshlets.size() * sizeof(Meshlet));
+	if (!strings.empty())
+		memcpy(&data[h.stringsOffset], strings.data(), strings.size());
+
+	// written beside it and moved over, so a cache is never seen half written
+	std::string temp = path + ".tmp";
+	if (!WriteFile(temp, data))
+	{
+		remove(temp.c_str());
+		return false;
+	}
+
+	remove(path.c_str());
+	if (rename(temp.c_str(), path.c_str()) != 0)
+	{
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+int MeshCache::numVertices() const
+{
+	return _header ? (int)_header->numVertices : 0;
+}
+
+int MeshCache::numTriangles() const
+{
+	return _header ? (int)_header->numTriangles : 0;
+}
+
+int MeshCache::numSubsets() const
+{
+	return _header ? (int)_header->numSubsets : 0;
+}
+
+int MeshCache::numMaterials() const
+{
+	return _header ? (int)_header->numMaterials : 0;
+}
+
+VertexFormat MeshCache::vertexFormat() const
+{
+	return _header ? (VertexFormat)_header->vertexFormat : VERTEX_FLOAT;
+}
+
+int MeshCache::vertexSize() const
+{
+	return _header ? (int)VertexSize(_header->vertexFormat) : 0;
+}
+
+const BakedVertex* MeshCache::vertices() const
+{
+	if (!_header || _header->vertexFormat != VERTEX_FLOAT)
+		return 0;
+	return (const BakedVertex*)(_file.data() + _header->verticesOffset);
+}
+
+const QuantizedVertex* MeshCache::quantizedVertices() const
+{
+	if (!_header || _header->vertexFormat != VERTEX_QUANTIZED)
+		return 0;
+	return (const QuantizedVertex*)(_file.data() + _header->verticesOffset);
+}
+
+const QuantizationBounds* MeshCache::quantizationBounds() const
+{
+	return _header ? &_header->bounds : 0;
+}
+
+void MeshCache::vertex(int i, BakedVertex* out) const
+{
+	if (_header->vertexFormat == VERTEX_QUANTIZED)
+	{
+		float uv[2];
+		MeshQuantizer::Decode(_header->bounds, quantizedVertices()[i], out->position, out->normal, uv);
+		out->u = uv[0];
+		out->v = uv[1];
+	}
+	else
+	{
+		*out = vertices()[i];
+	}
+}
+
+const void* MeshCache::indices() const
+{
+	return _header ? _file.data() + _header->indicesOffset : 0;
+}
+
+int MeshCache::indexSize() const
+{
+	return _header ? (int)_header->indexSize : 0;
+}
+
+const BakedSubset* MeshCache::subsets() const
+{
+	return _header ? (const BakedSubset*)(_file.data() + _header->subsetsOffset) : 0;
+}
+
+int MeshCache::numLods() const
+{
+	return _header ? (int)_header->numLods : 0;
+}
+
+const BakedLod* MeshCache::lods() const
+{
+	return _header ? (const BakedLod*)(_file.data() + _header->lodsOffset) : 0;
+}
+
+int MeshCache::numMeshlets() const
+{
+	return _header ? (int)_header->numMeshlets : 0;
+}
+
+const Meshlet* MeshCache::meshlets() const
+{
+	return _header ? (const Meshlet*)(_file.data() + _header->meshletsOffset) : 0;
+}
+
+const BakedMaterial* MeshCache::materials() const
+{
+	return _header ? (const BakedMaterial*)(_file.data() + _header->materialsOffset) : 0;
+}
+
+const char* MeshCache::texture(int material) const
+{
+	unsigned int offset = materials()[material].texture;
+	if (offset == NO_TEXTURE || offset >= _header->stringsSize)
+		return 0;
+	return _file.data() + _header->stringsOffset + offset;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string>
+#include "MappedFile.h"
+#include "XFile.h"
+#include "MeshQuantizer.h"
+#include "Meshlets.h"
+
+//A vertex the way Model draws it, D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_TEX1
+struct BakedVertex
+{
+	float position[3];
+	float normal[3];
+	float u, v;
+};
+
+//How a cache stores its vertices
+enum VertexFormat
+{
+	VERTEX_FLOAT,     // BakedVertex, 32 bytes, copied straight into the vertex buffer
+	VERTEX_QUANTIZED  // QuantizedVertex, 16 bytes, decoded with the cache's bounds
+};
+
+//A run of triangles with one material, laid out like D3DXATTRIBUTERANGE
+struct BakedSubset
+{
+	unsigned int material;
+	unsigned int firstTriangle;
+	unsigned int numTriangles;
+	unsigned int firstVertex;
+	unsigned int numVertices;
+};
+
+struct BakedMaterial
+{
+	float diffuse[4];
+	float power;
+	float specular[3];
+	float emissive[3];
+	unsigned int texture; // offset of the file name in the string table, NO_TEXTURE if none
+};
+
+//A level of detail: the subsets that draw the whole mesh at one error
+struct BakedLod
+{
+	unsigned int firstSubset;
+	unsigned int numSubsets;
+	unsigned int firstTriangle;
+	unsigned int numTriangles;
+	float error; // how far, in mesh units, the level strays from the full mesh
+	unsigned int firstMeshlet;
+	unsigned int numMeshlets;
+};
+
+/*Meshes baked into a file that is used as it is mapped, so a model that was
+loaded before starts without parsing anything.
+
+The cache for a.x is a.x.mesh, next to it. It holds a hash of the .x file's
+contents, and is baked again whenever that no longer matches, or the cache
+was written by a different version of the baker. Vertex, index, subset and
+material blobs each start on a cache line, and the triangles are sorted by
+material so every subset is one range of the index buffer. The levels of
+detail from MeshLod follow the full mesh in the index buffer, over the same
+vertices, each with subsets of its own and split into meshlets whose
+triangles are counted from the start of the index buffer. Vertices are kept as floats or
+quantized with MeshQuantizer, whichever open asks for; a cache in the other
+format is baked again.*/
+class MeshCache
+{
+public:
+	static const unsigned int NO_TEXTURE = 0xFFFFFFFF;
+
+	MeshCache();
+
+	// Maps the cache for source, baking it first if it is missing, stale or
+	// has its vertices in another format.
+	bool open(const std::string& source, std::string* error = 0, VertexFormat format = VERTEX_FLOAT);
+	void close();
+
+	// Whether the last open had to bake the cache.
+	bool rebuilt() const { return _rebuilt; }
+
+	int numVertices() const;
+	int numTriangles() const; // of every level together
+	int numSubsets() const;   // of every level together
+	int numMaterials() const;
+	int numLods() const;      // 1 or more, the first being the full mesh
+	int numMeshlets() const;  // of every level together
+
+	VertexFormat vertexFormat() const;
+	int vertexSize() const;
+	const BakedVertex* vertices() const;                   // 0 unless the format is VERTEX_FLOAT
+	const QuantizedVertex* quantizedVertices() const;      // 0 unless the format is VERTEX_QUANTIZED
+	const QuantizationBounds* quantizationBounds() const;  // what quantizedVertices are fractions of
+	void vertex(int i, BakedVertex* out) const;            // in either format
+	const void* indices() const; // 3 per triangle, indexSize() bytes each
+	int indexSize() const;       // 2 while the vertices fit in 16 bit indices, else 4
+	const BakedSubset* subsets() const;
+	const BakedMaterial* materials() const;
+	const BakedLod* lods() const;
+	const Meshlet* meshlets() const;
+	const char* texture(int material) const; // 0 if the material has none
+
+	// Writes mesh as a cache for a source with the given hash.
+	static bool Bake(const XMesh& mesh, unsigned long long sourceHash, const std::string& path,
+		VertexFormat format = VERTEX_FLOAT);
+
+	static unsigned long long Hash(const char* data, size_t size);
+	static std::string CachePath(const std::string& source);
+
+private:
+	bool valid(unsigned long long sourceHash, VertexFormat format);
+
+	MappedFile _file;
+	const struct BakedHeader* _header;
+	bool _rebuilt;
+};
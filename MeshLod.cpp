@@ -0,0 +1,668 @@
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include "MeshLod.h"
+#include "MeshOptimizer.h"
+/*Quadric error simplification for level of detail chains*/
+
+const float MeshLod::PIXEL_ERROR = 1.0f;
+const float MeshLod::HYSTERESIS = 0.25f;
+
+namespace
+{
+	// How much more than a triangle's plane the plane across a border, seam or
+	// material edge counts, so the simplifier keeps those lines where they are
+	const double BOUNDARY_WEIGHT = 10.0;
+
+	// Levels stop before they get this small
+	const size_t MIN_TRIANGLES = 16;
+
+	// Vertices at one position closer than this in uv, and in normal, are
+	// taken as one surface. Exporters often give every face its own slightly
+	// different uvs, which would otherwise make every edge a seam.
+	const float UV_TOLERANCE = 1.0f / 64.0f;
+	const float NORMAL_TOLERANCE = 0.9f; // cosine, about 25 degrees
+
+	// Sum of squared distances to weighted planes, as the symmetric matrix
+	// A, the vector b and the constant c of p'Ap + 2b'p + c
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2;
+		double c;
+		double weight;
+
+		void addPlane(const double n[3], double d, double w)
+		{
+			a00 += w * n[0] * n[0]; a01 += w * n[0] * n[1]; a02 += w * n[0] * n[2];
+			a11 += w * n[1] * n[1]; a12 += w * n[1] * n[2]; a22 += w * n[2] * n[2];
+			b0 += w * n[0] * d; b1 += w * n[1] * d; b2 += w * n[2] * d;
+			c += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02;
+			a11 += q.a11; a12 += q.a12; a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+			weight += q.weight;
+		}
+
+		// Mean squared distance of p to the planes
+		double error(const float* p) const
+		{
+			double x = p[0], y = p[1], z = p[2];
+			double e = x * (a00 * x + 2.0 * (a01 * y + a02 * z + b0))
+				+ y * (a11 * y + 2.0 * (a12 * z + b1))
+				+ z * (a22 * z + 2.0 * b2)
+				+ c;
+			return weight > 0.0 ? (e > 0.0 ? e : 0.0) / weight : 0.0;
+		}
+	};
+
+	// A triangle's side, by the two positions it joins, smaller first
+	struct Edge
+	{
+		unsigned int a, b;
+		unsigned int triangle;
+
+		bool operator<(const Edge& e) const
+		{
+			return a < e.a || (a == e.a && (b < e.b || (b == e.b && triangle < e.triangle)));
+		}
+	};
+
+	// Moving position from onto position to
+	struct Collapse
+	{
+		unsigned int from, to;
+		double cost;
+
+		bool operator<(const Collapse& c) const
+		{
+			return cost < c.cost;
+		}
+	};
+
+	// Orders vertex indices by the bits of their positions
+	struct PositionLess
+	{
+		const float* positions;
+
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			int c = memcmp(positions + a * 3, positions + b * 3, 3 * sizeof(float));
+			return c < 0 || (c == 0 && a < b);
+		}
+	};
+
+	void Cross(const float* a, const float* b, const float* c, double n[3])
+	{
+		double e1[3] = { (double)b[0] - a[0], (double)b[1] - a[1], (double)b[2] - a[2] };
+		double e2[3] = { (double)c[0] - a[0], (double)c[1] - a[1], (double)c[2] - a[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+
+	double Length(const double v[3])
+	{
+		return sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	}
+
+	size_t CountMaterials(const std::vector<unsigned int>& attributes)
+	{
+		std::vector<unsigned int> materials(attributes);
+		std::sort(materials.begin(), materials.end());
+		return std::unique(materials.begin(), materials.end()) - materials.begin();
+	}
+
+	/*The working state of one Simplify: triangles as vertex indices, and the
+	position each vertex stands for*/
+	class Simplifier
+	{
+	public:
+		Simplifier(const XMesh& mesh, const std::vector<unsigned int>& indices, const std::vector<unsigned int>& attributes)
+			: _positions(&mesh.positions[0])
+			, _numVertices(mesh.numVertices())
+			, _error(0.0)
+		{
+			joinPositions(mesh);
+
+			// triangles that are already a line or a point draw nothing
+			for (size_t t = 0; t < attributes.size(); t++)
+			{
+				const unsigned int* tri = &indices[t * 3];
+				unsigned int a = _position[tri[0]], b = _position[tri[1]], c = _position[tri[2]];
+				if (a == b || b == c || c == a)
+					continue;
+
+				_indices.insert(_indices.end(), tri, tri + 3);
+				_attributes.push_back(attributes[t]);
+			}
+
+			buildQuadrics();
+		}
+
+		size_t numTriangles() const { return _attributes.size(); }
+		double error() const { return sqrt(_error); }
+
+		// One round of the cheapest collapses that don't touch each other.
+		// Returns how many triangles went.
+		size_t pass(size_t wanted);
+
+		void result(std::vector<unsigned int>* indices, std::vector<unsigned int>* attributes)
+		{
+			indices->swap(_indices);
+			attributes->swap(_attributes);
+		}
+
+	private:
+		void joinPositions(const XMesh& mesh);
+		void buildQuadrics();
+		void findEdges();
+		bool canCollapse(unsigned int from, unsigned int to);
+
+		const float* pos(unsigned int p) const { return _positions + p * 3; }
+		unsigned int corner(unsigned int t, int k) const { return _position[_indices[t * 3 + k]]; }
+
+		const float* _positions;
+		size_t _numVertices;
+		std::vector<unsigned int> _position; // the first vertex with each vertex's position
+		std::vector<unsigned int> _wedge;    // the first vertex there that looks the same
+
+		std::vector<unsigned int> _indices;
+		std::vector<unsigned int> _attributes;
+		std::vector<Quadric> _quadrics;      // by position
+		double _error;                       // worst collapse so far, squared
+
+		// rebuilt every pass
+		std::vector<Edge> _edges;
+		std::vector<bool> _boundary;               // by edge, the same for every side in it
+		std::vector<unsigned int> _boundaryEdges;  // by position
+		std::vector<unsigned int> _firstTriangle;  // by position, into _triangles
+		std::vector<unsigned int> _triangles;      // around each position
+		std::vector<bool> _locked;                 // by position
+
+		// scratch for canCollapse
+		std::vector<unsigned int> _wedges;
+		std::vector<unsigned int> _neighbours;
+		std::vector<unsigned int> _others;
+	};
+
+	void Simplifier::joinPositions(const XMesh& mesh)
+	{
+		std::vector<unsigned int> order(_numVertices);
+		for (size_t v = 0; v < _numVertices; v++)
+			order[v] = (unsigned int)v;
+
+		PositionLess less;
+		less.positions = _positions;
+		std::sort(order.begin(), order.end(), less);
+
+		_position.resize(_numVertices);
+		for (size_t i = 0; i < _numVertices; i++)
+		{
+			bool same = i > 0 && memcmp(pos(order[i]), pos(order[i - 1]), 3 * sizeof(float)) == 0;
+			_position[order[i]] = same ? _position[order[i - 1]] : order[i];
+		}
+
+		bool hasNormals = !mesh.normals.empty();
+		bool hasTexCoords = !mesh.texCoords.empty();
+
+		_wedge.resize(_numVertices);
+		for (size_t i = 0; i < _numVertices; )
+		{
+			size_t end = i + 1;
+			while (end < _numVertices && _position[order[end]] == _position[order[i]])
+				end++;
+
+			// each vertex joins the first before it at the position it looks like
+			for (size_t j = i; j < end; j++)
+			{
+				unsigned int v = order[j];
+				_wedge[v] = v;
+				for (size_t k = i; k < j; k++)
+				{
+					unsigned int w = order[k];
+					if (_wedge[w] != w)
+						continue;
+
+					if (hasTexCoords && (fabsf(mesh.texCoords[v * 2] - mesh.texCoords[w * 2]) > UV_TOLERANCE
+						|| fabsf(mesh.texCoords[v * 2 + 1] - mesh.texCoords[w * 2 + 1]) > UV_TOLERANCE))
+					{
+						continue;
+					}
+					if (hasNormals && mesh.normals[v * 3] * mesh.normals[w * 3] + mesh.normals[v * 3 + 1] * mesh.normals[w * 3 + 1]
+						+ mesh.normals[v * 3 + 2] * mesh.normals[w * 3 + 2] < NORMAL_TOLERANCE)
+					{
+						continue;
+					}
+
+					_wedge[v] = w;
+					break;
+				}
+			}
+			i = end;
+		}
+	}
+
+	/*Every position starts with the planes of its triangles, weighted by
+	area, and the planes standing up along its boundary edges*/
+	void Simplifier::buildQuadrics()
+	{
+		Quadric zero;
+		memset(&zero, 0, sizeof(zero));
+		_quadrics.assign(_numVertices, zero);
+
+		for (size_t t = 0; t < _attributes.size(); t++)
+		{
+			double n[3];
+			Cross(pos(corner((unsigned int)t, 0)), pos(corner((unsigned int)t, 1)), pos(corner((unsigned int)t, 2)), n);
+			double area = Length(n);
+			if (area == 0.0)
+				continue;
+
+			n[0] /= area; n[1] /= area; n[2] /= area;
+			const float* p = pos(corner((unsigned int)t, 0));
+			double d = -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]);
+			for (int k = 0; k < 3; k++)
+				_quadrics[corner((unsigned int)t, k)].addPlane(n, d, area * 0.5);
+		}
+
+		findEdges();
+		for (size_t i = 0; i < _edges.size(); )
+		{
+			size_t end = i + 1;
+			while (end < _edges.size() && _edges[end].a == _edges[i].a && _edges[end].b == _edges[i].b)
+				end++;
+
+			unsigned int a = _edges[i].a, b = _edges[i].b;
+			if (_boundary[i])
+			{
+				const float* pa = pos(a);
+				const float* pb = pos(b);
+				double e[3] = { (double)pb[0] - pa[0], (double)pb[1] - pa[1], (double)pb[2] - pa[2] };
+				double length = Length(e);
+
+				for (size_t j = i; j < end && length > 0.0; j++)
+				{
+					unsigned int t = _edges[j].triangle;
+					double n[3];
+					Cross(pos(corner(t, 0)), pos(corner(t, 1)), pos(corner(t, 2)), n);
+
+					// the plane through the edge, square to the triangle
+					double s[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+					double ls = Length(s);
+					if (ls == 0.0)
+						continue;
+
+					s[0] /= ls; s[1] /= ls; s[2] /= ls;
+					double d = -(s[0] * pa[0] + s[1] * pa[1] + s[2] * pa[2]);
+					_quadrics[a].addPlane(s, d, BOUNDARY_WEIGHT * length * length);
+					_quadrics[b].addPlane(s, d, BOUNDARY_WEIGHT * length * length);
+				}
+			}
+			i = end;
+		}
+	}
+
+	/*Sorts the triangles' sides into edges and counts, for every position,
+	its edges that are open borders, seams (the triangles either side use
+	different vertices there) or between materials. Also which triangles
+	are around every position.*/
+	void Simplifier::findEdges()
+	{
+		size_t numTriangles = _attributes.size();
+
+		_edges.resize(numTriangles * 3);
+		for (size_t t = 0; t < numTriangles; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = corner((unsigned int)t, k), b = corner((unsigned int)t, (k + 1) % 3);
+				Edge& e = _edges[t * 3 + k];
+				e.a = a < b ? a : b;
+				e.b = a < b ? b : a;
+				e.triangle = (unsigned int)t;
+			}
+		}
+		std::sort(_edges.begin(), _edges.end());
+
+		_boundary.assign(_edges.size(), false);
+		_boundaryEdges.assign(_numVertices, 0);
+		for (size_t i = 0; i < _edges.size(); )
+		{
+			size_t end = i + 1;
+			while (end < _edges.size() && _edges[end].a == _edges[i].a && _edges[end].b == _edges[i].b)
+				end++;
+
+			bool boundary = end - i != 2;
+			if (!boundary)
+			{
+				unsigned int t0 = _edges[i].triangle, t1 = _edges[i + 1].triangle;
+				boundary = _attributes[t0] != _attributes[t1];
+				for (int k = 0; k < 3 && !boundary; k++)
+				{
+					for (int j = 0; j < 3 && !boundary; j++)
+					{
+						// the same position through different vertices
+						boundary = corner(t0, k) == corner(t1, j) && _wedge[_indices[t0 * 3 + k]] != _wedge[_indices[t1 * 3 + j]];
+					}
+				}
+			}
+
+			if (boundary)
+			{
+				_boundaryEdges[_edges[i].a]++;
+				_boundaryEdges[_edges[i].b]++;
+				for (size_t j = i; j < end; j++)
+					_boundary[j] = true;
+			}
+			i = end;
+		}
+
+		_firstTriangle.assign(_numVertices + 1, 0);
+		for (size_t i = 0; i < _indices.size(); i++)
+			_firstTriangle[_position[_indices[i]] + 1]++;
+		for (size_t p = 0; p < _numVertices; p++)
+			_firstTriangle[p + 1] += _firstTriangle[p];
+
+		_triangles.resize(_indices.size());
+		std::vector<unsigned int> fill(_firstTriangle.begin(), _firstTriangle.end() - 1);
+		for (size_t t = 0; t < numTriangles; t++)
+		{
+			for (int k = 0; k < 3; k++)
+				_triangles[fill[corner((unsigned int)t, k)]++] = (unsigned int)t;
+		}
+	}
+
+	/*Whether moving from onto to keeps the mesh as it was where it matters:
+	every vertex at from has one to take its place at to, no triangle turns
+	over, and the edge is the only thing the two positions share, so nothing
+	gets pinched together*/
+	bool Simplifier::canCollapse(unsigned int from, unsigned int to)
+	{
+		// pairs of the vertex at from and the one at to, in the triangles on the edge
+		_wedges.clear();
+		for (unsigned int i = _firstTriangle[from]; i < _firstTriangle[from + 1]; i++)
+		{
+			unsigned int t = _triangles[i];
+			int kf = -1, kt = -1;
+			for (int k = 0; k < 3; k++)
+			{
+				if (corner(t, k) == from)
+					kf = k;
+				else if (corner(t, k) == to)
+					kt = k;
+			}
+			if (kt < 0)
+				continue;
+
+			unsigned int wf = _wedge[_indices[t * 3 + kf]], wt = _indices[t * 3 + kt];
+			for (size_t j = 0; j < _wedges.size(); j += 2)
+			{
+				if (_wedges[j] == wf && _wedge[_wedges[j + 1]] != _wedge[wt])
+					return false; // a seam crosses the edge
+			}
+			_wedges.push_back(wf);
+			_wedges.push_back(wt);
+		}
+
+		_neighbours.clear();
+		for (unsigned int i = _firstTriangle[from]; i < _firstTriangle[from + 1]; i++)
+		{
+			unsigned int t = _triangles[i];
+			int kf = 0;
+			while (corner(t, kf) != from)
+				kf++;
+
+			// every vertex at from needs a partner at to
+			unsigned int wf = _wedge[_indices[t * 3 + kf]];
+			bool paired = false;
+			for (size_t j = 0; j < _wedges.size() && !paired; j += 2)
+				paired = _wedges[j] == wf;
+			if (!paired)
+				return false;
+
+			unsigned int b = corner(t, (kf + 1) % 3), c = corner(t, (kf + 2) % 3);
+			_neighbours.push_back(b);
+			_neighbours.push_back(c);
+			if (b == to || c == to)
+				continue;
+
+			// the triangle mustn't turn over
+			const float* p[3] = { pos(corner(t, 0)), pos(corner(t, 1)), pos(corner(t, 2)) };
+			double before[3], after[3];
+			Cross(p[0], p[1], p[2], before);
+			p[kf] = pos(to);
+			Cross(p[0], p[1], p[2], after);
+			if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0)
+				return false;
+		}
+
+		// the positions both ends share must be the corners opposite the edge
+		std::sort(_neighbours.begin(), _neighbours.end());
+		_neighbours.erase(std::unique(_neighbours.begin(), _neighbours.end()), _neighbours.end());
+
+		_others.clear();
+		for (unsigned int i = _firstTriangle[to]; i < _firstTriangle[to + 1]; i++)
+		{
+			unsigned int t = _triangles[i];
+			for (int k = 0; k < 3; k++)
+			{
+				if (corner(t, k) != to && corner(t, k) != from)
+					_others.push_back(corner(t, k));
+			}
+		}
+		std::sort(_others.begin(), _others.end());
+		_others.erase(std::unique(_others.begin(), _others.end()), _others.end());
+
+		size_t shared = 0;
+		for (size_t i = 0, j = 0; i < _neighbours.size() && j < _others.size(); )
+		{
+			if (_neighbours[i] < _others[j])
+				i++;
+			else if (_others[j] < _neighbours[i])
+				j++;
+			else
+			{
+				shared++;
+				i++;
+				j++;
+			}
+		}
+
+		// one opposite corner per triangle on the edge
+		return shared == _wedges.size() / 2;
+	}
+
+	size_t Simplifier::pass(size_t wanted)
+	{
+		findEdges();
+
+		// the cheaper way along every edge a vertex may move
+		std::vector<Collapse> collapses;
+		for (size_t i = 0; i < _edges.size(); )
+		{
+			size_t end = i + 1;
+			while (end < _edges.size() && _edges[end].a == _edges[i].a && _edges[end].b == _edges[i].b)
+				end++;
+
+			unsigned int a = _edges[i].a, b = _edges[i].b;
+			bool boundary = _boundary[i];
+			i = end;
+
+			// inside vertices go anywhere, ones on a single line only along it
+			bool aMoves = _boundaryEdges[a] == 0 || (_boundaryEdges[a] == 2 && boundary);
+			bool bMoves = _boundaryEdges[b] == 0 || (_boundaryEdges[b] == 2 && boundary);
+			if (!aMoves && !bMoves)
+				continue;
+
+			Quadric q = _quadrics[a];
+			q.add(_quadrics[b]);
+
+			Collapse c;
+			double toB = aMoves ? q.error(pos(b)) : DBL_MAX;
+			double toA = bMoves ? q.error(pos(a)) : DBL_MAX;
+			c.from = toB <= toA ? a : b;
+			c.to = toB <= toA ? b : a;
+			c.cost = toB <= toA ? toB : toA;
+			collapses.push_back(c);
+		}
+		std::sort(collapses.begin(), collapses.end());
+
+		// no dearer than the collapses that would do if none were in each
+		// other's way (two triangles each); the rest wait for the next pass
+		size_t affordable = wanted / 2 + 1;
+		double limit = collapses.empty() ? 0.0 : collapses[affordable < collapses.size() ? affordable - 1 : collapses.size() - 1].cost;
+
+		_locked.assign(_numVertices, false);
+		size_t removed = 0;
+		for (size_t i = 0; i < collapses.size() && removed < wanted && collapses[i].cost <= limit; i++)
+		{
+			unsigned int from = collapses[i].from, to = collapses[i].to;
+			if (_locked[from] || _locked[to] || !canCollapse(from, to))
+				continue;
+
+			for (unsigned int j = _firstTriangle[from]; j < _firstTriangle[from + 1]; j++)
+			{
+				unsigned int t = _triangles[j];
+				for (int k = 0; k < 3; k++)
+					_locked[corner(t, k)] = true;
+			}
+
+			for (unsigned int j = _firstTriangle[from]; j < _firstTriangle[from + 1]; j++)
+			{
+				unsigned int t = _triangles[j];
+				unsigned int* tri = &_indices[t * 3];
+				int kf = 0;
+				while (corner(t, kf) != from)
+					kf++;
+
+				// the triangles on the edge flatten, and go below
+				if (corner(t, (kf + 1) % 3) == to || corner(t, (kf + 2) % 3) == to)
+					removed++;
+
+				for (size_t w = 0; w < _wedges.size(); w += 2)
+				{
+					if (_wedges[w] == _wedge[tri[kf]])
+					{
+						tri[kf] = _wedges[w + 1];
+						break;
+					}
+				}
+			}
+
+			_quadrics[to].add(_quadrics[from]);
+			_error = collapses[i].cost > _error ? collapses[i].cost : _error;
+		}
+
+		// drop the triangles the collapses flattened
+		size_t kept = 0;
+		for (size_t t = 0; t < _attributes.size(); t++)
+		{
+			unsigned int a = corner((unsigned int)t, 0), b = corner((unsigned int)t, 1), c = corner((unsigned int)t, 2);
+			if (a == b || b == c || c == a)
+				continue;
+
+			memmove(&_indices[kept * 3], &_indices[t * 3], 3 * sizeof(unsigned int));
+			_attributes[kept] = _attributes[t];
+			kept++;
+		}
+		_indices.resize(kept * 3);
+		_attributes.resize(kept);
+
+		return removed;
+	}
+}
+
+float MeshLod::Simplify(const XMesh& mesh, const std::vector<unsigned int>& indices, const std::vector<unsigned int>& attributes,
+	size_t targetTriangles, std::vector<unsigned int>* outIndices, std::vector<unsigned int>* outAttributes)
+{
+	if (mesh.positions.empty())
+	{
+		outIndices->clear();
+		outAttributes->clear();
+		return 0.0f;
+	}
+
+	Simplifier simplifier(mesh, indices, attributes);
+	while (simplifier.numTriangles() > targetTriangles)
+	{
+		if (simplifier.pass(simplifier.numTriangles() - targetTriangles) == 0)
+			break;
+	}
+
+	simplifier.result(outIndices, outAttributes);
+	return (float)simplifier.error();
+}
+
+void MeshLod::BuildChain(const XMesh& mesh, std::vector<MeshLodLevel>* levels)
+{
+	levels->clear();
+	levels->resize(1);
+	(*levels)[0].indices = mesh.indices;
+	(*levels)[0].attributes = mesh.attributes;
+	(*levels)[0].error = 0.0f;
+
+	size_t target = mesh.numTriangles();
+	while ((int)levels->size() < MAX_LEVELS)
+	{
+		target /= 2;
+		if (target < MIN_TRIANGLES)
+			break;
+
+		MeshLodLevel level;
+		level.error = Simplify(mesh, mesh.indices, mesh.attributes, target, &level.indices, &level.attributes);
+
+		// stuck well short of the target, the rest would be no better
+		size_t previous = levels->back().attributes.size();
+		if (level.attributes.empty() || level.attributes.size() * 4 > previous * 3)
+			break;
+
+		// a material gone means a subset boundary gave way
+		if (CountMaterials(level.attributes) < CountMaterials(mesh.attributes))
+			break;
+
+		if (level.error < levels->back().error)
+			level.error = levels->back().error;
+
+		MeshOptimizer::OptimizeTriangles(&level.indices, &level.attributes, &mesh.positions[0], mesh.numVertices());
+		levels->push_back(level);
+	}
+
+	for (size_t l = 0; l < levels->size() && !mesh.positions.empty(); l++)
+	{
+		MeshLodLevel& level = (*levels)[l];
+		Meshlets::Build(&level.indices, level.attributes, &mesh.positions[0], mesh.numVertices(), &level.meshlets);
+	}
+}
+
+/*Goes to finer levels while the current one's error shows, then to coarser
+ones while the next one's error is well under the limit*/
+int MeshLod::Select(const float* errors, int numLevels, int current, float radius, float screenRadius)
+{
+	if (numLevels <= 1 || radius <= 0.0f)
+		return 0;
+
+	int level = current < 0 ? 0 : (current >= numLevels ? numLevels - 1 : current);
+	float pixelsPerUnit = screenRadius / radius;
+
+	while (level > 0 && errors[level] * pixelsPerUnit > PIXEL_ERROR)
+		level--;
+	while (level + 1 < numLevels && errors[level + 1] * pixelsPerUnit < PIXEL_ERROR * (1.0f - HYSTERESIS))
+		level++;
+
+	return level;
+}
+
+float MeshLod::ScreenRadius(float radius, float depth, float projectionScale, float viewportHeight)
+{
+	if (depth <= radius)
+		return FLT_MAX;
+	return radius * projectionScale * viewportHeight * 0.5f / depth;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include "XFile.h"
+#include "Meshlets.h"
+
+//One level of detail: the whole mesh drawn with fewer triangles, over the same vertices
+struct MeshLodLevel
+{
+	std::vector<unsigned int> indices;    // 3 per triangle, into the mesh's vertices
+	std::vector<unsigned int> attributes; // material of each triangle
+	float error;                          // how far, in mesh units, it strays from the full mesh
+	std::vector<Meshlet> meshlets;        // runs of indices, in order, covering every triangle
+};
+
+/*Level of detail chains and choosing between them.
+
+Simplify collapses edges in the order of their quadric error (Garland and
+Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997), always
+onto one of the edge's vertices, so a level only ever uses vertices of the
+full mesh and every level can share its vertex buffer. Vertices are joined
+by position, so the copies a uv seam or a hard edge splits move together;
+a vertex on a seam, an open border or the edge between two materials may
+only slide along it, and one where those meet never moves. Collapses that
+would flip a triangle or pinch the surface are skipped.*/
+class MeshLod
+{
+public:
+	// Most levels in a chain, the full mesh included
+	static const int MAX_LEVELS = 5;
+
+	// Largest error, in pixels, a level may show on screen
+	static const float PIXEL_ERROR;
+	// How far below PIXEL_ERROR the next level's error has to be before
+	// switching to it, as a fraction, so levels don't flicker at the edge
+	static const float HYSTERESIS;
+
+	// Simplifies the triangles (indices into mesh's vertices, and their
+	// attributes) down to targetTriangles or as near as it can get. Returns
+	// the error of the result.
+	static float Simplify(const XMesh& mesh, const std::vector<unsigned int>& indices, const std::vector<unsigned int>& attributes,
+		size_t targetTriangles, std::vector<unsigned int>* outIndices, std::vector<unsigned int>* outAttributes);
+
+	// levels gets the full mesh and then levels of a half, a quarter... of its
+	// triangles, until MAX_LEVELS or simplifying stops getting anywhere. Every
+	// level is sorted by material, in vertex cache order and split into
+	// meshlets. mesh should be through MeshOptimizer already.
+	static void BuildChain(const XMesh& mesh, std::vector<MeshLodLevel>* levels);
+
+	// The coarsest level whose error stays under PIXEL_ERROR for a bounding
+	// sphere of radius drawn screenRadius pixels across, moving from current.
+	static int Select(const float* errors, int numLevels, int current, float radius, float screenRadius);
+
+	// Pixels a sphere's radius covers at depth in front of the camera, for a
+	// projection whose _22 is projectionScale. Huge if the camera is inside.
+	static float ScreenRadius(float radius, float depth, float projectionScale, float viewportHeight);
+};
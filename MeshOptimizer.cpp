@@ -0,0 +1,634 @@
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include "MeshOptimizer.h"
+/*Triangle and vertex reordering for the post-transform cache, overdraw and
+vertex fetch, and the metrics that measure them*/
+
+const float MeshOptimizer::OVERDRAW_THRESHOLD = 1.05f;
+
+namespace
+{
+	const int GRID = 256; // overdraw is measured at this resolution
+
+	// A FIFO post-transform cache, as the metrics and soft boundaries model it
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t numVertices)
+			: _stamp(numVertices, 0)
+			, _time(MeshOptimizer::CACHE_SIZE + 1)
+		{
+		}
+
+		// Returns 1 if v had to be transformed
+		int access(unsigned int v)
+		{
+			if (_time - _stamp[v] <= (unsigned int)MeshOptimizer::CACHE_SIZE)
+				return 0;
+			_stamp[v] = _time++;
+			return 1;
+		}
+
+		void flush()
+		{
+			_time += MeshOptimizer::CACHE_SIZE + 1;
+		}
+
+	private:
+		std::vector<unsigned int> _stamp; // when each vertex went in
+		unsigned int _time;               // vertices put in so far
+	};
+
+	// Orders vertex records by their bits, ties by index so the first stays first
+	struct RecordLess
+	{
+		const float* records;
+		int stride;
+
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			int c = memcmp(records + a * stride, records + b * stride, stride * sizeof(float));
+			return c < 0 || (c == 0 && a < b);
+		}
+	};
+
+	// Area weighted centroid and summed face normal of a run of triangles
+	void ClusterShape(const float* positions, const unsigned int* indices, size_t first, size_t end,
+		float centroid[3], float normal[3])
+	{
+		float area = 0.0f;
+		centroid[0] = centroid[1] = centroid[2] = 0.0f;
+		normal[0] = normal[1] = normal[2] = 0.0f;
+
+		for (size_t t = first; t < end; t++)
+		{
+			const float* a = &positions[indices[t * 3] * 3];
+			const float* b = &positions[indices[t * 3 + 1] * 3];
+			const float* c = &positions[indices[t * 3 + 2] * 3];
+
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0]
+			};
+			float w = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int k = 0; k < 3; k++)
+			{
+				centroid[k] += (a[k] + b[k] + c[k]) * (w / 3.0f);
+				normal[k] += n[k];
+			}
+			area += w;
+		}
+
+		if (area > 0.0f)
+		{
+			centroid[0] /= area;
+			centroid[1] /= area;
+			centroid[2] /= area;
+		}
+	}
+
+	// Six times the volume the triangles enclose around center; negative when
+	// the winding makes the face normals point inwards
+	float SignedVolume(const float* positions, const unsigned int* indices, size_t numTriangles, const float center[3])
+	{
+		float volume = 0.0f;
+		for (size_t t = 0; t < numTriangles; t++)
+		{
+			const float* a = &positions[indices[t * 3] * 3];
+			const float* b = &positions[indices[t * 3 + 1] * 3];
+			const float* c = &positions[indices[t * 3 + 2] * 3];
+
+			float p[3] = { a[0] - center[0], a[1] - center[1], a[2] - center[2] };
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			volume += p[0] * (e1[1] * e2[2] - e1[2] * e2[1])
+				+ p[1] * (e1[2] * e2[0] - e1[0] * e2[2])
+				+ p[2] * (e1[0] * e2[1] - e1[1] * e2[0]);
+		}
+		return volume;
+	}
+
+	struct ClusterOrder
+	{
+		const std::vector<float>* keys;
+
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			return (*keys)[a] > (*keys)[b];
+		}
+	};
+}
+
+void MeshOptimizer::Optimize(XMesh* mesh)
+{
+	WeldVertices(mesh);
+	if (mesh->positions.empty())
+		return;
+
+	OptimizeTriangles(&mesh->indices, &mesh->attributes, &mesh->positions[0], mesh->numVertices());
+	OptimizeVertexFetch(mesh);
+}
+
+void MeshOptimizer::OptimizeTriangles(std::vector<unsigned int>* indices, std::vector<unsigned int>* attributes,
+	const float* positions, size_t numVertices)
+{
+	size_t numTriangles = attributes->size();
+	if (numTriangles == 0)
+		return;
+
+	// stable counting sort by material, so each material is one run
+	unsigned int numMaterials = 0;
+	for (size_t t = 0; t < numTriangles; t++)
+		numMaterials = (*attributes)[t] + 1 > numMaterials ? (*attributes)[t] + 1 : numMaterials;
+
+	std::vector<unsigned int> start(numMaterials + 1, 0);
+	for (size_t t = 0; t < numTriangles; t++)
+		start[(*attributes)[t] + 1]++;
+	for (unsigned int m = 0; m < numMaterials; m++)
+		start[m + 1] += start[m];
+
+	std::vector<unsigned int> sortedIndices(numTriangles * 3);
+	std::vector<unsigned int> sortedAttributes(numTriangles);
+	std::vector<unsigned int> next(start.begin(), start.end() - 1);
+	for (size_t t = 0; t < numTriangles; t++)
+	{
+		unsigned int to = next[(*attributes)[t]]++;
+		memcpy(&sortedIndices[to * 3], &(*indices)[t * 3], 3 * sizeof(unsigned int));
+		sortedAttributes[to] = (*attributes)[t];
+	}
+
+	std::vector<unsigned int> clusters;
+	for (unsigned int m = 0; m < numMaterials; m++)
+	{
+		size_t count = (start[m + 1] - start[m]) * 3;
+		if (count == 0)
+			continue;
+
+		// Tipsify is a heuristic, and a run the exporter already ordered well
+		// can come out using the cache worse; that one keeps its order
+		unsigned int* run = &sortedIndices[start[m] * 3];
+		std::vector<unsigned int> input(run, run + count);
+		OptimizeVertexCache(run, count, numVertices, &clusters);
+		OptimizeOverdraw(run, count, positions, numVertices, clusters);
+		if (ACMR(run, count, numVertices) > ACMR(&input[0], count, numVertices))
+			memcpy(run, &input[0], count * sizeof(unsigned int));
+	}
+
+	indices->swap(sortedIndices);
+	attributes->swap(sortedAttributes);
+}
+
+/*Sorts the vertices by their bits and keeps the first of every run of equal
+ones*/
+int MeshOptimizer::WeldVertices(XMesh* mesh)
+{
+	size_t numVertices = mesh->numVertices();
+	if (numVertices == 0)
+		return 0;
+
+	bool hasNormals = !mesh->normals.empty();
+	bool hasTexCoords = !mesh->texCoords.empty();
+	int stride = 3 + (hasNormals ? 3 : 0) + (hasTexCoords ? 2 : 0);
+
+	std::vector<float> records(numVertices * stride);
+	for (size_t v = 0; v < numVertices; v++)
+	{
+		float* r = &records[v * stride];
+		memcpy(r, &mesh->positions[v * 3], 3 * sizeof(float));
+		r += 3;
+		if (hasNormals)
+		{
+			memcpy(r, &mesh->normals[v * 3], 3 * sizeof(float));
+			r += 3;
+		}
+		if (hasTexCoords)
+			memcpy(r, &mesh->texCoords[v * 2], 2 * sizeof(float));
+	}
+
+	std::vector<unsigned int> order(numVertices);
+	for (size_t v = 0; v < numVertices; v++)
+		order[v] = (unsigned int)v;
+
+	RecordLess less;
+	less.records = &records[0];
+	less.stride = stride;
+	std::sort(order.begin(), order.end(), less);
+
+	// every vertex to the first one with the same bits
+	std::vector<unsigned int> first(numVertices);
+	for (size_t i = 0; i < numVertices; i++)
+	{
+		bool same = i > 0 && memcmp(&records[order[i] * stride], &records[order[i - 1] * stride], stride * sizeof(float)) == 0;
+		first[order[i]] = same ? first[order[i - 1]] : order[i];
+	}
+
+	// keep the firsts, in their original order
+	std::vector<unsigned int> remap(numVertices);
+	unsigned int kept = 0;
+	for (size_t v = 0; v < numVertices; v++)
+	{
+		if (first[v] == v)
+		{
+			remap[v] = kept;
+			memmove(&mesh->positions[kept * 3], &mesh->positions[v * 3], 3 * sizeof(float));
+			if (hasNormals)
+				memmove(&mesh->normals[kept * 3], &mesh->normals[v * 3], 3 * sizeof(float));
+			if (hasTexCoords)
+				memmove(&mesh->texCoords[kept * 2], &mesh->texCoords[v * 2], 2 * sizeof(float));
+			kept++;
+		}
+		else
+		{
+			remap[v] = remap[first[v]];
+		}
+	}
+
+	for (size_t i = 0; i < mesh->indices.size(); i++)
+		mesh->indices[i] = remap[mesh->indices[i]];
+
+	mesh->positions.resize(kept * 3);
+	if (hasNormals)
+		mesh->normals.resize(kept * 3);
+	if (hasTexCoords)
+		mesh->texCoords.resize(kept * 2);
+
+	return (int)(numVertices - kept);
+}
+
+/*Tipsify. Triangles are emitted by fanning around one vertex at a time; the
+next fan is the recently used vertex with triangles left that will still be
+in the cache once they are emitted, or failing that the latest vertex with
+triangles left (a dead end, where the cache starts over).*/
+void MeshOptimizer::OptimizeVertexCache(unsigned int* indices, size_t numIndices, size_t numVertices,
+	std::vector<unsigned int>* clusters)
+{
+	size_t numTriangles = numIndices / 3;
+	const int k = CACHE_SIZE;
+
+	if (clusters)
+		clusters->clear();
+	if (numTriangles == 0)
+		return;
+
+	// vertex to triangle adjacency; live is the triangles each vertex has left
+	std::vector<unsigned int> live(numVertices, 0);
+	for (size_t i = 0; i < numIndices; i++)
+		live[indices[i]]++;
+
+	std::vector<unsigned int> offsets(numVertices + 1, 0);
+	for (size_t v = 0; v < numVertices; v++)
+		offsets[v + 1] = offsets[v] + live[v];
+
+	std::vector<unsigned int> adjacency(numIndices);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < numTriangles; t++)
+	{
+		for (int j = 0; j < 3; j++)
+			adjacency[fill[indices[t * 3 + j]]++] = (unsigned int)t;
+	}
+
+	std::vector<int> cacheTime(numVertices, 0);
+	std::vector<unsigned int> deadEnd;
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<unsigned int> output;
+	output.reserve(numIndices);
+	std::vector<unsigned int> candidates;
+
+	int fan = (int)indices[0];
+	int time = k + 1;
+	size_t cursor = 0;
+
+	if (clusters)
+		clusters->push_back(0);
+
+	while (fan >= 0)
+	{
+		candidates.clear();
+		for (unsigned int a = offsets[fan]; a < offsets[fan + 1]; a++)
+		{
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+
+			for (int j = 0; j < 3; j++)
+			{
+				unsigned int v = indices[t * 3 + j];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cacheTime[v] > k)
+					cacheTime[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// the candidate that stays in the cache the longest
+		int best = -1, bestPriority = -1;
+		for (size_t c = 0; c < candidates.size(); c++)
+		{
+			unsigned int v = candidates[c];
+			if (live[v] == 0)
+				continue;
+
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * (int)live[v] <= k)
+				priority = time - cacheTime[v];
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				best = (int)v;
+			}
+		}
+
+		if (best < 0)
+		{
+			// dead end: the latest vertex with triangles left, then any vertex
+			while (!deadEnd.empty() && best < 0)
+			{
+				unsigned int v = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[v] > 0)
+					best = (int)v;
+			}
+			while (best < 0 && cursor < numVertices)
+			{
+				if (live[cursor] > 0)
+					best = (int)cursor;
+				cursor++;
+			}
+
+			if (best >= 0 && clusters && output.size() < numIndices)
+				clusters->push_back((unsigned int)(output.size() / 3));
+		}
+
+		fan = best;
+	}
+
+	memcpy(indices, &output[0], numIndices * sizeof(unsigned int));
+}
+
+/*Splits every cluster further wherever the part before still uses the cache
+nearly as well as the whole mesh does, then sorts them with SortClusters*/
+void MeshOptimizer::OptimizeOverdraw(unsigned int* indices, size_t numIndices, const float* positions, size_t numVertices,
+	const std::vector<unsigned int>& clusters)
+{
+	size_t numTriangles = numIndices / 3;
+	if (numTriangles == 0 || clusters.empty())
+		return;
+
+	float threshold = OVERDRAW_THRESHOLD * ACMR(indices, numIndices, numVertices);
+
+	// soft boundaries
+	std::vector<unsigned int> starts;
+	FifoCache cache(numVertices);
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : numTriangles;
+		size_t first = clusters[c];
+		starts.push_back((unsigned int)first);
+
+		cache.flush();
+		int misses = 0;
+		for (size_t t = first; t < end; t++)
+		{
+			for (int j = 0; j < 3; j++)
+				misses += cache.access(indices[t * 3 + j]);
+
+			if (t + 1 < end && misses <= threshold * (t + 1 - first))
+			{
+				first = t + 1;
+				starts.push_back((unsigned int)first);
+				cache.flush();
+				misses = 0;
+			}
+		}
+	}
+
+	SortClusters(indices, numIndices, positions, starts);
+}
+
+/*Sorts the clusters so those facing out from the middle of the mesh, which
+are the likeliest to hide the rest, are drawn first*/
+void MeshOptimizer::SortClusters(unsigned int* indices, size_t numIndices, const float* positions,
+	const std::vector<unsigned int>& starts, std::vector<unsigned int>* newOrder)
+{
+	size_t numTriangles = numIndices / 3;
+	size_t numClusters = starts.size();
+	if (numTriangles == 0 || numClusters == 0)
+		return;
+
+	float meshCentroid[3], meshNormal[3];
+	ClusterShape(positions, indices, 0, numTriangles, meshCentroid, meshNormal);
+
+	// outwards is whichever way the winding encloses a positive volume
+	float outwards = SignedVolume(positions, indices, numTriangles, meshCentroid) < 0.0f ? -1.0f : 1.0f;
+
+	std::vector<float> keys(numClusters);
+	for (size_t c = 0; c < numClusters; c++)
+	{
+		size_t end = c + 1 < numClusters ? starts[c + 1] : numTriangles;
+		float centroid[3], normal[3];
+		ClusterShape(positions, indices, starts[c], end, centroid, normal);
+
+		keys[c] = outwards * ((centroid[0] - meshCentroid[0]) * normal[0]
+			+ (centroid[1] - meshCentroid[1]) * normal[1]
+			+ (centroid[2] - meshCentroid[2]) * normal[2]);
+	}
+
+	std::vector<unsigned int> order(numClusters);
+	for (size_t c = 0; c < numClusters; c++)
+		order[c] = (unsigned int)c;
+
+	ClusterOrder byKey;
+	byKey.keys = &keys;
+	std::stable_sort(order.begin(), order.end(), byKey);
+
+	std::vector<unsigned int> sorted;
+	sorted.reserve(numIndices);
+	for (size_t i = 0; i < numClusters; i++)
+	{
+		size_t c = order[i];
+		size_t end = c + 1 < numClusters ? starts[c + 1] : numTriangles;
+		sorted.insert(sorted.end(), indices + starts[c] * 3, indices + end * 3);
+	}
+
+	memcpy(indices, &sorted[0], numIndices * sizeof(unsigned int));
+	if (newOrder)
+		newOrder->swap(order);
+}
+
+/*Numbers the vertices in the order the triangles first use them, dropping
+any no triangle uses*/
+void MeshOptimizer::OptimizeVertexFetch(XMesh* mesh)
+{
+	const unsigned int UNUSED = 0xFFFFFFFF;
+	size_t numVertices = mesh->numVertices();
+	bool hasNormals = !mesh->normals.empty();
+	bool hasTexCoords = !mesh->texCoords.empty();
+
+	std::vector<unsigned int> remap(numVertices, UNUSED);
+	std::vector<float> positions, normals, texCoords;
+	positions.reserve(mesh->positions.size());
+	normals.reserve(mesh->normals.size());
+	texCoords.reserve(mesh->texCoords.size());
+
+	unsigned int used = 0;
+	for (size_t i = 0; i < mesh->indices.size(); i++)
+	{
+		unsigned int v = mesh->indices[i];
+		if (remap[v] == UNUSED)
+		{
+			remap[v] = used++;
+			positions.insert(positions.end(), &mesh->positions[v * 3], &mesh->positions[v * 3] + 3);
+			if (hasNormals)
+				normals.insert(normals.end(), &mesh->normals[v * 3], &mesh->normals[v * 3] + 3);
+			if (hasTexCoords)
+				texCoords.insert(texCoords.end(), &mesh->texCoords[v * 2], &mesh->texCoords[v * 2] + 2);
+		}
+		mesh->indices[i] = remap[v];
+	}
+
+	mesh->positions.swap(positions);
+	mesh->normals.swap(normals);
+	mesh->texCoords.swap(texCoords);
+}
+
+float MeshOptimizer::ACMR(const unsigned int* indices, size_t numIndices, size_t numVertices)
+{
+	if (numIndices < 3)
+		return 0.0f;
+
+	FifoCache cache(numVertices);
+	int misses = 0;
+	for (size_t i = 0; i < numIndices; i++)
+		misses += cache.access(indices[i]);
+
+	return (float)misses / (float)(numIndices / 3);
+}
+
+float MeshOptimizer::ATVR(const unsigned int* indices, size_t numIndices, size_t numVertices)
+{
+	std::vector<bool> used(numVertices, false);
+	size_t numUsed = 0;
+	for (size_t i = 0; i < numIndices; i++)
+	{
+		if (!used[indices[i]])
+		{
+			used[indices[i]] = true;
+			numUsed++;
+		}
+	}
+
+	if (numUsed == 0)
+		return 0.0f;
+	return ACMR(indices, numIndices, numVertices) * (float)(numIndices / 3) / (float)numUsed;
+}
+
+/*Rasterizes the mesh in order along each axis with a depth test, counting
+every pixel that passes. Front and back facing triangles go to separate
+depth buffers, which is the same as looking from both ends of the axis.*/
+float MeshOptimizer::Overdraw(const float* positions, size_t numVertices, const unsigned int* indices, size_t numIndices)
+{
+	if (numVertices == 0 || numIndices < 3)
+		return 0.0f;
+
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t v = 0; v < numVertices; v++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = positions[v * 3 + k] < lo[k] ? positions[v * 3 + k] : lo[k];
+			hi[k] = positions[v * 3 + k] > hi[k] ? positions[v * 3 + k] : hi[k];
+		}
+	}
+
+	float extent = 0.0f;
+	for (int k = 0; k < 3; k++)
+		extent = hi[k] - lo[k] > extent ? hi[k] - lo[k] : extent;
+	float scale = extent > 0.0f ? (GRID - 1) / extent : 0.0f;
+
+	std::vector<float> depth[2];
+	depth[0].resize(GRID * GRID);
+	depth[1].resize(GRID * GRID);
+
+	long long shaded = 0, covered = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int ax = (axis + 1) % 3, ay = (axis + 2) % 3;
+		std::fill(depth[0].begin(), depth[0].end(), FLT_MAX);
+		std::fill(depth[1].begin(), depth[1].end(), FLT_MAX);
+
+		for (size_t i = 0; i + 2 < numIndices; i += 3)
+		{
+			float x[3], y[3], z[3];
+			for (int j = 0; j < 3; j++)
+			{
+				const float* p = &positions[indices[i + j] * 3];
+				x[j] = (p[ax] - lo[ax]) * scale;
+				y[j] = (p[ay] - lo[ay]) * scale;
+				z[j] = (p[axis] - lo[axis]) * scale;
+			}
+
+			float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+			if (area == 0.0f)
+				continue;
+
+			// a positive area faces up the axis, so is seen from its far end where
+			// nearer is higher; the rest are seen from the near end
+			int side = area > 0.0f ? 0 : 1;
+			float* buffer = &depth[side][0];
+			if (side == 0)
+			{
+				z[0] = -z[0];
+				z[1] = -z[1];
+				z[2] = -z[2];
+			}
+
+			float minX = x[0] < x[1] ? (x[0] < x[2] ? x[0] : x[2]) : (x[1] < x[2] ? x[1] : x[2]);
+			float maxX = x[0] > x[1] ? (x[0] > x[2] ? x[0] : x[2]) : (x[1] > x[2] ? x[1] : x[2]);
+			float minY = y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2]) : (y[1] < y[2] ? y[1] : y[2]);
+			float maxY = y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2]) : (y[1] > y[2] ? y[1] : y[2]);
+
+			int x0 = (int)minX, x1 = (int)maxX;
+			int y0 = (int)minY, y1 = (int)maxY;
+			float invArea = 1.0f / area;
+
+			for (int py = y0; py <= y1 && py < GRID; py++)
+			{
+				for (int px = x0; px <= x1 && px < GRID; px++)
+				{
+					float cx = px + 0.5f, cy = py + 0.5f;
+					float w0 = ((x[1] - cx) * (y[2] - cy) - (x[2] - cx) * (y[1] - cy)) * invArea;
+					float w1 = ((x[2] - cx) * (y[0] - cy) - (x[0] - cx) * (y[2] - cy)) * invArea;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					float d = w0 * z[0] + w1 * z[1] + w2 * z[2];
+					float& stored = buffer[py * GRID + px];
+					if (d < stored)
+					{
+						stored = d;
+						shaded++;
+					}
+				}
+			}
+		}
+
+		for (int s = 0; s < 2; s++)
+		{
+			for (int p = 0; p < GRID * GRID; p++)
+				covered += depth[s][p] != FLT_MAX;
+		}
+	}
+
+	return covered ? (float)shaded / (float)covered : 0.0f;
+}
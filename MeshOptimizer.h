@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include "XFile.h"
+
+/*Reorders meshes so the GPU does less work drawing them, without changing
+what is drawn. Works on XMesh, and on plain index lists for the passes that
+only need indices, so it runs the same on every platform and off the device.
+
+The passes, in the order Optimize runs them:
+- WeldVertices merges vertices whose position, normal and uv are identical.
+- OptimizeVertexCache orders triangles for the post-transform cache with
+  Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+  Locality and Reduced Overdraw", 2007).
+- OptimizeOverdraw splits that order into clusters that still use the cache
+  well and draws the clusters most likely to hide the others first.
+- OptimizeVertexFetch numbers the vertices in the order the triangles first
+  use them, so vertex fetch walks memory forwards.*/
+class MeshOptimizer
+{
+public:
+	// Post-transform cache size the passes and metrics assume
+	static const int CACHE_SIZE = 16;
+
+	// How much worse than the Tipsify order a cluster may use the cache
+	static const float OVERDRAW_THRESHOLD;
+
+	// Runs every pass on mesh, keeping each triangle's material. The triangles
+	// come out sorted by material, each material's run optimized on its own.
+	static void Optimize(XMesh* mesh);
+
+	// The triangle passes of Optimize on their own, for index lists that share
+	// a vertex buffer with others: sorts by material, then runs
+	// OptimizeVertexCache and OptimizeOverdraw on each material's run, which
+	// keeps its order instead if that used the cache better.
+	static void OptimizeTriangles(std::vector<unsigned int>* indices, std::vector<unsigned int>* attributes,
+		const float* positions, size_t numVertices);
+
+	// Returns how many vertices were removed.
+	static int WeldVertices(XMesh* mesh);
+
+	// Reorders the triangles of indices in place. If clusters is given it gets
+	// the first triangle of every run that starts from a cold cache.
+	static void OptimizeVertexCache(unsigned int* indices, size_t numIndices, size_t numVertices,
+		std::vector<unsigned int>* clusters = 0);
+
+	// Reorders the triangles of indices, which should be in vertex cache order
+	// with its clusters from OptimizeVertexCache, in place.
+	static void OptimizeOverdraw(unsigned int* indices, size_t numIndices, const float* positions, size_t numVertices,
+		const std::vector<unsigned int>& clusters);
+
+	// The sort OptimizeOverdraw ends with, on clusters that must stay whole:
+	// reorders the runs of triangles that begin at starts (the first at 0)
+	// so those facing out of the mesh come first. newOrder, if given, gets
+	// the runs' old numbers in their new order.
+	static void SortClusters(unsigned int* indices, size_t numIndices, const float* positions,
+		const std::vector<unsigned int>& starts, std::vector<unsigned int>* newOrder = 0);
+
+	static void OptimizeVertexFetch(XMesh* mesh);
+
+	// Average cache miss ratio: vertices transformed per triangle, 0.5 to 3
+	static float ACMR(const unsigned int* indices, size_t numIndices, size_t numVertices);
+	// Average transform to vertex ratio: vertices transformed per vertex, 1 at best
+	static float ATVR(const unsigned int* indices, size_t numIndices, size_t numVertices);
+	// Pixels shaded per pixel covered, from the six axis directions
+	static float Overdraw(const float* positions, size_t numVertices, const unsigned int* indices, size_t numIndices);
+};
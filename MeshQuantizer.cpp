@@ -0,0 +1,173 @@
+#include <float.h>
+#include <math.h>
+#include "MeshQuantizer.h"
+/*Packing vertices into 16 bit positions, octahedral normals and 16 bit uvs*/
+
+const float MeshQuantizer::NORMAL_ERROR = 0.005f;
+
+namespace
+{
+	const float STEPS = 65535.0f; // of a position or uv across its bounds
+	const float NORMAL_STEPS = 32767.0f;
+
+	// The fractions of offset..offset + extent that value is, rounded
+	unsigned short Quantize(float value, float offset, float scale)
+	{
+		if (scale <= 0.0f)
+			return 0;
+		float q = (value - offset) / scale + 0.5f;
+		q = q < 0.0f ? 0.0f : q;
+		q = q > STEPS ? STEPS : q;
+		return (unsigned short)q;
+	}
+
+	// Offset and scale so count values from lo to hi fill the 16 bits
+	void Fit(const float* lo, const float* hi, int count, float* offset, float* scale)
+	{
+		for (int k = 0; k < count; k++)
+		{
+			offset[k] = lo[k];
+			scale[k] = (hi[k] - lo[k]) / STEPS;
+		}
+	}
+
+	inline float SignOf(float x)
+	{
+		return x < 0.0f ? -1.0f : 1.0f;
+	}
+
+	// The unit vector a point on the unfolded octahedron stands for, -1..1 each way
+	void Unfold(float u, float v, float* normal)
+	{
+		float x = u, y = v, z = 1.0f - fabsf(u) - fabsf(v);
+		if (z < 0.0f)
+		{
+			x = (1.0f - fabsf(v)) * SignOf(u);
+			y = (1.0f - fabsf(u)) * SignOf(v);
+		}
+
+		float length = sqrtf(x * x + y * y + z * z);
+		normal[0] = x / length;
+		normal[1] = y / length;
+		normal[2] = z / length;
+	}
+}
+
+void MeshQuantizer::ComputeBounds(const float* positions, const float* texCoords, size_t numVertices, QuantizationBounds* bounds)
+{
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float uvLo[2] = { FLT_MAX, FLT_MAX }, uvHi[2] = { -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < numVertices; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			float p = positions[i * 3 + k];
+			lo[k] = p < lo[k] ? p : lo[k];
+			hi[k] = p > hi[k] ? p : hi[k];
+		}
+		for (int k = 0; texCoords && k < 2; k++)
+		{
+			float t = texCoords[i * 2 + k];
+			uvLo[k] = t < uvLo[k] ? t : uvLo[k];
+			uvHi[k] = t > uvHi[k] ? t : uvHi[k];
+		}
+	}
+
+	// nothing to fit leaves everything at zero
+	for (int k = 0; k < 3 && numVertices == 0; k++)
+		lo[k] = hi[k] = 0.0f;
+	for (int k = 0; k < 2 && (numVertices == 0 || !texCoords); k++)
+		uvLo[k] = uvHi[k] = 0.0f;
+
+	Fit(lo, hi, 3, bounds->positionOffset, bounds->positionScale);
+	Fit(uvLo, uvHi, 2, bounds->uvOffset, bounds->uvScale);
+}
+
+void MeshQuantizer::Encode(const QuantizationBounds& bounds, const float* position, const float* normal, const float* uv,
+	QuantizedVertex* out)
+{
+	for (int k = 0; k < 3; k++)
+		out->position[k] = Quantize(position[k], bounds.positionOffset[k], bounds.positionScale[k]);
+	out->pad = 0;
+
+	EncodeNormal(normal, out->normal);
+
+	for (int k = 0; k < 2; k++)
+		out->uv[k] = uv ? Quantize(uv[k], bounds.uvOffset[k], bounds.uvScale[k]) : 0;
+}
+
+void MeshQuantizer::Decode(const QuantizationBounds& bounds, const QuantizedVertex& in, float* position, float* normal, float* uv)
+{
+	for (int k = 0; k < 3; k++)
+		position[k] = bounds.positionOffset[k] + in.position[k] * bounds.positionScale[k];
+
+	DecodeNormal(in.normal, normal);
+
+	for (int k = 0; k < 2; k++)
+		uv[k] = bounds.uvOffset[k] + in.uv[k] * bounds.uvScale[k];
+}
+
+void MeshQuantizer::RoundPosition(const QuantizationBounds& bounds, float* position)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		unsigned short q = Quantize(position[k], bounds.positionOffset[k], bounds.positionScale[k]);
+		position[k] = bounds.positionOffset[k] + q * bounds.positionScale[k];
+	}
+}
+
+/*Half a step, and the rounding of the float scale multiplied up to the top
+of the range and of a result the size of offset*/
+float MeshQuantizer::Tolerance(float offset, float scale)
+{
+	return scale * 0.5f + FLT_EPSILON * (2.0f * STEPS * scale + 2.0f * fabsf(offset));
+}
+
+/*Projects the normal onto the octahedron |x| + |y| + |z| = 1, folds the
+lower half over the upper one and rounds. Rounding each way on its own can
+land on a grid point that is not the closest in angle, so the four around
+the projection are tried and the closest kept*/
+void MeshQuantizer::EncodeNormal(const float* normal, short* out)
+{
+	float sum = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	if (sum <= 0.0f)
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+
+	float u = normal[0] / sum, v = normal[1] / sum;
+	if (normal[2] < 0.0f)
+	{
+		float foldedU = (1.0f - fabsf(v)) * SignOf(u);
+		v = (1.0f - fabsf(u)) * SignOf(v);
+		u = foldedU;
+	}
+
+	float su = floorf(u * NORMAL_STEPS), sv = floorf(v * NORMAL_STEPS);
+	float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	float best = FLT_MAX;
+	for (int i = 0; i < 4; i++)
+	{
+		float qu = su + (i & 1), qv = sv + (i >> 1);
+		qu = qu < -NORMAL_STEPS ? -NORMAL_STEPS : (qu > NORMAL_STEPS ? NORMAL_STEPS : qu);
+		qv = qv < -NORMAL_STEPS ? -NORMAL_STEPS : (qv > NORMAL_STEPS ? NORMAL_STEPS : qv);
+
+		float n[3];
+		Unfold(qu / NORMAL_STEPS, qv / NORMAL_STEPS, n);
+		// by distance, a dot product this close to 1 is lost in float precision
+		float dx = n[0] - normal[0] / length, dy = n[1] - normal[1] / length, dz = n[2] - normal[2] / length;
+		float d = dx * dx + dy * dy + dz * dz;
+		if (d < best)
+		{
+			best = d;
+			out[0] = (short)qu;
+			out[1] = (short)qv;
+		}
+	}
+}
+
+void MeshQuantizer::DecodeNormal(const short* in, float* normal)
+{
+	Unfold(in[0] / NORMAL_STEPS, in[1] / NORMAL_STEPS, normal);
+}
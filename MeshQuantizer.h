@@ -0,0 +1,57 @@
+#pragma once
+
+#include "XFile.h"
+
+//A vertex in 16 bytes, half of a float position, normal and uv
+struct QuantizedVertex
+{
+	unsigned short position[3]; // fractions of the mesh's bounding box, 0 to 65535
+	unsigned short pad;
+	short normal[2];            // octahedral, -32767 to 32767
+	unsigned short uv[2];       // fractions of the mesh's uv bounds, 0 to 65535
+};
+
+//What a mesh's QuantizedVertex values are fractions of: value = offset + q * scale
+struct QuantizationBounds
+{
+	float positionOffset[3];
+	float positionScale[3];
+	float uvOffset[2];
+	float uvScale[2];
+};
+
+/*Packs vertices into QuantizedVertex and back.
+
+Positions and uvs are 16 bit fractions of the box around all of the mesh's,
+so each comes back within half a step (scale / 2) of where it was, per axis,
+give or take float rounding; Tolerance is the whole bound.
+Normals are folded onto an octahedron (Cigolle et al., "A Survey of
+Efficient Representations for Independent Unit Vectors", 2014) and the
+nearest of the four grid points around it is kept, which brings them back
+within NORMAL_ERROR (0.0025 degrees is the most seen over the sphere). That is
+the angle between the two vectors; the acos of their float dot product can't
+resolve it, being off by up to about 0.04 degrees on its own.*/
+class MeshQuantizer
+{
+public:
+	// Most a normal is turned by a round trip, in degrees
+	static const float NORMAL_ERROR;
+
+	// The bounds of numVertices positions, and of their uvs if texCoords isn't 0
+	static void ComputeBounds(const float* positions, const float* texCoords, size_t numVertices, QuantizationBounds* bounds);
+
+	// Packs a vertex; uv may be 0 for a mesh without any.
+	static void Encode(const QuantizationBounds& bounds, const float* position, const float* normal, const float* uv,
+		QuantizedVertex* out);
+	static void Decode(const QuantizationBounds& bounds, const QuantizedVertex& in, float* position, float* normal, float* uv);
+
+	// Moves a position to where a round trip brings it back
+	static void RoundPosition(const QuantizationBounds& bounds, float* position);
+
+	// Most a position or uv component with this offset and scale is moved by a round trip
+	static float Tolerance(float offset, float scale);
+
+	// A unit vector to two snorm16s and back. Zero comes back as +z.
+	static void EncodeNormal(const float* normal, short* out);
+	static void DecodeNormal(const short* in, float* normal);
+};
@@ -0,0 +1,394 @@
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include "Meshlets.h"
+#include "MeshOptimizer.h"
+/*Meshlets: building them, their bounds, and culling them*/
+
+namespace
+{
+	const unsigned int NONE = 0xFFFFFFFF;
+
+	// Vertices numbered by position, so the copies a seam splits share a number
+	unsigned int PositionIds(const float* positions, size_t numVertices, std::vector<unsigned int>* ids)
+	{
+		std::vector<unsigned int> order(numVertices);
+		for (size_t i = 0; i < numVertices; i++)
+			order[i] = (unsigned int)i;
+		std::sort(order.begin(), order.end(), [positions](unsigned int a, unsigned int b)
+		{
+			return memcmp(&positions[a * 3], &positions[b * 3], 3 * sizeof(float)) < 0;
+		});
+
+		ids->resize(numVertices);
+		unsigned int id = 0;
+		for (size_t i = 0; i < numVertices; i++)
+		{
+			if (i > 0 && memcmp(&positions[order[i - 1] * 3], &positions[order[i] * 3], 3 * sizeof(float)) != 0)
+				id++;
+			(*ids)[order[i]] = id;
+		}
+		return numVertices ? id + 1 : 0;
+	}
+
+	// Unit normal of a triangle, zero if it has no area
+	void FaceNormal(const float* a, const float* b, const float* c, float* n)
+	{
+		float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		n[0] *= scale;
+		n[1] *= scale;
+		n[2] *= scale;
+	}
+}
+
+MeshletStats::MeshletStats()
+	: meshlets(0)
+	, outside(0)
+	, backFacing(0)
+	, triangles(0)
+	, trianglesCulled(0)
+	, ranges(0)
+{
+}
+
+void Meshlets::Build(std::vector<unsigned int>* indices, const std::vector<unsigned int>& attributes,
+	const float* positions, size_t numVertices, std::vector<Meshlet>* meshlets)
+{
+	std::vector<unsigned int>& in = *indices;
+	unsigned int numTriangles = (unsigned int)(in.size() / 3);
+	if (numTriangles == 0)
+		return;
+
+	std::vector<unsigned int> ids;
+	unsigned int numPositions = PositionIds(positions, numVertices, &ids);
+
+	// the triangles around each position
+	std::vector<unsigned int> first(numPositions + 1, 0);
+	for (unsigned int i = 0; i < numTriangles * 3; i++)
+		first[ids[in[i]] + 1]++;
+	for (unsigned int p = 0; p < numPositions; p++)
+		first[p + 1] += first[p];
+	std::vector<unsigned int> around(numTriangles * 3);
+	std::vector<unsigned int> next(first.begin(), first.end() - 1);
+	for (unsigned int i = 0; i < numTriangles * 3; i++)
+		around[next[ids[in[i]]]++] = i / 3;
+
+	std::vector<float> centroids(numTriangles * 3), normals(numTriangles * 3);
+	for (unsigned int t = 0; t < numTriangles; t++)
+	{
+		const float* a = &positions[in[t * 3] * 3];
+		const float* b = &positions[in[t * 3 + 1] * 3];
+		const float* c = &positions[in[t * 3 + 2] * 3];
+		for (int k = 0; k < 3; k++)
+			centroids[t * 3 + k] = (a[k] + b[k] + c[k]) / 3.0f;
+		FaceNormal(a, b, c, &normals[t * 3]);
+	}
+
+	std::vector<unsigned int> order;
+	order.reserve(numTriangles);
+	std::vector<char> taken(numTriangles, 0);
+	std::vector<unsigned int> listed(numTriangles, NONE); // the meshlet that has it as a candidate
+	std::vector<unsigned int> members, candidates;
+	size_t firstNew = meshlets->size();
+	std::vector<size_t> runMeshlets; // each run's first meshlet
+	unsigned int stamp = 0;
+
+	for (unsigned int runStart = 0, runEnd = 0; runStart < numTriangles; runStart = runEnd)
+	{
+		runEnd = runStart + 1;
+		while (runEnd < numTriangles && attributes[runEnd] == attributes[runStart])
+			runEnd++;
+		runMeshlets.push_back(meshlets->size());
+
+		for (unsigned int seed = runStart; seed < runEnd; seed++)
+		{
+			if (taken[seed])
+				continue;
+
+			float middle[3] = { 0.0f, 0.0f, 0.0f }, facing[3] = { 0.0f, 0.0f, 0.0f };
+			members.clear();
+			candidates.clear();
+			stamp++;
+
+			unsigned int t = seed;
+			while (true)
+			{
+				taken[t] = 1;
+				members.push_back(t);
+				for (int k = 0; k < 3; k++)
+				{
+					middle[k] += centroids[t * 3 + k];
+					facing[k] += normals[t * 3 + k];
+				}
+
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int p = ids[in[t * 3 + k]];
+					for (unsigned int j = first[p]; j < first[p + 1]; j++)
+					{
+						unsigned int u = around[j];
+						if (u >= runStart && u < runEnd && !taken[u] && listed[u] != stamp)
+						{
+							listed[u] = stamp;
+							candidates.push_back(u);
+						}
+					}
+				}
+
+				if (members.size() >= MAX_TRIANGLES)
+					break;
+
+				// the closest candidate, counting those turned away from the
+				// meshlet as further off, up to seven times as far facing back
+				float count = (float)members.size();
+				float center[3] = { middle[0] / count, middle[1] / count, middle[2] / count };
+				float length = sqrtf(facing[0] * facing[0] + facing[1] * facing[1] + facing[2] * facing[2]);
+				float axis[3] = { 0.0f, 0.0f, 0.0f };
+				for (int k = 0; k < 3 && length > 0.0f; k++)
+					axis[k] = facing[k] / length;
+
+				size_t best = NONE;
+				float bestScore = FLT_MAX;
+				for (size_t i = 0; i < candidates.size(); i++)
+				{
+					unsigned int c = candidates[i];
+					const float* p = &centroids[c * 3];
+					const float* n = &normals[c * 3];
+					float d[3] = { p[0] - center[0], p[1] - center[1], p[2] - center[2] };
+					float distance = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+					float score = distance * (1.0f + 3.0f * (1.0f - (n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2])));
+					if (score < bestScore)
+					{
+						bestScore = score;
+						best = i;
+					}
+				}
+
+				if (best == NONE)
+					break;
+				t = candidates[best];
+				candidates[best] = candidates.back();
+				candidates.pop_back();
+			}
+
+			// in the order they came, which kept the vertex cache warm
+			std::sort(members.begin(), members.end());
+
+			Meshlet meshlet;
+			meshlet.firstTriangle = (unsigned int)order.size();
+			meshlet.numTriangles = (unsigned int)members.size();
+			order.insert(order.end(), members.begin(), members.end());
+			meshlets->push_back(meshlet);
+		}
+	}
+
+	std::vector<unsigned int> out(in.size());
+	for (unsigned int t = 0; t < numTriangles; t++)
+	{
+		out[t * 3] = in[order[t] * 3];
+		out[t * 3 + 1] = in[order[t] * 3 + 1];
+		out[t * 3 + 2] = in[order[t] * 3 + 2];
+	}
+	in.swap(out);
+	runMeshlets.push_back(meshlets->size());
+
+	// outward facing meshlets first within each run, as OptimizeOverdraw leaves them
+	std::vector<unsigned int> starts, newOrder;
+	std::vector<Meshlet> sorted;
+	for (size_t r = 0; r + 1 < runMeshlets.size(); r++)
+	{
+		Meshlet* run = &(*meshlets)[runMeshlets[r]];
+		size_t numRun = runMeshlets[r + 1] - runMeshlets[r];
+		unsigned int base = run[0].firstTriangle;
+		unsigned int end = run[numRun - 1].firstTriangle + run[numRun - 1].numTriangles;
+
+		starts.clear();
+		for (size_t m = 0; m < numRun; m++)
+			starts.push_back(run[m].firstTriangle - base);
+		MeshOptimizer::SortClusters(&in[base * 3], (end - base) * 3, positions, starts, &newOrder);
+
+		sorted.clear();
+		unsigned int next = base;
+		for (size_t m = 0; m < numRun; m++)
+		{
+			sorted.push_back(run[newOrder[m]]);
+			sorted.back().firstTriangle = next;
+			next += sorted.back().numTriangles;
+		}
+		std::copy(sorted.begin(), sorted.end(), run);
+	}
+
+	for (size_t m = firstNew; m < meshlets->size(); m++)
+	{
+		Meshlet& meshlet = (*meshlets)[m];
+		MeshOptimizer::OptimizeVertexCache(&in[meshlet.firstTriangle * 3], meshlet.numTriangles * 3, numVertices);
+		ComputeBounds(&in[meshlet.firstTriangle * 3], positions, &meshlet);
+	}
+}
+
+/*The sphere around the box of the meshlet's vertices, and the cone around
+its triangles' normals. The cone's axis is their average; the cutoff is
+the sine of the widest angle any of them makes with it, and 1 once that
+passes 90 degrees, as then no eye sees them all from behind*/
+void Meshlets::ComputeBounds(const unsigned int* indices, const float* positions, Meshlet* meshlet)
+{
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+	for (unsigned int i = 0; i < meshlet->numTriangles * 3; i++)
+	{
+		const float* p = &positions[indices[i] * 3];
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = p[k] < lo[k] ? p[k] : lo[k];
+			hi[k] = p[k] > hi[k] ? p[k] : hi[k];
+		}
+
+		if (i % 3 == 2)
+		{
+			float n[3];
+			FaceNormal(&positions[indices[i - 2] * 3], &positions[indices[i - 1] * 3], p, n);
+			axis[0] += n[0];
+			axis[1] += n[1];
+			axis[2] += n[2];
+		}
+	}
+
+	float radius = 0.0f;
+	for (int k = 0; k < 3; k++)
+		meshlet->center[k] = (lo[k] + hi[k]) * 0.5f;
+	for (unsigned int i = 0; i < meshlet->numTriangles * 3; i++)
+	{
+		const float* p = &positions[indices[i] * 3];
+		float d[3] = { p[0] - meshlet->center[0], p[1] - meshlet->center[1], p[2] - meshlet->center[2] };
+		float r = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		radius = r > radius ? r : radius;
+	}
+	meshlet->radius = radius;
+
+	float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	meshlet->coneCutoff = 1.0f;
+	meshlet->coneAxis[0] = meshlet->coneAxis[1] = 0.0f;
+	meshlet->coneAxis[2] = 1.0f;
+	if (length <= 0.0f)
+		return;
+
+	for (int k = 0; k < 3; k++)
+		meshlet->coneAxis[k] = axis[k] / length;
+
+	float lowest = 1.0f;
+	for (unsigned int t = 0; t < meshlet->numTriangles; t++)
+	{
+		float n[3];
+		FaceNormal(&positions[indices[t * 3] * 3], &positions[indices[t * 3 + 1] * 3], &positions[indices[t * 3 + 2] * 3], n);
+		if (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f)
+			continue;
+		float d = n[0] * meshlet->coneAxis[0] + n[1] * meshlet->coneAxis[1] + n[2] * meshlet->coneAxis[2];
+		lowest = d < lowest ? d : lowest;
+	}
+
+	if (lowest > 0.0f)
+		meshlet->coneCutoff = sqrtf(1.0f - lowest * lowest);
+}
+
+/*Gribb and Hartmann's extraction: with clip = v * matrix, each plane is the
+fourth column plus or minus one of the others. D3D's depth runs 0 to w, so
+the near plane is the third column on its own*/
+void Meshlets::FrustumPlanes(const float* matrix, float* planes)
+{
+	const float* m = matrix;
+	for (int k = 0; k < 4; k++)
+	{
+		float x = m[k * 4], y = m[k * 4 + 1], z = m[k * 4 + 2], w = m[k * 4 + 3];
+		planes[0 * 4 + k] = w + x; // left
+		planes[1 * 4 + k] = w - x; // right
+		planes[2 * 4 + k] = w + y; // bottom
+		planes[3 * 4 + k] = w - y; // top
+		planes[4 * 4 + k] = z;     // near
+		planes[5 * 4 + k] = w - z; // far
+	}
+
+	for (int p = 0; p < 6; p++)
+	{
+		float* plane = &planes[p * 4];
+		float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		if (length > 0.0f)
+		{
+			for (int k = 0; k < 4; k++)
+				plane[k] /= length;
+		}
+	}
+}
+
+bool Meshlets::Outside(const Meshlet& meshlet, const float* planes)
+{
+	for (int p = 0; p < 6; p++)
+	{
+		const float* plane = &planes[p * 4];
+		float d = plane[0] * meshlet.center[0] + plane[1] * meshlet.center[1] + plane[2] * meshlet.center[2] + plane[3];
+		if (d < -meshlet.radius)
+			return true;
+	}
+	return false;
+}
+
+/*A triangle faces away when the eye is behind its plane. Every normal is
+within the cone's angle of the axis, so all of them face away if every
+direction from the eye into the sphere is within 90 degrees less that angle
+of the axis: dot(v, axis) >= cutoff * |v| for every v from the eye to a
+point of the sphere, which holds if it does for the nearest and farthest*/
+bool Meshlets::BackFacing(const Meshlet& meshlet, const float* eye)
+{
+	if (meshlet.coneCutoff >= 1.0f)
+		return false;
+
+	float v[3] = { meshlet.center[0] - eye[0], meshlet.center[1] - eye[1], meshlet.center[2] - eye[2] };
+	float distance = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	float along = v[0] * meshlet.coneAxis[0] + v[1] * meshlet.coneAxis[1] + v[2] * meshlet.coneAxis[2];
+	return along - meshlet.radius >= meshlet.coneCutoff * (distance + meshlet.radius);
+}
+
+void Meshlets::Cull(const Meshlet* meshlets, size_t numMeshlets, const float* planes, const float* eye, bool backFaces,
+	std::vector<MeshletRange>* ranges, MeshletStats* stats)
+{
+	size_t firstRange = ranges->size();
+	for (size_t i = 0; i < numMeshlets; i++)
+	{
+		const Meshlet& meshlet = meshlets[i];
+		bool outside = Outside(meshlet, planes);
+		bool backFacing = !outside && backFaces && BackFacing(meshlet, eye);
+
+		if (stats)
+		{
+			stats->meshlets++;
+			stats->outside += outside;
+			stats->backFacing += backFacing;
+			stats->triangles += meshlet.numTriangles;
+			stats->trianglesCulled += outside || backFacing ? meshlet.numTriangles : 0;
+		}
+		if (outside || backFacing)
+			continue;
+
+		if (ranges->size() > firstRange
+			&& ranges->back().firstTriangle + ranges->back().numTriangles == meshlet.firstTriangle)
+		{
+			ranges->back().numTriangles += meshlet.numTriangles;
+			continue;
+		}
+
+		MeshletRange range;
+		range.firstTriangle = meshlet.firstTriangle;
+		range.numTriangles = meshlet.numTriangles;
+		ranges->push_back(range);
+	}
+
+	if (stats)
+		stats->ranges += (unsigned int)(ranges->size() - firstRange);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+//A run of up to Meshlets::MAX_TRIANGLES triangles of one material, close
+//together and facing much the same way, with what culling it needs
+struct Meshlet
+{
+	unsigned int firstTriangle; // in the index list it was built from
+	unsigned int numTriangles;
+	float center[3];            // of a sphere around its vertices
+	float radius;
+	float coneAxis[3];          // the way its triangles face, on average
+	float coneCutoff;           // sine of how far any of them turns from it, 1 if too far to cull
+};
+
+//Triangles to draw, one run of the index buffer
+struct MeshletRange
+{
+	unsigned int firstTriangle;
+	unsigned int numTriangles;
+};
+
+//What culling took out
+struct MeshletStats
+{
+	MeshletStats();
+
+	unsigned int meshlets;
+	unsigned int outside;         // meshlets out of the frustum
+	unsigned int backFacing;      // meshlets facing away from the eye
+	unsigned int triangles;
+	unsigned int trianglesCulled;
+	unsigned int ranges;          // draw calls the rest took
+};
+
+/*Splits meshes into meshlets and culls them on the CPU, so the parts of a
+big mesh that are off screen or turned away are never submitted.
+
+Build grows each meshlet from the first triangle not yet taken, adding the
+neighbour (by position, so seams don't stop it) closest to the meshlet's
+middle, favouring ones facing its way, until it is full or runs out. Each
+meshlet's triangles are then put back in vertex cache order, and the
+meshlets of a material sorted outward facing first, as MeshOptimizer
+leaves a whole mesh. The bounds are a sphere and a normal cone, as
+meshoptimizer computes them: every triangle in a meshlet faces away from an
+eye that sees the whole sphere from far enough behind the cone.*/
+class Meshlets
+{
+public:
+	static const unsigned int MAX_TRIANGLES = 128;
+
+	// Reorders the triangles of indices so each meshlet is one run, never
+	// across a change of material, and appends the meshlets. attributes
+	// stays as it is, so should already be sorted by material.
+	static void Build(std::vector<unsigned int>* indices, const std::vector<unsigned int>& attributes,
+		const float* positions, size_t numVertices, std::vector<Meshlet>* meshlets);
+
+	// Works out a meshlet's sphere and cone from its numTriangles triangles,
+	// which indices starts at, and the positions they are drawn at
+	static void ComputeBounds(const unsigned int* indices, const float* positions, Meshlet* meshlet);
+
+	// The six planes of the frustum a world * view * projection matrix (row
+	// major, the way D3D lays it out) sees, in the space of what the matrix
+	// transforms, as a, b, c, d with the normals unit length and inwards.
+	static void FrustumPlanes(const float* matrix, float* planes);
+
+	// Appends the runs of triangles to draw from the meshlets that are in
+	// the frustum and, if backFaces is true, face the eye. Meshlets next to
+	// each other in the index buffer are drawn as one run. Adds to stats.
+	static void Cull(const Meshlet* meshlets, size_t numMeshlets, const float* planes, const float* eye, bool backFaces,
+		std::vector<MeshletRange>* ranges, MeshletStats* stats = 0);
+
+	// Whether a meshlet is out of the frustum, or faces away from eye
+	static bool Outside(const Meshlet& meshlet, const float* planes);
+	static bool BackFacing(const Meshlet& meshlet, const float* eye);
+};
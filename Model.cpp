@@ -1,22 +1,48 @@
+#include <float.h>
 #include "Model.h"
+#include "MeshOptimizer.h"
+#include "MeshLod.h"
 /*Represents a model loaded in from a .x file, has functions for initializing the
 shapes/textures needed to render the model
 
 Also contains functions that handle transformations of the model.*/
 
+namespace
+{
+	// Set the ambient color for the material (D3DX does not do this)
+	D3DMATERIAL9 MakeMaterial(const float* diffuse, float power, const float* specular, const float* emissive)
+	{
+		D3DMATERIAL9 material;
+		ZeroMemory(&material, sizeof(D3DMATERIAL9));
+		material.Diffuse = D3DXCOLOR(diffuse[0], diffuse[1], diffuse[2], diffuse[3]);
+		material.Specular = D3DXCOLOR(specular[0], specular[1], specular[2], 1.0f);
+		material.Emissive = D3DXCOLOR(emissive[0], emissive[1], emissive[2], 1.0f);
+		material.Power = power;
+		material.Ambient = material.Diffuse;
+		return material;
+	}
+}
+
 
 /*Creates a model after being given a string that is the name of the .x file for the model
 
 Also initializes the transformation matrix that determines the rendering position of the model
+
+format - how the model's baked cache keeps its vertices
 */
-Model::Model(string xFile)
+Model::Model(string xFile, VertexFormat format)
 	: g_pMesh(0)
 	, g_pMeshMaterials(0)
 	, g_pMeshTextures(0)
 	, g_dwNumMaterials(0L)
+	, g_dwNumLods(0L)
 	, mxFile(xFile)
+	, vertexFormat(format)
+	, loaded(false)
+	, lod(0)
 {
 	D3DXMatrixIdentity(&master);
+	previous = transform;
 }
 
 /*Deallocates the resources that the model uses
@@ -26,11 +52,156 @@ Model::~Model()
 	Cleanup();
 }
 
-/*Loads in the mesh and textures from the .x file
+/*Loads in the mesh and textures from the .x file, all on this thread
 
 g_pDevice is the direct3d device used for rendering
 */
 HRESULT Model::InitGeometry(LPDIRECT3DDEVICE9 g_pDevice)
+{
+	return Create(g_pDevice, *Decode(mxFile, vertexFormat));
+}
+
+/*Starts loading the model on the loader's threads. The mesh is created, and
+the bounding sphere worked out, on the device thread by a later pump of the
+loader; until then IsLoaded is false
+
+loader - the loader that reads and decodes the files
+g_pDevice is the direct3d device used for rendering
+*/
+void Model::LoadAsync(AssetLoader* loader, LPDIRECT3DDEVICE9 g_pDevice)
+{
+	string xFile = mxFile;
+	VertexFormat format = vertexFormat;
+	loader->load<std::shared_ptr<ModelAsset> >(
+		[xFile, format]() { return Decode(xFile, format); },
+		[this, g_pDevice](const std::shared_ptr<ModelAsset>& asset)
+		{
+			if (SUCCEEDED(Create(g_pDevice, *asset)))
+				CreateBounds();
+		});
+}
+
+bool Model::IsLoaded() const
+{
+	return loaded;
+}
+
+/*Reads everything the model needs without touching the device: the baked
+cache of the .x file (made or remade if it is missing or stale), or failing
+that the parsed file, and the contents of every texture it uses. Safe to call
+from any thread
+
+xFile - the model's .x file
+format - how the cache keeps its vertices
+*/
+std::shared_ptr<ModelAsset> Model::Decode(const string& xFile, VertexFormat format)
+{
+	std::shared_ptr<ModelAsset> asset(new ModelAsset());
+
+	asset->cached = asset->cache.open(xFile, 0, format);
+	if (!asset->cached)
+	{
+		asset->parsed = XFile::Load(xFile, &asset->mesh);
+		if (asset->parsed)
+		{
+			MeshOptimizer::Optimize(&asset->mesh);
+			MeshLod::BuildChain(asset->mesh, &asset->lods);
+		}
+	}
+	BuildBvh(asset.get());
+
+	int numMaterials = asset->cached ? asset->cache.numMaterials() : (int)asset->mesh.materials.size();
+	asset->textures.resize(numMaterials);
+	for (int i = 0; i < numMaterials; i++)
+	{
+		const char* texture = asset->cached ? asset->cache.texture(i) : asset->mesh.materials[i].texture.c_str();
+		if (!texture || !*texture)
+			continue;
+
+		// another model loaded it already, nothing to read
+		if (TextureCache::Contains(texture))
+			continue;
+
+		// the same two places the texture cache looks
+		if (!AssetLoader::ReadFile(texture, &asset->textures[i]))
+			AssetLoader::ReadFile(string("..\\") + texture, &asset->textures[i]);
+	}
+
+	return asset;
+}
+
+/*Builds the asset's BVH over the full level, the first faces of the mesh
+either way it is made, so a hit's triangle is the mesh's face
+
+asset - decoded, with a cache or a parsed mesh (a BVH isn't built otherwise)
+*/
+void Model::BuildBvh(ModelAsset* asset)
+{
+	vector<float> positions;
+	vector<unsigned int> indices;
+	if (asset->cached)
+	{
+		positions.resize(asset->cache.numVertices() * 3);
+		for (int i = 0; i < asset->cache.numVertices(); i++)
+		{
+			BakedVertex vertex;
+			asset->cache.vertex(i, &vertex);
+			for (int k = 0; k < 3; k++)
+				positions[i * 3 + k] = vertex.position[k];
+		}
+
+		const BakedLod& full = asset->cache.lods()[0];
+		indices.resize(full.numTriangles * 3);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			size_t at = full.firstTriangle * 3 + i;
+			if (asset->cache.indexSize() == 4)
+				indices[i] = ((const unsigned int*)asset->cache.indices())[at];
+			else
+				indices[i] = ((const unsigned short*)asset->cache.indices())[at];
+		}
+	}
+	else if (asset->parsed)
+	{
+		positions = asset->mesh.positions;
+		indices = asset->lods.empty() ? asset->mesh.indices : asset->lods[0].indices;
+	}
+
+	if (!indices.empty())
+		asset->bvh.build(&positions[0], &indices[0], (unsigned int)indices.size() / 3);
+}
+
+/*Makes the device resources for a decoded model. The baked cache is used
+when there is one, then the parsed file, and anything XFile can't read goes
+through D3DX
+
+g_pDevice is the direct3d device used for rendering
+asset - what Decode read
+*/
+HRESULT Model::Create(LPDIRECT3DDEVICE9 g_pDevice, const ModelAsset& asset)
+{
+	HRESULT r = E_FAIL;
+	if (asset.cached)
+		r = CreateMesh(g_pDevice, asset.cache, &asset.textures);
+	if (FAILED(r) && asset.parsed)
+		r = CreateMesh(g_pDevice, asset.mesh, &asset.textures, &asset.lods);
+	if (SUCCEEDED(r))
+		bvh = asset.bvh;
+	else
+	{
+		bvh.clear();
+		r = LoadWithD3DX(g_pDevice);
+	}
+
+	loaded = SUCCEEDED(r);
+	return r;
+}
+
+/*Loads the mesh and textures with D3DX, for files XFile can't read
+
+g_pDevice is the direct3d device used for rendering
+*/
+HRESULT Model::LoadWithD3DX(LPDIRECT3DDEVICE9 g_pDevice)
 {
 	LPD3DXBUFFER pD3DXMtrlBuffer;
 
@@ -69,49 +240,400 @@ HRESULT Model::InitGeometry(LPDIRECT3DDEVICE9 g_pDevice)
 		if (d3dxMaterials[i].pTextureFilename != NULL &&
 			lstrlen(d3dxMaterials[i].pTextureFilename) > 0)
 		{
-			// Create the texture
-			if (FAILED(D3DXCreateTextureFromFile(g_pDevice,
-				d3dxMaterials[i].pTextureFilename,
-				&g_pMeshTextures[i])))
-			{
-				// If texture is not in current folder, try parent folder
-				const TCHAR* strPrefix = TEXT("..\\");
-				const int lenPrefix = lstrlen(strPrefix);
-				TCHAR strTexture[MAX_PATH];
-				lstrcpyn(strTexture, strPrefix, MAX_PATH);
-				lstrcpyn(strTexture + lenPrefix, d3dxMaterials[i].pTextureFilename, MAX_PATH - lenPrefix);
-				// If texture is not in current folder, try parent folder
-				if (FAILED(D3DXCreateTextureFromFile(g_pDevice,
-					strTexture,
-					&g_pMeshTextures[i])))
-				{
-					MessageBox(NULL, "Could not find texture map", "Meshes.exe", MB_OK);
-				}
-			}
+			LoadTexture(g_pDevice, d3dxMaterials[i].pTextureFilename, 0, &g_pMeshTextures[i]);
 		}
 	}
 
 	// Done with the material buffer
 	pD3DXMtrlBuffer->Release();
 
+	// no levels of detail or meshlets, only the mesh as it is
+	g_dwNumLods = 1;
+	lodErrors.assign(1, 0.0f);
+	lodTriangles.assign(1, g_pMesh->GetNumFaces());
+	SetMeshlets(0, 0);
+
+	return S_OK;
+}
+
+/*Builds the D3DX mesh, materials and textures from a mesh XFile loaded
+
+g_pDevice is the direct3d device used for rendering
+xMesh is the loaded file
+textures - the texture files' contents per material, if they have been read already
+lods - xMesh's levels of detail from MeshLod, or 0 to draw it as it is
+*/
+HRESULT Model::CreateMesh(LPDIRECT3DDEVICE9 g_pDevice, const XMesh& xMesh, const vector<vector<char> >* textures,
+	const vector<MeshLodLevel>* lods)
+{
+	struct MeshVertex
+	{
+		D3DXVECTOR3 position;
+		D3DXVECTOR3 normal;
+		float u, v;
+	};
+
+	// without levels of detail the mesh is its own only level
+	vector<MeshLodLevel> single;
+	if (!lods || lods->empty())
+	{
+		single.resize(1);
+		single[0].indices = xMesh.indices;
+		single[0].attributes = xMesh.attributes;
+		single[0].error = 0.0f;
+		lods = &single;
+	}
+
+	DWORD numVertices = xMesh.numVertices();
+	DWORD numMaterials = (DWORD)xMesh.materials.size();
+	DWORD numFaces = 0;
+	for (size_t l = 0; l < lods->size(); l++)
+		numFaces += (DWORD)(*lods)[l].attributes.size();
+	if (numVertices == 0 || numFaces == 0)
+		return E_FAIL;
+
+	DWORD options = D3DXMESH_SYSTEMMEM;
+	if (numVertices > 0xFFFF)
+		options |= D3DXMESH_32BIT;
+
+	if (FAILED(D3DXCreateMeshFVF(numFaces, numVertices, options,
+		D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_TEX1, g_pDevice, &g_pMesh)))
+	{
+		return E_FAIL;
+	}
+
+	bool hasNormals = !xMesh.normals.empty();
+	bool hasTexCoords = !xMesh.texCoords.empty();
+
+	MeshVertex* v;
+	g_pMesh->LockVertexBuffer(0, (void**)&v);
+	for (DWORD i = 0; i < numVertices; i++)
+	{
+		v[i].position = D3DXVECTOR3(&xMesh.positions[i * 3]);
+		v[i].normal = hasNormals ? D3DXVECTOR3(&xMesh.normals[i * 3]) : D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		v[i].u = hasTexCoords ? xMesh.texCoords[i * 2] : 0.0f;
+		v[i].v = hasTexCoords ? xMesh.texCoords[i * 2 + 1] : 0.0f;
+	}
+	g_pMesh->UnlockVertexBuffer();
+
+	// the levels one after another, over the same vertices
+	void* indices;
+	g_pMesh->LockIndexBuffer(0, &indices);
+	DWORD i = 0;
+	for (size_t l = 0; l < lods->size(); l++)
+	{
+		const vector<unsigned int>& levelIndices = (*lods)[l].indices;
+		for (size_t k = 0; k < levelIndices.size(); k++, i++)
+		{
+			if (options & D3DXMESH_32BIT)
+				((DWORD*)indices)[i] = levelIndices[k];
+			else
+				((WORD*)indices)[i] = (WORD)levelIndices[k];
+		}
+	}
+	g_pMesh->UnlockIndexBuffer();
+
+	// each level has a subset per material, after the last level's, and
+	// the attribute table is worked out on the way if the faces come sorted
+	DWORD* attributes;
+	g_pMesh->LockAttributeBuffer(0, &attributes);
+	g_dwNumLods = (DWORD)lods->size();
+	lodErrors.resize(g_dwNumLods);
+	lodTriangles.resize(g_dwNumLods);
+	vector<D3DXATTRIBUTERANGE> table;
+	vector<Meshlet> levelMeshlets;
+	bool sorted = true;
+	i = 0;
+	for (DWORD l = 0; l < g_dwNumLods; l++)
+	{
+		const MeshLodLevel& level = (*lods)[l];
+		for (size_t m = 0; m < level.meshlets.size(); m++)
+		{
+			levelMeshlets.push_back(level.meshlets[m]);
+			levelMeshlets.back().firstTriangle += i;
+		}
+
+		for (size_t t = 0; t < level.attributes.size(); t++, i++)
+		{
+			DWORD id = l * numMaterials + level.attributes[t];
+			attributes[i] = id;
+
+			if (table.empty() || table.back().AttribId != id)
+			{
+				sorted = sorted && (table.empty() || table.back().AttribId < id);
+				D3DXATTRIBUTERANGE range = { id, i, 0, numVertices, 0 };
+				table.push_back(range);
+			}
+
+			// VertexCount holds the highest vertex until the table is done
+			D3DXATTRIBUTERANGE& range = table.back();
+			range.FaceCount++;
+			for (int k = 0; k < 3; k++)
+			{
+				DWORD v = level.indices[t * 3 + k];
+				range.VertexStart = v < range.VertexStart ? v : range.VertexStart;
+				range.VertexCount = v > range.VertexCount ? v : range.VertexCount;
+			}
+		}
+		lodErrors[l] = level.error;
+		lodTriangles[l] = (DWORD)level.attributes.size();
+	}
+	g_pMesh->UnlockAttributeBuffer();
+
+	// the coarser levels add their faces' normals too, but they lie along
+	// the same surface
+	if (!hasNormals)
+		D3DXComputeNormals(g_pMesh, NULL);
+
+	if (sorted)
+	{
+		// each subset is one run of faces already, so each DrawSubset is one draw call
+		for (size_t r = 0; r < table.size(); r++)
+			table[r].VertexCount = table[r].VertexCount - table[r].VertexStart + 1;
+		g_pMesh->SetAttributeTable(&table[0], (DWORD)table.size());
+	}
+	else
+	{
+		// group the faces by material so each DrawSubset is one draw call, like D3DX does,
+		// without splitting the vertices the levels share. The meshlets' runs are lost.
+		DWORD* adjacency = new DWORD[numFaces * 3];
+		g_pMesh->GenerateAdjacency(0.0f, adjacency);
+		g_pMesh->OptimizeInplace(D3DXMESHOPT_ATTRSORT | D3DXMESHOPT_DONOTSPLIT, adjacency, NULL, NULL, NULL);
+		delete[] adjacency;
+		levelMeshlets.clear();
+	}
+
+	g_dwNumMaterials = numMaterials;
+	g_pMeshMaterials = new D3DMATERIAL9[g_dwNumMaterials];
+	g_pMeshTextures = new LPDIRECT3DTEXTURE9[g_dwNumMaterials];
+
+	for (DWORD i = 0; i < g_dwNumMaterials; i++)
+	{
+		const XMaterial& m = xMesh.materials[i];
+		g_pMeshMaterials[i] = MakeMaterial(m.diffuse, m.power, m.specular, m.emissive);
+
+		g_pMeshTextures[i] = NULL;
+		if (!m.texture.empty())
+		{
+			LoadTexture(g_pDevice, m.texture.c_str(), textures ? &(*textures)[i] : 0, &g_pMeshTextures[i]);
+		}
+	}
+
+	SetMeshlets(levelMeshlets.empty() ? 0 : &levelMeshlets[0], levelMeshlets.size());
+	return S_OK;
+}
+
+/*Builds the D3DX mesh, materials and textures straight from a mapped cache.
+The cache is already in the index size and material order the mesh uses, so
+the index buffer is copied and the attribute table is set from the subsets
+rather than worked out again. Float vertices are copied too; quantized ones
+are unpacked, as the fixed function pipeline only takes float positions and
+normals
+
+g_pDevice is the direct3d device used for rendering
+cache is the opened cache
+textures - the texture files' contents per material, if they have been read already
+*/
+HRESULT Model::CreateMesh(LPDIRECT3DDEVICE9 g_pDevice, const MeshCache& cache, const vector<vector<char> >* textures)
+{
+	DWORD numVertices = cache.numVertices();
+	DWORD numFaces = cache.numTriangles();
+	if (numVertices == 0 || numFaces == 0)
+		return E_FAIL;
+
+	DWORD options = D3DXMESH_SYSTEMMEM;
+	if (cache.indexSize() == 4)
+		options |= D3DXMESH_32BIT;
+
+	if (FAILED(D3DXCreateMeshFVF(numFaces, numVertices, options,
+		D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_TEX1, g_pDevice, &g_pMesh)))
+	{
+		return E_FAIL;
+	}
+
+	BakedVertex* vertices;
+	g_pMesh->LockVertexBuffer(0, (void**)&vertices);
+	if (cache.vertexFormat() == VERTEX_FLOAT)
+		memcpy(vertices, cache.vertices(), numVertices * sizeof(BakedVertex));
+	else
+	{
+		for (DWORD i = 0; i < numVertices; i++)
+			cache.vertex(i, &vertices[i]);
+	}
+	g_pMesh->UnlockVertexBuffer();
+
+	void* indices;
+	g_pMesh->LockIndexBuffer(0, &indices);
+	memcpy(indices, cache.indices(), numFaces * 3 * cache.indexSize());
+	g_pMesh->UnlockIndexBuffer();
+
+	// each level has a subset per material, after the last level's
+	const BakedSubset* subsets = cache.subsets();
+	const BakedLod* lods = cache.lods();
+	D3DXATTRIBUTERANGE* table = new D3DXATTRIBUTERANGE[cache.numSubsets()];
+	DWORD* attributes;
+	g_pMesh->LockAttributeBuffer(0, &attributes);
+	g_dwNumLods = (DWORD)cache.numLods();
+	lodErrors.resize(g_dwNumLods);
+	lodTriangles.resize(g_dwNumLods);
+	for (DWORD l = 0; l < g_dwNumLods; l++)
+	{
+		for (unsigned int s = lods[l].firstSubset; s < lods[l].firstSubset + lods[l].numSubsets; s++)
+		{
+			DWORD id = l * cache.numMaterials() + subsets[s].material;
+			for (DWORD i = 0; i < subsets[s].numTriangles; i++)
+				attributes[subsets[s].firstTriangle + i] = id;
+
+			table[s].AttribId = id;
+			table[s].FaceStart = subsets[s].firstTriangle;
+			table[s].FaceCount = subsets[s].numTriangles;
+			table[s].VertexStart = subsets[s].firstVertex;
+			table[s].VertexCount = subsets[s].numVertices;
+		}
+		lodErrors[l] = lods[l].error;
+		lodTriangles[l] = lods[l].numTriangles;
+	}
+	g_pMesh->UnlockAttributeBuffer();
+	g_pMesh->SetAttributeTable(table, cache.numSubsets());
+	delete[] table;
+
+	g_dwNumMaterials = (DWORD)cache.numMaterials();
+	g_pMeshMaterials = new D3DMATERIAL9[g_dwNumMaterials];
+	g_pMeshTextures = new LPDIRECT3DTEXTURE9[g_dwNumMaterials];
+
+	const BakedMaterial* materials = cache.materials();
+	for (DWORD i = 0; i < g_dwNumMaterials; i++)
+	{
+		const BakedMaterial& m = materials[i];
+		g_pMeshMaterials[i] = MakeMaterial(m.diffuse, m.power, m.specular, m.emissive);
+
+		g_pMeshTextures[i] = NULL;
+		if (cache.texture(i))
+		{
+			LoadTexture(g_pDevice, cache.texture(i), textures ? &(*textures)[i] : 0, &g_pMeshTextures[i]);
+		}
+	}
+
+	SetMeshlets(cache.meshlets(), cache.numMeshlets());
 	return S_OK;
 }
 
-/*Sets the transormation matrix for the model
+/*Gets the texture from the shared cache, which creates it from the current
+folder, or failing that the parent folder, the first time any model asks
 
 g_pDevice is the direct3d device used for rendering
+fileName is the texture's file name as the .x file gives it
+data - the file's contents if a loader thread has read them already, else 0
 */
-void Model::RenderModel(LPDIRECT3DDEVICE9 g_pDevice)
+void Model::LoadTexture(LPDIRECT3DDEVICE9 g_pDevice, const char* fileName, const vector<char>* data, LPDIRECT3DTEXTURE9* ppTexture)
 {
-	//Make a master matrix in this function as a member
-	//make functions that alter the transformation matrix 
-	//Use the directx matrix generation/multiplication functions
-	g_pDevice->SetTransform(D3DTS_WORLD, &master);
+	*ppTexture = TextureCache::Acquire(g_pDevice, fileName, data);
+	if (!*ppTexture)
+	{
+		MessageBox(NULL, "Could not find texture map", "Meshes.exe", MB_OK);
+	}
+}
+
+/*Remembers the current transformation so the next frames can blend from it
+to wherever the coming simulation step moves the model
+*/
+void Model::SaveState()
+{
+	previous = transform;
+}
+
+/*Rebuilds the world matrices of the models that moved (or were measured)
+since the last call, then their world bounds, each in one batch, and returns
+how many that was
+
+bounds - the world bounds, one per model in the same order
+*/
+size_t Model::UpdateWorlds(Model** models, int numModels, WorldBounds* bounds)
+{
+	vector<Transform*> transforms;
+	vector<float*> worlds;
+	vector<const LocalBounds*> locals;
+	vector<WorldBounds*> placed;
+	for (int i = 0; i < numModels; i++)
+	{
+		if (!models[i]->transform.dirty)
+			continue;
+
+		transforms.push_back(&models[i]->transform);
+		worlds.push_back((float*)&models[i]->master);
+		locals.push_back(&models[i]->localBounds);
+		placed.push_back(&bounds[i]);
+	}
+	if (transforms.empty())
+		return 0;
+
+	Transforms::UpdateWorlds(&transforms[0], &worlds[0], transforms.size());
+	Bounds::PlaceAll(&locals[0], (const float* const*)&worlds[0], &placed[0], placed.size());
+	return transforms.size();
+}
 
-	//Translate BSphere to same spot as model
-	//Gets messed up by rotation, fix later
-	BSphere._center = D3DXVECTOR3(master._41, master._42, master._43);
+/*Sets the world transform for the model, blended between its last two states
+
+g_pDevice is the direct3d device used for rendering
+alpha - where between the previous (0) and the current (1) transformation to draw the model
+*/
+void Model::SetWorld(LPDIRECT3DDEVICE9 g_pDevice, float alpha)
+{
+	//Blend the two states a part at a time, lerping a whole matrix would shear
+	//the model part way through a rotation
+	D3DXMATRIXA16 world = master;
+	if (alpha < 1.0f)
+	{
+		Transform blended;
+		Transforms::Blend(previous, transform, alpha, &blended);
+		Transforms::Matrix(blended, (float*)&world);
+	}
+	//Moved (or measured) since the last batch, so master is behind. The flag
+	//is left for UpdateWorlds, which places the bounds along with the matrix
+	else if (transform.dirty)
+	{
+		Transforms::Matrix(transform, (float*)&world);
+	}
+
+	g_pDevice->SetTransform(D3DTS_WORLD, &world);
+}
+
+/*Draws the model, at the level of detail its size on screen calls for, and
+returns how many triangles that took. With meshlets, only those in view and
+facing the camera are drawn, each subset's survivors as a few runs of its
+faces
+
+g_pDevice is the direct3d device used for rendering
+alpha - where between the previous (0) and the current (1) transformation to draw the model
+useLods - false to always draw the full mesh
+useMeshlets - false to draw whole subsets
+stats - if given, what culling the meshlets took out is added to it
+*/
+DWORD Model::RenderModel(LPDIRECT3DDEVICE9 g_pDevice, float alpha, bool useLods, bool useMeshlets, MeshletStats* stats)
+{
+	SetWorld(g_pDevice, alpha);
+	lod = useLods ? SelectLod(g_pDevice) : 0;
 
+	bool cull = useMeshlets && !meshlets.empty();
+	float planes[24], eye[3];
+	bool backFaces = false;
+	if (cull)
+	{
+		backFaces = CullSpace(g_pDevice, planes, eye);
+
+		// DrawSubset sets these for itself, the runs need them set
+		LPDIRECT3DVERTEXBUFFER9 vertexBuffer;
+		LPDIRECT3DINDEXBUFFER9 indexBuffer;
+		g_pMesh->GetVertexBuffer(&vertexBuffer);
+		g_pMesh->GetIndexBuffer(&indexBuffer);
+		g_pDevice->SetStreamSource(0, vertexBuffer, 0, g_pMesh->GetNumBytesPerVertex());
+		g_pDevice->SetIndices(indexBuffer);
+		g_pDevice->SetFVF(g_pMesh->GetFVF());
+		vertexBuffer->Release();
+		indexBuffer->Release();
+	}
+
+	DWORD triangles = 0;
 	for (DWORD i = 0; i < g_dwNumMaterials; i++)
 	{
 		// Set the material and texture for this subset
@@ -119,8 +641,141 @@ void Model::RenderModel(LPDIRECT3DDEVICE9 g_pDevice)
 		g_pDevice->SetTexture(0, g_pMeshTextures[i]);
 
 		// Draw the mesh subset
-		g_pMesh->DrawSubset(i);
+		DWORD subset = lod * g_dwNumMaterials + i;
+		if (!cull)
+		{
+			g_pMesh->DrawSubset(subset);
+			continue;
+		}
+
+		ranges.clear();
+		DWORD first = subsetMeshlets[subset];
+		Meshlets::Cull(&meshlets[0] + first, subsetMeshlets[subset + 1] - first, planes, eye, backFaces, &ranges, stats);
+
+		const D3DXATTRIBUTERANGE& range = subsetRanges[subset];
+		for (size_t r = 0; r < ranges.size(); r++)
+		{
+			g_pDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, range.VertexStart, range.VertexCount,
+				ranges[r].firstTriangle * 3, ranges[r].numTriangles);
+			triangles += ranges[r].numTriangles;
+		}
 	}
+
+	return cull ? triangles : lodTriangles[lod];
+}
+
+/*Works out the frustum planes and the camera's position in the model's own
+space, from the transforms set on the device, and returns whether back faces
+are culled at all, as the meshlets' cones are no use otherwise
+
+g_pDevice is the direct3d device used for rendering
+planes - gets the six planes, see Meshlets::FrustumPlanes
+eye - gets the camera's position
+*/
+bool Model::CullSpace(LPDIRECT3DDEVICE9 g_pDevice, float* planes, float* eye)
+{
+	D3DXMATRIXA16 world, view, projection, worldView, all, inverse;
+	g_pDevice->GetTransform(D3DTS_WORLD, &world);
+	g_pDevice->GetTransform(D3DTS_VIEW, &view);
+	g_pDevice->GetTransform(D3DTS_PROJECTION, &projection);
+
+	D3DXMatrixMultiply(&worldView, &world, &view);
+	D3DXMatrixMultiply(&all, &worldView, &projection);
+	Meshlets::FrustumPlanes((const float*)&all, planes);
+
+	// the camera is at the origin of view space
+	D3DXMatrixInverse(&inverse, NULL, &worldView);
+	eye[0] = inverse._41;
+	eye[1] = inverse._42;
+	eye[2] = inverse._43;
+
+	DWORD cullMode;
+	g_pDevice->GetRenderState(D3DRS_CULLMODE, &cullMode);
+	return cullMode != D3DCULL_NONE;
+}
+
+/*Keeps the meshlets, whose runs are counted from the start of the index
+buffer, and finds each subset's among them. The mesh and its attribute
+table must be made already
+
+newMeshlets - every level's meshlets in the order of their faces, or 0 for none
+*/
+void Model::SetMeshlets(const Meshlet* newMeshlets, size_t numMeshlets)
+{
+	DWORD numSubsets = g_dwNumLods * g_dwNumMaterials;
+	D3DXATTRIBUTERANGE none = { 0, 0, 0, 0, 0 };
+	subsetRanges.assign(numSubsets, none);
+	meshlets.assign(newMeshlets, newMeshlets + numMeshlets);
+	subsetMeshlets.assign(numSubsets + 1, (DWORD)numMeshlets);
+
+	DWORD numRanges = 0;
+	g_pMesh->GetAttributeTable(NULL, &numRanges);
+	vector<D3DXATTRIBUTERANGE> table(numRanges);
+	if (numRanges > 0)
+		g_pMesh->GetAttributeTable(&table[0], &numRanges);
+	for (DWORD r = 0; r < numRanges; r++)
+	{
+		if (table[r].AttribId < numSubsets)
+			subsetRanges[table[r].AttribId] = table[r];
+	}
+
+	// the subsets run in the order of their ids, and no meshlet crosses one
+	size_t m = 0;
+	for (DWORD s = 0; s < numSubsets; s++)
+	{
+		subsetMeshlets[s] = (DWORD)m;
+		while (m < numMeshlets && meshlets[m].firstTriangle < subsetRanges[s].FaceStart + subsetRanges[s].FaceCount)
+			m++;
+	}
+}
+
+/*Picks the level of detail from the size the bounding sphere projects to
+with the current view, projection and viewport, starting from the last one
+drawn so it only changes once the size is well past the switch
+
+g_pDevice is the direct3d device used for rendering
+*/
+int Model::SelectLod(LPDIRECT3DDEVICE9 g_pDevice)
+{
+	D3DXMATRIXA16 world, view, projection;
+	D3DVIEWPORT9 viewport;
+	g_pDevice->GetTransform(D3DTS_WORLD, &world);
+	g_pDevice->GetTransform(D3DTS_VIEW, &view);
+	g_pDevice->GetTransform(D3DTS_PROJECTION, &projection);
+	g_pDevice->GetViewport(&viewport);
+
+	// the sphere where SetWorld is drawing the model
+	WorldBounds bounds;
+	Bounds::Place(localBounds, (const float*)&world, &bounds);
+	D3DXVECTOR3 center(bounds.center[0], bounds.center[1], bounds.center[2]);
+	D3DXVec3TransformCoord(&center, &center, &view);
+
+	float screenRadius = MeshLod::ScreenRadius(bounds.radius, center.z, projection._22, (float)viewport.Height);
+	return MeshLod::Select(&lodErrors[0], (int)lodErrors.size(), lod, localBounds.radius, screenRadius);
+}
+
+int Model::GetLod() const
+{
+	return lod;
+}
+
+/*Draws a stand in where the model will be, while it is still loading
+
+g_pDevice is the direct3d device used for rendering
+placeholder - the mesh to draw instead, in plain grey
+alpha - where between the previous (0) and the current (1) transformation to draw the model
+*/
+void Model::RenderPlaceholder(LPDIRECT3DDEVICE9 g_pDevice, LPD3DXMESH placeholder, float alpha)
+{
+	SetWorld(g_pDevice, alpha);
+
+	const float grey[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	const float black[3] = { 0.0f, 0.0f, 0.0f };
+	D3DMATERIAL9 material = MakeMaterial(grey, 0.0f, black, black);
+	g_pDevice->SetMaterial(&material);
+	g_pDevice->SetTexture(0, 0);
+
+	placeholder->DrawSubset(0);
 }
 
 /*Creates the initial matrix for the rendering position of the model, the camera,
@@ -166,24 +821,77 @@ void Model::SetupMatrices(LPDIRECT3DDEVICE9 g_pDevice)
 	g_pDevice->SetTransform(D3DTS_PROJECTION, &matProj);
 }
 
-void Model::CreateBSphere()
+/*Measures the mesh's bounding sphere and box in model space, and marks the
+transform changed so the next UpdateWorlds places them in the world
+*/
+void Model::CreateBounds()
 {
 	BYTE* v;
 	g_pMesh->LockVertexBuffer(0, (void**)&v);
 
-	D3DXComputeBoundingSphere(
-		(D3DXVECTOR3*)v,
-		g_pMesh->GetNumVertices(),
-		D3DXGetFVFVertexSize(g_pMesh->GetFVF()),
-		&BSphere._center,
-		&BSphere._radius);
+	DWORD numVertices = g_pMesh->GetNumVertices();
+	DWORD stride = D3DXGetFVFVertexSize(g_pMesh->GetFVF());
+	D3DXVECTOR3 center, lo, hi;
+	float radius;
+	D3DXComputeBoundingSphere((D3DXVECTOR3*)v, numVertices, stride, &center, &radius);
+	D3DXComputeBoundingBox((D3DXVECTOR3*)v, numVertices, stride, &lo, &hi);
 
 	g_pMesh->UnlockVertexBuffer();
+
+	localBounds.center[0] = center.x;
+	localBounds.center[1] = center.y;
+	localBounds.center[2] = center.z;
+	localBounds.radius = radius;
+	const float* low = (const float*)&lo;
+	const float* high = (const float*)&hi;
+	for (int k = 0; k < 3; k++)
+	{
+		localBounds.boxCenter[k] = (low[k] + high[k]) * 0.5f;
+		localBounds.boxExtent[k] = (high[k] - low[k]) * 0.5f;
+	}
+	transform.dirty = true;
+}
+
+const LocalBounds& Model::GetLocalBounds() const
+{
+	return localBounds;
 }
 
-BoundingSphere* Model::GetBSphere()
+const MeshBvh* Model::GetBvh() const
 {
-	return &BSphere;
+	return bvh.empty() ? 0 : &bvh;
+}
+
+/*How far any point of the mesh can be from where the latest state puts it
+when it is drawn between its last two states: the move, plus the arc its
+farthest point can sweep through the turn and the change of scale. Culling
+world bounds grown by this never loses a model part way through a step
+*/
+float Model::GetMotion() const
+{
+	if (!loaded)
+		return 0.0f;
+
+	float scale = 0.0f, scaleChange = 0.0f;
+	for (int k = 0; k < 3; k++)
+	{
+		scale = transform.scale[k] > scale ? transform.scale[k] : scale;
+		scale = previous.scale[k] > scale ? previous.scale[k] : scale;
+		float change = fabsf(transform.scale[k] - previous.scale[k]);
+		scaleChange = change > scaleChange ? change : scaleChange;
+	}
+
+	const float* q0 = previous.rotation;
+	const float* q1 = transform.rotation;
+	float cosine = fabsf(q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] + q0[3] * q1[3]);
+	float angle = 2.0f * acosf(cosine < 1.0f ? cosine : 1.0f);
+
+	D3DXVECTOR3 center(localBounds.center[0], localBounds.center[1], localBounds.center[2]);
+	D3DXVECTOR3 moved(transform.translation[0] - previous.translation[0],
+		transform.translation[1] - previous.translation[1],
+		transform.translation[2] - previous.translation[2]);
+	float reach = D3DXVec3Length(&center) + localBounds.radius;
+	return D3DXVec3Length(&moved) + reach * (scale * angle + scaleChange);
 }
 
 /*Deallocates the resources used by the model*/
@@ -196,8 +904,8 @@ void Model::Cleanup()
 	{
 		for (DWORD i = 0; i < g_dwNumMaterials; i++)
 		{
-			if (g_pMeshTextures[i])
-				g_pMeshTextures[i]->Release();
+			// shared with every other model using the same image
+			TextureCache::Release(g_pMeshTextures[i]);
 		}
 		delete[] g_pMeshTextures;
 	}
@@ -205,6 +913,12 @@ void Model::Cleanup()
 		g_pMesh->Release();
 }
 
+ModelAsset::ModelAsset()
+	: cached(false)
+	, parsed(false)
+{
+}
+
 BoundingSphere::BoundingSphere()
 {
 	_radius = 0.0f;
@@ -217,54 +931,42 @@ g_pDevice - the direct3d device used for rendering
 */
 void Model::moveRight(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 trans;
-	D3DXMatrixTranslation(&trans, -0.2f, 0, 0);
-	D3DXMatrixMultiply(&master, &master, &trans);
+	Transforms::Translate(&transform, -0.2f, 0.0f, 0.0f);
 }
 /*Translates the model to the left along x axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::moveLeft(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 trans;
-	D3DXMatrixTranslation(&trans, 0.2f, 0, 0);
-	D3DXMatrixMultiply(&master, &master, &trans);
+	Transforms::Translate(&transform, 0.2f, 0.0f, 0.0f);
 }
 /*Translates the model forward along z axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::moveForward(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 trans;
-	D3DXMatrixTranslation(&trans, 0, 0, -0.2f);
-	D3DXMatrixMultiply(&master, &master, &trans);
+	Transforms::Translate(&transform, 0.0f, 0.0f, -0.2f);
 }
 /*Translates the model backward along z axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::moveBack(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 trans;
-	D3DXMatrixTranslation(&trans, 0, 0, 0.2f);
-	D3DXMatrixMultiply(&master, &master, &trans);
+	Transforms::Translate(&transform, 0.0f, 0.0f, 0.2f);
 }
 /*Translates the model up along y axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::moveUp(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 trans;
-	D3DXMatrixTranslation(&trans, 0, 0.2f, 0);
-	D3DXMatrixMultiply(&master, &master, &trans);
+	Transforms::Translate(&transform, 0.0f, 0.2f, 0.0f);
 }
 /*Translates the model down along y axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::moveDown(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 trans;
-	D3DXMatrixTranslation(&trans, 0, -0.2f, 0);
-	D3DXMatrixMultiply(&master, &master, &trans);
+	Transforms::Translate(&transform, 0.0f, -0.2f, 0.0f);
 }
 
 /*Rotates the model CW around the x axis
@@ -272,54 +974,48 @@ g_pDevice - the direct3d device used for rendering
 */
 void Model::rotateXpos(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 rotate;
-	D3DXMatrixRotationX(&rotate, 0.1f);
-	D3DXMatrixMultiply(&master, &master, &rotate);
+	const float axis[3] = { 1.0f, 0.0f, 0.0f };
+	Transforms::Rotate(&transform, axis, 0.1f);
 }
 /*Rotates the model CW around the y axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::rotateYpos(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 rotate;
-	D3DXMatrixRotationY(&rotate, 0.1f);
-	D3DXMatrixMultiply(&master, &master, &rotate);
+	const float axis[3] = { 0.0f, 1.0f, 0.0f };
+	Transforms::Rotate(&transform, axis, 0.1f);
 }
 /*Rotates the model CW around the z axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::rotateZpos(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 rotate;
-	D3DXMatrixRotationZ(&rotate, 0.1f);
-	D3DXMatrixMultiply(&master, &master, &rotate);
+	const float axis[3] = { 0.0f, 0.0f, 1.0f };
+	Transforms::Rotate(&transform, axis, 0.1f);
 }
 /*Rotates the model CCW around the x axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::rotateXneg(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 rotate;
-	D3DXMatrixRotationX(&rotate, -0.1f);
-	D3DXMatrixMultiply(&master, &master, &rotate);
+	const float axis[3] = { 1.0f, 0.0f, 0.0f };
+	Transforms::Rotate(&transform, axis, -0.1f);
 }
 /*Rotates the model CCW around the y axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::rotateYneg(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 rotate;
-	D3DXMatrixRotationY(&rotate, -0.1f);
-	D3DXMatrixMultiply(&master, &master, &rotate);
+	const float axis[3] = { 0.0f, 1.0f, 0.0f };
+	Transforms::Rotate(&transform, axis, -0.1f);
 }
 /*Rotates the model CCW around the z axis
 g_pDevice - the direct3d device used for rendering
 */
 void Model::rotateZneg(LPDIRECT3DDEVICE9 g_pDevice)
 {
-	D3DXMATRIXA16 rotate;
-	D3DXMatrixRotationZ(&rotate, -0.1f);
-	D3DXMatrixMultiply(&master, &master, &rotate);
+	const float axis[3] = { 0.0f, 0.0f, 1.0f };
+	Transforms::Rotate(&transform, axis, -0.1f);
 }
 
 #pragma endregion
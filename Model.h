@@ -1,6 +1,15 @@
 #pragma once
 
 #include "basics.h"
+#include "XFile.h"
+#include "MeshCache.h"
+#include "AssetLoader.h"
+#include "TextureCache.h"
+#include "MeshLod.h"
+#include "Meshlets.h"
+#include "Transform.h"
+#include "Bounds.h"
+#include "MeshBvh.h"
 
 struct BoundingSphere
 {
@@ -10,18 +19,49 @@ struct BoundingSphere
 	float       _radius;
 };
 
+//Everything a model needs that can be read and decoded without the device
+struct ModelAsset
+{
+	ModelAsset();
+
+	MeshCache cache;
+	bool      cached;   // cache is open
+	XMesh     mesh;     // the parsed file, when there is no cache
+	bool      parsed;
+	vector<vector<char> > textures; // texture file contents per material, empty if not read
+	vector<MeshLodLevel> lods;      // mesh's levels of detail, when parsed
+	MeshBvh bvh;                    // over the full level's triangles, for picking
+};
+
 class Model {
 
 public:
-	Model(string xFile);
+	Model(string xFile, VertexFormat format = VERTEX_QUANTIZED);
 	Model();
 	~Model();
 
 	HRESULT InitGeometry(LPDIRECT3DDEVICE9 g_pDevice);
+	void LoadAsync(AssetLoader* loader, LPDIRECT3DDEVICE9 g_pDevice);
+	bool IsLoaded() const;
+
+	static std::shared_ptr<ModelAsset> Decode(const string& xFile, VertexFormat format = VERTEX_QUANTIZED);
+	HRESULT Create(LPDIRECT3DDEVICE9 g_pDevice, const ModelAsset& asset);
+	HRESULT CreateMesh(LPDIRECT3DDEVICE9 g_pDevice, const XMesh& xMesh, const vector<vector<char> >* textures = 0,
+		const vector<MeshLodLevel>* lods = 0);
+	HRESULT CreateMesh(LPDIRECT3DDEVICE9 g_pDevice, const MeshCache& cache, const vector<vector<char> >* textures = 0);
+	HRESULT LoadWithD3DX(LPDIRECT3DDEVICE9 g_pDevice);
+	void LoadTexture(LPDIRECT3DDEVICE9 g_pDevice, const char* fileName, const vector<char>* data, LPDIRECT3DTEXTURE9* ppTexture);
 	void SetupMatrices(LPDIRECT3DDEVICE9 g_pDevice);
-	void RenderModel(LPDIRECT3DDEVICE9 g_pDevice);
-	void CreateBSphere();
-	BoundingSphere* GetBSphere();
+	DWORD RenderModel(LPDIRECT3DDEVICE9 g_pDevice, float alpha = 1.0f, bool useLods = true, bool useMeshlets = true,
+		MeshletStats* stats = 0);
+	void RenderPlaceholder(LPDIRECT3DDEVICE9 g_pDevice, LPD3DXMESH placeholder, float alpha = 1.0f);
+	void SaveState();
+	static size_t UpdateWorlds(Model** models, int numModels, WorldBounds* bounds);
+	void CreateBounds();
+	const LocalBounds& GetLocalBounds() const;
+	float GetMotion() const;
+	const MeshBvh* GetBvh() const; // 0 if the model was loaded through D3DX
+	int GetLod() const; // the level of detail last drawn
 
 	void moveRight(LPDIRECT3DDEVICE9 g_pDevice);
 	void moveLeft(LPDIRECT3DDEVICE9 g_pDevice);
@@ -44,13 +84,33 @@ public:
 	D3DMATERIAL9*           g_pMeshMaterials; // Materials for our mesh
 	LPDIRECT3DTEXTURE9*     g_pMeshTextures; // Textures for our mesh
 	DWORD                   g_dwNumMaterials;   // Number of mesh materials
+	DWORD                   g_dwNumLods;        // Levels of detail, subset lod * g_dwNumMaterials + material
 
 	string mxFile;
+	VertexFormat vertexFormat; // of the baked cache
 
-	D3DXMATRIXA16 master;
-
-	BoundingSphere BSphere;
+	Transform transform;    // where the model is
+	Transform previous;     // transform as it was before the last simulation step
+	D3DXMATRIXA16 master;   // transform's world matrix, rebuilt when it has changed
 
 private:
+	static void BuildBvh(ModelAsset* asset);
+	void SetWorld(LPDIRECT3DDEVICE9 g_pDevice, float alpha);
+	int SelectLod(LPDIRECT3DDEVICE9 g_pDevice);
+	bool CullSpace(LPDIRECT3DDEVICE9 g_pDevice, float* planes, float* eye);
+	void SetMeshlets(const Meshlet* newMeshlets, size_t numMeshlets);
+
+	bool loaded; // the mesh is on the device and can be drawn
+	LocalBounds localBounds; // of the mesh, in model space
+	MeshBvh bvh;             // triangles are the mesh's faces, the full level coming first
+
+	vector<float> lodErrors;    // per level, in mesh units
+	vector<DWORD> lodTriangles; // per level
+	int lod;                    // the level last drawn
+
+	vector<Meshlet> meshlets;                 // of every level, runs counted from the start of the index buffer
+	vector<DWORD> subsetMeshlets;             // each subset's first meshlet, and one past the last subset's
+	vector<D3DXATTRIBUTERANGE> subsetRanges;  // each subset's faces and vertices, by id
+	vector<MeshletRange> ranges;              // what is left of a subset to draw, reused
 };
 
@@ -1,41 +1,57 @@
-#include <cstdlib>
 #include "pSystem.h"
 
 const DWORD Particle::FVF = D3DFVF_XYZ | D3DFVF_DIFFUSE;
 
 PSystem::PSystem()
 	: _device(0)
-	, _vb(0)
+	, _stream(0)
+	, _ownsStream(false)
 	, _tex(0)
+	, _emitRate(0.0f)
+	, _size(0.0f)
+	, _maxParticles(0)
+	, _vbSize(0)
+	, _sortBackToFront(false)
+	, _cap(-1)
+	, _emitScale(1.0f)
+	, _emitAccumulator(0.0f)
+	, _renderRewind(0.0f)
+	, _seed(1)
+	, _updateCount(0)
+	, _pool(ThreadPool::Shared())
+	, _collision(0)
 {
+	seed(_seed);
 }
 
 PSystem::~PSystem()
 {
-	_vb->Release();
-	_tex->Release();
+	// a system that was never init'ed (headless benchmark) has no device resources
+	if (_ownsStream)
+		delete _stream;
+	if (_tex)
+		_tex->Release();
 }
 
-bool PSystem::init(IDirect3DDevice9* device, char* texFileName)
+bool PSystem::init(IDirect3DDevice9* device, char* texFileName, VertexStream* stream)
 {
 	_device = device; // save a ptr to the device
 
 	HRESULT hr = 0;
 
-	hr = device->CreateVertexBuffer(
-		_vbSize * sizeof(Particle),
-		D3DUSAGE_DYNAMIC | D3DUSAGE_POINTS | D3DUSAGE_WRITEONLY,
-		Particle::FVF,
-		D3DPOOL_DEFAULT, // D3DPOOL_MANAGED can't be used with D3DUSAGE_DYNAMIC 
-		&_vb,
-		0);
-
-	if (FAILED(hr))
+	if (stream)
 	{
-		::MessageBox(0, "CreateVertexBuffer() - FAILED", "PSystem", 0);
-		return false;
+		_stream = stream;
+	}
+	else
+	{
+		_stream = new VertexStream(new D3DVertexStreamBackend(device), _vbSize * sizeof(Particle));
+		_ownsStream = true;
 	}
 
+	if (!texFileName)
+		return true;
+
 	hr = D3DXCreateTextureFromFile(
 		device,
 		texFileName,
@@ -52,18 +68,89 @@ bool PSystem::init(IDirect3DDevice9* device, char* texFileName)
 
 void PSystem::reset()
 {
-	list<Attribute>::iterator i;
-	for (i = _particles.begin(); i != _particles.end(); i++)
+	for (int i = 0; i < _particles.alive(); i++)
 	{
-		resetParticle(&(*i));
+		respawnParticle(i, _rng);
 	}
 }
 
 void PSystem::addParticle()
 {
 	Attribute attribute;
-	resetParticle(&attribute);
-	_particles.push_back(attribute);
+	resetParticle(&attribute, _rng);
+	_particles.store(_particles.add(), attribute);
+}
+
+void PSystem::respawnParticle(int i, RandomStream& rng)
+{
+	Attribute attribute;
+	resetParticle(&attribute, rng);
+	_particles.store(i, attribute);
+}
+
+void PSystem::respawnParticles(const int* indices, int count, RandomStream& rng)
+{
+	for (int i = 0; i < count; i++)
+	{
+		respawnParticle(indices[i], rng);
+	}
+}
+
+void PSystem::seed(unsigned int seed)
+{
+	_seed = seed;
+	_updateCount = 0;
+	_rng.seed(seed);
+}
+
+void PSystem::setThreadPool(ThreadPool* pool)
+{
+	_pool = pool;
+}
+
+void PSystem::setCollision(ParticleCollision* collision)
+{
+	_collision = collision;
+}
+
+void PSystem::setTexture(IDirect3DTexture9* tex)
+{
+	if (_tex)
+		_tex->Release();
+	_tex = tex;
+}
+
+void PSystem::setSortMode(bool backToFront)
+{
+	_sortBackToFront = backToFront;
+	_sort.reset();
+}
+
+void PSystem::updateChunks(float timeDelta)
+{
+	int n = _particles.alive();
+	if ((int)_respawn.size() < n)
+		_respawn.resize(n);
+
+	int numChunks = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	unsigned int update = _updateCount++;
+
+	_pool->parallelFor(numChunks, [this, n, update, timeDelta](int chunk)
+	{
+		int first = chunk * CHUNK_SIZE;
+		int count = n - first;
+		if (count > CHUNK_SIZE)
+			count = CHUNK_SIZE;
+
+		// stream 0 is the main thread's, chunk streams start at 1
+		RandomStream rng(_seed, update + 1, chunk);
+		updateChunk(first, count, timeDelta, rng);
+	});
+}
+
+// Systems that don't split their update into chunks never get here.
+void PSystem::updateChunk(int first, int count, float timeDelta, RandomStream& rng)
+{
 }
 
 void PSystem::preRender()
@@ -98,117 +185,176 @@ void PSystem::postRender()
 
 void PSystem::render()
 {
-	if (!_particles.empty())
+	if (_particles.alive() > 0)
 	{
 		// set render states
 		preRender();
 
 		_device->SetTexture(0, _tex);
 		_device->SetFVF(Particle::FVF);
-		_device->SetStreamSource(0, _vb, 0, sizeof(Particle));
+		_device->SetStreamSource(0, _stream->buffer(), 0, sizeof(Particle));
 
-		// render batches one by one
-		// start at beginning if we're at the end of the vb
-		if (_vbOffset >= _vbSize)
-			_vbOffset = 0;
-
-		Particle* v = 0;
-
-		_vb->Lock(_vbOffset * sizeof(Particle), _vbBatchSize * sizeof(Particle), (void**)&v, 
-			_vbOffset ? D3DLOCK_NOOVERWRITE : D3DLOCK_DISCARD);
+		// back to front order, starting from last frame's
+		const int* order = 0;
+		if (_sortBackToFront)
+		{
+			D3DXMATRIX view;
+			_device->GetTransform(D3DTS_VIEW, &view);
+			order = _sort.sort(_particles._posX, _particles._posY, _particles._posZ, _particles.alive(), view);
+		}
 
-		DWORD numParticlesInBatch = 0;
+		// one lock covers as many particles as the stream can hold,
+		// so normally the whole system goes in one batch.
+		int maxBatch = (int)_stream->maxVertices(sizeof(Particle));
 
 		// Until all particles have been rendered.
-		std::list<Attribute>::iterator i;
-		for (i = _particles.begin(); i != _particles.end(); i++)
+		int first = 0;
+		while (first < _particles.alive())
 		{
-			if (i->_isAlive)
-			{
-				// Copy a batch of the living particles to the next vertex buffer segment
-				v->_position = i->_position;
-				v->_color = (D3DCOLOR)i->_color;
-				v++; // next element;
-
-				numParticlesInBatch++; //increase batch counter
-
-				// if this batch full?
-				if (numParticlesInBatch == _vbBatchSize)
-				{
-					// Draw the last batch of particles that was copied to the vertex buffer. 
-					_vb->Unlock();
-
-					_device->DrawPrimitive(D3DPT_POINTLIST, _vbOffset, _vbBatchSize);
-
-					// While that batch is drawing, start filling the next batch with particles.
-					
-					// move the offset to the start of the next batch
-					_vbOffset += _vbBatchSize;
-
-					// don't offset into memory thats outside the vb's range.
-					// If we're at the end, start at the beginning.
-					if (_vbOffset >= _vbSize)
-						_vbOffset = 0;
-
-					_vb->Lock(_vbOffset * sizeof(Particle), _vbBatchSize * sizeof(Particle), (void**)&v,
-						_vbOffset ? D3DLOCK_NOOVERWRITE : D3DLOCK_DISCARD);
-
-					numParticlesInBatch = 0; // reset for new batch
-				}
-			}
-		}
+			int numParticlesInBatch = _particles.alive() - first;
+			if (numParticlesInBatch > maxBatch)
+				numParticlesInBatch = maxBatch;
 
-		_vb->Unlock();
+			UINT firstVertex = 0;
+			Particle* v = (Particle*)_stream->alloc(numParticlesInBatch, sizeof(Particle), &firstVertex);
+			if (!v)
+				break;
 
-		// its possible that the LAST batch being filled never got rendered because the condition 
-		// (numParticlesInBatch == _vbBatchSize) would not have been satisfied.  We draw the last partially filled batch now.
+			if (order)
+				fillVertices(v, order + first, numParticlesInBatch);
+			else
+				fillVertices(v, first, numParticlesInBatch);
+			_stream->commit();
 
-		if (numParticlesInBatch)
-		{
-			_device->DrawPrimitive(D3DPT_POINTLIST, _vbOffset, numParticlesInBatch);
-		}
+			_device->DrawPrimitive(D3DPT_POINTLIST, firstVertex, numParticlesInBatch);
 
-		// next block
-		_vbOffset += _vbBatchSize;
+			first += numParticlesInBatch;
+		}
 
 		// reset render states
 		postRender();
 	}
 }
 
-bool PSystem::isEmpty()
+void PSystem::fillVertices(Particle* v, int first, int count)
+{
+	const float* px = _particles._posX + first;
+	const float* py = _particles._posY + first;
+	const float* pz = _particles._posZ + first;
+	const float* vx = _particles._velX + first;
+	const float* vy = _particles._velY + first;
+	const float* vz = _particles._velZ + first;
+	const float* age = _particles._age + first;
+	const D3DCOLOR* color = _particles._color + first;
+	float rewind = _renderRewind;
+
+	// a particle is never drawn from before it was spawned, so one spawned
+	// this step shows where it starts rather than stepped back past it
+	for (int i = 0; i < count; i++)
+	{
+		float t = age[i] < rewind ? age[i] : rewind;
+		v[i]._position.x = px[i] - vx[i] * t;
+		v[i]._position.y = py[i] - vy[i] * t;
+		v[i]._position.z = pz[i] - vz[i] * t;
+		v[i]._color = color[i];
+	}
+}
+
+void PSystem::setRenderRewind(float seconds)
 {
-	return _particles.empty();
+	_renderRewind = seconds;
 }
 
-bool PSystem::isDead()
+void PSystem::setBudget(int cap, float emitScale)
 {
-	list<Attribute>::iterator i;
-	for (i = _particles.begin(); i != _particles.end(); i++)
+	_cap = cap;
+	_emitScale = emitScale;
+}
+
+void PSystem::emit(float timeDelta)
+{
+	// no budget set yet, the system keeps the particles it was made with
+	if (_cap < 0)
+		return;
+
+	int cap = _cap < _maxParticles ? _cap : _maxParticles;
+
+	if (_particles.alive() > cap)
 	{
-		// If any particles still alive, the system is not dead
-		if (i->_isAlive)
-			return false;
+		_particles.truncate(cap);
+		_emitAccumulator = 0.0f;
+		return;
 	}
-	// no living particles found, the system must be dead.
-	return true;
+
+	_emitAccumulator += _emitRate * _emitScale * timeDelta;
+	while (_emitAccumulator >= 1.0f && _particles.alive() < cap)
+	{
+		addParticle();
+		_emitAccumulator -= 1.0f;
+	}
+
+	// don't save up emission while full
+	if (_particles.alive() >= cap)
+		_emitAccumulator = 0.0f;
 }
 
-void PSystem::removeDeadParticles()
+int PSystem::liveCount()
+{
+	return _particles.alive();
+}
+
+int PSystem::maxParticles()
+{
+	return _maxParticles;
+}
+
+const D3DXVECTOR3& PSystem::origin()
+{
+	return _origin;
+}
+
+void PSystem::fillVertices(Particle* v, const int* order, int count)
 {
-	list<Attribute>::iterator i = _particles.begin();
+	float rewind = _renderRewind;
 
-	while (i != _particles.end())
+	for (int k = 0; k < count; k++)
 	{
-		if (i->_isAlive == false)
+		int i = order[k];
+		float t = _particles._age[i] < rewind ? _particles._age[i] : rewind;
+		v[k]._position.x = _particles._posX[i] - _particles._velX[i] * t;
+		v[k]._position.y = _particles._posY[i] - _particles._velY[i] * t;
+		v[k]._position.z = _particles._posZ[i] - _particles._velZ[i] * t;
+		v[k]._color = _particles._color[i];
+	}
+}
+
+bool PSystem::isEmpty()
+{
+	return _particles.alive() == 0;
+}
+
+bool PSystem::isDead()
+{
+	// dead particles are removed from the pool straight away, so the
+	// system is dead once nothing is left in it.
+	return _particles.alive() == 0;
+}
+
+void PSystem::removeDeadParticles()
+{
+	// particles with a lifetime die once they are older than it,
+	// a lifetime of zero means the particle lives until it is respawned.
+	int i = 0;
+	while (i < _particles.alive())
+	{
+		if (_particles._lifeTime[i] > 0.0f && _particles._age[i] > _particles._lifeTime[i])
 		{
-			// erase returns the next iterator, so no need to
-			// incrememnt to the next one ourselves.
-			i = _particles.erase(i);
+			// kill moves the last particle into slot i, so look at i again.
+			_particles.kill(i);
 		}
 		else
 		{
-			i++; // next in list
+			i++; // next particle
 		}
 	}
 }
@@ -243,14 +389,7 @@ bool BoundingBox::isPointInside(D3DXVECTOR3& p)
 
 float PSystem::GetRandomFloat(float lowBound, float highBound)
 {
-	if (lowBound >= highBound) // bad input
-		return lowBound;
-
-	// get random float in [0, 1] interval
-	float f = (rand() % 10000) * 0.0001f;
-
-	// return float in [lowBound, highBound] interval. 
-	return (f * (highBound - lowBound)) + lowBound;
+	return _rng.GetFloat(lowBound, highBound);
 }
 
 void PSystem::GetRandomVector(
@@ -258,9 +397,7 @@ void PSystem::GetRandomVector(
 	D3DXVECTOR3* min,
 	D3DXVECTOR3* max)
 {
-	out->x = GetRandomFloat(min->x, max->x);
-	out->y = GetRandomFloat(min->y, max->y);
-	out->z = GetRandomFloat(min->z, max->z);
+	_rng.GetVector(out, min, max);
 }
 
 DWORD PSystem::FtoDw(float f)
@@ -1,7 +1,13 @@
 #pragma once
 
 #include "basics.h"
-#include <list>
+#include "ParticlePool.h"
+#include "RandomStream.h"
+#include "ThreadPool.h"
+#include "VertexStream.h"
+#include "ParticleSort.h"
+#include "ParticleCollision.h"
+#include <vector>
 
 //Utility
 struct BoundingBox
@@ -24,41 +30,56 @@ struct Particle
 	static const DWORD FVF;
 };
 
-struct Attribute
-{
-	Attribute()
-	{
-		_lifeTime = 0.0f;
-		_age = 0.0f;
-		_isAlive = true;
-	}
-
-	D3DXVECTOR3 _position;
-	D3DXVECTOR3 _velocity;
-	D3DXVECTOR3 _acceleration;
-	float       _lifeTime;     // how long the particle lives for before dying  
-	float       _age;          // current age of the particle  
-	D3DXCOLOR   _color;        // current color of the particle   
-	D3DXCOLOR   _colorFade;    // how the color fades with respect to time
-	bool        _isAlive;
-};
-
 class PSystem
 {
 public:
 	PSystem();
 	virtual ~PSystem();
 
-	virtual bool init(IDirect3DDevice9* device, char* texFileName);
+	// Particles are streamed through stream, which can be shared with other
+	// systems. Without one the system makes its own of _vbSize particles.
+	// With no texFileName the particles are untextured until setTexture.
+	virtual bool init(IDirect3DDevice9* device, char* texFileName, VertexStream* stream = 0);
 	virtual void reset();
 
 	// sometimes we don't want to free the memory of a dead particle,
 	// but rather respawn it instead.
-	virtual void resetParticle(Attribute* attribute) = 0;
+	// rng is the stream of whoever is respawning, so chunks running on
+	// different threads never share one.
+	virtual void resetParticle(Attribute* attribute, RandomStream& rng) = 0;
 	virtual void addParticle();
 
 	virtual void update(float timeDelta) = 0;
 
+	// Seeds the spawn stream and the per chunk streams used by updateChunks.
+	void seed(unsigned int seed);
+	void setThreadPool(ThreadPool* pool);
+
+	// Particles that hit one of collision's colliders get its response. The
+	// colliders have to be built before update and not change during it.
+	void setCollision(ParticleCollision* collision);
+
+	// Takes over the caller's reference to tex, for textures loaded after init.
+	void setTexture(IDirect3DTexture9* tex);
+
+	// Draw the particles farthest from the camera first, so alpha blending comes out right.
+	void setSortMode(bool backToFront);
+
+	// The simulation runs ahead of the frame being drawn, so render draws every
+	// particle this many seconds back along its velocity, or back to where it
+	// was spawned if that is more recent (its age).
+	void setRenderRewind(float seconds);
+
+	// Limits set by the ParticleBudget. cap is how many particles may be alive,
+	// emitScale scales _emitRate.
+	void setBudget(int cap, float emitScale);
+	// Trims the system down to its cap, or emits towards it at the scaled rate.
+	void emit(float timeDelta);
+
+	int liveCount();
+	int maxParticles();
+	const D3DXVECTOR3& origin();
+
 	virtual void preRender();
 	virtual void render();
 	virtual void postRender();
@@ -66,8 +87,13 @@ public:
 	bool isEmpty();
 	bool isDead();
 
-	//Utility
-	// Desc: Return random float in [lowBound, highBound] interval.
+	// Copies count living particles starting at first into the vertex array v.
+	void fillVertices(Particle* v, int first, int count);
+	// Copies the count particles listed in order into the vertex array v.
+	void fillVertices(Particle* v, const int* order, int count);
+
+	//Utility, these draw from the system's own stream
+	// Desc: Return random float in [lowBound, highBound) interval.
 	float GetRandomFloat(float lowBound, float highBound);
 
 	// Desc: Returns a random vector in the bounds specified by min and max.
@@ -79,6 +105,22 @@ public:
 protected:
 	virtual void removeDeadParticles();
 
+	// Respawns the particle in slot i through resetParticle.
+	void respawnParticle(int i, RandomStream& rng);
+
+	// Respawns a list of particles. Systems can override this to draw all of
+	// their random numbers in batches instead of one resetParticle at a time.
+	virtual void respawnParticles(const int* indices, int count, RandomStream& rng);
+
+	// Splits the living particles into CHUNK_SIZE chunks and runs updateChunk on each
+	// across the thread pool. Every chunk gets its own random stream seeded from the
+	// system seed, the update number and the chunk number, so the result is the same
+	// whatever the number of threads.
+	void updateChunks(float timeDelta);
+	virtual void updateChunk(int first, int count, float timeDelta, RandomStream& rng);
+
+	static const int CHUNK_SIZE = 8192; // particles, a multiple of the SIMD width
+
 protected:
 	IDirect3DDevice9*       _device;
 	D3DXVECTOR3             _origin;
@@ -86,15 +128,21 @@ protected:
 	float                   _emitRate;   // rate new particles are added to system
 	float                   _size;       // size of particles
 	IDirect3DTexture9*      _tex;
-	IDirect3DVertexBuffer9* _vb;
-	std::list<Attribute>    _particles;
+	VertexStream*           _stream;
+	bool                    _ownsStream;
+	ParticlePool            _particles;
+	std::vector<int>        _respawn;      // particles that left the system this update
+	RandomStream            _rng;          // spawn stream for the main thread
+	unsigned int            _seed;
+	unsigned int            _updateCount;
+	ThreadPool*             _pool;
+	ParticleCollision*      _collision;    // scene to collide with, not owned
 	int                     _maxParticles; // max allowed particles system can have
-
-										   //
-										   // Following three data elements used for rendering the p-system efficiently
-										   //
-
-	DWORD _vbSize;      // size of vb
-	DWORD _vbOffset;    // offset in vb to lock   
-	DWORD _vbBatchSize; // number of vertices to lock starting at _vbOffset
+	bool                    _sortBackToFront;
+	int                     _cap;            // budgeted number of particles
+	float                   _emitScale;      // budgeted fraction of _emitRate
+	float                   _emitAccumulator;// particles owed by emit but not yet added
+	float                   _renderRewind;   // seconds to step particles back by when drawing
+	ParticleSort            _sort;
+	DWORD                   _vbSize;       // size of the system's own stream, in particles
 };
\ No newline at end of file
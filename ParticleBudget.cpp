@@ -0,0 +1,174 @@
+#include "ParticleBudget.h"
+#include "Utility.h"
+/*Shares a particle frame time budget out between every particle system*/
+
+namespace
+{
+	const double COST_SMOOTHING = 0.1;   // weight of the newest measurement
+	const double DEFAULT_COST = 20e-9;   // seconds per particle before anything is measured
+	const float DISTANCE_FALLOFF = 20.0f;// distance at which a system's weight halves
+	const int MIN_PARTICLES = 64;        // no registered system is starved completely
+	const int REBALANCE_PASSES = 4;
+}
+
+ParticleBudget::ParticleBudget(float targetMs)
+	: _targetMs(targetMs)
+	, _eye(0.0f, 0.0f, 0.0f)
+{
+}
+
+void ParticleBudget::add(PSystem* system, float priority)
+{
+	Entry entry;
+	entry.system = system;
+	entry.priority = priority;
+	entry.updateSeconds = 0.0;
+	entry.renderSeconds = 0.0;
+	entry.costPerParticle = DEFAULT_COST;
+	_systems.push_back(entry);
+}
+
+void ParticleBudget::remove(PSystem* system)
+{
+	for (size_t i = 0; i < _systems.size(); i++)
+	{
+		if (_systems[i].system == system)
+		{
+			_systems.erase(_systems.begin() + i);
+			return;
+		}
+	}
+}
+
+void ParticleBudget::setTarget(float targetMs)
+{
+	_targetMs = targetMs;
+}
+
+void ParticleBudget::setCamera(const D3DXVECTOR3& eye)
+{
+	_eye = eye;
+}
+
+void ParticleBudget::update(float timeDelta)
+{
+	for (size_t i = 0; i < _systems.size(); i++)
+	{
+		Entry& e = _systems[i];
+
+		double start = Utility::GetTime();
+		e.system->emit(timeDelta);
+		e.system->update(timeDelta);
+		e.updateSeconds = Utility::GetTime() - start;
+
+		// render time is from the last frame's render, which drew about as many particles
+		int live = e.system->liveCount();
+		if (live > 0)
+		{
+			double cost = (e.updateSeconds + e.renderSeconds) / live;
+			e.costPerParticle += (cost - e.costPerParticle) * COST_SMOOTHING;
+		}
+	}
+
+	rebalance();
+}
+
+void ParticleBudget::render(float rewind)
+{
+	for (size_t i = 0; i < _systems.size(); i++)
+	{
+		double start = Utility::GetTime();
+		_systems[i].system->setRenderRewind(rewind);
+		_systems[i].system->render();
+		_systems[i].renderSeconds = Utility::GetTime() - start;
+	}
+}
+
+/*Shares the target time out by weight and turns each share into a cap*/
+void ParticleBudget::rebalance()
+{
+	size_t n = _systems.size();
+	if (n == 0)
+		return;
+
+	std::vector<double> weight(n);
+	std::vector<int> cap(n, -1);   // -1 while still sharing
+
+	for (size_t i = 0; i < n; i++)
+	{
+		D3DXVECTOR3 d = _systems[i].system->origin() - _eye;
+		float distance = D3DXVec3Length(&d);
+		weight[i] = _systems[i].priority / (1.0f + distance / DISTANCE_FALLOFF);
+	}
+
+	// systems that hit their maximum give the rest of their share back
+	double seconds = _targetMs * 0.001;
+	for (int pass = 0; pass < REBALANCE_PASSES; pass++)
+	{
+		double totalWeight = 0.0;
+		for (size_t i = 0; i < n; i++)
+			if (cap[i] < 0)
+				totalWeight += weight[i];
+
+		if (totalWeight <= 0.0)
+			break;
+
+		bool clamped = false;
+		for (size_t i = 0; i < n; i++)
+		{
+			if (cap[i] >= 0)
+				continue;
+
+			double share = seconds * weight[i] / totalWeight;
+			int maxCount = _systems[i].system->maxParticles();
+			if (share / _systems[i].costPerParticle >= maxCount)
+			{
+				cap[i] = maxCount;
+				seconds -= maxCount * _systems[i].costPerParticle;
+				clamped = true;
+			}
+		}
+
+		if (!clamped)
+			break;
+	}
+
+	double totalWeight = 0.0;
+	for (size_t i = 0; i < n; i++)
+		if (cap[i] < 0)
+			totalWeight += weight[i];
+
+	for (size_t i = 0; i < n; i++)
+	{
+		PSystem* system = _systems[i].system;
+		int maxCount = system->maxParticles();
+
+		if (cap[i] < 0)
+		{
+			double share = (totalWeight > 0.0 && seconds > 0.0) ? seconds * weight[i] / totalWeight : 0.0;
+			double particles = share / _systems[i].costPerParticle;
+			cap[i] = particles < maxCount ? (int)particles : maxCount;
+		}
+
+		if (cap[i] < MIN_PARTICLES)
+			cap[i] = MIN_PARTICLES < maxCount ? MIN_PARTICLES : maxCount;
+
+		system->setBudget(cap[i], maxCount > 0 ? (float)cap[i] / maxCount : 0.0f);
+	}
+}
+
+int ParticleBudget::liveCount()
+{
+	int live = 0;
+	for (size_t i = 0; i < _systems.size(); i++)
+		live += _systems[i].system->liveCount();
+	return live;
+}
+
+float ParticleBudget::lastCostMs()
+{
+	double seconds = 0.0;
+	for (size_t i = 0; i < _systems.size(); i++)
+		seconds += _systems[i].updateSeconds + _systems[i].renderSeconds;
+	return (float)(seconds * 1000.0);
+}
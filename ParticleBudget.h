@@ -0,0 +1,50 @@
+#pragma once
+
+#include "basics.h"
+#include "PSystem.h"
+#include <vector>
+
+/*Keeps all particle systems together inside a frame time budget.
+
+Systems are registered with a priority. The budget runs their updates and
+renders itself so it can time them, and keeps a smoothed cost per particle
+for each. Every update the target time is shared out by priority, divided
+by distance from the camera, and turned into a particle cap and emission
+scale for each system using its own cost. Time a system can't use (it is
+already at its maximum) goes back to the others.*/
+class ParticleBudget
+{
+public:
+	ParticleBudget(float targetMs);
+
+	void add(PSystem* system, float priority);
+	void remove(PSystem* system);
+
+	void setTarget(float targetMs);
+	void setCamera(const D3DXVECTOR3& eye);
+
+	// Emits, updates and times every system, then reassigns the caps.
+	void update(float timeDelta);
+	// Renders and times every system, drawing the particles rewind seconds
+	// behind the last update (see PSystem::setRenderRewind).
+	void render(float rewind = 0.0f);
+
+	int liveCount();
+	float lastCostMs();    // measured update + render time of the last frame
+
+private:
+	struct Entry
+	{
+		PSystem* system;
+		float    priority;
+		double   updateSeconds;   // last measured
+		double   renderSeconds;
+		double   costPerParticle; // smoothed seconds per live particle per frame
+	};
+
+	void rebalance();
+
+	std::vector<Entry> _systems;
+	float _targetMs;
+	D3DXVECTOR3 _eye;
+};
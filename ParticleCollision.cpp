@@ -0,0 +1,309 @@
+#include <math.h>
+#include "ParticleCollision.h"
+/*Particle vs scene collision through a spatial hash of the scene's bounding spheres*/
+
+namespace
+{
+	const int MIN_TABLE_SIZE = 1024;
+	const float MIN_CELL_SIZE = 0.25f;
+	const int BLOCK = 256; // particles filtered before the candidates are handled
+
+	// The grid starts at the corner of the spheres' bounds, so every cell that
+	// holds a sphere has positive coordinates and truncating is flooring
+	inline int CellOf(float x, float origin, float invCellSize)
+	{
+		return (int)((x - origin) * invCellSize);
+	}
+}
+
+ParticleCollision::ParticleCollision(float cellSize)
+	: _fixedCellSize(cellSize)
+	, _cellSize(1.0f)
+	, _invCellSize(1.0f)
+	, _restitution(0.5f)
+	, _min(0.0f, 0.0f, 0.0f)
+	, _max(0.0f, 0.0f, 0.0f)
+	, _tableMask(0)
+{
+}
+
+/*Removes every collider, call build() after adding the new ones*/
+void ParticleCollision::clear()
+{
+	_spheres.clear();
+	_planes.clear();
+	_bucketStart.clear();
+	_entries.clear();
+	_occupied.clear();
+	_tableMask = 0;
+}
+
+void ParticleCollision::addSphere(const D3DXVECTOR3& center, float radius, CollisionResponse response)
+{
+	Sphere s;
+	s.center = center;
+	s.radius = radius;
+	s.radiusSq = radius * radius;
+	s.response = response;
+	_spheres.push_back(s);
+}
+
+/*plane is ax + by + cz + d = 0, particles on the side the normal points away from collide*/
+void ParticleCollision::addPlane(const D3DXPLANE& plane, CollisionResponse response)
+{
+	float length = sqrtf(plane.a * plane.a + plane.b * plane.b + plane.c * plane.c);
+	if (length <= 0.0f)
+		return;
+
+	Plane p;
+	p.normal = D3DXVECTOR3(plane.a / length, plane.b / length, plane.c / length);
+	p.d = plane.d / length;
+	p.response = response;
+	_planes.push_back(p);
+}
+
+void ParticleCollision::setRestitution(float restitution)
+{
+	_restitution = restitution;
+}
+
+unsigned int ParticleCollision::cellHash(int x, int y, int z) const
+{
+	unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u;
+	return h & _tableMask;
+}
+
+/*Hashes every sphere into each cell its bounds overlap*/
+void ParticleCollision::build()
+{
+	_bucketStart.clear();
+	_entries.clear();
+	_occupied.clear();
+	_tableMask = 0;
+
+	int n = (int)_spheres.size();
+	if (n == 0)
+		return;
+
+	// cells of half an average radius hug the spheres closely enough that
+	// most particles in an occupied cell really are inside a sphere
+	_cellSize = _fixedCellSize;
+	if (_cellSize <= 0.0f)
+	{
+		float sum = 0.0f;
+		for (int i = 0; i < n; i++)
+			sum += _spheres[i].radius;
+		_cellSize = 0.5f * sum / n;
+	}
+	if (_cellSize < MIN_CELL_SIZE)
+		_cellSize = MIN_CELL_SIZE;
+	_invCellSize = 1.0f / _cellSize;
+
+	_min = _spheres[0].center;
+	_max = _spheres[0].center;
+	for (int i = 0; i < n; i++)
+	{
+		const Sphere& s = _spheres[i];
+		D3DXVECTOR3 r(s.radius, s.radius, s.radius);
+		D3DXVECTOR3 lo = s.center - r;
+		D3DXVECTOR3 hi = s.center + r;
+
+		if (lo.x < _min.x) _min.x = lo.x;
+		if (lo.y < _min.y) _min.y = lo.y;
+		if (lo.z < _min.z) _min.z = lo.z;
+		if (hi.x > _max.x) _max.x = hi.x;
+		if (hi.y > _max.y) _max.y = hi.y;
+		if (hi.z > _max.z) _max.z = hi.z;
+	}
+
+	int numEntries = 0;
+	for (int i = 0; i < n; i++)
+	{
+		const Sphere& s = _spheres[i];
+		numEntries += (CellOf(s.center.x + s.radius, _min.x, _invCellSize) - CellOf(s.center.x - s.radius, _min.x, _invCellSize) + 1)
+			* (CellOf(s.center.y + s.radius, _min.y, _invCellSize) - CellOf(s.center.y - s.radius, _min.y, _invCellSize) + 1)
+			* (CellOf(s.center.z + s.radius, _min.z, _invCellSize) - CellOf(s.center.z - s.radius, _min.z, _invCellSize) + 1);
+	}
+
+	// An empty cell that shares a bucket with a sphere's cell turns every particle
+	// in it into a candidate, so keep the table at least 8 times the entries.
+	// The occupancy bits the filter reads still fit in the L1 cache.
+	unsigned int tableSize = MIN_TABLE_SIZE;
+	while ((int)tableSize < numEntries * 8)
+		tableSize *= 2;
+	_tableMask = tableSize - 1;
+	_occupied.assign(tableSize / 32, 0);
+
+	// count the spheres in each bucket one slot along, then turn the counts
+	// into start offsets, still one slot along
+	_bucketStart.assign(tableSize + 1, 0);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			int start = 0;
+			for (unsigned int h = 0; h < tableSize; h++)
+			{
+				int c = _bucketStart[h + 1];
+				_bucketStart[h + 1] = start;
+				start += c;
+			}
+			_entries.resize(numEntries);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			const Sphere& s = _spheres[i];
+			int x0 = CellOf(s.center.x - s.radius, _min.x, _invCellSize), x1 = CellOf(s.center.x + s.radius, _min.x, _invCellSize);
+			int y0 = CellOf(s.center.y - s.radius, _min.y, _invCellSize), y1 = CellOf(s.center.y + s.radius, _min.y, _invCellSize);
+			int z0 = CellOf(s.center.z - s.radius, _min.z, _invCellSize), z1 = CellOf(s.center.z + s.radius, _min.z, _invCellSize);
+
+			for (int z = z0; z <= z1; z++)
+			{
+				for (int y = y0; y <= y1; y++)
+				{
+					for (int x = x0; x <= x1; x++)
+					{
+						unsigned int h = cellHash(x, y, z);
+						if (pass == 0)
+						{
+							_bucketStart[h + 1]++;
+							_occupied[h >> 5] |= 1u << (h & 31);
+						}
+						else
+							_entries[_bucketStart[h + 1]++] = i;
+					}
+				}
+			}
+		}
+	}
+	// filling moved each start along by one bucket, so bucket h now
+	// ends at _bucketStart[h + 1] and starts at _bucketStart[h]
+}
+
+/*Works through the particles a block at a time. A first pass with no branches
+picks out the candidates, the particles under a plane or in an occupied cell,
+so the random outcomes of those tests never reach the branch predictor. Only
+the candidates are then tested exactly.*/
+int ParticleCollision::collide(float* px, float* py, float* pz,
+	float* vx, float* vy, float* vz,
+	int count, int base, int* killed) const
+{
+	int numKilled = 0;
+	int numPlanes = (int)_planes.size();
+	const Plane* planes = numPlanes ? &_planes[0] : 0;
+	bool haveSpheres = _tableMask != 0;
+	const int* bucketStart = haveSpheres ? &_bucketStart[0] : 0;
+	const unsigned int* occupied = haveSpheres ? &_occupied[0] : 0;
+
+	int candidates[BLOCK];
+
+	for (int first = 0; first < count; first += BLOCK)
+	{
+		int n = count - first;
+		if (n > BLOCK)
+			n = BLOCK;
+
+		int numCandidates = 0;
+		for (int j = 0; j < n; j++)
+		{
+			float x = px[first + j], y = py[first + j], z = pz[first + j];
+
+			int below = 0;
+			for (int k = 0; k < numPlanes; k++)
+				below |= planes[k].normal.x * x + planes[k].normal.y * y + planes[k].normal.z * z + planes[k].d < 0.0f;
+
+			int near = 0;
+			if (haveSpheres)
+			{
+				int inside = (x >= _min.x) & (y >= _min.y) & (z >= _min.z) & (x <= _max.x) & (y <= _max.y) & (z <= _max.z);
+				unsigned int h = cellHash(CellOf(x, _min.x, _invCellSize), CellOf(y, _min.y, _invCellSize), CellOf(z, _min.z, _invCellSize));
+				near = inside & (int)(occupied[h >> 5] >> (h & 31)) & 1;
+			}
+
+			candidates[numCandidates] = first + j;
+			numCandidates += below | near;
+		}
+
+		for (int c = 0; c < numCandidates; c++)
+		{
+			int i = candidates[c];
+			D3DXVECTOR3 p(px[i], py[i], pz[i]);
+			CollisionResponse response = COLLIDE_KILL;
+			D3DXVECTOR3 normal;
+			bool hit = false;
+
+			for (int k = 0; k < numPlanes && !hit; k++)
+			{
+				const Plane& plane = planes[k];
+				float dist = plane.normal.x * p.x + plane.normal.y * p.y + plane.normal.z * p.z + plane.d;
+				if (dist < 0.0f)
+				{
+					hit = true;
+					response = plane.response;
+					normal = plane.normal;
+					p -= normal * dist; // back onto the plane
+				}
+			}
+
+			if (!hit && haveSpheres &&
+				p.x >= _min.x && p.y >= _min.y && p.z >= _min.z &&
+				p.x <= _max.x && p.y <= _max.y && p.z <= _max.z)
+			{
+				unsigned int h = cellHash(CellOf(p.x, _min.x, _invCellSize), CellOf(p.y, _min.y, _invCellSize), CellOf(p.z, _min.z, _invCellSize));
+				int end = bucketStart[h + 1];
+				for (int e = bucketStart[h]; e < end; e++)
+				{
+					const Sphere& s = _spheres[_entries[e]];
+					D3DXVECTOR3 d = p - s.center;
+					float distSq = d.x * d.x + d.y * d.y + d.z * d.z;
+					if (distSq < s.radiusSq)
+					{
+						hit = true;
+						response = s.response;
+
+						// a particle right at the centre gets pushed out the top
+						float dist = sqrtf(distSq);
+						normal = dist > 0.0f ? d / dist : D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+						p = s.center + normal * s.radius;
+						break;
+					}
+				}
+			}
+
+			if (!hit)
+				continue;
+
+			if (response == COLLIDE_KILL)
+			{
+				killed[numKilled++] = base + i;
+				continue;
+			}
+
+			px[i] = p.x;
+			py[i] = p.y;
+			pz[i] = p.z;
+
+			if (response == COLLIDE_STICK)
+			{
+				vx[i] = 0.0f;
+				vy[i] = 0.0f;
+				vz[i] = 0.0f;
+			}
+			else
+			{
+				// reflect the part of the velocity going into the surface
+				float vn = vx[i] * normal.x + vy[i] * normal.y + vz[i] * normal.z;
+				if (vn < 0.0f)
+				{
+					float k = (1.0f + _restitution) * vn;
+					vx[i] -= k * normal.x;
+					vy[i] -= k * normal.y;
+					vz[i] -= k * normal.z;
+				}
+			}
+		}
+	}
+
+	return numKilled;
+}
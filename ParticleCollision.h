@@ -0,0 +1,82 @@
+#pragma once
+
+#include "basics.h"
+#include <vector>
+
+//What happens to a particle that hits a collider
+enum CollisionResponse
+{
+	COLLIDE_KILL,   // the particle is handed back to its system to respawn
+	COLLIDE_BOUNCE, // pushed back out and its velocity reflected
+	COLLIDE_STICK   // pushed back out and stopped where it landed
+};
+
+/*Collides particles with the scene: spheres (the models' bounding spheres)
+and planes (the floor).
+
+The spheres are put into a uniform grid that is hashed into a fixed size
+table, so a particle only tests the spheres that overlap its own cell.
+Planes are few and infinite, so every particle tests all of them.
+
+The colliders move with the models, so the owner clears, re-adds and
+builds them once per simulation step, before the particle systems update.
+collide() only reads the grid and can run on every chunk at once.*/
+class ParticleCollision
+{
+public:
+	// cellSize of 0 picks one from the sizes of the spheres on every build.
+	ParticleCollision(float cellSize = 0.0f);
+
+	void clear();
+	void addSphere(const D3DXVECTOR3& center, float radius, CollisionResponse response = COLLIDE_KILL);
+	void addPlane(const D3DXPLANE& plane, CollisionResponse response = COLLIDE_KILL);
+	void build();
+
+	// How much speed a bouncing particle keeps, 1 is a perfect bounce.
+	void setRestitution(float restitution);
+
+	// Tests count particles against every collider and applies the responses.
+	// The indices (offset by base) of the particles to kill are written to
+	// killed, and their number returned.
+	int collide(float* px, float* py, float* pz,
+		float* vx, float* vy, float* vz,
+		int count, int base, int* killed) const;
+
+	int numSpheres() const { return (int)_spheres.size(); }
+	int numPlanes() const { return (int)_planes.size(); }
+
+private:
+	struct Sphere
+	{
+		D3DXVECTOR3 center;
+		float radius;
+		float radiusSq;
+		CollisionResponse response;
+	};
+
+	struct Plane
+	{
+		D3DXVECTOR3 normal; // unit length
+		float d;
+		CollisionResponse response;
+	};
+
+	unsigned int cellHash(int x, int y, int z) const;
+
+	std::vector<Sphere> _spheres;
+	std::vector<Plane>  _planes;
+
+	float _fixedCellSize;
+	float _cellSize;
+	float _invCellSize;
+	float _restitution;
+	D3DXVECTOR3 _min;  // bounds of all the spheres, particles outside skip the grid
+	D3DXVECTOR3 _max;
+
+	// The grid as a counting sort: the spheres in bucket h are
+	// _entries[_bucketStart[h]] up to _entries[_bucketStart[h + 1]]
+	unsigned int _tableMask;
+	std::vector<int> _bucketStart;
+	std::vector<int> _entries;
+	std::vector<unsigned int> _occupied; // one bit per bucket, set if it holds any sphere
+};
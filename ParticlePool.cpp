@@ -0,0 +1,169 @@
+#include <malloc.h>
+#include "ParticlePool.h"
+/*Contiguous particle storage used by PSystem in place of a linked list of Attributes*/
+
+namespace
+{
+	const int POOL_ALIGN = 32; // bytes, wide enough for an 8 float load
+	const int POOL_PAD = 8;    // capacity is rounded up to this many elements
+
+	//Allocates a new aligned array and copies the first count elements of the old one over
+	template<class T> T* Grow(T* old, int count, int capacity)
+	{
+		T* p = (T*)_aligned_malloc(capacity * sizeof(T), POOL_ALIGN);
+		if (old)
+		{
+			memcpy(p, old, count * sizeof(T));
+			_aligned_free(old);
+		}
+		return p;
+	}
+
+	template<class T> void Free(T*& p)
+	{
+		if (p)
+		{
+			_aligned_free(p);
+			p = 0;
+		}
+	}
+}
+
+ParticlePool::ParticlePool()
+	: _posX(0), _posY(0), _posZ(0)
+	, _velX(0), _velY(0), _velZ(0)
+	, _accX(0), _accY(0), _accZ(0)
+	, _lifeTime(0)
+	, _age(0)
+	, _color(0)
+	, _colorFade(0)
+	, _alive(0)
+	, _capacity(0)
+{
+}
+
+ParticlePool::~ParticlePool()
+{
+	release();
+}
+
+/*Makes room for at least capacity particles, keeping the living ones*/
+void ParticlePool::reserve(int capacity)
+{
+	capacity = (capacity + POOL_PAD - 1) / POOL_PAD * POOL_PAD;
+	if (capacity <= _capacity)
+		return;
+
+	_posX = Grow(_posX, _alive, capacity);
+	_posY = Grow(_posY, _alive, capacity);
+	_posZ = Grow(_posZ, _alive, capacity);
+	_velX = Grow(_velX, _alive, capacity);
+	_velY = Grow(_velY, _alive, capacity);
+	_velZ = Grow(_velZ, _alive, capacity);
+	_accX = Grow(_accX, _alive, capacity);
+	_accY = Grow(_accY, _alive, capacity);
+	_accZ = Grow(_accZ, _alive, capacity);
+	_lifeTime = Grow(_lifeTime, _alive, capacity);
+	_age = Grow(_age, _alive, capacity);
+	_color = Grow(_color, _alive, capacity);
+	_colorFade = Grow(_colorFade, _alive, capacity);
+
+	_capacity = capacity;
+}
+
+/*Kills every particle, the memory is kept for reuse*/
+void ParticlePool::clear()
+{
+	_alive = 0;
+}
+
+/*Takes the first free slot and returns its index. The slot's contents are undefined
+until store() is called on it.*/
+int ParticlePool::add()
+{
+	if (_alive == _capacity)
+		reserve(_capacity ? _capacity * 2 : POOL_PAD);
+
+	return _alive++;
+}
+
+/*Kills particle i by moving the last living particle into its slot.
+When iterating, the caller has to look at index i again afterwards.*/
+void ParticlePool::kill(int i)
+{
+	int last = --_alive;
+	if (i == last)
+		return;
+
+	_posX[i] = _posX[last];
+	_posY[i] = _posY[last];
+	_posZ[i] = _posZ[last];
+	_velX[i] = _velX[last];
+	_velY[i] = _velY[last];
+	_velZ[i] = _velZ[last];
+	_accX[i] = _accX[last];
+	_accY[i] = _accY[last];
+	_accZ[i] = _accZ[last];
+	_lifeTime[i] = _lifeTime[last];
+	_age[i] = _age[last];
+	_color[i] = _color[last];
+	_colorFade[i] = _colorFade[last];
+}
+
+/*Kills every particle after the first count*/
+void ParticlePool::truncate(int count)
+{
+	if (count < _alive)
+		_alive = count < 0 ? 0 : count;
+}
+
+/*Scatters an Attribute into slot i*/
+void ParticlePool::store(int i, const Attribute& attribute)
+{
+	_posX[i] = attribute._position.x;
+	_posY[i] = attribute._position.y;
+	_posZ[i] = attribute._position.z;
+	_velX[i] = attribute._velocity.x;
+	_velY[i] = attribute._velocity.y;
+	_velZ[i] = attribute._velocity.z;
+	_accX[i] = attribute._acceleration.x;
+	_accY[i] = attribute._acceleration.y;
+	_accZ[i] = attribute._acceleration.z;
+	_lifeTime[i] = attribute._lifeTime;
+	_age[i] = attribute._age;
+	_color[i] = (D3DCOLOR)attribute._color;
+	_colorFade[i] = attribute._colorFade;
+}
+
+/*Gathers slot i back into an Attribute*/
+void ParticlePool::load(int i, Attribute* attribute) const
+{
+	attribute->_position = D3DXVECTOR3(_posX[i], _posY[i], _posZ[i]);
+	attribute->_velocity = D3DXVECTOR3(_velX[i], _velY[i], _velZ[i]);
+	attribute->_acceleration = D3DXVECTOR3(_accX[i], _accY[i], _accZ[i]);
+	attribute->_lifeTime = _lifeTime[i];
+	attribute->_age = _age[i];
+	attribute->_color = D3DXCOLOR(_color[i]);
+	attribute->_colorFade = _colorFade[i];
+	attribute->_isAlive = true;
+}
+
+void ParticlePool::release()
+{
+	Free(_posX);
+	Free(_posY);
+	Free(_posZ);
+	Free(_velX);
+	Free(_velY);
+	Free(_velZ);
+	Free(_accX);
+	Free(_accY);
+	Free(_accZ);
+	Free(_lifeTime);
+	Free(_age);
+	Free(_color);
+	Free(_colorFade);
+
+	_alive = 0;
+	_capacity = 0;
+}
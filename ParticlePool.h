@@ -0,0 +1,76 @@
+#pragma once
+
+#include "basics.h"
+
+//A single particle as seen by the spawning code. The pool itself does not
+//store Attributes, it splits them up into one array per field.
+struct Attribute
+{
+	Attribute()
+	{
+		_lifeTime = 0.0f;
+		_age = 0.0f;
+		_isAlive = true;
+	}
+
+	D3DXVECTOR3 _position;
+	D3DXVECTOR3 _velocity;
+	D3DXVECTOR3 _acceleration;
+	float       _lifeTime;     // how long the particle lives for before dying
+	float       _age;          // current age of the particle
+	D3DXCOLOR   _color;        // current color of the particle
+	D3DXCOLOR   _colorFade;    // how the color fades with respect to time
+	bool        _isAlive;
+};
+
+/*Structure-of-arrays storage for the particles of a PSystem.
+
+Living particles are packed into [0, alive()). Every slot after that is free,
+so adding a particle is taking the first free slot and killing one is moving
+the last living particle into its place (swap-remove). The arrays are aligned
+and padded to a multiple of 8 floats so they can be read 4 or 8 at a time.*/
+class ParticlePool
+{
+public:
+	ParticlePool();
+	~ParticlePool();
+
+	void reserve(int capacity);
+	void clear();
+
+	int add();
+	void kill(int i);
+	void truncate(int count);
+
+	void store(int i, const Attribute& attribute);
+	void load(int i, Attribute* attribute) const;
+
+	int alive() const { return _alive; }
+	int capacity() const { return _capacity; }
+
+	//Hot data, touched every update
+	float* _posX;
+	float* _posY;
+	float* _posZ;
+	float* _velX;
+	float* _velY;
+	float* _velZ;
+
+	//Cold data, only touched on spawn or by systems that use it
+	float* _accX;
+	float* _accY;
+	float* _accZ;
+	float* _lifeTime;
+	float* _age;
+	D3DCOLOR*  _color;
+	D3DXCOLOR* _colorFade;
+
+private:
+	ParticlePool(const ParticlePool&);
+	ParticlePool& operator=(const ParticlePool&);
+
+	void release();
+
+	int _alive;
+	int _capacity;
+};
@@ -0,0 +1,175 @@
+#include <intrin.h>
+#include <immintrin.h>
+#include "ParticleSimd.h"
+/*SSE2 and AVX versions of the particle integration loop, and the CPU check used to pick one*/
+
+namespace
+{
+	typedef int(*IntegrateFn)(float*, float*, float*, const float*, const float*, const float*,
+		int, int, float, const BoundingBox&, int*);
+
+	int IntegrateScalar(float* px, float* py, float* pz,
+		const float* vx, const float* vy, const float* vz,
+		int count, int base, float timeDelta, const BoundingBox& box, int* outside)
+	{
+		int numOutside = 0;
+		for (int i = 0; i < count; i++)
+		{
+			px[i] += vx[i] * timeDelta;
+			py[i] += vy[i] * timeDelta;
+			pz[i] += vz[i] * timeDelta;
+
+			if (!(px[i] >= box._min.x && py[i] >= box._min.y && pz[i] >= box._min.z &&
+				px[i] <= box._max.x && py[i] <= box._max.y && pz[i] <= box._max.z))
+			{
+				outside[numOutside++] = base + i;
+			}
+		}
+		return numOutside;
+	}
+
+	int IntegrateSSE2(float* px, float* py, float* pz,
+		const float* vx, const float* vy, const float* vz,
+		int count, int base, float timeDelta, const BoundingBox& box, int* outside)
+	{
+		const __m128 dt = _mm_set1_ps(timeDelta);
+		const __m128 minX = _mm_set1_ps(box._min.x), maxX = _mm_set1_ps(box._max.x);
+		const __m128 minY = _mm_set1_ps(box._min.y), maxY = _mm_set1_ps(box._max.y);
+		const __m128 minZ = _mm_set1_ps(box._min.z), maxZ = _mm_set1_ps(box._max.z);
+
+		int numOutside = 0;
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x = _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(_mm_loadu_ps(vx + i), dt));
+			__m128 y = _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(_mm_loadu_ps(vy + i), dt));
+			__m128 z = _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(_mm_loadu_ps(vz + i), dt));
+			_mm_storeu_ps(px + i, x);
+			_mm_storeu_ps(py + i, y);
+			_mm_storeu_ps(pz + i, z);
+
+			// all six compares are ordered, so a NaN lane counts as outside like the scalar test
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(x, minX), _mm_cmple_ps(x, maxX));
+			inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(y, minY), _mm_cmple_ps(y, maxY)));
+			inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(z, minZ), _mm_cmple_ps(z, maxZ)));
+
+			int mask = ~_mm_movemask_ps(inside) & 0xF;
+			while (mask)
+			{
+				unsigned long lane;
+				_BitScanForward(&lane, mask);
+				outside[numOutside++] = base + i + lane;
+				mask &= mask - 1;
+			}
+		}
+
+		return numOutside + IntegrateScalar(px + i, py + i, pz + i, vx + i, vy + i, vz + i,
+			count - i, base + i, timeDelta, box, outside + numOutside);
+	}
+
+	int IntegrateAVX(float* px, float* py, float* pz,
+		const float* vx, const float* vy, const float* vz,
+		int count, int base, float timeDelta, const BoundingBox& box, int* outside)
+	{
+		const __m256 dt = _mm256_set1_ps(timeDelta);
+		const __m256 minX = _mm256_set1_ps(box._min.x), maxX = _mm256_set1_ps(box._max.x);
+		const __m256 minY = _mm256_set1_ps(box._min.y), maxY = _mm256_set1_ps(box._max.y);
+		const __m256 minZ = _mm256_set1_ps(box._min.z), maxZ = _mm256_set1_ps(box._max.z);
+
+		int numOutside = 0;
+		int i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 x = _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(_mm256_loadu_ps(vx + i), dt));
+			__m256 y = _mm256_add_ps(_mm256_loadu_ps(py + i), _mm256_mul_ps(_mm256_loadu_ps(vy + i), dt));
+			__m256 z = _mm256_add_ps(_mm256_loadu_ps(pz + i), _mm256_mul_ps(_mm256_loadu_ps(vz + i), dt));
+			_mm256_storeu_ps(px + i, x);
+			_mm256_storeu_ps(py + i, y);
+			_mm256_storeu_ps(pz + i, z);
+
+			__m256 inside = _mm256_and_ps(_mm256_cmp_ps(x, minX, _CMP_GE_OQ), _mm256_cmp_ps(x, maxX, _CMP_LE_OQ));
+			inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(y, minY, _CMP_GE_OQ), _mm256_cmp_ps(y, maxY, _CMP_LE_OQ)));
+			inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(z, minZ, _CMP_GE_OQ), _mm256_cmp_ps(z, maxZ, _CMP_LE_OQ)));
+
+			int mask = ~_mm256_movemask_ps(inside) & 0xFF;
+			while (mask)
+			{
+				unsigned long lane;
+				_BitScanForward(&lane, mask);
+				outside[numOutside++] = base + i + lane;
+				mask &= mask - 1;
+			}
+		}
+
+		return numOutside + IntegrateSSE2(px + i, py + i, pz + i, vx + i, vy + i, vz + i,
+			count - i, base + i, timeDelta, box, outside + numOutside);
+	}
+
+	bool levelChosen = false;
+	SimdLevel level = SIMD_SCALAR;
+	IntegrateFn integrate = IntegrateScalar;
+}
+
+/*Asks the CPU (and OS, for the AVX registers) what it supports*/
+SimdLevel ParticleSimd::Detect()
+{
+	int info[4];
+	__cpuid(info, 1);
+
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	// the OS has to save the upper halves of the ymm registers on a context switch
+	if (osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+		return SIMD_AVX;
+
+	if (sse2)
+		return SIMD_SSE2;
+
+	return SIMD_SCALAR;
+}
+
+SimdLevel ParticleSimd::GetLevel()
+{
+	if (!levelChosen)
+		SetLevel(Detect());
+
+	return level;
+}
+
+/*Forces the kernels to a level, clamped to what the CPU supports*/
+void ParticleSimd::SetLevel(SimdLevel newLevel)
+{
+	SimdLevel best = Detect();
+	if (newLevel > best)
+		newLevel = best;
+
+	level = newLevel;
+	levelChosen = true;
+
+	switch (level)
+	{
+	case SIMD_AVX:  integrate = IntegrateAVX;    break;
+	case SIMD_SSE2: integrate = IntegrateSSE2;   break;
+	default:        integrate = IntegrateScalar; break;
+	}
+}
+
+const char* ParticleSimd::LevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SIMD_AVX:  return "AVX";
+	case SIMD_SSE2: return "SSE2";
+	default:        return "scalar";
+	}
+}
+
+int ParticleSimd::Integrate(float* px, float* py, float* pz,
+	const float* vx, const float* vy, const float* vz,
+	int count, int base, float timeDelta, const BoundingBox& box, int* outside)
+{
+	GetLevel();
+	return integrate(px, py, pz, vx, vy, vz, count, base, timeDelta, box, outside);
+}
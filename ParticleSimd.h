@@ -0,0 +1,31 @@
+#pragma once
+
+#include "basics.h"
+#include "PSystem.h"
+
+//Instruction sets the particle kernels can run on, in order of preference
+enum SimdLevel
+{
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX
+};
+
+/*Vectorized particle kernels with a scalar fallback. The best level the CPU
+supports is picked the first time a kernel is used; SetLevel can force a lower
+one. All levels give bit-identical results (separate multiply and add, no FMA).*/
+class ParticleSimd
+{
+public:
+	static SimdLevel GetLevel();
+	static void SetLevel(SimdLevel level);
+	static SimdLevel Detect();
+	static const char* LevelName(SimdLevel level);
+
+	// Moves count particles by velocity * timeDelta and writes the index (plus base)
+	// of every particle that ended up outside box to outside, in increasing order.
+	// Returns the number of indices written.
+	static int Integrate(float* px, float* py, float* pz,
+		const float* vx, const float* vy, const float* vz,
+		int count, int base, float timeDelta, const BoundingBox& box, int* outside);
+};
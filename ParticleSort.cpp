@@ -0,0 +1,153 @@
+#include <cfloat>
+#include "ParticleSort.h"
+/*Keeps the particles of a system sorted back to front from frame to frame*/
+
+namespace
+{
+	// only try the insertion sort when at most 1 in this many keys is out of place
+	const int INSERTION_DESCENTS = 64;
+}
+
+ParticleSort::ParticleSort()
+	: _lastPath(SORT_NONE)
+{
+}
+
+/*Forgets the previous order, the next sort starts from scratch*/
+void ParticleSort::reset()
+{
+	_order.clear();
+}
+
+ParticleSort::Path ParticleSort::lastPath() const
+{
+	return _lastPath;
+}
+
+const int* ParticleSort::sort(const float* px, const float* py, const float* pz, int count, const D3DXMATRIX& view)
+{
+	if (count <= 0)
+		return 0;
+
+	// particles were added or removed, the old order no longer lines up
+	if ((int)_order.size() != count)
+	{
+		_order.resize(count);
+		for (int i = 0; i < count; i++)
+			_order[i] = i;
+	}
+
+	_keys.resize(count);
+	_depth.resize(count);
+	_slotKeys.resize(count);
+
+	// view space depth of every slot, in memory order
+	float zmin = FLT_MAX;
+	float zmax = -FLT_MAX;
+	for (int i = 0; i < count; i++)
+	{
+		float z = px[i] * view._13 + py[i] * view._23 + pz[i] * view._33 + view._43;
+		_depth[i] = z;
+
+		if (z < zmin) zmin = z;
+		if (z > zmax) zmax = z;
+	}
+
+	// farthest gets key 0, so ascending keys draw back to front
+	float scale = (zmax > zmin) ? 65535.0f / (zmax - zmin) : 0.0f;
+	for (int i = 0; i < count; i++)
+		_slotKeys[i] = (unsigned short)((zmax - _depth[i]) * scale);
+
+	// keys in last frame's order, counting where that order is now wrong
+	int descents = 0;
+	_keys[0] = _slotKeys[_order[0]];
+	for (int k = 1; k < count; k++)
+	{
+		_keys[k] = _slotKeys[_order[k]];
+		if (_keys[k] < _keys[k - 1])
+			descents++;
+	}
+
+	if (descents == 0)
+	{
+		_lastPath = SORT_NONE;
+	}
+	else if (descents <= count / INSERTION_DESCENTS && insertionSort(count, count))
+	{
+		_lastPath = SORT_INSERTION;
+	}
+	else
+	{
+		// the insertion sort leaves keys and order in step, so carry on from there
+		radixSort(count);
+		_lastPath = SORT_RADIX;
+	}
+
+	return &_order[0];
+}
+
+/*Sorts keys (and order with them) in place, giving up after budget moves.
+Returns whether it finished.*/
+bool ParticleSort::insertionSort(int count, int budget)
+{
+	int moves = 0;
+
+	for (int k = 1; k < count; k++)
+	{
+		unsigned short key = _keys[k];
+		if (key >= _keys[k - 1])
+			continue;
+
+		int index = _order[k];
+		int j = k;
+		while (j > 0 && _keys[j - 1] > key)
+		{
+			_keys[j] = _keys[j - 1];
+			_order[j] = _order[j - 1];
+			j--;
+		}
+		_keys[j] = key;
+		_order[j] = index;
+
+		moves += k - j;
+		if (moves > budget)
+			return false;
+	}
+
+	return true;
+}
+
+/*Stable LSD radix sort on the 16 bit keys, one 8 bit digit per pass*/
+void ParticleSort::radixSort(int count)
+{
+	_tempKeys.resize(count);
+	_tempOrder.resize(count);
+
+	// histograms of both digits in one go
+	int low[257] = { 0 };
+	int high[257] = { 0 };
+	for (int k = 0; k < count; k++)
+	{
+		low[(_keys[k] & 0xFF) + 1]++;
+		high[(_keys[k] >> 8) + 1]++;
+	}
+	for (int d = 0; d < 256; d++)
+	{
+		low[d + 1] += low[d];
+		high[d + 1] += high[d];
+	}
+
+	for (int k = 0; k < count; k++)
+	{
+		int dst = low[_keys[k] & 0xFF]++;
+		_tempKeys[dst] = _keys[k];
+		_tempOrder[dst] = _order[k];
+	}
+
+	for (int k = 0; k < count; k++)
+	{
+		int dst = high[_tempKeys[k] >> 8]++;
+		_keys[dst] = _tempKeys[k];
+		_order[dst] = _tempOrder[k];
+	}
+}
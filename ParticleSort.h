@@ -0,0 +1,43 @@
+#pragma once
+
+#include "basics.h"
+#include <vector>
+
+/*Back to front ordering of particles for alpha blending.
+
+Depth is view space z quantized to 16 bits. Each frame starts from the order
+it produced the frame before, so a system whose particles have barely moved
+is already sorted (one pass to check) or nearly sorted (an insertion sort
+with a move budget fixes it). When too many keys are out of place, or the
+budget runs out, it falls back to a stable two pass LSD radix sort, which
+keeps equal keys in last frame's order.*/
+class ParticleSort
+{
+public:
+	enum Path
+	{
+		SORT_NONE,      // last frame's order was still right
+		SORT_INSERTION,
+		SORT_RADIX
+	};
+
+	ParticleSort();
+
+	// Returns count particle indices, farthest from the camera first.
+	const int* sort(const float* px, const float* py, const float* pz, int count, const D3DXMATRIX& view);
+
+	void reset();
+	Path lastPath() const;
+
+private:
+	bool insertionSort(int count, int budget);
+	void radixSort(int count);
+
+	std::vector<int> _order;
+	std::vector<int> _tempOrder;
+	std::vector<unsigned short> _keys;
+	std::vector<unsigned short> _tempKeys;
+	std::vector<unsigned short> _slotKeys; // key of each particle slot
+	std::vector<float> _depth;
+	Path _lastPath;
+};
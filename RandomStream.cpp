@@ -0,0 +1,148 @@
+#include "RandomStream.h"
+/*Per stream random numbers for particle spawning*/
+
+namespace
+{
+	// Philox4x32 multipliers and Weyl key increments (Salmon et al. 2011)
+	const unsigned int PHILOX_M0 = 0xD2511F53u;
+	const unsigned int PHILOX_M1 = 0xCD9E8D57u;
+	const unsigned int PHILOX_W0 = 0x9E3779B9u;
+	const unsigned int PHILOX_W1 = 0xBB67AE85u;
+	const int PHILOX_ROUNDS = 10;
+
+	// 24 random bits is every float in [0, 1) with an even spacing
+	const float TO_UNIT = 1.0f / 16777216.0f;
+
+	inline float ToUnit(unsigned int x)
+	{
+		return (x >> 8) * TO_UNIT;
+	}
+
+	void Philox(const unsigned int counter[4], const unsigned int key[2], unsigned int out[4])
+	{
+		unsigned int c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+		unsigned int k0 = key[0], k1 = key[1];
+
+		for (int r = 0; r < PHILOX_ROUNDS; r++)
+		{
+			unsigned long long p0 = (unsigned long long)PHILOX_M0 * c0;
+			unsigned long long p1 = (unsigned long long)PHILOX_M1 * c2;
+
+			unsigned int n0 = (unsigned int)(p1 >> 32) ^ c1 ^ k0;
+			unsigned int n2 = (unsigned int)(p0 >> 32) ^ c3 ^ k1;
+			c1 = (unsigned int)p1;
+			c3 = (unsigned int)p0;
+			c0 = n0;
+			c2 = n2;
+
+			k0 += PHILOX_W0;
+			k1 += PHILOX_W1;
+		}
+
+		out[0] = c0;
+		out[1] = c1;
+		out[2] = c2;
+		out[3] = c3;
+	}
+}
+
+RandomStream::RandomStream(unsigned int seed, unsigned int streamA, unsigned int streamB)
+{
+	this->seed(seed, streamA, streamB);
+}
+
+void RandomStream::seed(unsigned int seed, unsigned int streamA, unsigned int streamB)
+{
+	_key[0] = seed;
+	_key[1] = 0x5EED5EEDu;
+
+	_counter[0] = 0;       // position in the stream, in blocks of 4
+	_counter[1] = 0;
+	_counter[2] = streamA;
+	_counter[3] = streamB;
+
+	_used = 4;
+}
+
+void RandomStream::nextBlock()
+{
+	Philox(_counter, _key, _block);
+
+	// 64 bit position, so a stream never wraps in practice
+	if (++_counter[0] == 0)
+		_counter[1]++;
+
+	_used = 0;
+}
+
+unsigned int RandomStream::GetUInt()
+{
+	if (_used == 4)
+		nextBlock();
+
+	return _block[_used++];
+}
+
+float RandomStream::GetFloat(float lowBound, float highBound)
+{
+	if (lowBound >= highBound) // bad input
+		return lowBound;
+
+	// get random float in [0, 1) interval
+	float f = ToUnit(GetUInt());
+
+	// return float in [lowBound, highBound) interval.
+	return (f * (highBound - lowBound)) + lowBound;
+}
+
+void RandomStream::GetVector(D3DXVECTOR3* out, const D3DXVECTOR3* min, const D3DXVECTOR3* max)
+{
+	out->x = GetFloat(min->x, max->x);
+	out->y = GetFloat(min->y, max->y);
+	out->z = GetFloat(min->z, max->z);
+}
+
+void RandomStream::FillFloats(float* out, int count, float lowBound, float highBound)
+{
+	float scale = highBound - lowBound;
+	if (scale < 0.0f)
+		scale = 0.0f;
+
+	int i = 0;
+
+	// use up what is left of the current block first
+	while (i < count && _used < 4)
+		out[i++] = ToUnit(_block[_used++]) * scale + lowBound;
+
+	// then whole blocks straight into the output
+	unsigned int block[4];
+	while (i + 4 <= count)
+	{
+		Philox(_counter, _key, block);
+		if (++_counter[0] == 0)
+			_counter[1]++;
+
+		out[i + 0] = ToUnit(block[0]) * scale + lowBound;
+		out[i + 1] = ToUnit(block[1]) * scale + lowBound;
+		out[i + 2] = ToUnit(block[2]) * scale + lowBound;
+		out[i + 3] = ToUnit(block[3]) * scale + lowBound;
+		i += 4;
+	}
+
+	while (i < count)
+		out[i++] = ToUnit(GetUInt()) * scale + lowBound;
+}
+
+void RandomStream::FillVectors(D3DXVECTOR3* out, int count, const D3DXVECTOR3* min, const D3DXVECTOR3* max)
+{
+	// a D3DXVECTOR3 is three packed floats
+	FillFloats((float*)out, count * 3, 0.0f, 1.0f);
+
+	D3DXVECTOR3 size = *max - *min;
+	for (int i = 0; i < count; i++)
+	{
+		out[i].x = out[i].x * size.x + min->x;
+		out[i].y = out[i].y * size.y + min->y;
+		out[i].z = out[i].z * size.z + min->z;
+	}
+}
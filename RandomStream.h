@@ -0,0 +1,36 @@
+#pragma once
+
+#include "basics.h"
+
+/*Counter-based random numbers (Philox4x32-10). Every value is a pure function
+of the seed, the stream number (a, b) and its position in the stream, so
+streams never share state: each thread or chunk can have its own, and any of
+them can be replayed from its seed. Values are made 4 at a time.*/
+class RandomStream
+{
+public:
+	RandomStream(unsigned int seed = 1, unsigned int streamA = 0, unsigned int streamB = 0);
+
+	// Restarts the stream at position 0 of stream (a, b) of seed.
+	void seed(unsigned int seed, unsigned int streamA = 0, unsigned int streamB = 0);
+
+	unsigned int GetUInt();
+
+	// Desc: Return random float in [lowBound, highBound) interval.
+	float GetFloat(float lowBound, float highBound);
+
+	// Desc: Returns a random vector in the bounds specified by min and max.
+	void GetVector(D3DXVECTOR3* out, const D3DXVECTOR3* min, const D3DXVECTOR3* max);
+
+	// Batch versions, these fill count values in one call
+	void FillFloats(float* out, int count, float lowBound, float highBound);
+	void FillVectors(D3DXVECTOR3* out, int count, const D3DXVECTOR3* min, const D3DXVECTOR3* max);
+
+private:
+	void nextBlock();
+
+	unsigned int _key[2];
+	unsigned int _counter[4];
+	unsigned int _block[4]; // values made from the last counter
+	int _used;              // how many of _block have been handed out
+};
@@ -0,0 +1,371 @@
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <emmintrin.h>
+#include "SceneBvh.h"
+#include "ThreadPool.h"
+#include "ParticleSimd.h"
+/*BVH over models, each with a triangle BVH of its own, for single rays and
+batches of them*/
+
+namespace
+{
+	// A binary level pushes one more than it pops, and the build keeps the
+	// tree within 64 levels
+	const int STACK_SIZE = 128;
+	const unsigned int LEAF_MODELS = 1;
+}
+
+SceneBvh::SceneBvh()
+	: _pool(ThreadPool::Shared())
+{
+}
+
+void SceneBvh::setThreadPool(ThreadPool* pool)
+{
+	_pool = pool;
+}
+
+void SceneBvh::clear()
+{
+	_models.clear();
+	_boxes.clear();
+	_nodes.clear();
+	_order.clear();
+}
+
+void SceneBvh::add(unsigned int id, const MeshBvh* mesh, const WorldBounds& bounds, const float* inverseWorld)
+{
+	Model model;
+	model.mesh = mesh && !mesh->empty() ? mesh : 0;
+	model.id = id;
+	for (int k = 0; k < 16; k++)
+		model.inverse[k] = inverseWorld[k];
+	for (int k = 0; k < 3; k++)
+		model.center[k] = bounds.center[k];
+	model.radius = bounds.radius;
+	_models.push_back(model);
+
+	// a model without a mesh is hit on its sphere, which reaches past the
+	// corners of its box, so the sphere's box is its leaf. Unmeasured bounds
+	// are infinite, and the build needs finite boxes
+	float lo[3], hi[3];
+	for (int k = 0; k < 3; k++)
+	{
+		lo[k] = model.mesh ? bounds.boxMin[k] : bounds.center[k] - bounds.radius;
+		hi[k] = model.mesh ? bounds.boxMax[k] : bounds.center[k] + bounds.radius;
+	}
+	for (int k = 0; k < 3; k++)
+		_boxes.push_back(lo[k] > -FLT_MAX ? lo[k] : -FLT_MAX);
+	for (int k = 0; k < 3; k++)
+		_boxes.push_back(hi[k] < FLT_MAX ? hi[k] : FLT_MAX);
+}
+
+void SceneBvh::build()
+{
+	MeshBvh::BuildNodes(_boxes.empty() ? 0 : &_boxes[0], (unsigned int)_models.size(), LEAF_MODELS, &_nodes, &_order);
+}
+
+bool SceneBvh::intersectModel(const Model& model, const float* origin, const float* direction, RayHit* hit) const
+{
+	if (!model.mesh)
+	{
+		// nearest t >= 0 where |origin + t direction - center| = radius
+		float oc[3] = { origin[0] - model.center[0], origin[1] - model.center[1], origin[2] - model.center[2] };
+		float a = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+		float b = oc[0] * direction[0] + oc[1] * direction[1] + oc[2] * direction[2];
+		float c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - model.radius * model.radius;
+		float discriminant = b * b - a * c;
+		if (a == 0.0f || discriminant < 0.0f)
+			return false;
+		float root = sqrtf(discriminant);
+		float t = (-b - root) / a;
+		if (t < 0.0f)
+			t = c <= 0.0f ? 0.0f : FLT_MAX; // inside it, or it is behind
+		if (t >= hit->distance)
+			return false;
+		hit->distance = t;
+		hit->triangle = MeshBvh::NONE;
+		hit->u = hit->v = 0.0f;
+		hit->id = model.id;
+		return true;
+	}
+
+	const float* m = model.inverse;
+	float localOrigin[3], localDirection[3];
+	for (int j = 0; j < 3; j++)
+	{
+		localOrigin[j] = origin[0] * m[j] + origin[1] * m[4 + j] + origin[2] * m[8 + j] + m[12 + j];
+		localDirection[j] = direction[0] * m[j] + direction[1] * m[4 + j] + direction[2] * m[8 + j];
+	}
+	if (!model.mesh->intersect(localOrigin, localDirection, hit))
+		return false;
+	hit->id = model.id;
+	return true;
+}
+
+bool SceneBvh::intersect(const float* origin, const float* direction, RayHit* hit) const
+{
+	if (_nodes.empty())
+		return false;
+
+	float inverse[3] = { 1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2] };
+	if (MeshBvh::Enter(_nodes[0], origin, inverse, hit->distance) == FLT_MAX)
+		return false;
+
+	unsigned int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	bool found = false;
+	while (top > 0)
+	{
+		const BvhNode& node = _nodes[stack[--top]];
+		if (node.count)
+		{
+			for (unsigned int i = node.first; i < node.first + node.count; i++)
+				found = intersectModel(_models[_order[i]], origin, direction, hit) || found;
+			continue;
+		}
+
+		unsigned int left = node.first, right = node.first + 1;
+		float enterLeft = MeshBvh::Enter(_nodes[left], origin, inverse, hit->distance);
+		float enterRight = MeshBvh::Enter(_nodes[right], origin, inverse, hit->distance);
+		if (enterLeft > enterRight)
+		{
+			std::swap(left, right);
+			std::swap(enterLeft, enterRight);
+		}
+		if (enterRight != FLT_MAX)
+			stack[top++] = right;
+		if (enterLeft != FLT_MAX)
+			stack[top++] = left;
+	}
+	return found;
+}
+
+void SceneBvh::intersect(const float* origins, const float* directions, int count, RayHit* hits,
+	RayCoherence coherence) const
+{
+	if (_nodes.empty() || count == 0)
+		return;
+
+	bool packets = coherence == RAYS_COHERENT && ParticleSimd::GetLevel() != SIMD_SCALAR;
+	int numJobs = (count + RAYS_PER_JOB - 1) / RAYS_PER_JOB;
+	_pool->parallelFor(numJobs, [this, origins, directions, count, hits, packets](int job)
+	{
+		int first = job * RAYS_PER_JOB;
+		int jobRays = count - first < RAYS_PER_JOB ? count - first : RAYS_PER_JOB;
+		if (packets)
+			tracePackets(origins, directions, first, jobRays, hits);
+		else
+			traceStream(origins, directions, first, jobRays, hits);
+	});
+}
+
+/*Fours of rays turned a coordinate at a time; a last short four is made up
+with copies of its first ray that can't hit anything*/
+void SceneBvh::tracePackets(const float* origins, const float* directions, int first, int count, RayHit* hits) const
+{
+	for (int i = first; i < first + count; i += 4)
+	{
+		float o[12], d[12];
+		RayHit four[4];
+		for (int lane = 0; lane < 4; lane++)
+		{
+			int r = i + lane < first + count ? i + lane : i;
+			for (int k = 0; k < 3; k++)
+			{
+				o[k * 4 + lane] = origins[r * 3 + k];
+				d[k * 4 + lane] = directions[r * 3 + k];
+			}
+			four[lane] = hits[r];
+			if (r != i + lane)
+				four[lane].distance = -1.0f;
+		}
+
+		intersectPacket(o, d, four);
+		for (int lane = 0; lane < 4 && i + lane < first + count; lane++)
+			hits[i + lane] = four[lane];
+	}
+}
+
+/*The top level for four rays, a lane each, the same way TracePacket takes a
+mesh's: a node is searched if any ray enters it before its nearest hit, the
+nearer child first by whichever ray enters it soonest. At a model the four
+rays are carried into its space together and its BVH takes them as a packet*/
+void SceneBvh::intersectPacket(const float* origins, const float* directions, RayHit* hits) const
+{
+	struct Entry
+	{
+		unsigned int node;
+		__m128 enter; // where each ray enters its box, +infinity for those that don't
+	};
+
+	__m128 o[3], d[3], inverse[3];
+	for (int k = 0; k < 3; k++)
+	{
+		o[k] = _mm_loadu_ps(origins + k * 4);
+		d[k] = _mm_loadu_ps(directions + k * 4);
+		inverse[k] = _mm_div_ps(_mm_set1_ps(1.0f), d[k]);
+	}
+	const __m128 zero = _mm_setzero_ps(), never = _mm_set1_ps(INFINITY);
+
+	Entry stack[STACK_SIZE];
+	int top = 0;
+	stack[top].node = 0;
+	stack[top++].enter = zero;
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		__m128 best = _mm_setr_ps(hits[0].distance, hits[1].distance, hits[2].distance, hits[3].distance);
+		if (!_mm_movemask_ps(_mm_cmple_ps(entry.enter, best)))
+			continue;
+
+		const BvhNode& node = _nodes[entry.node];
+		if (node.count)
+		{
+			for (unsigned int i = node.first; i < node.first + node.count; i++)
+			{
+				const Model& model = _models[_order[i]];
+				if (!model.mesh)
+				{
+					for (int lane = 0; lane < 4; lane++)
+					{
+						float origin[3] = { origins[lane], origins[4 + lane], origins[8 + lane] };
+						float direction[3] = { directions[lane], directions[4 + lane], directions[8 + lane] };
+						if (hits[lane].distance >= 0.0f)
+							intersectModel(model, origin, direction, &hits[lane]);
+					}
+					continue;
+				}
+
+				// the same sums as intersectModel, a lane per ray
+				const float* m = model.inverse;
+				float localOrigins[12], localDirections[12];
+				for (int j = 0; j < 3; j++)
+				{
+					__m128 a = _mm_set1_ps(m[j]), b = _mm_set1_ps(m[4 + j]), c = _mm_set1_ps(m[8 + j]);
+					_mm_storeu_ps(localOrigins + j * 4, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(o[0], a),
+						_mm_mul_ps(o[1], b)), _mm_mul_ps(o[2], c)), _mm_set1_ps(m[12 + j])));
+					_mm_storeu_ps(localDirections + j * 4, _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], a),
+						_mm_mul_ps(d[1], b)), _mm_mul_ps(d[2], c)));
+				}
+				int mask = model.mesh->intersectPacket(localOrigins, localDirections, hits);
+				for (int lane = 0; lane < 4; lane++)
+				{
+					if (mask & (1 << lane))
+						hits[lane].id = model.id;
+				}
+			}
+			continue;
+		}
+
+		Entry children[2];
+		float keys[2];
+		int numChildren = 0;
+		for (unsigned int c = node.first; c < node.first + 2; c++)
+		{
+			const BvhNode& child = _nodes[c];
+			__m128 in = zero, out = best;
+			for (int k = 0; k < 3; k++)
+			{
+				__m128 a = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(child.min[k]), o[k]), inverse[k]);
+				__m128 b = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(child.max[k]), o[k]), inverse[k]);
+				in = _mm_max_ps(_mm_min_ps(a, b), in);
+				out = _mm_min_ps(_mm_max_ps(a, b), out);
+			}
+			__m128 inside = _mm_cmple_ps(in, out);
+			if (!_mm_movemask_ps(inside))
+				continue;
+
+			__m128 enter = _mm_or_ps(_mm_and_ps(inside, in), _mm_andnot_ps(inside, never));
+			__m128 key = _mm_min_ps(enter, _mm_shuffle_ps(enter, enter, _MM_SHUFFLE(2, 3, 0, 1)));
+			key = _mm_min_ps(key, _mm_shuffle_ps(key, key, _MM_SHUFFLE(1, 0, 3, 2)));
+			children[numChildren].node = c;
+			children[numChildren].enter = enter;
+			keys[numChildren++] = _mm_cvtss_f32(key);
+		}
+		if (numChildren == 2 && keys[0] < keys[1])
+			std::swap(children[0], children[1]);
+		for (int i = 0; i < numChildren; i++)
+			stack[top++] = children[i];
+	}
+}
+
+/*The rays go down the top level together, depth first, into whichever child
+most of them point towards first. Each node filters its parent's list down to
+the rays that enter it before their nearest hit, appended to one array; a
+node's list is dropped once its subtree is done, which is whenever a node
+earlier in the array is taken off the stack*/
+void SceneBvh::traceStream(const float* origins, const float* directions, int first, int count, RayHit* hits) const
+{
+	struct Frame
+	{
+		unsigned int node;
+		size_t first;  // of its parent's list
+		size_t count;
+	};
+
+	std::vector<float> inverses(count * 3);
+	std::vector<unsigned int> rays(count);
+	for (int i = 0; i < count; i++)
+	{
+		rays[i] = first + i;
+		for (int k = 0; k < 3; k++)
+			inverses[i * 3 + k] = 1.0f / directions[(first + i) * 3 + k];
+	}
+
+	std::vector<Frame> frames;
+	Frame root = { 0, 0, (size_t)count };
+	frames.push_back(root);
+	while (!frames.empty())
+	{
+		Frame frame = frames.back();
+		frames.pop_back();
+		rays.resize(frame.first + frame.count);
+
+		const BvhNode& node = _nodes[frame.node];
+		size_t listFirst = rays.size();
+		for (size_t i = frame.first; i < frame.first + frame.count; i++)
+		{
+			unsigned int r = rays[i];
+			if (MeshBvh::Enter(node, &origins[r * 3], &inverses[(r - first) * 3], hits[r].distance) != FLT_MAX)
+				rays.push_back(r);
+		}
+		size_t listCount = rays.size() - listFirst;
+		if (listCount == 0)
+			continue;
+
+		if (node.count)
+		{
+			for (unsigned int i = node.first; i < node.first + node.count; i++)
+			{
+				const Model& model = _models[_order[i]];
+				for (size_t j = listFirst; j < listFirst + listCount; j++)
+				{
+					unsigned int r = rays[j];
+					intersectModel(model, &origins[r * 3], &directions[r * 3], &hits[r]);
+				}
+			}
+			continue;
+		}
+
+		// the child most of the rays reach first goes first, so their hits in
+		// it rule out more of the other
+		const BvhNode& left = _nodes[node.first];
+		const BvhNode& right = _nodes[node.first + 1];
+		float apart[3];
+		for (int k = 0; k < 3; k++)
+			apart[k] = (right.min[k] + right.max[k]) - (left.min[k] + left.max[k]);
+		float towardsRight = 0.0f;
+		for (size_t j = listFirst; j < listFirst + listCount; j++)
+		{
+			const float* d = &directions[rays[j] * 3];
+			towardsRight += d[0] * apart[0] + d[1] * apart[1] + d[2] * apart[2] > 0.0f ? 1.0f : -1.0f;
+		}
+		Frame nearer = { towardsRight >= 0.0f ? node.first : node.first + 1, listFirst, listCount };
+		Frame further = { towardsRight >= 0.0f ? node.first + 1 : node.first, listFirst, listCount };
+		frames.push_back(further);
+		frames.push_back(nearer);
+	}
+}
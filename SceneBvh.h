@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include "MeshBvh.h"
+#include "Bounds.h"
+
+class ThreadPool;
+
+//How the rays of a batch lie to each other
+enum RayCoherence
+{
+	RAYS_COHERENT,   // each four in a row start close and point much the same way, like a block of 2x2 pixels
+	RAYS_INCOHERENT  // anything else: scattered probes, bounces, checks between unrelated points
+};
+
+/*The top level of two: a BVH over models' world boxes, each leaf pointing at
+a model's own MeshBvh. A ray that reaches a leaf is carried into the model's
+space by the inverse of its world matrix, unnormalized, so distances along it
+are the same in both spaces and hits in different models compare directly.
+The nearest hit over every model is kept.
+
+A model without a mesh BVH (one D3DX loaded) is hit where the ray enters its
+bounding sphere, with no triangle. Rebuild whenever a model moves; the top
+level is small and builds in microseconds.
+
+Batches of rays are shared out among the pool's threads RAYS_PER_JOB at a
+time. Coherent ones go through both levels four at a time, a ray per SSE
+lane, so the boxes and triangles they all meet are fetched and tested once
+for the four. Incoherent ones would leave most of a packet's lanes idle, so
+they stream down the top level together instead: each node keeps only the
+rays that enter it, and a model's BVH is walked by every ray that reached it
+in turn. That gives up each ray's own nearest-first order through the top
+level, so on one thread a stream is a little slower than the same rays one at
+a time; what it buys is the split over threads. Either way each ray's
+distance is what intersect finds for it.*/
+class SceneBvh
+{
+public:
+	static const int RAYS_PER_JOB = 256;
+
+	SceneBvh();
+
+	void setThreadPool(ThreadPool* pool);
+	void clear();
+
+	// id is what a hit on this model reports; inverseWorld (row major) takes
+	// world points into its space.
+	void add(unsigned int id, const MeshBvh* mesh, const WorldBounds& bounds, const float* inverseWorld);
+	void build();
+
+	// Whether the ray hits anything nearer than hit->distance; if so hit is moved to it.
+	bool intersect(const float* origin, const float* direction, RayHit* hit) const;
+
+	// The nearest hit of each of count rays, origins and directions 3 floats a
+	// ray, moving hits[i] as the one ray does its hit. On the scalar SIMD
+	// level coherent rays are streamed too.
+	void intersect(const float* origins, const float* directions, int count, RayHit* hits,
+		RayCoherence coherence) const;
+
+	int numModels() const { return (int)_models.size(); }
+
+private:
+	struct Model
+	{
+		const MeshBvh* mesh;
+		unsigned int id;
+		float inverse[16];
+		float center[3];
+		float radius;
+	};
+
+	bool intersectModel(const Model& model, const float* origin, const float* direction, RayHit* hit) const;
+	void intersectPacket(const float* origins, const float* directions, RayHit* hits) const;
+	void tracePackets(const float* origins, const float* directions, int first, int count, RayHit* hits) const;
+	void traceStream(const float* origins, const float* directions, int first, int count, RayHit* hits) const;
+
+	ThreadPool* _pool;
+
+	std::vector<Model> _models;
+	std::vector<float> _boxes;          // 6 per model: its world box's min and max
+	std::vector<BvhNode> _nodes;
+	std::vector<unsigned int> _order;   // models in leaf order
+};
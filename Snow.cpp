@@ -1,37 +1,52 @@
 #include "Snow.h"
+#include "ParticleSimd.h"
 
-Snow::Snow(int numParticles)
+Snow::Snow(int numParticles, unsigned int seed)
 {
 	BoundingBox boundingBox;
 	boundingBox._min = D3DXVECTOR3(-10.0f, -10.0f, -10.0f);
 	boundingBox._max = D3DXVECTOR3(10.0f, 10.0f, 10.0f);
+	create(boundingBox, numParticles, seed);
+}
+
+Snow::Snow(const BoundingBox& boundingBox, int numParticles, unsigned int seed)
+{
+	create(boundingBox, numParticles, seed);
+}
+
+void Snow::create(const BoundingBox& boundingBox, int numParticles, unsigned int seed)
+{
 	_boundingBox = boundingBox;
 
+	_origin = (boundingBox._min + boundingBox._max) * 0.5f;
 	_size = 0.25f;
 	_vbSize = 2048;
-	_vbOffset = 0;
-	_vbBatchSize = 512;
+	_maxParticles = numParticles;
+	_emitRate = numParticles * 0.5f; // refills from empty in two seconds
+
+	this->seed(seed);
 
+	_particles.reserve(numParticles);
 	for (int i = 0; i < numParticles; i++)
 	{
 		addParticle();
 	}
 }
 
-void Snow::resetParticle(Attribute* attribute)
+void Snow::resetParticle(Attribute* attribute, RandomStream& rng)
 {
 	attribute->_isAlive = true;
 
 	// get random x, z coordinate for the position of the snow flake.
-	GetRandomVector(&attribute->_position, &_boundingBox._min, &_boundingBox._max);
+	rng.GetVector(&attribute->_position, &_boundingBox._min, &_boundingBox._max);
 
 	// no randomness for height (y-coordinate).  Snow flake
 	// always starts at the top of bounding box.
 	attribute->_position.y = _boundingBox._max.y;
 
 	// snow flakes fall downwards and slightly to the left
-	attribute->_velocity.x = GetRandomFloat(0.0f, 1.0f) * -3.0f;
-	attribute->_velocity.y = GetRandomFloat(0.0f, 1.0f) * -10.0f;
+	attribute->_velocity.x = rng.GetFloat(0.0f, 1.0f) * -3.0f;
+	attribute->_velocity.y = rng.GetFloat(0.0f, 1.0f) * -10.0f;
 	attribute->_velocity.z = 0.0f;
 
 	// white snow flake
@@ -41,17 +56,81 @@ void Snow::resetParticle(Attribute* attribute)
 
 void Snow::update(float timeDelta)
 {
-	list<Attribute>::iterator i;
-	for (i = _particles.begin(); i != _particles.end(); i++)
+	updateChunks(timeDelta);
+}
+
+void Snow::updateChunk(int first, int count, float timeDelta, RandomStream& rng)
+{
+	// this chunk's share of the respawn list starts at the same index as its particles
+	int* outside = &_respawn[first];
+
+	// move every flake and collect the ones that fell outside the bounds
+	int numOutside = ParticleSimd::Integrate(
+		_particles._posX + first, _particles._posY + first, _particles._posZ + first,
+		_particles._velX + first, _particles._velY + first, _particles._velZ + first,
+		count, first, timeDelta, _boundingBox, outside);
+
+	// how long each flake has been falling, which render won't rewind past
+	float* age = _particles._age + first;
+	for (int i = 0; i < count; i++)
+		age[i] += timeDelta;
+
+	// we want to recycle dead particles, so respawn them instead.
+	// The respawned slots all lie inside this chunk, so chunks never touch each other's particles.
+	respawnParticles(outside, numOutside, rng);
+
+	// flakes that landed on the scene, respawned flakes are back at the top
+	// of the box so none is listed twice
+	if (_collision)
+	{
+		int numKilled = _collision->collide(
+			_particles._posX + first, _particles._posY + first, _particles._posZ + first,
+			_particles._velX + first, _particles._velY + first, _particles._velZ + first,
+			count, first, outside);
+
+		respawnParticles(outside, numKilled, rng);
+	}
+}
+
+/*Same distribution as resetParticle, but the random numbers are drawn a
+group at a time and written straight into the particle arrays*/
+void Snow::respawnParticles(const int* indices, int count, RandomStream& rng)
+{
+	const int GROUP = 256;
+	float x[GROUP], z[GROUP], vx[GROUP], vy[GROUP];
+
+	for (int first = 0; first < count; first += GROUP)
 	{
-		i->_position += i->_velocity * timeDelta;
+		int n = count - first;
+		if (n > GROUP)
+			n = GROUP;
+
+		rng.FillFloats(x, n, _boundingBox._min.x, _boundingBox._max.x);
+		rng.FillFloats(z, n, _boundingBox._min.z, _boundingBox._max.z);
+		rng.FillFloats(vx, n, 0.0f, 1.0f);
+		rng.FillFloats(vy, n, 0.0f, 1.0f);
 
-		// is the point outside bounds?
-		if (_boundingBox.isPointInside(i->_position) == false)
+		for (int j = 0; j < n; j++)
 		{
-			// nope so kill it, but we want to recycle dead 
-			// particles, so respawn it instead.
-			resetParticle(&(*i));
+			int i = indices[first + j];
+
+			// flakes start at the top of the box
+			_particles._posX[i] = x[j];
+			_particles._posY[i] = _boundingBox._max.y;
+			_particles._posZ[i] = z[j];
+
+			// and fall downwards and slightly to the left
+			_particles._velX[i] = vx[j] * -3.0f;
+			_particles._velY[i] = vy[j] * -10.0f;
+			_particles._velZ[i] = 0.0f;
+
+			_particles._accX[i] = 0.0f;
+			_particles._accY[i] = 0.0f;
+			_particles._accZ[i] = 0.0f;
+			_particles._lifeTime[i] = 0.0f;
+			_particles._age[i] = 0.0f;
+			_particles._color[i] = D3DCOLOR_XRGB(255, 255, 255);
+			_particles._colorFade[i] = D3DXCOLOR(0.0f, 0.0f, 0.0f, 0.0f);
 		}
 	}
-}
\ No newline at end of file
+}
@@ -4,7 +4,13 @@
 class Snow : public PSystem
 {
 public:
-	Snow(int numParticles);
-	void resetParticle(Attribute* attribute);
+	Snow(int numParticles, unsigned int seed = 1);
+	Snow(const BoundingBox& boundingBox, int numParticles, unsigned int seed = 1);
+	void resetParticle(Attribute* attribute, RandomStream& rng);
 	void update(float timeDelta);
+
+protected:
+	void create(const BoundingBox& boundingBox, int numParticles, unsigned int seed);
+	void updateChunk(int first, int count, float timeDelta, RandomStream& rng);
+	void respawnParticles(const int* indices, int count, RandomStream& rng);
 };
@@ -0,0 +1,185 @@
+#include "TextureCache.h"
+#include "AssetLoader.h"
+#include "MeshCache.h"
+/*Textures shared by path and by contents across every model*/
+
+TextureCache::State& TextureCache::Get()
+{
+	static State state;
+	return state;
+}
+
+string TextureCache::NormalizePath(const string& path)
+{
+	vector<string> parts;
+	string part;
+	for (size_t i = 0; i <= path.size(); i++)
+	{
+		char c = i < path.size() ? path[i] : '\\';
+		if (c == '/' || c == '\\')
+		{
+			if (part == "..")
+			{
+				if (!parts.empty() && parts.back() != "..")
+					parts.pop_back();
+				else
+					parts.push_back(part);
+			}
+			else if (!part.empty() && part != ".")
+			{
+				parts.push_back(part);
+			}
+			part.clear();
+		}
+		else
+		{
+			part += (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+		}
+	}
+
+	string normalized;
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (i)
+			normalized += '\\';
+		normalized += parts[i];
+	}
+	return normalized;
+}
+
+/*Lets path find entry too, unless it is empty or already finds something*/
+void TextureCache::AddPath(State& state, Entry* entry, const string& path)
+{
+	if (path.empty() || state.byPath.find(path) != state.byPath.end())
+		return;
+
+	entry->paths.push_back(path);
+	state.byPath[path] = entry;
+}
+
+LPDIRECT3DTEXTURE9 TextureCache::Acquire(LPDIRECT3DDEVICE9 device, const string& fileName, const vector<char>* data)
+{
+	State& state = Get();
+	string path = NormalizePath(fileName);
+
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		std::map<string, Entry*>::iterator it = state.byPath.find(path);
+		if (it != state.byPath.end())
+		{
+			it->second->refs++;
+			state.stats.hits++;
+			state.stats.bytesSaved += it->second->size;
+			return it->second->texture;
+		}
+	}
+
+	// the path the bytes really came from, when that isn't the one asked for
+	string source;
+	vector<char> read;
+	if (!data || data->empty())
+	{
+		if (!AssetLoader::ReadFile(fileName, &read))
+		{
+			if (!AssetLoader::ReadFile("..\\" + fileName, &read))
+				return 0;
+			source = NormalizePath("..\\" + fileName);
+		}
+		data = &read;
+	}
+	if (data->empty())
+		return 0;
+
+	unsigned long long hash = MeshCache::Hash(&(*data)[0], data->size());
+
+	std::lock_guard<std::mutex> lock(state.mutex);
+
+	// the same image under another name
+	std::unordered_map<unsigned long long, Entry*>::iterator same = state.byHash.find(hash);
+	if (same != state.byHash.end() && same->second->size == data->size())
+	{
+		Entry* entry = same->second;
+		entry->refs++;
+		AddPath(state, entry, path);
+		AddPath(state, entry, source);
+		state.stats.hits++;
+		state.stats.bytesSaved += entry->size;
+		return entry->texture;
+	}
+
+	LPDIRECT3DTEXTURE9 texture = 0;
+	if (FAILED(D3DXCreateTextureFromFileInMemory(device, &(*data)[0], (UINT)data->size(), &texture)))
+		return 0;
+
+	Entry* entry = new Entry();
+	entry->texture = texture;
+	entry->hash = hash;
+	entry->size = data->size();
+	entry->refs = 1;
+	AddPath(state, entry, path);
+	AddPath(state, entry, source);
+
+	state.byHash[hash] = entry;
+	state.byTexture[texture] = entry;
+	state.stats.misses++;
+	state.stats.textures++;
+	return texture;
+}
+
+/*Gives back one reference. Textures the cache doesn't know (0, or ones
+already dropped by Clear) are ignored*/
+void TextureCache::Release(LPDIRECT3DTEXTURE9 texture)
+{
+	State& state = Get();
+	std::lock_guard<std::mutex> lock(state.mutex);
+
+	std::map<LPDIRECT3DTEXTURE9, Entry*>::iterator it = state.byTexture.find(texture);
+	if (it == state.byTexture.end())
+		return;
+
+	Entry* entry = it->second;
+	if (--entry->refs > 0)
+		return;
+
+	for (size_t i = 0; i < entry->paths.size(); i++)
+		state.byPath.erase(entry->paths[i]);
+	state.byHash.erase(entry->hash);
+	state.byTexture.erase(it);
+	state.stats.textures--;
+
+	entry->texture->Release();
+	delete entry;
+}
+
+bool TextureCache::Contains(const string& fileName)
+{
+	State& state = Get();
+	string path = NormalizePath(fileName);
+
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.byPath.find(path) != state.byPath.end();
+}
+
+TextureCache::Stats TextureCache::GetStats()
+{
+	State& state = Get();
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.stats;
+}
+
+void TextureCache::Clear()
+{
+	State& state = Get();
+	std::lock_guard<std::mutex> lock(state.mutex);
+
+	for (std::map<LPDIRECT3DTEXTURE9, Entry*>::iterator it = state.byTexture.begin(); it != state.byTexture.end(); ++it)
+	{
+		it->second->texture->Release();
+		delete it->second;
+	}
+
+	state.byPath.clear();
+	state.byHash.clear();
+	state.byTexture.clear();
+	state.stats.textures = 0;
+}
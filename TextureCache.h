@@ -0,0 +1,71 @@
+#pragma once
+
+#include "basics.h"
+#include <map>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+/*One texture per image for the whole process, however many models use it.
+
+Textures are found by their normalised path first, and then by a hash of the
+file's contents, so the same image reached through another path (a copy,
+or the ..\ fallback) is still only created once. A texture read through the
+..\ fallback is found both by the name it was asked for and by its ..\ path,
+so asking for either again doesn't read the file. Every Acquire takes a
+reference that Release gives back, and the texture is released when the
+last one is.
+
+Acquire and Release are for the device thread. Contains may be called from
+any thread, so loaders can skip reading files the cache already has.*/
+class TextureCache
+{
+public:
+	struct Stats
+	{
+		int hits;          // Acquires that found the texture already there
+		int misses;        // Acquires that created a texture
+		size_t bytesSaved; // file bytes hits did not have to decode again
+		int textures;      // textures alive now
+	};
+
+	// Returns the texture for fileName, with a reference the caller must
+	// Release, or 0 if the image can't be found or decoded. data is the file's
+	// contents if they were read already; otherwise it is read here, from the
+	// current folder or failing that the parent folder.
+	static LPDIRECT3DTEXTURE9 Acquire(LPDIRECT3DDEVICE9 device, const string& fileName, const vector<char>* data = 0);
+	static void Release(LPDIRECT3DTEXTURE9 texture);
+
+	static bool Contains(const string& fileName);
+	static Stats GetStats();
+
+	// Releases every texture, for when the device goes away before the users.
+	static void Clear();
+
+	// Lower case, one kind of separator, no . or resolvable .. parts
+	static string NormalizePath(const string& path);
+
+private:
+	struct Entry
+	{
+		LPDIRECT3DTEXTURE9 texture;
+		unsigned long long hash;
+		size_t size;
+		int refs;
+		vector<string> paths; // every normalised path that led here
+	};
+
+	struct State
+	{
+		State() { ZeroMemory(&stats, sizeof(Stats)); }
+
+		std::mutex mutex;
+		std::map<string, Entry*> byPath;
+		std::unordered_map<unsigned long long, Entry*> byHash;
+		std::map<LPDIRECT3DTEXTURE9, Entry*> byTexture;
+		Stats stats;
+	};
+
+	static State& Get();
+	static void AddPath(State& state, Entry* entry, const string& path);
+};
@@ -0,0 +1,120 @@
+#include "ThreadPool.h"
+/*Worker threads used to split engine work across cores*/
+
+ThreadPool::ThreadPool(int numThreads)
+	: _job(0)
+	, _count(0)
+	, _next(0)
+	, _remaining(0)
+	, _generation(0)
+	, _busy(0)
+	, _quit(false)
+{
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	for (int i = 1; i < numThreads; i++)
+		_workers.push_back(std::thread(&ThreadPool::workerMain, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+	_wake.notify_all();
+
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i].join();
+}
+
+int ThreadPool::size() const
+{
+	return (int)_workers.size() + 1;
+}
+
+ThreadPool* ThreadPool::Shared()
+{
+	static ThreadPool pool;
+	return &pool;
+}
+
+/*Runs job(i) for every i in [0, count), blocking until all have finished*/
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& job)
+{
+	if (count <= 0)
+		return;
+
+	if (_workers.empty() || count == 1)
+	{
+		for (int i = 0; i < count; i++)
+			job(i);
+		return;
+	}
+
+	{
+		// a worker that woke late for the last batch may still be looking at it
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [this] { return _busy == 0; });
+
+		_job = &job;
+		_count = count;
+		_next = 0;
+		_remaining = count;
+		_generation++;
+	}
+	_wake.notify_all();
+
+	// the calling thread takes jobs too instead of sleeping
+	runJobs();
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_done.wait(lock, [this] { return _remaining == 0 && _busy == 0; });
+}
+
+void ThreadPool::workerMain()
+{
+	unsigned int seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this, seen] { return _quit || _generation != seen; });
+			if (_quit)
+				return;
+
+			seen = _generation;
+			_busy++;
+		}
+
+		runJobs();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_busy--;
+		}
+		_done.notify_all();
+	}
+}
+
+void ThreadPool::runJobs()
+{
+	for (;;)
+	{
+		int i = _next++;
+		if (i >= _count)
+			return;
+
+		(*_job)(i);
+
+		if (--_remaining == 0)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_done.notify_all();
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "basics.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/*A fixed set of worker threads for fork-join work. parallelFor hands out job
+indices to the workers and the calling thread and returns once all are done.
+Which thread runs which index is not fixed, so jobs must not depend on it.*/
+class ThreadPool
+{
+public:
+	// numThreads counts the calling thread, so 1 means no workers. 0 uses every core.
+	ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	int size() const;
+
+	void parallelFor(int count, const std::function<void(int)>& job);
+
+	// Pool shared by the engine systems, sized to the machine
+	static ThreadPool* Shared();
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void workerMain();
+	void runJobs();
+
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+
+	const std::function<void(int)>* _job;
+	int _count;
+	std::atomic<int> _next;
+	std::atomic<int> _remaining;
+	unsigned int _generation;
+	int _busy;      // workers inside runJobs
+	bool _quit;
+};
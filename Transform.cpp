@@ -0,0 +1,241 @@
+#include <math.h>
+#include <xmmintrin.h>
+#include "Transform.h"
+/*Transforms: moving and turning them, and building their world matrices*/
+
+namespace
+{
+	void Normalize(float* q)
+	{
+		float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		for (int k = 0; k < 4; k++)
+			q[k] *= scale;
+		if (length == 0.0f)
+			q[3] = 1.0f;
+	}
+
+	/*Builds the world matrices of four transforms at once, one lane each.
+	Every value goes through the same operations, in the same order, as in
+	Transforms::Matrix, so the two agree to the bit*/
+	void Matrix4(Transform* const* t, float* const* matrices)
+	{
+		// a quaternion per register, turned into a component per register
+		__m128 x = _mm_loadu_ps(t[0]->rotation), y = _mm_loadu_ps(t[1]->rotation);
+		__m128 z = _mm_loadu_ps(t[2]->rotation), w = _mm_loadu_ps(t[3]->rotation);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		// scale and the float after it, which is in the Transform too
+		__m128 sx = _mm_loadu_ps(t[0]->scale), sy = _mm_loadu_ps(t[1]->scale);
+		__m128 sz = _mm_loadu_ps(t[2]->scale), unused = _mm_loadu_ps(t[3]->scale);
+		_MM_TRANSPOSE4_PS(sx, sy, sz, unused);
+
+		const __m128 one = _mm_set1_ps(1.0f);
+		__m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+		// an entry per register, turned back into a row of each matrix per register
+		__m128 zero = _mm_setzero_ps();
+		__m128 r0[4] = {
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx),
+			_mm_mul_ps(_mm_add_ps(xy, wz), sx),
+			_mm_mul_ps(_mm_sub_ps(xz, wy), sx),
+			zero
+		};
+		__m128 r1[4] = {
+			_mm_mul_ps(_mm_sub_ps(xy, wz), sy),
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy),
+			_mm_mul_ps(_mm_add_ps(yz, wx), sy),
+			zero
+		};
+		__m128 r2[4] = {
+			_mm_mul_ps(_mm_add_ps(xz, wy), sz),
+			_mm_mul_ps(_mm_sub_ps(yz, wx), sz),
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz),
+			zero
+		};
+		_MM_TRANSPOSE4_PS(r0[0], r0[1], r0[2], r0[3]);
+		_MM_TRANSPOSE4_PS(r1[0], r1[1], r1[2], r1[3]);
+		_MM_TRANSPOSE4_PS(r2[0], r2[1], r2[2], r2[3]);
+
+		for (int i = 0; i < 4; i++)
+		{
+			float* m = matrices[i];
+			_mm_storeu_ps(m, r0[i]);
+			_mm_storeu_ps(m + 4, r1[i]);
+			_mm_storeu_ps(m + 8, r2[i]);
+			m[12] = t[i]->translation[0];
+			m[13] = t[i]->translation[1];
+			m[14] = t[i]->translation[2];
+			m[15] = 1.0f;
+		}
+	}
+}
+
+Transform::Transform()
+	: dirty(true)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		translation[k] = 0.0f;
+		rotation[k] = 0.0f;
+		scale[k] = 1.0f;
+	}
+	rotation[3] = 1.0f;
+}
+
+void Transforms::Translate(Transform* transform, float x, float y, float z)
+{
+	transform->translation[0] += x;
+	transform->translation[1] += y;
+	transform->translation[2] += z;
+	transform->dirty = true;
+}
+
+/*The turn d is put in front of the rotation, d * q, since the world matrix
+applies q first; the translation is turned by d as v + 2w(u x v) + 2u x (u x v)
+with u the vector part of d*/
+void Transforms::Rotate(Transform* transform, const float* axis, float angle)
+{
+	float s = sinf(angle * 0.5f);
+	float d[4] = { axis[0] * s, axis[1] * s, axis[2] * s, cosf(angle * 0.5f) };
+
+	float* t = transform->translation;
+	float c[3] = {
+		2.0f * (d[1] * t[2] - d[2] * t[1]),
+		2.0f * (d[2] * t[0] - d[0] * t[2]),
+		2.0f * (d[0] * t[1] - d[1] * t[0])
+	};
+	float turned[3] = {
+		t[0] + d[3] * c[0] + (d[1] * c[2] - d[2] * c[1]),
+		t[1] + d[3] * c[1] + (d[2] * c[0] - d[0] * c[2]),
+		t[2] + d[3] * c[2] + (d[0] * c[1] - d[1] * c[0])
+	};
+	for (int k = 0; k < 3; k++)
+		t[k] = turned[k];
+
+	const float* q = transform->rotation;
+	float r[4] = {
+		d[3] * q[0] + d[0] * q[3] + d[1] * q[2] - d[2] * q[1],
+		d[3] * q[1] - d[0] * q[2] + d[1] * q[3] + d[2] * q[0],
+		d[3] * q[2] + d[0] * q[1] - d[1] * q[0] + d[2] * q[3],
+		d[3] * q[3] - d[0] * q[0] - d[1] * q[1] - d[2] * q[2]
+	};
+	Normalize(r);
+	for (int k = 0; k < 4; k++)
+		transform->rotation[k] = r[k];
+	transform->dirty = true;
+}
+
+void Transforms::Blend(const Transform& from, const Transform& to, float alpha, Transform* out)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		out->translation[k] = from.translation[k] + (to.translation[k] - from.translation[k]) * alpha;
+		out->scale[k] = from.scale[k] + (to.scale[k] - from.scale[k]) * alpha;
+	}
+
+	const float* q0 = from.rotation;
+	const float* q1 = to.rotation;
+	float cosine = q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] + q0[3] * q1[3];
+	float sign = 1.0f;
+	if (cosine < 0.0f)
+	{
+		cosine = -cosine;
+		sign = -1.0f;
+	}
+
+	// nearly the same rotation: lerp, as the sines would lose all precision
+	float a = 1.0f - alpha, b = alpha;
+	if (cosine < 0.9995f)
+	{
+		float angle = acosf(cosine);
+		float sine = sinf(angle);
+		a = sinf((1.0f - alpha) * angle) / sine;
+		b = sinf(alpha * angle) / sine;
+	}
+	for (int k = 0; k < 4; k++)
+		out->rotation[k] = a * q0[k] + sign * b * q1[k];
+	Normalize(out->rotation);
+	out->dirty = true;
+}
+
+void Transforms::Matrix(const Transform& transform, float* m)
+{
+	float x = transform.rotation[0], y = transform.rotation[1], z = transform.rotation[2], w = transform.rotation[3];
+	float sx = transform.scale[0], sy = transform.scale[1], sz = transform.scale[2];
+
+	float x2 = x + x, y2 = y + y, z2 = z + z;
+	float xx = x * x2, yy = y * y2, zz = z * z2;
+	float xy = x * y2, xz = x * z2, yz = y * z2;
+	float wx = w * x2, wy = w * y2, wz = w * z2;
+
+	m[0] = (1.0f - (yy + zz)) * sx;
+	m[1] = (xy + wz) * sx;
+	m[2] = (xz - wy) * sx;
+	m[3] = 0.0f;
+	m[4] = (xy - wz) * sy;
+	m[5] = (1.0f - (xx + zz)) * sy;
+	m[6] = (yz + wx) * sy;
+	m[7] = 0.0f;
+	m[8] = (xz + wy) * sz;
+	m[9] = (yz - wx) * sz;
+	m[10] = (1.0f - (xx + yy)) * sz;
+	m[11] = 0.0f;
+	m[12] = transform.translation[0];
+	m[13] = transform.translation[1];
+	m[14] = transform.translation[2];
+	m[15] = 1.0f;
+}
+
+/*(S R T)^-1 is T^-1 R^T S^-1: the rotation's rows become columns, each
+divided by its axis's scale, and the translation is taken back through them*/
+void Transforms::InverseMatrix(const Transform& transform, float* m)
+{
+	float forward[16];
+	Matrix(transform, forward);
+
+	for (int i = 0; i < 3; i++)
+	{
+		// row i of the forward matrix is the rotation's row times scale i
+		float scaleSq = transform.scale[i] * transform.scale[i];
+		for (int j = 0; j < 3; j++)
+			m[j * 4 + i] = forward[i * 4 + j] / scaleSq;
+	}
+	m[3] = m[7] = m[11] = 0.0f;
+
+	const float* t = transform.translation;
+	for (int j = 0; j < 3; j++)
+		m[12 + j] = -(t[0] * m[j] + t[1] * m[4 + j] + t[2] * m[8 + j]);
+	m[15] = 1.0f;
+}
+
+/*Gathers the dirty transforms, builds them in fours and the rest one at a time*/
+size_t Transforms::UpdateWorlds(Transform* const* transforms, float* const* matrices, size_t count)
+{
+	Transform* batch[4];
+	float* batchMatrices[4];
+	size_t inBatch = 0, built = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!transforms[i]->dirty)
+			continue;
+
+		transforms[i]->dirty = false;
+		batch[inBatch] = transforms[i];
+		batchMatrices[inBatch] = matrices[i];
+		built++;
+		if (++inBatch == 4)
+		{
+			Matrix4(batch, batchMatrices);
+			inBatch = 0;
+		}
+	}
+
+	for (size_t i = 0; i < inBatch; i++)
+		Matrix(*batch[i], batchMatrices[i]);
+
+	return built;
+}
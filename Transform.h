@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+
+//Where a model is, kept as its parts rather than as a matrix, so any number of
+//moves and turns leave it a rigid, unsheared shape
+struct Transform
+{
+	Transform();
+
+	float translation[3];
+	float rotation[4];    // unit quaternion x, y, z, w
+	float scale[3];
+	bool  dirty;          // changed since its world matrix was last built
+};
+
+/*Moves, turns and blends Transforms, and builds their world matrices.
+
+A world matrix multiplied by one small rotation after another, the way models
+used to move, drifts: rounding in each product leaves the rows a little less
+unit length and a little less square to each other, and the error is never
+taken out again, so the model slowly shears. A Transform's rotation is a
+quaternion put back to unit length after every turn, so its matrix is always
+a rotation to within float rounding, however many turns it has taken.
+
+Matrices are row major, laid out and multiplied the way D3D's are: the world
+matrix is scale * rotation * translation. UpdateWorlds builds only the dirty
+ones, four at a time with SSE2, and gives the same bits as Matrix.*/
+class Transforms
+{
+public:
+	// Moves by x, y, z in world space
+	static void Translate(Transform* transform, float x, float y, float z);
+
+	// Turns by angle radians about a world axis (unit length) through the
+	// origin, moving the translation round with it: what multiplying a
+	// rotation matrix onto the right of the world matrix did.
+	static void Rotate(Transform* transform, const float* axis, float angle);
+
+	// Where between from (0) and to (1) alpha is: positions and scales
+	// lerped, rotations slerped the short way round.
+	static void Blend(const Transform& from, const Transform& to, float alpha, Transform* out);
+
+	static void Matrix(const Transform& transform, float* matrix);
+
+	// The inverse of Matrix, from world space into the transform's, built
+	// straight from the parts rather than by inverting the matrix.
+	static void InverseMatrix(const Transform& transform, float* matrix);
+
+	// Builds the world matrix of every dirty transform into the matching
+	// matrices entry and marks it clean. Returns how many were built.
+	static size_t UpdateWorlds(Transform* const* transforms, float* const* matrices, size_t count);
+};
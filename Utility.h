@@ -11,4 +11,13 @@ public:
 	{
 		cerr << errorMsg << endl;
 	}
+
+	/*Returns the current time in seconds from the performance counter*/
+	static double GetTime()
+	{
+		LARGE_INTEGER freq, count;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&count);
+		return (double)count.QuadPart / (double)freq.QuadPart;
+	}
 };
@@ -0,0 +1,176 @@
+#include "VertexStream.h"
+/*Ring buffer allocator for vertices that are rebuilt every frame*/
+
+#pragma region Backends
+
+D3DVertexStreamBackend::D3DVertexStreamBackend(IDirect3DDevice9* device)
+	: _device(device)
+	, _vb(0)
+{
+}
+
+D3DVertexStreamBackend::~D3DVertexStreamBackend()
+{
+	if (_vb)
+		_vb->Release();
+}
+
+bool D3DVertexStreamBackend::create(UINT bytes)
+{
+	// no FVF so the one buffer can hold vertices of any format
+	HRESULT hr = _device->CreateVertexBuffer(
+		bytes,
+		D3DUSAGE_DYNAMIC | D3DUSAGE_POINTS | D3DUSAGE_WRITEONLY,
+		0,
+		D3DPOOL_DEFAULT, // D3DPOOL_MANAGED can't be used with D3DUSAGE_DYNAMIC
+		&_vb,
+		0);
+
+	if (FAILED(hr))
+	{
+		::MessageBox(0, "CreateVertexBuffer() - FAILED", "VertexStream", 0);
+		return false;
+	}
+
+	return true;
+}
+
+void* D3DVertexStreamBackend::lock(UINT offset, UINT bytes, bool discard)
+{
+	void* data = 0;
+	if (FAILED(_vb->Lock(offset, bytes, &data, discard ? D3DLOCK_DISCARD : D3DLOCK_NOOVERWRITE)))
+		return 0;
+
+	return data;
+}
+
+void D3DVertexStreamBackend::unlock()
+{
+	_vb->Unlock();
+}
+
+IDirect3DVertexBuffer9* D3DVertexStreamBackend::buffer()
+{
+	return _vb;
+}
+
+MockVertexStreamBackend::MockVertexStreamBackend()
+	: _memory(0)
+	, _size(0)
+	, _locked(false)
+{
+}
+
+MockVertexStreamBackend::~MockVertexStreamBackend()
+{
+	delete[] _memory;
+}
+
+bool MockVertexStreamBackend::create(UINT bytes)
+{
+	_memory = new BYTE[bytes];
+	_size = bytes;
+	return true;
+}
+
+void* MockVertexStreamBackend::lock(UINT offset, UINT bytes, bool discard)
+{
+	if (_locked || offset + bytes > _size)
+		return 0;
+
+	_locked = true;
+	return _memory + offset;
+}
+
+void MockVertexStreamBackend::unlock()
+{
+	_locked = false;
+}
+
+IDirect3DVertexBuffer9* MockVertexStreamBackend::buffer()
+{
+	return 0;
+}
+
+#pragma endregion
+
+VertexStream::VertexStream(VertexStreamBackend* backend, UINT bytes)
+	: _backend(backend)
+	, _size(bytes)
+	, _offset(0)
+	, _locked(false)
+{
+	_valid = _backend->create(bytes);
+	beginFrame();
+}
+
+VertexStream::~VertexStream()
+{
+	if (_locked)
+		_backend->unlock();
+
+	delete _backend;
+}
+
+/*Starts a new set of per frame counters. The ring itself carries on from
+where it was, it only wraps when it runs out of room.*/
+void VertexStream::beginFrame()
+{
+	ZeroMemory(&_stats, sizeof(_stats));
+}
+
+void* VertexStream::alloc(UINT count, UINT stride, UINT* firstVertex)
+{
+	UINT bytes = count * stride;
+	if (!_valid || _locked || count == 0 || bytes > _size)
+		return 0;
+
+	// vertices are addressed in units of their own stride
+	UINT offset = (_offset + stride - 1) / stride * stride;
+
+	// the first lock ever and every wrap around throw the old contents away,
+	// everything else appends behind data the GPU may still be reading.
+	bool discard = (offset == 0 || offset + bytes > _size);
+	if (offset + bytes > _size)
+		offset = 0;
+
+	void* data = _backend->lock(offset, bytes, discard);
+	if (!data)
+		return 0;
+
+	_locked = true;
+	_offset = offset + bytes;
+	*firstVertex = offset / stride;
+
+	_stats.allocations++;
+	_stats.locks++;
+	if (discard)
+		_stats.discards++;
+	_stats.bytes += bytes;
+
+	return data;
+}
+
+void VertexStream::commit()
+{
+	if (_locked)
+	{
+		_backend->unlock();
+		_locked = false;
+	}
+}
+
+UINT VertexStream::maxVertices(UINT stride) const
+{
+	return _size / stride;
+}
+
+IDirect3DVertexBuffer9* VertexStream::buffer()
+{
+	return _backend->buffer();
+}
+
+const VertexStreamStats& VertexStream::stats() const
+{
+	return _stats;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "basics.h"
+
+//Where a VertexStream's memory lives. The D3D backend wraps a dynamic vertex
+//buffer, the mock one is plain memory so the stream can run without a device.
+class VertexStreamBackend
+{
+public:
+	virtual ~VertexStreamBackend() {}
+
+	virtual bool create(UINT bytes) = 0;
+	virtual void* lock(UINT offset, UINT bytes, bool discard) = 0;
+	virtual void unlock() = 0;
+
+	// Buffer to pass to SetStreamSource, 0 for backends without one
+	virtual IDirect3DVertexBuffer9* buffer() = 0;
+};
+
+class D3DVertexStreamBackend : public VertexStreamBackend
+{
+public:
+	D3DVertexStreamBackend(IDirect3DDevice9* device);
+	~D3DVertexStreamBackend();
+
+	bool create(UINT bytes);
+	void* lock(UINT offset, UINT bytes, bool discard);
+	void unlock();
+	IDirect3DVertexBuffer9* buffer();
+
+private:
+	IDirect3DDevice9* _device;
+	IDirect3DVertexBuffer9* _vb;
+};
+
+class MockVertexStreamBackend : public VertexStreamBackend
+{
+public:
+	MockVertexStreamBackend();
+	~MockVertexStreamBackend();
+
+	bool create(UINT bytes);
+	void* lock(UINT offset, UINT bytes, bool discard);
+	void unlock();
+	IDirect3DVertexBuffer9* buffer();
+
+	BYTE* _memory;
+	UINT  _size;
+	bool  _locked;
+};
+
+//Per frame counters, reset by beginFrame
+struct VertexStreamStats
+{
+	DWORD allocations;
+	DWORD locks;
+	DWORD discards;
+	DWORD bytes;
+};
+
+/*Transient geometry for anything that rebuilds its vertices every frame.
+alloc hands out room for N vertices of a given stride from a ring over one
+dynamic buffer: it locks with NOOVERWRITE while there is room after the last
+allocation and wraps around with DISCARD when there is not. Fill the returned
+pointer, call commit, then draw from firstVertex with the same stride.*/
+class VertexStream
+{
+public:
+	// Takes ownership of backend
+	VertexStream(VertexStreamBackend* backend, UINT bytes);
+	~VertexStream();
+
+	void beginFrame();
+
+	// Returns 0 if count * stride doesn't fit in the buffer at all, see maxVertices.
+	void* alloc(UINT count, UINT stride, UINT* firstVertex);
+	void commit();
+
+	UINT maxVertices(UINT stride) const;
+	IDirect3DVertexBuffer9* buffer();
+	const VertexStreamStats& stats() const;
+
+private:
+	VertexStream(const VertexStream&);
+	VertexStream& operator=(const VertexStream&);
+
+	VertexStreamBackend* _backend;
+	UINT _size;
+	UINT _offset;   // first free byte
+	bool _locked;
+	bool _valid;
+	VertexStreamStats _stats;
+};
@@ -0,0 +1,1536 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <map>
+#include <unordered_map>
+#include "XFile.h"
+#include "MappedFile.h"
+/*Portable DirectX .x mesh loading: a tokenizer that works in place on the
+mapped file, and a builder that merges the meshes it finds into an XMesh*/
+
+XMaterial::XMaterial()
+	: power(0.0f)
+{
+	diffuse[0] = diffuse[1] = diffuse[2] = diffuse[3] = 1.0f;
+	specular[0] = specular[1] = specular[2] = 0.0f;
+	emissive[0] = emissive[1] = emissive[2] = 0.0f;
+}
+
+void XMesh::clear()
+{
+	positions.clear();
+	normals.clear();
+	texCoords.clear();
+	indices.clear();
+	attributes.clear();
+	materials.clear();
+}
+
+namespace
+{
+	const size_t HEADER_SIZE = 16; // "xof 0303txt 0032"
+
+	//Row vector 4x4 transform, as in FrameTransformMatrix
+	struct Matrix
+	{
+		float m[16];
+
+		static Matrix Identity()
+		{
+			Matrix r;
+			for (int i = 0; i < 16; i++)
+				r.m[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+			return r;
+		}
+
+		// this then parent
+		Matrix operator*(const Matrix& parent) const
+		{
+			Matrix r;
+			for (int row = 0; row < 4; row++)
+			{
+				for (int col = 0; col < 4; col++)
+				{
+					float sum = 0.0f;
+					for (int k = 0; k < 4; k++)
+						sum += m[row * 4 + k] * parent.m[k * 4 + col];
+					r.m[row * 4 + col] = sum;
+				}
+			}
+			return r;
+		}
+	};
+
+	/*One Mesh object as the file lays it out: positions and normals each with
+	their own polygon lists. append() turns it into indexed triangles.*/
+	struct MeshBuilder
+	{
+		std::vector<float> positions;
+		std::vector<unsigned int> faceSizes;   // corners per polygon
+		std::vector<unsigned int> faceIndices; // corners of every polygon, one after another
+		std::vector<float> normals;
+		std::vector<unsigned int> normalFaceSizes;
+		std::vector<unsigned int> normalFaceIndices;
+		std::vector<float> texCoords;
+		std::vector<unsigned int> faceMaterials;
+		std::vector<XMaterial> materials;
+
+		bool append(const Matrix& world, XMesh* out, std::string* error) const;
+	};
+
+	bool MeshBuilder::append(const Matrix& world, XMesh* out, std::string* error) const
+	{
+		unsigned int numPositions = (unsigned int)positions.size() / 3;
+		unsigned int numNormals = (unsigned int)normals.size() / 3;
+		size_t numFaces = faceSizes.size();
+
+		for (size_t i = 0; i < faceIndices.size(); i++)
+		{
+			if (faceIndices[i] >= numPositions)
+			{
+				*error = "face index out of range";
+				return false;
+			}
+		}
+
+		// the normals only count if they cover the same polygons
+		bool hasNormals = numNormals > 0 && normalFaceSizes == faceSizes;
+		if (hasNormals)
+		{
+			for (size_t i = 0; i < normalFaceIndices.size(); i++)
+			{
+				if (normalFaceIndices[i] >= numNormals)
+				{
+					*error = "normal index out of range";
+					return false;
+				}
+			}
+		}
+		bool hasTexCoords = texCoords.size() / 2 >= numPositions && numPositions > 0;
+
+		// a normal per position, listed the same way, needs no vertex splitting
+		bool direct = !hasNormals || (numNormals == numPositions && normalFaceIndices == faceIndices);
+
+		// the corners, as (position, normal) pairs, that become the vertices
+		std::vector<unsigned int> cornerVertex(faceIndices.size());
+		std::vector<unsigned int> vertexPosition;
+		std::vector<unsigned int> vertexNormal;
+		if (direct)
+		{
+			for (size_t i = 0; i < faceIndices.size(); i++)
+				cornerVertex[i] = faceIndices[i];
+			vertexPosition.resize(numPositions);
+			for (unsigned int i = 0; i < numPositions; i++)
+				vertexPosition[i] = i;
+			if (hasNormals)
+				vertexNormal = vertexPosition;
+		}
+		else
+		{
+			std::unordered_map<unsigned long long, unsigned int> remap;
+			remap.reserve(faceIndices.size());
+			for (size_t i = 0; i < faceIndices.size(); i++)
+			{
+				unsigned long long key = (unsigned long long)faceIndices[i] << 32 | normalFaceIndices[i];
+				std::unordered_map<unsigned long long, unsigned int>::iterator it = remap.find(key);
+				if (it == remap.end())
+				{
+					unsigned int v = (unsigned int)vertexPosition.size();
+					remap[key] = v;
+					vertexPosition.push_back(faceIndices[i]);
+					vertexNormal.push_back(normalFaceIndices[i]);
+					cornerVertex[i] = v;
+				}
+				else
+				{
+					cornerVertex[i] = it->second;
+				}
+			}
+		}
+
+		// keep the optional arrays the same length as the positions when
+		// only some of the meshes have them
+		size_t base = out->positions.size() / 3;
+		if (hasNormals && out->normals.size() < base * 3)
+			out->normals.resize(base * 3, 0.0f);
+		if (hasTexCoords && out->texCoords.size() < base * 2)
+			out->texCoords.resize(base * 2, 0.0f);
+
+		const float* m = world.m;
+		for (size_t v = 0; v < vertexPosition.size(); v++)
+		{
+			const float* p = &positions[vertexPosition[v] * 3];
+			out->positions.push_back(p[0] * m[0] + p[1] * m[4] + p[2] * m[8] + m[12]);
+			out->positions.push_back(p[0] * m[1] + p[1] * m[5] + p[2] * m[9] + m[13]);
+			out->positions.push_back(p[0] * m[2] + p[1] * m[6] + p[2] * m[10] + m[14]);
+
+			if (hasNormals)
+			{
+				const float* n = &normals[vertexNormal[v] * 3];
+				float x = n[0] * m[0] + n[1] * m[4] + n[2] * m[8];
+				float y = n[0] * m[1] + n[1] * m[5] + n[2] * m[9];
+				float z = n[0] * m[2] + n[1] * m[6] + n[2] * m[10];
+				float length = sqrtf(x * x + y * y + z * z);
+				if (length > 0.0f)
+				{
+					x /= length;
+					y /= length;
+					z /= length;
+				}
+				out->normals.push_back(x);
+				out->normals.push_back(y);
+				out->normals.push_back(z);
+			}
+			else if (!out->normals.empty())
+			{
+				out->normals.insert(out->normals.end(), 3, 0.0f);
+			}
+
+			if (hasTexCoords)
+			{
+				out->texCoords.push_back(texCoords[vertexPosition[v] * 2]);
+				out->texCoords.push_back(texCoords[vertexPosition[v] * 2 + 1]);
+			}
+			else if (!out->texCoords.empty())
+			{
+				out->texCoords.insert(out->texCoords.end(), 2, 0.0f);
+			}
+		}
+
+		// a mesh without a material list still needs one to be drawn with
+		unsigned int materialBase = (unsigned int)out->materials.size();
+		if (materials.empty())
+			out->materials.push_back(XMaterial());
+		else
+			out->materials.insert(out->materials.end(), materials.begin(), materials.end());
+		unsigned int numMaterials = (unsigned int)out->materials.size() - materialBase;
+
+		// fan every polygon into triangles; a short material list repeats its last entry
+		size_t corner = 0;
+		unsigned int material = 0;
+		for (size_t f = 0; f < numFaces; f++)
+		{
+			if (f < faceMaterials.size())
+				material = faceMaterials[f];
+			if (material >= numMaterials)
+			{
+				*error = "material index out of range";
+				return false;
+			}
+
+			unsigned int size = faceSizes[f];
+			for (unsigned int k = 1; k + 1 < size; k++)
+			{
+				out->indices.push_back((unsigned int)base + cornerVertex[corner]);
+				out->indices.push_back((unsigned int)base + cornerVertex[corner + k]);
+				out->indices.push_back((unsigned int)base + cornerVertex[corner + k + 1]);
+				out->attributes.push_back(materialBase + material);
+			}
+			corner += size;
+		}
+
+		return true;
+	}
+
+	//A name in the file, pointing into the mapped data
+	struct Token
+	{
+		const char* p;
+		size_t length;
+
+		bool operator==(const char* s) const
+		{
+			return strlen(s) == length && memcmp(p, s, length) == 0;
+		}
+
+		std::string str() const { return std::string(p, length); }
+	};
+
+	inline bool IsNameChar(char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+			c == '_' || c == '-' || c == '.';
+	}
+
+	/*Tokens of a text file. Separators (, and ;) are treated as white space;
+	the object and member order tells the parser what each number is.*/
+	class TextLexer
+	{
+	public:
+		TextLexer(const char* data, size_t size)
+			: _p(data)
+			, _end(data + size)
+		{
+		}
+
+		bool failed() const { return !_error.empty(); }
+		const std::string& error() const { return _error; }
+
+		void fail(const char* what)
+		{
+			if (_error.empty())
+				_error = what;
+			_p = _end;
+		}
+
+		bool atEnd()
+		{
+			skip();
+			return _p >= _end;
+		}
+
+		bool peekClose()
+		{
+			return peek('}');
+		}
+
+		void close()
+		{
+			expect('}');
+		}
+
+		bool readName(Token* name)
+		{
+			skip();
+			const char* start = _p;
+			while (_p < _end && IsNameChar(*_p))
+				_p++;
+
+			name->p = start;
+			name->length = _p - start;
+			if (name->length == 0)
+			{
+				fail("expected a name");
+				return false;
+			}
+			return true;
+		}
+
+		// A { name } reference to an object defined elsewhere
+		bool readReference(Token* name)
+		{
+			if (!peek('{'))
+				return false;
+
+			_p++;
+			readName(name);
+			expect('}');
+			return true;
+		}
+
+		// After the type: the optional name, the brace and the optional GUID
+		void openObject(Token* name)
+		{
+			skip();
+			name->p = _p;
+			name->length = 0;
+			if (_p < _end && *_p != '{')
+				readName(name);
+
+			expect('{');
+			if (peek('<'))
+			{
+				while (_p < _end && *_p != '>')
+					_p++;
+				_p++;
+			}
+		}
+
+		// Everything up to and including the brace that closes the current object
+		void skipObject()
+		{
+			int depth = 1;
+			while (_p < _end)
+			{
+				char c = *_p++;
+				if (c == '{')
+				{
+					depth++;
+				}
+				else if (c == '}')
+				{
+					if (--depth == 0)
+						return;
+				}
+				else if (c == '"')
+				{
+					while (_p < _end && *_p != '"')
+						_p++;
+					_p++;
+				}
+				else if (c == '/' && _p < _end && *_p == '/')
+				{
+					while (_p < _end && *_p != '\n')
+						_p++;
+				}
+			}
+			fail("missing }");
+		}
+
+		unsigned int readUInt()
+		{
+			skip();
+			unsigned int value = 0;
+			const char* start = _p;
+			while (_p < _end && *_p >= '0' && *_p <= '9')
+			{
+				value = value * 10 + (*_p - '0');
+				_p++;
+			}
+			if (_p == start)
+				fail("expected an integer");
+			return value;
+		}
+
+		float readFloat()
+		{
+			skip();
+			float value = 0.0f;
+			const char* next = _p < _end ? XFile::ParseFloat(_p, _end, &value) : _p;
+			if (next == _p)
+				fail("expected a number");
+			_p = next;
+			return value;
+		}
+
+		void readUInts(unsigned int* out, size_t count)
+		{
+			for (size_t i = 0; i < count && !failed(); i++)
+				out[i] = readUInt();
+		}
+
+		void readFloats(float* out, size_t count)
+		{
+			for (size_t i = 0; i < count && !failed(); i++)
+				out[i] = readFloat();
+		}
+
+		// Most numbers an array could have in what is left of the file
+		size_t maxCount() const { return _end - _p; }
+
+		std::string readString()
+		{
+			skip();
+			if (_p >= _end || *_p != '"')
+			{
+				fail("expected a string");
+				return std::string();
+			}
+
+			const char* start = ++_p;
+			while (_p < _end && *_p != '"')
+				_p++;
+			std::string s(start, _p - start);
+			if (_p < _end)
+				_p++;
+			return s;
+		}
+
+	private:
+		// white space, separators and comments
+		void skip()
+		{
+			while (_p < _end)
+			{
+				char c = *_p;
+				if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == ',' || c == ';')
+				{
+					_p++;
+				}
+				else if (c == '#' || (c == '/' && _p + 1 < _end && _p[1] == '/'))
+				{
+					while (_p < _end && *_p != '\n')
+						_p++;
+				}
+				else
+				{
+					break;
+				}
+			}
+		}
+
+		bool peek(char c)
+		{
+			skip();
+			return _p < _end && *_p == c;
+		}
+
+		void expect(char c)
+		{
+			if (!peek(c))
+			{
+				fail("unexpected character");
+				return;
+			}
+			_p++;
+		}
+
+		const char* _p;
+		const char* _end;
+		std::string _error;
+	};
+
+	// Binary token ids
+	enum
+	{
+		TOKEN_NAME = 1,
+		TOKEN_STRING = 2,
+		TOKEN_INTEGER = 3,
+		TOKEN_GUID = 5,
+		TOKEN_INTEGER_LIST = 6,
+		TOKEN_FLOAT_LIST = 7,
+		TOKEN_OBRACE = 10,
+		TOKEN_CBRACE = 11,
+		TOKEN_TEMPLATE = 31
+	};
+
+	/*Tokens of a binary file: a 16 bit id, then whatever data the id has.
+	Numbers come in integer and float list tokens that can be split anywhere,
+	so the lexer hands them out one at a time across list boundaries, and a
+	whole array that sits inside one list is copied out in one go.*/
+	class BinaryLexer
+	{
+	public:
+		BinaryLexer(const char* data, size_t size, int floatSize)
+			: _p(data)
+			, _end(data + size)
+			, _floatSize(floatSize)
+			, _ints(0)
+			, _intsLeft(0)
+			, _floats(0)
+			, _floatsLeft(0)
+		{
+		}
+
+		bool failed() const { return !_error.empty(); }
+		const std::string& error() const { return _error; }
+
+		void fail(const char* what)
+		{
+			if (_error.empty())
+				_error = what;
+			_p = _end;
+			_intsLeft = 0;
+			_floatsLeft = 0;
+		}
+
+		bool atEnd()
+		{
+			dropLists();
+			return _p >= _end;
+		}
+
+		bool peekClose()
+		{
+			dropLists();
+			return peekToken() == TOKEN_CBRACE;
+		}
+
+		void close()
+		{
+			expect(TOKEN_CBRACE);
+		}
+
+		bool readName(Token* name)
+		{
+			dropLists();
+			int token = nextToken();
+			if (token == TOKEN_TEMPLATE)
+			{
+				name->p = "template";
+				name->length = 8;
+				return true;
+			}
+			if (token != TOKEN_NAME)
+			{
+				fail("expected a name");
+				return false;
+			}
+			return readNameData(name);
+		}
+
+		bool readReference(Token* name)
+		{
+			dropLists();
+			if (peekToken() != TOKEN_OBRACE)
+				return false;
+
+			_p += 2;
+			readName(name);
+			expect(TOKEN_CBRACE);
+			return true;
+		}
+
+		void openObject(Token* name)
+		{
+			dropLists();
+			name->p = _p;
+			name->length = 0;
+			if (peekToken() == TOKEN_NAME)
+			{
+				_p += 2;
+				readNameData(name);
+			}
+
+			expect(TOKEN_OBRACE);
+			if (peekToken() == TOKEN_GUID)
+				skipBytes(2 + 16);
+		}
+
+		void skipObject()
+		{
+			dropLists();
+			int depth = 1;
+			while (_p < _end)
+			{
+				int token = nextToken();
+				if (token == TOKEN_OBRACE)
+					depth++;
+				else if (token == TOKEN_CBRACE && --depth == 0)
+					return;
+				else
+					skipTokenData(token);
+			}
+			fail("missing }");
+		}
+
+		unsigned int readUInt()
+		{
+			if (_intsLeft == 0 && !nextIntegers())
+				return 0;
+
+			unsigned int value;
+			memcpy(&value, _ints, 4);
+			_ints += 4;
+			_intsLeft--;
+			return value;
+		}
+
+		float readFloat()
+		{
+			if (_floatsLeft == 0 && !nextFloats())
+				return 0.0f;
+
+			float value;
+			if (_floatSize == 4)
+			{
+				memcpy(&value, _floats, 4);
+			}
+			else
+			{
+				double d;
+				memcpy(&d, _floats, 8);
+				value = (float)d;
+			}
+			_floats += _floatSize;
+			_floatsLeft--;
+			return value;
+		}
+
+		void readUInts(unsigned int* out, size_t count)
+		{
+			while (count > 0 && !failed())
+			{
+				if (_intsLeft == 0 && !nextIntegers())
+					return;
+
+				size_t n = count < _intsLeft ? count : _intsLeft;
+				memcpy(out, _ints, n * 4);
+				_ints += n * 4;
+				_intsLeft -= n;
+				out += n;
+				count -= n;
+			}
+		}
+
+		void readFloats(float* out, size_t count)
+		{
+			while (count > 0 && !failed())
+			{
+				if (_floatsLeft == 0 && !nextFloats())
+					return;
+
+				size_t n = count < _floatsLeft ? count : _floatsLeft;
+				if (_floatSize == 4)
+				{
+					memcpy(out, _floats, n * 4);
+					_floats += n * 4;
+				}
+				else
+				{
+					for (size_t i = 0; i < n; i++)
+					{
+						double d;
+						memcpy(&d, _floats, 8);
+						out[i] = (float)d;
+						_floats += 8;
+					}
+				}
+				_floatsLeft -= n;
+				out += n;
+				count -= n;
+			}
+		}
+
+		size_t maxCount() const { return (_end - _p) / 4 + _intsLeft + _floatsLeft; }
+
+		std::string readString()
+		{
+			dropLists();
+			if (nextToken() != TOKEN_STRING)
+			{
+				fail("expected a string");
+				return std::string();
+			}
+
+			unsigned int length = readDWord();
+			if (length > (size_t)(_end - _p))
+			{
+				fail("string longer than the file");
+				return std::string();
+			}
+
+			std::string s(_p, length);
+			_p += length;
+			skipBytes(2); // the ; or , after it
+			return s;
+		}
+
+	private:
+		int peekToken()
+		{
+			if (_end - _p < 2)
+				return 0;
+
+			unsigned short token;
+			memcpy(&token, _p, 2);
+			return token;
+		}
+
+		int nextToken()
+		{
+			int token = peekToken();
+			if (token == 0)
+				fail("unexpected end of file");
+			else
+				_p += 2;
+			return token;
+		}
+
+		void expect(int token)
+		{
+			dropLists();
+			if (nextToken() != token)
+				fail("unexpected token");
+		}
+
+		unsigned int readDWord()
+		{
+			if (_end - _p < 4)
+			{
+				fail("unexpected end of file");
+				return 0;
+			}
+
+			unsigned int value;
+			memcpy(&value, _p, 4);
+			_p += 4;
+			return value;
+		}
+
+		void skipBytes(size_t n)
+		{
+			if ((size_t)(_end - _p) < n)
+				fail("unexpected end of file");
+			else
+				_p += n;
+		}
+
+		bool readNameData(Token* name)
+		{
+			unsigned int length = readDWord();
+			if (length > (size_t)(_end - _p))
+			{
+				fail("name longer than the file");
+				return false;
+			}
+
+			name->p = _p;
+			name->length = length;
+			_p += length;
+			return true;
+		}
+
+		void skipTokenData(int token)
+		{
+			switch (token)
+			{
+			case TOKEN_NAME:
+				skipBytes(readDWord());
+				break;
+			case TOKEN_STRING:
+				skipBytes(readDWord());
+				skipBytes(2);
+				break;
+			case TOKEN_INTEGER:
+				skipBytes(4);
+				break;
+			case TOKEN_GUID:
+				skipBytes(16);
+				break;
+			case TOKEN_INTEGER_LIST:
+				skipBytes((size_t)readDWord() * 4);
+				break;
+			case TOKEN_FLOAT_LIST:
+				skipBytes((size_t)readDWord() * _floatSize);
+				break;
+			default:
+				break; // punctuation and keywords have no data
+			}
+		}
+
+		// Starts the next integer list, a lone integer is a list of one
+		bool nextIntegers()
+		{
+			int token = nextToken();
+			if (token == TOKEN_INTEGER || token == TOKEN_INTEGER_LIST)
+			{
+				unsigned int count = token == TOKEN_INTEGER ? 1 : readDWord();
+				if ((size_t)(_end - _p) / 4 < count)
+				{
+					fail("integer list longer than the file");
+					return false;
+				}
+
+				_ints = _p;
+				_intsLeft = count;
+				_p += (size_t)count * 4;
+				if (count > 0)
+					return true;
+				return nextIntegers();
+			}
+
+			fail("expected an integer");
+			return false;
+		}
+
+		bool nextFloats()
+		{
+			int token = nextToken();
+			if (token == TOKEN_FLOAT_LIST)
+			{
+				unsigned int count = readDWord();
+				if ((size_t)(_end - _p) / _floatSize < count)
+				{
+					fail("float list longer than the file");
+					return false;
+				}
+
+				_floats = _p;
+				_floatsLeft = count;
+				_p += (size_t)count * _floatSize;
+				if (count > 0)
+					return true;
+				return nextFloats();
+			}
+
+			fail("expected a number");
+			return false;
+		}
+
+		// Numbers the parser did not ask for, e.g. members of a newer template version
+		void dropLists()
+		{
+			_intsLeft = 0;
+			_floatsLeft = 0;
+		}
+
+		const char* _p;
+		const char* _end;
+		int _floatSize;
+
+		const char* _ints;   // rest of the current integer list
+		size_t _intsLeft;
+		const char* _floats; // rest of the current float list
+		size_t _floatsLeft;
+		std::string _error;
+	};
+
+	/*Recursive descent over the data objects of a file, the same for both
+	formats. Objects the loader has no use for are skipped whole.*/
+	template<class Lexer>
+	class ObjectParser
+	{
+	public:
+		ObjectParser(Lexer& lexer, XMesh* mesh)
+			: _lex(lexer)
+			, _mesh(mesh)
+		{
+		}
+
+		bool parse()
+		{
+			Matrix identity = Matrix::Identity();
+			while (!_lex.failed() && !_lex.atEnd())
+			{
+				Token type;
+				if (!_lex.readName(&type))
+					break;
+				parseObject(type, identity);
+			}
+			return !_lex.failed() && _error.empty();
+		}
+
+		const std::string& error() const { return _error.empty() ? _lex.error() : _error; }
+
+	private:
+		void parseObject(const Token& type, const Matrix& parent)
+		{
+			Token name;
+			_lex.openObject(&name);
+
+			if (type == "Frame")
+				parseFrame(parent);
+			else if (type == "Mesh")
+				parseMesh(parent);
+			else if (type == "Material")
+			{
+				XMaterial material;
+				parseMaterial(&material);
+				if (name.length)
+					_materials[name.str()] = material;
+			}
+			else
+				_lex.skipObject(); // templates, headers, animation
+		}
+
+		void parseFrame(const Matrix& parent)
+		{
+			Matrix world = parent;
+			while (!_lex.failed())
+			{
+				if (_lex.peekClose())
+				{
+					_lex.close();
+					return;
+				}
+
+				Token type, name;
+				if (_lex.readReference(&name))
+					continue;
+				if (!_lex.readName(&type))
+					return;
+
+				if (type == "FrameTransformMatrix")
+				{
+					_lex.openObject(&name);
+					Matrix local;
+					_lex.readFloats(local.m, 16);
+					_lex.close();
+
+					// meshes in this frame are in its space, then its parent's
+					world = local * parent;
+				}
+				else
+				{
+					parseObject(type, world);
+				}
+			}
+		}
+
+		void readArray(std::vector<float>* out, size_t count)
+		{
+			// a count bigger than the file could hold is a broken file, not an allocation
+			if (count > _lex.maxCount())
+			{
+				_lex.fail("array longer than the file");
+				return;
+			}
+
+			out->resize(count);
+			if (count)
+				_lex.readFloats(&(*out)[0], count);
+		}
+
+		void readFaces(std::vector<unsigned int>* sizes, std::vector<unsigned int>* indices)
+		{
+			unsigned int numFaces = _lex.readUInt();
+			if (numFaces > _lex.maxCount())
+			{
+				_lex.fail("face list longer than the file");
+				return;
+			}
+
+			sizes->resize(numFaces);
+			indices->clear();
+			indices->reserve(numFaces * 3);
+			for (unsigned int f = 0; f < numFaces && !_lex.failed(); f++)
+			{
+				unsigned int size = _lex.readUInt();
+				if (size > _lex.maxCount())
+				{
+					_lex.fail("face longer than the file");
+					return;
+				}
+
+				(*sizes)[f] = size;
+				size_t first = indices->size();
+				indices->resize(first + size);
+				if (size)
+					_lex.readUInts(&(*indices)[first], size);
+			}
+		}
+
+		void parseMesh(const Matrix& world)
+		{
+			MeshBuilder b;
+			readArray(&b.positions, (size_t)_lex.readUInt() * 3);
+			readFaces(&b.faceSizes, &b.faceIndices);
+
+			while (!_lex.failed())
+			{
+				if (_lex.peekClose())
+				{
+					_lex.close();
+					break;
+				}
+
+				Token type, name;
+				if (_lex.readReference(&name))
+					continue;
+				if (!_lex.readName(&type))
+					return;
+
+				_lex.openObject(&name);
+				if (type == "MeshNormals")
+				{
+					readArray(&b.normals, (size_t)_lex.readUInt() * 3);
+					readFaces(&b.normalFaceSizes, &b.normalFaceIndices);
+					_lex.close();
+				}
+				else if (type == "MeshTextureCoords")
+				{
+					readArray(&b.texCoords, (size_t)_lex.readUInt() * 2);
+					_lex.close();
+				}
+				else if (type == "MeshMaterialList")
+				{
+					parseMaterialList(&b);
+				}
+				else
+				{
+					_lex.skipObject();
+				}
+			}
+
+			if (!_lex.failed() && _error.empty() && !b.append(world, _mesh, &_error))
+				_lex.fail(_error.c_str());
+		}
+
+		void parseMaterialList(MeshBuilder* b)
+		{
+			unsigned int numMaterials = _lex.readUInt();
+			unsigned int numFaceIndexes = _lex.readUInt();
+			if (numFaceIndexes > _lex.maxCount())
+			{
+				_lex.fail("material list longer than the file");
+				return;
+			}
+
+			b->faceMaterials.resize(numFaceIndexes);
+			if (numFaceIndexes)
+				_lex.readUInts(&b->faceMaterials[0], numFaceIndexes);
+
+			while (!_lex.failed())
+			{
+				if (_lex.peekClose())
+				{
+					_lex.close();
+					break;
+				}
+
+				Token type, name;
+				if (_lex.readReference(&name))
+				{
+					std::map<std::string, XMaterial>::iterator it = _materials.find(name.str());
+					b->materials.push_back(it != _materials.end() ? it->second : XMaterial());
+					continue;
+				}
+				if (!_lex.readName(&type))
+					return;
+
+				_lex.openObject(&name);
+				if (type == "Material")
+				{
+					XMaterial material;
+					parseMaterial(&material);
+					if (name.length)
+						_materials[name.str()] = material;
+					b->materials.push_back(material);
+				}
+				else
+				{
+					_lex.skipObject();
+				}
+			}
+
+			if (b->materials.size() < numMaterials)
+				b->materials.resize(numMaterials);
+		}
+
+		void parseMaterial(XMaterial* material)
+		{
+			_lex.readFloats(material->diffuse, 4);
+			material->power = _lex.readFloat();
+			_lex.readFloats(material->specular, 3);
+			_lex.readFloats(material->emissive, 3);
+
+			while (!_lex.failed())
+			{
+				if (_lex.peekClose())
+				{
+					_lex.close();
+					return;
+				}
+
+				Token type, name;
+				if (!_lex.readName(&type))
+					return;
+
+				_lex.openObject(&name);
+				if (type == "TextureFilename" || type == "TextureFileName")
+				{
+					material->texture = _lex.readString();
+					_lex.close();
+				}
+				else
+				{
+					_lex.skipObject();
+				}
+			}
+		}
+
+		Lexer& _lex;
+		XMesh* _mesh;
+		std::string _error;
+		std::map<std::string, XMaterial> _materials; // named materials, for { name } references
+	};
+
+	/*Writes the tokens of a binary file. Numbers go out as one list per
+	array, the way the DirectX exporters write them.*/
+	class BinaryWriter
+	{
+	public:
+		explicit BinaryWriter(FILE* f) : _f(f) {}
+
+		void name(const char* s)
+		{
+			token(TOKEN_NAME);
+			dword((unsigned int)strlen(s));
+			fwrite(s, 1, strlen(s), _f);
+		}
+
+		void open(const char* type)
+		{
+			name(type);
+			token(TOKEN_OBRACE);
+		}
+
+		void close()
+		{
+			token(TOKEN_CBRACE);
+		}
+
+		void string(const std::string& s)
+		{
+			token(TOKEN_STRING);
+			dword((unsigned int)s.size());
+			fwrite(s.data(), 1, s.size(), _f);
+			token(20); // ;
+		}
+
+		void ints(const unsigned int* values, size_t count)
+		{
+			token(TOKEN_INTEGER_LIST);
+			dword((unsigned int)count);
+			fwrite(values, 4, count, _f);
+		}
+
+		void floats(const float* values, size_t count)
+		{
+			token(TOKEN_FLOAT_LIST);
+			dword((unsigned int)count);
+			fwrite(values, 4, count, _f);
+		}
+
+	private:
+		void token(unsigned short id) { fwrite(&id, 2, 1, _f); }
+		void dword(unsigned int value) { fwrite(&value, 4, 1, _f); }
+
+		FILE* _f;
+	};
+
+	// count, then a triangle per face, as one list
+	std::vector<unsigned int> FaceList(const XMesh& mesh)
+	{
+		std::vector<unsigned int> list;
+		list.reserve(1 + mesh.indices.size() / 3 * 4);
+		list.push_back(mesh.numTriangles());
+		for (size_t i = 0; i < mesh.indices.size(); i += 3)
+		{
+			list.push_back(3);
+			list.insert(list.end(), &mesh.indices[i], &mesh.indices[i] + 3);
+		}
+		return list;
+	}
+
+	void WriteText(FILE* f, const XMesh& mesh)
+	{
+		size_t numVertices = mesh.numVertices();
+		size_t numTriangles = mesh.numTriangles();
+
+		// %.9g round trips every float
+		fprintf(f, "Mesh {\n %u;\n", (unsigned int)numVertices);
+		for (size_t v = 0; v < numVertices; v++)
+		{
+			const float* p = &mesh.positions[v * 3];
+			fprintf(f, " %.9g;%.9g;%.9g;%c\n", p[0], p[1], p[2], v + 1 < numVertices ? ',' : ';');
+		}
+
+		fprintf(f, " %u;\n", (unsigned int)numTriangles);
+		for (size_t t = 0; t < numTriangles; t++)
+		{
+			const unsigned int* i = &mesh.indices[t * 3];
+			fprintf(f, " 3;%u,%u,%u;%c\n", i[0], i[1], i[2], t + 1 < numTriangles ? ',' : ';');
+		}
+
+		if (!mesh.normals.empty())
+		{
+			fprintf(f, " MeshNormals {\n  %u;\n", (unsigned int)numVertices);
+			for (size_t v = 0; v < numVertices; v++)
+			{
+				const float* n = &mesh.normals[v * 3];
+				fprintf(f, "  %.9g;%.9g;%.9g;%c\n", n[0], n[1], n[2], v + 1 < numVertices ? ',' : ';');
+			}
+
+			fprintf(f, "  %u;\n", (unsigned int)numTriangles);
+			for (size_t t = 0; t < numTriangles; t++)
+			{
+				const unsigned int* i = &mesh.indices[t * 3];
+				fprintf(f, "  3;%u,%u,%u;%c\n", i[0], i[1], i[2], t + 1 < numTriangles ? ',' : ';');
+			}
+			fprintf(f, " }\n");
+		}
+
+		if (!mesh.texCoords.empty())
+		{
+			fprintf(f, " MeshTextureCoords {\n  %u;\n", (unsigned int)numVertices);
+			for (size_t v = 0; v < numVertices; v++)
+			{
+				const float* uv = &mesh.texCoords[v * 2];
+				fprintf(f, "  %.9g;%.9g;%c\n", uv[0], uv[1], v + 1 < numVertices ? ',' : ';');
+			}
+			fprintf(f, " }\n");
+		}
+
+		fprintf(f, " MeshMaterialList {\n  %u;\n  %u;\n", (unsigned int)mesh.materials.size(), (unsigned int)numTriangles);
+		for (size_t t = 0; t < numTriangles; t++)
+			fprintf(f, "  %u%c\n", mesh.attributes[t], t + 1 < numTriangles ? ',' : ';');
+
+		for (size_t m = 0; m < mesh.materials.size(); m++)
+		{
+			const XMaterial& material = mesh.materials[m];
+			fprintf(f, "  Material {\n   %.9g;%.9g;%.9g;%.9g;;\n   %.9g;\n   %.9g;%.9g;%.9g;;\n   %.9g;%.9g;%.9g;;\n",
+				material.diffuse[0], material.diffuse[1], material.diffuse[2], material.diffuse[3],
+				material.power,
+				material.specular[0], material.specular[1], material.specular[2],
+				material.emissive[0], material.emissive[1], material.emissive[2]);
+			if (!material.texture.empty())
+				fprintf(f, "   TextureFilename {\n    \"%s\";\n   }\n", material.texture.c_str());
+			fprintf(f, "  }\n");
+		}
+		fprintf(f, " }\n}\n");
+	}
+
+	void WriteBinary(FILE* f, const XMesh& mesh)
+	{
+		BinaryWriter w(f);
+		unsigned int numVertices = mesh.numVertices();
+		unsigned int numTriangles = mesh.numTriangles();
+		std::vector<unsigned int> faces = FaceList(mesh);
+
+		w.open("Mesh");
+		w.ints(&numVertices, 1);
+		w.floats(mesh.positions.empty() ? 0 : &mesh.positions[0], mesh.positions.size());
+		w.ints(&faces[0], faces.size());
+
+		if (!mesh.normals.empty())
+		{
+			w.open("MeshNormals");
+			w.ints(&numVertices, 1);
+			w.floats(&mesh.normals[0], mesh.normals.size());
+			w.ints(&faces[0], faces.size());
+			w.close();
+		}
+
+		if (!mesh.texCoords.empty())
+		{
+			w.open("MeshTextureCoords");
+			w.ints(&numVertices, 1);
+			w.floats(&mesh.texCoords[0], mesh.texCoords.size());
+			w.close();
+		}
+
+		std::vector<unsigned int> list;
+		list.push_back((unsigned int)mesh.materials.size());
+		list.push_back(numTriangles);
+		list.insert(list.end(), mesh.attributes.begin(), mesh.attributes.end());
+
+		w.open("MeshMaterialList");
+		w.ints(&list[0], list.size());
+		for (size_t m = 0; m < mesh.materials.size(); m++)
+		{
+			const XMaterial& material = mesh.materials[m];
+			float values[11];
+			memcpy(values, material.diffuse, sizeof(material.diffuse));
+			values[4] = material.power;
+			memcpy(values + 5, material.specular, sizeof(material.specular));
+			memcpy(values + 8, material.emissive, sizeof(material.emissive));
+
+			w.open("Material");
+			w.floats(values, 11);
+			if (!material.texture.empty())
+			{
+				w.open("TextureFilename");
+				w.string(material.texture);
+				w.close();
+			}
+			w.close();
+		}
+		w.close();
+
+		w.close();
+	}
+
+	// Exact powers of ten a double can hold
+	const double POW10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+}
+
+/*Decimal digits go into a 64 bit integer, which is scaled by an exact power
+of ten in double precision and rounded to float once. The 6 to 9 digits the
+exporters write come out the same as strtof.*/
+const char* XFile::ParseFloat(const char* p, const char* end, float* out)
+{
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	unsigned long long mantissa = 0;
+	int digits = 0;   // significant digits kept in mantissa
+	int exponent = 0;
+	bool any = false;
+
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				digits++;
+		}
+		else
+		{
+			exponent++;
+		}
+		p++;
+		any = true;
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					digits++;
+				exponent--;
+			}
+			p++;
+			any = true;
+		}
+	}
+
+	if (!any)
+		return start;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			negativeExponent = *q == '-';
+			q++;
+		}
+
+		int e = 0;
+		const char* digitsStart = q;
+		while (q < end && *q >= '0' && *q <= '9')
+		{
+			if (e < 10000)
+				e = e * 10 + (*q - '0');
+			q++;
+		}
+
+		// "1e" is the number 1 followed by something else
+		if (q != digitsStart)
+		{
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+
+	double value = (double)mantissa;
+	while (exponent > 22)
+	{
+		value *= POW10[22];
+		exponent -= 22;
+	}
+	while (exponent < -22)
+	{
+		value /= POW10[22];
+		exponent += 22;
+	}
+	if (exponent > 0)
+		value *= POW10[exponent];
+	else if (exponent < 0)
+		value /= POW10[-exponent];
+
+	*out = (float)(negative ? -value : value);
+	return p;
+}
+
+bool XFile::ParseText(const char* data, size_t size, XMesh* mesh, std::string* error)
+{
+	mesh->clear();
+
+	if (size < HEADER_SIZE)
+	{
+		if (error)
+			*error = "file too short";
+		return false;
+	}
+
+	TextLexer lexer(data + HEADER_SIZE, size - HEADER_SIZE);
+	ObjectParser<TextLexer> parser(lexer, mesh);
+	if (!parser.parse())
+	{
+		if (error)
+			*error = parser.error();
+		mesh->clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool XFile::ParseBinary(const char* data, size_t size, XMesh* mesh, std::string* error)
+{
+	mesh->clear();
+
+	if (size < HEADER_SIZE)
+	{
+		if (error)
+			*error = "file too short";
+		return false;
+	}
+
+	// the header says how wide the numbers in float lists are
+	int floatSize = memcmp(data + 12, "0064", 4) == 0 ? 8 : 4;
+
+	BinaryLexer lexer(data + HEADER_SIZE, size - HEADER_SIZE, floatSize);
+	ObjectParser<BinaryLexer> parser(lexer, mesh);
+	if (!parser.parse())
+	{
+		if (error)
+			*error = parser.error();
+		mesh->clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool XFile::Parse(const char* data, size_t size, XMesh* mesh, std::string* error)
+{
+	std::string reason;
+	if (size < HEADER_SIZE || memcmp(data, "xof ", 4) != 0)
+		reason = "not a .x file";
+	else if (memcmp(data + 8, "txt ", 4) == 0)
+		return ParseText(data, size, mesh, error);
+	else if (memcmp(data + 8, "bin ", 4) == 0)
+		return ParseBinary(data, size, mesh, error);
+	else
+		reason = "compressed .x files are not supported";
+
+	if (error)
+		*error = reason;
+	mesh->clear();
+	return false;
+}
+
+bool XFile::Load(const std::string& path, XMesh* mesh, std::string* error)
+{
+	std::string reason;
+	MappedFile file;
+
+	if (!file.open(path))
+		reason = "could not open " + path;
+	else if (Parse(file.data(), file.size(), mesh, &reason))
+		return true;
+	else
+		reason = path + ": " + reason;
+
+	if (error)
+		*error = reason;
+	mesh->clear();
+	return false;
+}
+
+/*Writes mesh as a single Mesh object, with its normals, texture coordinates
+and materials, in the text or the binary format. Frames are not written; the
+positions are already in world space.*/
+bool XFile::Save(const std::string& path, const XMesh& mesh, bool binary)
+{
+	if (mesh.numTriangles() == 0)
+		return false;
+
+	FILE* f = 0;
+#ifdef _MSC_VER
+	if (fopen_s(&f, path.c_str(), "wb") != 0)
+		f = 0;
+#else
+	f = fopen(path.c_str(), "wb");
+#endif
+	if (!f)
+		return false;
+
+	fputs(binary ? "xof 0303bin 0032" : "xof 0303txt 0032\n", f);
+	if (binary)
+		WriteBinary(f, mesh);
+	else
+		WriteText(f, mesh);
+
+	bool ok = ferror(f) == 0;
+	return fclose(f) == 0 && ok;
+}
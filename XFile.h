@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+//A material as the .x file gives it
+struct XMaterial
+{
+	XMaterial();
+
+	float diffuse[4];   // r, g, b, a
+	float power;
+	float specular[3];
+	float emissive[3];
+	std::string texture; // file name, empty if the material has no texture
+};
+
+/*Every mesh in a .x file merged into one indexed triangle list, with the
+frame transforms applied, the way D3DXLoadMeshFromX hands it back.
+
+A vertex is a position, a normal and a texture coordinate, split wherever
+the file gives one position different normals. Polygons are fanned into
+triangles, and each triangle keeps the material of the face it came from.*/
+struct XMesh
+{
+	std::vector<float> positions;        // x, y, z per vertex
+	std::vector<float> normals;          // x, y, z per vertex, empty if the file has none
+	std::vector<float> texCoords;        // u, v per vertex, empty if the file has none
+	std::vector<unsigned int> indices;   // 3 per triangle
+	std::vector<unsigned int> attributes;// material of each triangle
+	std::vector<XMaterial> materials;
+
+	int numVertices() const { return (int)positions.size() / 3; }
+	int numTriangles() const { return (int)indices.size() / 3; }
+
+	void clear();
+};
+
+/*Reads DirectX .x mesh files without D3DX, so they load the same on every
+platform. The file is memory mapped and tokenized in place; nothing is
+copied out of it except the numbers and names that end up in the XMesh.
+Binary files have their number arrays copied out whole, without parsing.*/
+class XFile
+{
+public:
+	// Loads path into mesh. On failure returns false and, if error is
+	// given, says why.
+	static bool Load(const std::string& path, XMesh* mesh, std::string* error = 0);
+
+	// Parses a whole .x file held in memory, text or binary.
+	static bool Parse(const char* data, size_t size, XMesh* mesh, std::string* error = 0);
+	// Parses a whole text .x file (xof 0302txt / 0303txt) held in memory.
+	static bool ParseText(const char* data, size_t size, XMesh* mesh, std::string* error = 0);
+	// Parses a whole binary .x file (xof 0302bin / 0303bin) held in memory.
+	static bool ParseBinary(const char* data, size_t size, XMesh* mesh, std::string* error = 0);
+
+	// Writes mesh to path as a text or a binary .x file.
+	static bool Save(const std::string& path, const XMesh& mesh, bool binary);
+
+	// The float parser the text path uses. Reads a number at p, which must be
+	// before end, stores it in out and returns the character after it, or p
+	// if there is no number there.
+	static const char* ParseFloat(const char* p, const char* end, float* out);
+};
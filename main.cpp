@@ -1,5 +1,6 @@
 #include "basics.h"
 #include "Window.h"
+#include "Benchmark.h"
 
 //int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR pstrCmdLine, int iCmdShow)
 //{
@@ -13,3 +14,11 @@
 //	return window->MsgLoop();
 //}
 
+
+//Headless entry point, build as a console application with BENCHMARK defined
+#ifdef BENCHMARK
+int main()
+{
+	return Benchmark::RunAll() == 0 ? 0 : 1;
+}
+#endif